@@ -47,6 +47,8 @@ namespace JsCPPUtils
 		virtual void operator=(T value) = 0;
 		virtual operator T() const = 0;
 		virtual T get() const = 0;
+		/* read for monitoring, without taking a lock where the implementation has one; defaults to get() */
+		virtual T peek() const { return get(); }
 		virtual T getset(T value) = 0;
 		virtual T getifset(T value, T ifvalue) = 0;
 		virtual T incget() = 0;
@@ -335,6 +337,16 @@ namespace JsCPPUtils
 	private:
 		volatile T m_value;
 
+		/* under the lock; atomic only for the sake of peek() */
+		void _store(T value)
+		{
+#if defined(__GNUC__)
+			__atomic_store_n(&m_value, value, __ATOMIC_RELAXED);
+#else
+			m_value = value;
+#endif
+		}
+
 	public:
 		basic_AtomicNumMutex() : 
 			m_value(0)
@@ -353,14 +365,14 @@ namespace JsCPPUtils
 		void set(T value)
 		{
 			lock();
-			m_value = value;
+			_store(value);
 			unlock();
 		}
 		
 		void operator=(T value)
 		{
 			lock();
-			m_value = value;
+			_store(value);
 			unlock();
 		}
 
@@ -382,12 +394,21 @@ namespace JsCPPUtils
 			return value;
 		}
 
+		T peek() const
+		{
+#if defined(__GNUC__)
+			return __atomic_load_n(&m_value, __ATOMIC_RELAXED);
+#else
+			return m_value;
+#endif
+		}
+
 		T getset(T value)
 		{
 			T old;
 			lock();
 			old = m_value;
-			m_value = value;
+			_store(value);
 			unlock();
 			return old;
 		}
@@ -398,7 +419,7 @@ namespace JsCPPUtils
 			lock();
 			old = m_value;
 			if(old == ifvalue)
-				m_value = value;
+				_store(value);
 			unlock();
 			return old;
 		}
@@ -407,7 +428,8 @@ namespace JsCPPUtils
 		{
 			T value;
 			lock();
-			value = ++m_value;
+			value = m_value + 1;
+			_store(value);
 			unlock();
 			return value;
 		}
@@ -416,7 +438,8 @@ namespace JsCPPUtils
 		{
 			T value;
 			lock();
-			value = --m_value;
+			value = m_value - 1;
+			_store(value);
 			unlock();
 			return value;
 		}
@@ -424,42 +447,42 @@ namespace JsCPPUtils
 		void operator+=(T y)
 		{
 			lock();
-			m_value += y;
+			_store(m_value + y);
 			unlock();
 		}
 
 		void operator-=(T y)
 		{
 			lock();
-			m_value -= y;
+			_store(m_value - y);
 			unlock();
 		}
 
 		void operator++()
 		{
 			lock();
-			m_value++;
+			_store(m_value + 1);
 			unlock();
 		}
 
 		void operator--()
 		{
 			lock();
-			m_value--;
+			_store(m_value - 1);
 			unlock();
 		}
 
 		void operator&=(T y)
 		{
 			lock();
-			m_value &= y;
+			_store(m_value & y);
 			unlock();
 		}
 
 		void operator|=(T y)
 		{
 			lock();
-			m_value |= y;
+			_store(m_value | y);
 			unlock();
 		}
 
@@ -659,6 +682,15 @@ namespace JsCPPUtils
 			return m_pimpl->get();
 		}
 
+		/**
+		 * The value without taking the lock, for monitoring : never blocks on a writer,
+		 * may be slightly stale.
+		 */
+		T peek() const
+		{
+			return m_pimpl->peek();
+		}
+
 		T getset(T value)
 		{
 			T resvalue;
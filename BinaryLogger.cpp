@@ -0,0 +1,670 @@
+/**
+ * @file	BinaryLogger.cpp
+ * @class	BinaryLogger
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/18
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BinaryLogger.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(JSCUTILS_OS_LINUX)
+#define _JSBLOG_CAS64(p, o, n) (__sync_val_compare_and_swap((p), (o), (n)) == (o))
+#define _JSBLOG_INC64(p) __sync_add_and_fetch((p), 1)
+#define _JSBLOG_LOAD64(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _JSBLOG_STORE64_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif defined(JSCUTILS_OS_WINDOWS)
+#define _JSBLOG_CAS64(p, o, n) (::InterlockedCompareExchange64((volatile LONGLONG*)(p), (LONGLONG)(n), (LONGLONG)(o)) == (LONGLONG)(o))
+#define _JSBLOG_INC64(p) ::InterlockedIncrement64((volatile LONGLONG*)(p))
+#define _JSBLOG_LOAD64(p) ((uint64_t)::InterlockedCompareExchange64((volatile LONGLONG*)(p), 0, 0))
+#define _JSBLOG_STORE64_REL(p, v) do { MemoryBarrier(); *(p) = (v); } while (0)
+#endif
+
+namespace JsCPPUtils
+{
+	static const char g_jsblog_magic[8] = { 'J', 'S', 'B', 'L', 'O', 'G', 0, 1 };
+	static const uint32_t g_jsblog_version = 1;
+
+	/* Process-wide format registry */
+	struct BinaryLogFormat {
+		Logger::LogType logtype;
+		std::string format;
+	};
+	static Lockable &_formatRegistryLock()
+	{
+		static Lockable lock;
+		return lock;
+	}
+	static std::vector<BinaryLogFormat> &_formatRegistry()
+	{
+		static std::vector<BinaryLogFormat> formats;
+		return formats;
+	}
+
+	int BinaryLogger::registerFormat(Logger::LogType logtype, const char *format)
+	{
+		BinaryLogFormat item;
+		int fmtid;
+		item.logtype = logtype;
+		item.format = format;
+		_formatRegistryLock().lock();
+		fmtid = (int)_formatRegistry().size();
+		_formatRegistry().push_back(item);
+		_formatRegistryLock().unlock();
+		return fmtid;
+	}
+
+	BinaryLogger::BinaryLogger()
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		m_fd = -1;
+#elif defined(JSCUTILS_OS_WINDOWS)
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+#endif
+		m_pbase = NULL;
+		m_mapsize = 0;
+		m_pheader = NULL;
+		m_pdict = NULL;
+		m_pring = NULL;
+		m_ringmask = 0;
+		m_blocksize = 0;
+		m_minlevel = Logger::LOGTYPE_DEBUG;
+		m_dictsynced = 0;
+	}
+
+	BinaryLogger::~BinaryLogger()
+	{
+		close();
+	}
+
+	int BinaryLogger::open(const char *szFilePath, size_t ringsize, size_t blocksize, size_t dictsize)
+	{
+		size_t capacity = 4096;
+		size_t headersize = 4096;
+		size_t totalsize;
+
+		close();
+
+		while (capacity < blocksize)
+			capacity <<= 1;
+		blocksize = capacity;
+		while (capacity < ringsize)
+			capacity <<= 1;
+		if (capacity < blocksize * 2)
+			capacity = blocksize * 2;
+		ringsize = capacity;
+		dictsize = (dictsize + 4095) & ~((size_t)4095);
+		totalsize = headersize + dictsize + ringsize;
+
+#if defined(JSCUTILS_OS_LINUX)
+		m_fd = ::open(szFilePath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (m_fd < 0)
+			return -errno;
+		if (::ftruncate(m_fd, (off_t)totalsize) < 0)
+		{
+			int err = errno;
+			::close(m_fd);
+			m_fd = -1;
+			return -err;
+		}
+		m_pbase = (char*)::mmap(NULL, totalsize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (m_pbase == (char*)MAP_FAILED)
+		{
+			int err = errno;
+			m_pbase = NULL;
+			::close(m_fd);
+			m_fd = -1;
+			return -err;
+		}
+#elif defined(JSCUTILS_OS_WINDOWS)
+		m_hFile = ::CreateFileA(szFilePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return -((int)::GetLastError());
+		m_hMapping = ::CreateFileMappingA(m_hFile, NULL, PAGE_READWRITE, (DWORD)(((uint64_t)totalsize) >> 32), (DWORD)totalsize, NULL);
+		if (m_hMapping == NULL)
+		{
+			int err = (int)::GetLastError();
+			::CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+			return -err;
+		}
+		m_pbase = (char*)::MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, totalsize);
+		if (m_pbase == NULL)
+		{
+			int err = (int)::GetLastError();
+			::CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+			::CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+			return -err;
+		}
+#endif
+
+		m_mapsize = totalsize;
+		m_pheader = (FileHeader*)m_pbase;
+		m_pdict = m_pbase + headersize;
+		m_pring = m_pdict + dictsize;
+		m_ringmask = ringsize - 1;
+		m_blocksize = blocksize;
+		m_dictsynced = 0;
+
+		memset(m_pheader, 0, sizeof(FileHeader));
+		m_pheader->version = g_jsblog_version;
+		m_pheader->blocksize = (uint32_t)blocksize;
+		m_pheader->dictoffset = headersize;
+		m_pheader->dictsize = dictsize;
+		m_pheader->ringoffset = headersize + dictsize;
+		m_pheader->ringsize = ringsize;
+		// The magic goes in last so a half-initialized file is never taken for a log.
+		memcpy(m_pheader->magic, g_jsblog_magic, sizeof(g_jsblog_magic));
+
+		return 1;
+	}
+
+	void BinaryLogger::close()
+	{
+		if (m_pbase != NULL)
+		{
+#if defined(JSCUTILS_OS_LINUX)
+			::msync(m_pbase, m_mapsize, MS_SYNC);
+			::munmap(m_pbase, m_mapsize);
+#elif defined(JSCUTILS_OS_WINDOWS)
+			::FlushViewOfFile(m_pbase, 0);
+			::UnmapViewOfFile(m_pbase);
+#endif
+			m_pbase = NULL;
+		}
+#if defined(JSCUTILS_OS_LINUX)
+		if (m_fd >= 0)
+		{
+			::close(m_fd);
+			m_fd = -1;
+		}
+#elif defined(JSCUTILS_OS_WINDOWS)
+		if (m_hMapping != NULL)
+		{
+			::CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+		}
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			::CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+#endif
+		m_pheader = NULL;
+		m_pdict = NULL;
+		m_pring = NULL;
+		m_mapsize = 0;
+	}
+
+	void BinaryLogger::flush()
+	{
+		if (m_pbase == NULL)
+			return;
+#if defined(JSCUTILS_OS_LINUX)
+		::msync(m_pbase, m_mapsize, MS_ASYNC);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		::FlushViewOfFile(m_pbase, 0);
+#endif
+	}
+
+	bool BinaryLogger::_syncDict(int fmtid)
+	{
+		bool bResult = true;
+		m_dictlock.lock();
+		_formatRegistryLock().lock();
+		while (m_dictsynced <= fmtid)
+		{
+			const BinaryLogFormat &item = _formatRegistry()[m_dictsynced];
+			DictEntryHeader entry;
+			size_t entrysize = (sizeof(entry) + item.format.length() + 3) & ~((size_t)3);
+			uint64_t used = m_pheader->dictused;
+			if (used + entrysize > m_pheader->dictsize)
+			{
+				bResult = false;
+				break;
+			}
+			entry.fmtid = (uint32_t)m_dictsynced;
+			entry.logtype = (uint32_t)item.logtype;
+			entry.len = (uint32_t)item.format.length();
+			memcpy(m_pdict + used, &entry, sizeof(entry));
+			memcpy(m_pdict + used + sizeof(entry), item.format.c_str(), item.format.length());
+			_JSBLOG_STORE64_REL(&m_pheader->dictused, used + entrysize);
+			m_dictsynced++;
+		}
+		_formatRegistryLock().unlock();
+		m_dictlock.unlock();
+		if (!bResult)
+			_JSBLOG_INC64(&m_pheader->dropped);
+		return bResult;
+	}
+
+	int64_t BinaryLogger::_reserve(size_t len)
+	{
+		volatile uint64_t *pwritepos = &m_pheader->writepos;
+
+		if (len > m_blocksize)
+		{
+			_JSBLOG_INC64(&m_pheader->dropped);
+			return -1;
+		}
+
+		for (;;)
+		{
+			uint64_t pos = _JSBLOG_LOAD64(pwritepos);
+			uint64_t blockend = (pos & ~(m_blocksize - 1)) + m_blocksize;
+			uint64_t start = ((pos + len) > blockend) ? blockend : pos;
+			if (!_JSBLOG_CAS64(pwritepos, pos, start + len))
+				continue;
+			if ((start != pos) && ((blockend - pos) >= sizeof(RecordHeader)))
+			{
+				// Close the rest of the block with a padding record.
+				RecordHeader *ppad = (RecordHeader*)(m_pring + (pos & m_ringmask));
+				ppad->len = (uint32_t)(blockend - pos);
+				ppad->fmtid = PAD_FMTID;
+				ppad->timestamp = 0;
+				_JSBLOG_STORE64_REL(&ppad->seq, pos + 1);
+			}
+			return (int64_t)start;
+		}
+	}
+
+	void BinaryLogger::_commit(char *prec, int64_t abspos, size_t len, int fmtid)
+	{
+		RecordHeader *phdr = (RecordHeader*)prec;
+		phdr->len = (uint32_t)len;
+		phdr->fmtid = (uint32_t)fmtid;
+		phdr->timestamp = (int64_t)time(NULL);
+		_JSBLOG_STORE64_REL(&phdr->seq, (uint64_t)abspos + 1);
+	}
+
+	BinaryLogDecoder::BinaryLogDecoder()
+	{
+		memset(&m_header, 0, sizeof(m_header));
+	}
+
+	BinaryLogDecoder::~BinaryLogDecoder()
+	{
+	}
+
+	int BinaryLogDecoder::load(const char *szFilePath)
+	{
+		FILE *fp;
+		long filesize;
+		size_t pos;
+
+		m_data.clear();
+		m_formats.clear();
+		memset(&m_header, 0, sizeof(m_header));
+
+#if defined(_JSCUTILS_MSVC_CRT_SECURE)
+		if (fopen_s(&fp, szFilePath, "rb") != 0)
+			fp = NULL;
+#else
+		fp = fopen(szFilePath, "rb");
+#endif
+		if (fp == NULL)
+			return -errno;
+		fseek(fp, 0, SEEK_END);
+		filesize = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		if (filesize < (long)sizeof(BinaryLogger::FileHeader))
+		{
+			fclose(fp);
+			return 0;
+		}
+		m_data.resize((size_t)filesize);
+		if (fread(&m_data[0], 1, (size_t)filesize, fp) != (size_t)filesize)
+		{
+			fclose(fp);
+			m_data.clear();
+			return -EIO;
+		}
+		fclose(fp);
+
+		memcpy(&m_header, &m_data[0], sizeof(m_header));
+		if ((memcmp(m_header.magic, g_jsblog_magic, sizeof(g_jsblog_magic)) != 0) ||
+			(m_header.version != g_jsblog_version) ||
+			(m_header.blocksize == 0) ||
+			(m_header.ringoffset + m_header.ringsize > (uint64_t)filesize) ||
+			(m_header.dictoffset + m_header.dictused > (uint64_t)filesize))
+		{
+			m_data.clear();
+			return 0;
+		}
+
+		pos = 0;
+		while (pos + sizeof(BinaryLogger::DictEntryHeader) <= m_header.dictused)
+		{
+			BinaryLogger::DictEntryHeader entry;
+			const char *pentry = &m_data[(size_t)m_header.dictoffset + pos];
+			memcpy(&entry, pentry, sizeof(entry));
+			if (pos + sizeof(entry) + entry.len > m_header.dictused)
+				break;
+			if (m_formats.size() <= entry.fmtid)
+				m_formats.resize(entry.fmtid + 1);
+			m_formats[entry.fmtid].logtype = (Logger::LogType)entry.logtype;
+			m_formats[entry.fmtid].format.assign(pentry + sizeof(entry), entry.len);
+			m_formats[entry.fmtid].valid = true;
+			pos += (sizeof(entry) + entry.len + 3) & ~((size_t)3);
+		}
+
+		return 1;
+	}
+
+	/*
+	 * Takes the next argument; returns false when the record has no more arguments.
+	 */
+	static bool _nextArg(const char *&p, const char *end, char *ptag, const char **ppdata, size_t *plen)
+	{
+		if (p >= end)
+			return false;
+		*ptag = *p++;
+		if (*ptag == BinaryLogger::ARGTYPE_STRING)
+		{
+			uint16_t len16;
+			if (p + 2 > end)
+				return false;
+			memcpy(&len16, p, 2);
+			p += 2;
+			if (p + len16 > end)
+				return false;
+			*ppdata = p;
+			*plen = len16;
+			p += len16;
+		} else {
+			if (p + 8 > end)
+				return false;
+			*ppdata = p;
+			*plen = 8;
+			p += 8;
+		}
+		return true;
+	}
+
+	static int64_t _argAsInt(char tag, const char *pdata)
+	{
+		int64_t i64;
+		double d;
+		if (tag == BinaryLogger::ARGTYPE_DOUBLE)
+		{
+			memcpy(&d, pdata, 8);
+			return (int64_t)d;
+		}
+		if (tag == BinaryLogger::ARGTYPE_STRING)
+			return 0;
+		memcpy(&i64, pdata, 8);
+		return i64;
+	}
+
+	std::string BinaryLogDecoder::_render(const FormatInfo& info, int64_t timestamp, const char *pargs, size_t argslen)
+	{
+		static const char strmonths[][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+		static const char *strlogtypes[] = { "EMERG", "ALERT", "CRIT", "ERR", "WARN", "NOTI", "INFO", "DEBUG" };
+		std::string strline;
+		const char *fmt = info.format.c_str();
+		const char *argp = pargs;
+		const char *argend = pargs + argslen;
+		char buf[512];
+		time_t rawtime = (time_t)timestamp;
+		struct tm timeinfo;
+
+#if defined(JSCUTILS_OS_WINDOWS)
+		localtime_s(&timeinfo, &rawtime);
+#elif defined(JSCUTILS_OS_LINUX)
+		localtime_r(&rawtime, &timeinfo);
+#endif
+		snprintf(buf, sizeof(buf), "[%s] %s %02d %02d:%02d:%02d %d] ",
+			(((int)info.logtype >= 0) && ((int)info.logtype < 8)) ? strlogtypes[info.logtype] : "UNDEFINED",
+			strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900);
+		strline = buf;
+
+		while (*fmt)
+		{
+			std::string strspec;
+			char conv;
+			char tag;
+			const char *pdata;
+			size_t datalen;
+
+			if (*fmt != '%')
+			{
+				const char *next = strchr(fmt, '%');
+				if (next == NULL)
+					next = fmt + strlen(fmt);
+				strline.append(fmt, next - fmt);
+				fmt = next;
+				continue;
+			}
+			if (fmt[1] == '%')
+			{
+				strline += '%';
+				fmt += 2;
+				continue;
+			}
+
+			// "%[flags][width][.precision]" keeps as-is, '*' is replaced with the recorded value.
+			strspec = "%";
+			fmt++;
+			while (*fmt && strchr("-+ #0'", *fmt))
+				strspec += *fmt++;
+			for (int part = 0; part < 2; part++)
+			{
+				if (part == 1)
+				{
+					if (*fmt != '.')
+						break;
+					strspec += *fmt++;
+				}
+				if (*fmt == '*')
+				{
+					fmt++;
+					if (_nextArg(argp, argend, &tag, &pdata, &datalen))
+					{
+						snprintf(buf, sizeof(buf), "%d", (int)_argAsInt(tag, pdata));
+						strspec += buf;
+					}
+				} else {
+					while ((*fmt >= '0') && (*fmt <= '9'))
+						strspec += *fmt++;
+				}
+			}
+			// The recorded width is always 64 bits, so the length modifier is dropped.
+			while (*fmt && strchr("hlLqjzt", *fmt))
+				fmt++;
+			conv = *fmt;
+			if (conv == 0)
+				break;
+			fmt++;
+
+			if (conv == 'n')
+				continue;
+			if (!_nextArg(argp, argend, &tag, &pdata, &datalen))
+			{
+				strline += "(?)";
+				continue;
+			}
+
+			switch (conv)
+			{
+			case 'd':
+			case 'i':
+				strspec += "lld";
+				snprintf(buf, sizeof(buf), strspec.c_str(), (long long)_argAsInt(tag, pdata));
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				strspec += "ll";
+				strspec += conv;
+				snprintf(buf, sizeof(buf), strspec.c_str(), (unsigned long long)_argAsInt(tag, pdata));
+				break;
+			case 'c':
+				strspec += 'c';
+				snprintf(buf, sizeof(buf), strspec.c_str(), (int)_argAsInt(tag, pdata));
+				break;
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+			{
+				double d;
+				if (tag == BinaryLogger::ARGTYPE_DOUBLE)
+					memcpy(&d, pdata, 8);
+				else
+					d = (double)_argAsInt(tag, pdata);
+				strspec += conv;
+				snprintf(buf, sizeof(buf), strspec.c_str(), d);
+				break;
+			}
+			case 's':
+				if (tag == BinaryLogger::ARGTYPE_STRING)
+				{
+					std::string strarg(pdata, datalen);
+					std::vector<char> longbuf;
+					int needed;
+					strspec += 's';
+					needed = snprintf(buf, sizeof(buf), strspec.c_str(), strarg.c_str());
+					if (needed >= (int)sizeof(buf))
+					{
+						longbuf.resize(needed + 1);
+						snprintf(&longbuf[0], longbuf.size(), strspec.c_str(), strarg.c_str());
+						strline += &longbuf[0];
+						buf[0] = 0;
+					}
+				} else {
+					snprintf(buf, sizeof(buf), "(?)");
+				}
+				break;
+			case 'p':
+				snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)_argAsInt(tag, pdata));
+				break;
+			default:
+				snprintf(buf, sizeof(buf), "%%%c", conv);
+				break;
+			}
+			strline += buf;
+		}
+
+		return strline;
+	}
+
+	int64_t BinaryLogDecoder::decode(void(*fnLine)(void *userptr, const char *szLine), void *userptr)
+	{
+		uint64_t blocksize = m_header.blocksize;
+		uint64_t ringsize = m_header.ringsize;
+		uint64_t writepos = m_header.writepos;
+		uint64_t pos;
+		int64_t count = 0;
+		const char *pring;
+
+		if (m_data.empty())
+			return 0;
+		pring = &m_data[(size_t)m_header.ringoffset];
+
+		// The oldest block may be partly overwritten; start on the block after it.
+		if (writepos > ringsize)
+			pos = ((writepos - ringsize + blocksize - 1) / blocksize) * blocksize;
+		else
+			pos = 0;
+
+		while (pos < writepos)
+		{
+			uint64_t blockend = (pos / blocksize + 1) * blocksize;
+			BinaryLogger::RecordHeader hdr;
+
+			if (blockend - pos < sizeof(hdr))
+			{
+				pos = blockend;
+				continue;
+			}
+			memcpy(&hdr, pring + (pos % ringsize), sizeof(hdr));
+			if ((hdr.seq != pos + 1) || (hdr.len < sizeof(hdr)) || (hdr.len > blockend - pos))
+			{
+				// Stale or never completed; the next block is a fresh sync point.
+				pos = blockend;
+				continue;
+			}
+			if (hdr.fmtid != BinaryLogger::PAD_FMTID)
+			{
+				std::string strline;
+				if ((hdr.fmtid < m_formats.size()) && m_formats[hdr.fmtid].valid)
+				{
+					strline = _render(m_formats[hdr.fmtid], hdr.timestamp, pring + (pos % ringsize) + sizeof(hdr), hdr.len - sizeof(hdr));
+				} else {
+					char buf[64];
+					snprintf(buf, sizeof(buf), "(unknown format id %u)", hdr.fmtid);
+					strline = buf;
+				}
+				fnLine(userptr, strline.c_str());
+				count++;
+			}
+			pos += hdr.len;
+		}
+
+		return count;
+	}
+
+	static void _decodeToFile(void *userptr, const char *szLine)
+	{
+		FILE *fp = (FILE*)userptr;
+		fputs(szLine, fp);
+		fputc('\n', fp);
+	}
+
+	int64_t BinaryLogDecoder::decode(FILE *fpOut)
+	{
+		return decode(_decodeToFile, fpOut);
+	}
+}
+
+#ifdef JSCPPUTILS_BINLOGDECODER_MAIN
+
+int main(int argc, char *argv[])
+{
+	JsCPPUtils::BinaryLogDecoder decoder;
+	int rc;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s FILE\nPrints the records of a BinaryLogger file on stdout, oldest first.\n", argv[0]);
+		return 2;
+	}
+	rc = decoder.load(argv[1]);
+	if (rc < 0)
+	{
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(-rc));
+		return 1;
+	}
+	if (rc == 0)
+	{
+		fprintf(stderr, "%s: not a binary log\n", argv[1]);
+		return 1;
+	}
+	decoder.decode(stdout);
+	if (decoder.getDropped() > 0)
+		fprintf(stderr, "%llu records dropped\n", (unsigned long long)decoder.getDropped());
+	return 0;
+}
+
+#endif /* JSCPPUTILS_BINLOGDECODER_MAIN */
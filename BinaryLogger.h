@@ -0,0 +1,291 @@
+/**
+ * @file	BinaryLogger.h
+ * @class	BinaryLogger
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/18
+ * @brief	Binary log writer (format id + raw arguments into a mmap'ed ring file) and its decoder
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_BINARYLOGGER_H__
+#define __JSCPPUTILS_BINARYLOGGER_H__
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+
+#include "Common.h"
+#include "Lockable.h"
+#include "Logger.h"
+
+/*
+ * JSBLOG(pblogger, Logger::LOGTYPE_INFO, "req %d from %s", id, szAddr);
+ * The format string is registered once per call site (the first enabled call, through a local
+ * static, whose initialization is thread-safe in C++11); each call only copies the arguments.
+ * The dead printf lets the compiler check the format against the arguments.
+ */
+#define JSBLOG(pblogger, logtype, format, ...) do { \
+		if ((pblogger)->isEnabled(logtype)) { \
+			static const int _jsblog_fmtid = JsCPPUtils::BinaryLogger::registerFormat(logtype, format); \
+			(pblogger)->log(_jsblog_fmtid, ##__VA_ARGS__); \
+		} \
+		if (0) ::printf(format, ##__VA_ARGS__); \
+	} while (0)
+
+namespace JsCPPUtils
+{
+	/**
+	 * File layout
+	 *   FileHeader | format dictionary (dictsize) | ring (ringsize, a multiple of blocksize)
+	 * Ring records never cross a block boundary, so a decoder can always resynchronize on
+	 * the next block after the oldest (partly overwritten) one.
+	 */
+	class BinaryLogger
+	{
+	public:
+		enum {
+			ARGTYPE_INT = 'i',
+			ARGTYPE_UINT = 'u',
+			ARGTYPE_DOUBLE = 'f',
+			ARGTYPE_STRING = 's',
+			ARGTYPE_POINTER = 'p'
+		};
+
+		enum {
+			MAX_STRING_LENGTH = 4096
+		};
+
+#pragma pack(push, 1)
+		struct FileHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t blocksize;
+			uint64_t dictoffset;
+			uint64_t dictsize;
+			uint64_t ringoffset;
+			uint64_t ringsize;
+			volatile uint64_t dictused;
+			volatile uint64_t writepos;
+			volatile uint64_t dropped;
+		};
+
+		struct RecordHeader {
+			uint32_t len;
+			uint32_t fmtid;
+			/* absolute ring position + 1; written last, so a mismatch means stale or incomplete */
+			volatile uint64_t seq;
+			int64_t timestamp;
+		};
+
+		struct DictEntryHeader {
+			uint32_t fmtid;
+			uint32_t logtype;
+			uint32_t len;
+		};
+#pragma pack(pop)
+
+		static const uint32_t PAD_FMTID = 0xFFFFFFFF;
+
+	private:
+#if defined(JSCUTILS_OS_LINUX)
+		int m_fd;
+#elif defined(JSCUTILS_OS_WINDOWS)
+		HANDLE m_hFile;
+		HANDLE m_hMapping;
+#endif
+		char *m_pbase;
+		size_t m_mapsize;
+		FileHeader *m_pheader;
+		char *m_pdict;
+		char *m_pring;
+		uint64_t m_ringmask;
+		uint64_t m_blocksize;
+
+		volatile int m_minlevel;
+		volatile int m_dictsynced;
+		Lockable m_dictlock;
+
+		bool _syncDict(int fmtid);
+		int64_t _reserve(size_t len);
+		void _commit(char *prec, int64_t abspos, size_t len, int fmtid);
+
+		/* argument encoding */
+		static size_t _argsSize() { return 0; }
+		template<typename T, typename... TARGS>
+		static size_t _argsSize(const T& v, const TARGS&... rest) {
+			return _argSize(v) + _argsSize(rest...);
+		}
+		static void _encodeArgs(char *) { }
+		template<typename T, typename... TARGS>
+		static void _encodeArgs(char *p, const T& v, const TARGS&... rest) {
+			p = _encodeArg(p, v);
+			_encodeArgs(p, rest...);
+		}
+
+		static size_t _strlen(const char *s) {
+			size_t len = (s != NULL) ? strlen(s) : 0;
+			return (len > (size_t)MAX_STRING_LENGTH) ? (size_t)MAX_STRING_LENGTH : len;
+		}
+		static char *_putTagged(char *p, char tag, const void *data, size_t len) {
+			*p++ = tag;
+			memcpy(p, data, len);
+			return p + len;
+		}
+		static char *_putString(char *p, const char *s, size_t len) {
+			uint16_t len16 = (uint16_t)len;
+			*p++ = (char)ARGTYPE_STRING;
+			memcpy(p, &len16, 2);
+			if (len > 0)
+				memcpy(p + 2, s, len);
+			return p + 2 + len;
+		}
+
+		template<typename T>
+		static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type _argSize(const T&) { return 9; }
+		template<typename T>
+		static typename std::enable_if<std::is_floating_point<T>::value, size_t>::type _argSize(const T&) { return 9; }
+		template<typename T>
+		static size_t _argSize(T * const &) { return 9; }
+		static size_t _argSize(const char * const &v) { return 3 + _strlen(v); }
+		static size_t _argSize(char * const &v) { return 3 + _strlen(v); }
+		template<size_t N>
+		static size_t _argSize(const char (&v)[N]) { return 3 + _strlen(v); }
+		template<size_t N>
+		static size_t _argSize(char (&v)[N]) { return 3 + _strlen(v); }
+
+		template<typename T>
+		static typename std::enable_if<(std::is_integral<T>::value || std::is_enum<T>::value) && std::is_signed<T>::value, char*>::type _encodeArg(char *p, const T& v) {
+			int64_t x = (int64_t)v;
+			return _putTagged(p, (char)ARGTYPE_INT, &x, 8);
+		}
+		template<typename T>
+		static typename std::enable_if<(std::is_integral<T>::value || std::is_enum<T>::value) && !std::is_signed<T>::value, char*>::type _encodeArg(char *p, const T& v) {
+			uint64_t x = (uint64_t)v;
+			return _putTagged(p, (char)ARGTYPE_UINT, &x, 8);
+		}
+		template<typename T>
+		static typename std::enable_if<std::is_floating_point<T>::value, char*>::type _encodeArg(char *p, const T& v) {
+			double x = (double)v;
+			return _putTagged(p, (char)ARGTYPE_DOUBLE, &x, 8);
+		}
+		template<typename T>
+		static char *_encodeArg(char *p, T * const &v) {
+			uint64_t x = (uint64_t)(uintptr_t)v;
+			return _putTagged(p, (char)ARGTYPE_POINTER, &x, 8);
+		}
+		static char *_encodeArg(char *p, const char * const &v) { return _putString(p, v, _strlen(v)); }
+		static char *_encodeArg(char *p, char * const &v) { return _putString(p, v, _strlen(v)); }
+		template<size_t N>
+		static char *_encodeArg(char *p, const char (&v)[N]) { return _putString(p, v, _strlen(v)); }
+		template<size_t N>
+		static char *_encodeArg(char *p, char (&v)[N]) { return _putString(p, v, _strlen(v)); }
+
+	public:
+		BinaryLogger();
+		~BinaryLogger();
+
+		/**
+		 * Creates (truncates) the log file.
+		 * ringsize is rounded up to a power of two and must be at least two blocks.
+		 * @return 1 on success, negative errno on failure
+		 */
+		int open(const char *szFilePath, size_t ringsize = 16 * 1024 * 1024, size_t blocksize = 64 * 1024, size_t dictsize = 1024 * 1024);
+		void close();
+		bool isOpened() const {
+			return m_pbase != NULL;
+		}
+		/**
+		 * Asks the OS to write the mapped pages back (msync MS_ASYNC / FlushViewOfFile).
+		 */
+		void flush();
+
+		void setLevel(Logger::LogType level) {
+			m_minlevel = (int)level;
+		}
+		bool isEnabled(Logger::LogType logtype) const {
+			return (m_pbase != NULL) && ((int)logtype <= m_minlevel);
+		}
+		uint64_t getDropped() const {
+			return (m_pheader != NULL) ? m_pheader->dropped : 0;
+		}
+
+		/**
+		 * Process-wide format registry; ids are shared by all BinaryLogger instances.
+		 */
+		static int registerFormat(Logger::LogType logtype, const char *format);
+
+		template<typename... TARGS>
+		void log(int fmtid, const TARGS&... args)
+		{
+			size_t len = sizeof(RecordHeader) + _argsSize(args...);
+			int64_t abspos;
+			char *prec;
+
+			if ((fmtid < 0) || (m_pbase == NULL))
+				return;
+			if ((fmtid >= m_dictsynced) && !_syncDict(fmtid))
+				return;
+			len = (len + 7) & ~((size_t)7);
+			abspos = _reserve(len);
+			if (abspos < 0)
+				return;
+			prec = m_pring + (abspos & m_ringmask);
+			_encodeArgs(prec + sizeof(RecordHeader), args...);
+			_commit(prec, abspos, len, fmtid);
+		}
+	};
+
+	/**
+	 * Renders a BinaryLogger file back into "[LEVEL] Mon DD hh:mm:ss YYYY] text" lines,
+	 * oldest record first.
+	 *
+	 * Build BinaryLogger.cpp with JSCPPUTILS_BINLOGDECODER_MAIN defined for the command-line
+	 * decoder : it takes the file and prints its lines on stdout.
+	 */
+	class BinaryLogDecoder
+	{
+	public:
+		struct FormatInfo {
+			Logger::LogType logtype;
+			std::string format;
+			bool valid;
+			FormatInfo() : logtype(Logger::LOGTYPE_INFO), valid(false) {}
+		};
+
+	private:
+		std::vector<char> m_data;
+		BinaryLogger::FileHeader m_header;
+		std::vector<FormatInfo> m_formats;
+
+		std::string _render(const FormatInfo& info, int64_t timestamp, const char *pargs, size_t argslen);
+
+	public:
+		BinaryLogDecoder();
+		~BinaryLogDecoder();
+
+		/**
+		 * @return 1 on success, 0 if the file is not a binary log, negative errno on failure
+		 */
+		int load(const char *szFilePath);
+		/**
+		 * Calls fnLine for each decoded line (without line terminator). Returns the number of records.
+		 */
+		int64_t decode(void(*fnLine)(void *userptr, const char *szLine), void *userptr);
+		int64_t decode(FILE *fpOut);
+		uint64_t getDropped() const {
+			return m_header.dropped;
+		}
+	};
+
+}
+
+#endif /* __JSCPPUTILS_BINARYLOGGER_H__ */
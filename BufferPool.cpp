@@ -0,0 +1,125 @@
+/**
+ * @file	BufferPool.cpp
+ * @class	BufferPool
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/22
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "BufferPool.h"
+
+#include <new>
+
+namespace JsCPPUtils
+{
+	void BufferPool::Chunk::release()
+	{
+		if(_JSBUFFERPOOL_REF_DEC(&m_refcnt) == 0)
+			m_ppool->_recycle(this);
+	}
+
+	void BufferPool::Chunk::releaseProc(char *pbuf, void *freeparam)
+	{
+		((Chunk*)freeparam)->release();
+	}
+
+	BufferPool::BufferPool(int minsize, int maxsize, int maxcached)
+	{
+		m_minshift = 4;
+		while(((1 << m_minshift) < minsize) && (m_minshift < 30))
+			m_minshift++;
+		m_numclasses = 1;
+		while(((1 << (m_minshift + m_numclasses - 1)) < maxsize) && (m_numclasses < MAX_CLASSES) && (m_minshift + m_numclasses - 1 < 30))
+			m_numclasses++;
+		m_maxcached = (maxcached > 0) ? maxcached : 0;
+	}
+
+	BufferPool::~BufferPool()
+	{
+		int i;
+		for(i = 0; i < m_numclasses; i++)
+		{
+			Chunk *pchunk = m_classes[i].pfree;
+			while(pchunk != NULL)
+			{
+				Chunk *pnext = pchunk->m_pnext;
+				pchunk->~Chunk();
+				::free(pchunk);
+				pchunk = pnext;
+			}
+			m_classes[i].pfree = NULL;
+			m_classes[i].cached = 0;
+		}
+	}
+
+	BufferPool::Chunk *BufferPool::acquire(int size)
+	{
+		int sizeclass = 0;
+		int capacity;
+		void *pmem;
+
+		if(size < 0)
+			return NULL;
+		while((sizeclass < m_numclasses) && ((1 << (m_minshift + sizeclass)) < size))
+			sizeclass++;
+
+		if(sizeclass < m_numclasses)
+		{
+			SizeClass &cls = m_classes[sizeclass];
+			Chunk *pchunk;
+			cls.lock.lock();
+			pchunk = cls.pfree;
+			if(pchunk != NULL)
+			{
+				cls.pfree = pchunk->m_pnext;
+				cls.cached--;
+			}
+			cls.lock.unlock();
+			if(pchunk != NULL)
+			{
+				pchunk->m_pnext = NULL;
+				pchunk->m_refcnt = 1;
+				return pchunk;
+			}
+			capacity = 1 << (m_minshift + sizeclass);
+		}else{
+			sizeclass = -1;
+			capacity = size;
+		}
+
+		pmem = ::malloc(HEADER_SIZE + capacity);
+		if(pmem == NULL)
+			return NULL;
+		return new (pmem) Chunk(this, sizeclass, capacity);
+	}
+
+	void BufferPool::_recycle(Chunk *pchunk)
+	{
+		if(pchunk->m_sizeclass >= 0)
+		{
+			SizeClass &cls = m_classes[pchunk->m_sizeclass];
+			cls.lock.lock();
+			if(cls.cached < m_maxcached)
+			{
+				pchunk->m_pnext = cls.pfree;
+				cls.pfree = pchunk;
+				cls.cached++;
+				pchunk = NULL;
+			}
+			cls.lock.unlock();
+		}
+		if(pchunk != NULL)
+		{
+			pchunk->~Chunk();
+			::free(pchunk);
+		}
+	}
+
+	BufferPool *BufferPool::getDefault()
+	{
+		static BufferPool *s_pdefaultpool = new BufferPool();
+		return s_pdefaultpool;
+	}
+}
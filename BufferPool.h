@@ -0,0 +1,128 @@
+/**
+ * @file	BufferPool.h
+ * @class	BufferPool
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/22
+ * @brief	Power-of-two size classes of refcounted buffers, recycled through per-class free lists
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_BUFFERPOOL_H__
+#define __JSCPPUTILS_BUFFERPOOL_H__
+
+#include <stdlib.h>
+
+#include "Common.h"
+#include "Lockable.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#define _JSBUFFERPOOL_REF_INC(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define _JSBUFFERPOOL_REF_DEC(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#elif defined(JSCUTILS_OS_WINDOWS)
+#define _JSBUFFERPOOL_REF_INC(p) ::InterlockedIncrement((volatile LONG*)(p))
+#define _JSBUFFERPOOL_REF_DEC(p) ::InterlockedDecrement((volatile LONG*)(p))
+#endif
+
+namespace JsCPPUtils
+{
+	/**
+	 * Thread-safe. Chunks may be released on any thread; the pool must outlive them.
+	 */
+	class BufferPool
+	{
+	public:
+		class Chunk
+		{
+			friend class BufferPool;
+		private:
+			BufferPool *m_ppool;
+			/* -1 : larger than the biggest class, freed on release */
+			int m_sizeclass;
+			int m_capacity;
+			/* a plain counter : retain() and release() are on the per-read path */
+			volatile int m_refcnt;
+			Chunk *m_pnext;
+
+			Chunk(BufferPool *ppool, int sizeclass, int capacity)
+				: m_ppool(ppool), m_sizeclass(sizeclass), m_capacity(capacity), m_refcnt(1), m_pnext(NULL) {}
+			~Chunk() {}
+
+		public:
+			char *getData() {
+				return ((char*)this) + HEADER_SIZE;
+			}
+			int getCapacity() const {
+				return m_capacity;
+			}
+			void retain() {
+				_JSBUFFERPOOL_REF_INC(&m_refcnt);
+			}
+			/**
+			 * Back to the pool when the last reference goes.
+			 */
+			void release();
+
+			/**
+			 * JsClientSocket::SendBufferFree_t compatible : releases the Chunk passed as freeparam.
+			 */
+			static void releaseProc(char *pbuf, void *freeparam);
+		};
+
+		enum {
+			MAX_CLASSES = 16
+		};
+
+	private:
+		struct SizeClass {
+			Lockable lock;
+			Chunk *pfree;
+			int cached;
+			SizeClass() : pfree(NULL), cached(0) {}
+		};
+
+		/* keeps getData() 16-byte aligned */
+		static const size_t HEADER_SIZE = (sizeof(Chunk) + 15) & ~((size_t)15);
+
+		int m_minshift;
+		int m_numclasses;
+		int m_maxcached;
+		SizeClass m_classes[MAX_CLASSES];
+
+		void _recycle(Chunk *pchunk);
+
+	public:
+		/**
+		 * minsize and maxsize are rounded up to powers of two (at most MAX_CLASSES classes).
+		 * maxcached : idle chunks kept per class, the rest go back to the heap.
+		 */
+		BufferPool(int minsize = 2048, int maxsize = 256 * 1024, int maxcached = 64);
+		~BufferPool();
+
+		int getMinSize() const {
+			return 1 << m_minshift;
+		}
+		int getMaxSize() const {
+			return 1 << (m_minshift + m_numclasses - 1);
+		}
+
+		/**
+		 * A chunk of at least size bytes with one reference, or NULL when out of memory.
+		 * Sizes above getMaxSize() are allocated exactly and not pooled.
+		 */
+		Chunk *acquire(int size);
+
+		/**
+		 * Process-wide pool with the default classes (2 KB .. 256 KB). It is never destroyed.
+		 */
+		static BufferPool *getDefault();
+	};
+
+}
+
+#endif /* __JSCPPUTILS_BUFFERPOOL_H__ */
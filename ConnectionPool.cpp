@@ -0,0 +1,532 @@
+/**
+ * @file	ConnectionPool.cpp
+ * @class	ConnectionPool
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/24
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "ConnectionPool.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+namespace JsCPPUtils
+{
+	ConnectionPool::ConnectionPool(Timer *ptimer, int64_t maintenanceintervalms)
+	{
+		memset(&m_stats, 0, sizeof(m_stats));
+		m_pengine = NULL;
+#ifdef USE_OPENSSL
+		m_ssl_method = NULL;
+#endif
+		m_conf_recvdatabufsize = 4096;
+		m_conf_minidle = 0;
+		m_conf_maxidle = 8;
+		m_conf_maxtotal = 64;
+		m_conf_idletimeoutms = 60000;
+		m_conf_probeintervalms = 0;
+		m_conf_connecttimeoutms = 5000;
+		m_recvhandler = NULL;
+		m_disconnectedhandler = NULL;
+		m_probehandler = NULL;
+
+		if(ptimer != NULL)
+		{
+			m_ptimer = ptimer;
+			m_bOwnTimer = false;
+		}else{
+			m_ptimer = new Timer();
+			m_bOwnTimer = true;
+		}
+		m_sptask = new MaintenanceTask(this);
+		m_ptimer->schedule(m_sptask, maintenanceintervalms, maintenanceintervalms);
+	}
+
+	ConnectionPool::~ConnectionPool()
+	{
+		std::map<std::string, KeyEntry*>::iterator iterKey;
+		std::list<PooledSocket*> socks;
+		std::list<PooledSocket*>::iterator iterSock;
+
+		/* waits for a maintenance run in progress; the timer may keep the task, not the pool */
+		m_sptask->lock.lock();
+		m_sptask->ppool = NULL;
+		m_sptask->cancel();
+		m_sptask->lock.unlock();
+		if(m_bOwnTimer)
+		{
+			delete m_ptimer;
+			m_ptimer = NULL;
+		}
+
+		m_lock.lock();
+		socks.swap(m_doomed);
+		for(iterKey = m_keys.begin(); iterKey != m_keys.end(); iterKey++)
+		{
+			KeyEntry *pkey = iterKey->second;
+			while(!pkey->conns.empty())
+			{
+				Conn *pconn = pkey->conns.front();
+				socks.push_back(pconn->psock);
+				_forget(pconn);
+			}
+			delete pkey;
+		}
+		m_keys.clear();
+		m_lock.unlock();
+
+		for(iterSock = socks.begin(); iterSock != socks.end(); iterSock++)
+			delete *iterSock;
+	}
+
+	void ConnectionPool::setEngine(JsSocketEngine *pengine)
+	{
+		m_pengine = pengine;
+	}
+
+#ifdef USE_OPENSSL
+	void ConnectionPool::setSSLMethod(const SSL_METHOD *ssl_method)
+	{
+		m_ssl_method = ssl_method;
+	}
+
+	void ConnectionPool::setSSLContext(const JsCPPUtils::SmartPointer<JsSSLContext> &spctx)
+	{
+		m_lock.lock();
+		m_spsslctx = spctx;
+		m_lock.unlock();
+	}
+
+	JsCPPUtils::SmartPointer<JsSSLContext> ConnectionPool::getSSLContext()
+	{
+		JsCPPUtils::SmartPointer<JsSSLContext> spctx;
+		m_lock.lock();
+		spctx = m_spsslctx;
+		m_lock.unlock();
+		return spctx;
+	}
+#endif
+
+	int ConnectionPool::init(long recvdatabufsize, Pool_RecvHandler_t recvhandler, Pool_DisconnectedHandler_t disconnectedhandler, Pool_ProbeHandler_t probehandler)
+	{
+		m_conf_recvdatabufsize = recvdatabufsize;
+		m_recvhandler = recvhandler;
+		m_disconnectedhandler = disconnectedhandler;
+		m_probehandler = probehandler;
+		return 1;
+	}
+
+	void ConnectionPool::setLimits(int minidle, int maxidle, int maxtotal)
+	{
+		m_lock.lock();
+		m_conf_maxtotal = (maxtotal > 0) ? maxtotal : 1;
+		m_conf_maxidle = (maxidle < 0) ? 0 : ((maxidle > m_conf_maxtotal) ? m_conf_maxtotal : maxidle);
+		m_conf_minidle = (minidle < 0) ? 0 : ((minidle > m_conf_maxidle) ? m_conf_maxidle : minidle);
+		m_lock.unlock();
+	}
+
+	void ConnectionPool::setIdleTimeout(int64_t idletimeoutms)
+	{
+		m_conf_idletimeoutms = (idletimeoutms > 0) ? idletimeoutms : 0;
+	}
+
+	void ConnectionPool::setProbeInterval(int64_t probeintervalms)
+	{
+		m_conf_probeintervalms = (probeintervalms > 0) ? probeintervalms : 0;
+	}
+
+	void ConnectionPool::setConnectTimeout(long timeoutms)
+	{
+		m_conf_connecttimeoutms = timeoutms;
+	}
+
+	int64_t ConnectionPool::_nowUs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	/*
+	 * under m_lock
+	 */
+	ConnectionPool::KeyEntry *ConnectionPool::_getKey(const char *szHost, uint16_t port, bool bUseSSL)
+	{
+		std::map<std::string, KeyEntry*>::iterator iter;
+		std::string strKey(szHost);
+		char szSuffix[16];
+		KeyEntry *pkey;
+
+		snprintf(szSuffix, sizeof(szSuffix), ":%u%s", (unsigned int)port, bUseSSL ? "/s" : "");
+		strKey.append(szSuffix);
+		iter = m_keys.find(strKey);
+		if(iter != m_keys.end())
+			return iter->second;
+
+		pkey = new KeyEntry();
+		pkey->host = szHost;
+		pkey->port = port;
+		pkey->ssl = bUseSSL;
+		m_keys[strKey] = pkey;
+		return pkey;
+	}
+
+	/*
+	 * under m_lock : a new socket counted against the key, not connected yet
+	 */
+	ConnectionPool::PooledSocket *ConnectionPool::_newSocket(KeyEntry *pkey, bool bCheckedOut)
+	{
+		Conn *pconn = new Conn();
+		pconn->pkey = pkey;
+		pconn->checkedout = bCheckedOut;
+		pconn->probing = false;
+		pconn->idlesince = Common::getTickCount();
+		pconn->lastprobe = pconn->idlesince;
+		pconn->psock = new PooledSocket(this, pconn);
+		pkey->conns.push_back(pconn);
+		if(!bCheckedOut)
+			pkey->idle.push_back(pconn);
+		return pconn->psock;
+	}
+
+	/*
+	 * not under m_lock (may wait for the connect)
+	 */
+	int ConnectionPool::_connect(PooledSocket *psock, long timeoutms)
+	{
+		KeyEntry *pkey = psock->pconn->pkey;
+		int rc;
+
+		if(m_pengine != NULL)
+			psock->setEngine(m_pengine);
+#ifdef USE_OPENSSL
+		if(pkey->ssl)
+		{
+			JsCPPUtils::SmartPointer<JsSSLContext> spctx;
+			m_lock.lock();
+			if(m_spsslctx.getPtr() == NULL)
+			{
+				spctx = new JsSSLContext();
+				if(spctx->init((m_ssl_method != NULL) ? m_ssl_method : ::SSLv23_client_method()) == 1)
+					m_spsslctx = spctx;
+			}
+			spctx = m_spsslctx;
+			m_lock.unlock();
+			if(spctx.getPtr() == NULL)
+				return -ENOMEM;
+			psock->setSSLContext(spctx);
+		}
+#endif
+		rc = psock->init(AF_INET, SOCK_STREAM, 0, pkey->ssl,
+#ifdef USE_OPENSSL
+			(m_ssl_method != NULL) ? m_ssl_method : ::SSLv23_client_method(),
+#else
+			NULL,
+#endif
+			m_conf_recvdatabufsize, NULL, NULL, _clientConnectedProc, _clientRecvProc, _clientDisconnectedProc);
+		if(rc != 1)
+			return (rc < 0) ? rc : -EINVAL;
+		/* auto-reconnect : a socket dropped while idle comes back by itself */
+		rc = psock->beginConnect(NULL, 0, pkey->host.c_str(), pkey->port, true, timeoutms);
+		if(rc != 1)
+			return (rc < 0) ? rc : -ETIMEDOUT;
+		return 1;
+	}
+
+	/*
+	 * under m_lock : drops the bookkeeping of pconn. The socket is deleted by the caller, later,
+	 * outside the lock and never on its own loop thread.
+	 */
+	void ConnectionPool::_forget(Conn *pconn)
+	{
+		KeyEntry *pkey = pconn->pkey;
+		pkey->idle.remove(pconn);
+		pkey->conns.remove(pconn);
+		pconn->psock->pconn = NULL;
+		delete pconn;
+	}
+
+	JsClientSocket *ConnectionPool::checkout(const char *szHost, uint16_t port, bool bUseSSL, int *presult)
+	{
+		int64_t starttime = _nowUs();
+		int64_t elapsed;
+		std::list<Conn*>::iterator iter;
+		PooledSocket *psock = NULL;
+		KeyEntry *pkey;
+		bool bReused = false;
+		int rc = 1;
+
+		m_lock.lock();
+		m_stats.checkouts++;
+		pkey = _getKey(szHost, port, bUseSSL);
+		for(iter = pkey->idle.begin(); iter != pkey->idle.end(); iter++)
+		{
+			Conn *pconn = *iter;
+			/* skips the ones reconnecting or being probed */
+			if(!pconn->probing && pconn->psock->isConnected())
+			{
+				pkey->idle.erase(iter);
+				pconn->checkedout = true;
+				psock = pconn->psock;
+				bReused = true;
+				break;
+			}
+		}
+		if(psock == NULL)
+		{
+			if((int)pkey->conns.size() >= m_conf_maxtotal)
+			{
+				m_stats.busy++;
+				rc = -EBUSY;
+			}else{
+				psock = _newSocket(pkey, true);
+			}
+		}
+		m_lock.unlock();
+
+		if((psock != NULL) && !bReused)
+		{
+			rc = _connect(psock, m_conf_connecttimeoutms);
+			if((rc == 1) && !psock->isConnected())
+			{
+				/* beginConnect does not wait on a loop thread : keep it as an idle one */
+				m_lock.lock();
+				if(psock->pconn != NULL)
+				{
+					psock->pconn->checkedout = false;
+					psock->pconn->idlesince = Common::getTickCount();
+					pkey->idle.push_back(psock->pconn);
+				}
+				m_lock.unlock();
+				psock = NULL;
+				rc = -EINPROGRESS;
+			}else if(rc != 1)
+			{
+				psock->beginDisconnect();
+				m_lock.lock();
+				if(psock->pconn != NULL)
+					_forget(psock->pconn);
+				m_doomed.push_back(psock);
+				m_lock.unlock();
+				psock = NULL;
+			}
+		}
+
+		elapsed = _nowUs() - starttime;
+		m_lock.lock();
+		if(psock != NULL)
+		{
+			if(bReused)
+				m_stats.reused++;
+			else
+				m_stats.connected++;
+		}else if(rc != -EBUSY)
+		{
+			m_stats.failed++;
+		}
+		m_stats.latency_total_us += elapsed;
+		if(elapsed > m_stats.latency_max_us)
+			m_stats.latency_max_us = elapsed;
+		m_lock.unlock();
+
+		if(presult != NULL)
+			*presult = rc;
+		return psock;
+	}
+
+	void ConnectionPool::checkin(JsClientSocket *pclient, bool bReusable)
+	{
+		PooledSocket *psock = (PooledSocket*)pclient;
+		Conn *pconn;
+
+		pclient->setUserPtr(NULL);
+		m_lock.lock();
+		pconn = psock->pconn;
+		if(pconn == NULL)
+		{
+			m_lock.unlock();
+			return;
+		}
+		pconn->checkedout = false;
+		if(bReusable && ((int)pconn->pkey->idle.size() < m_conf_maxidle))
+		{
+			pconn->idlesince = Common::getTickCount();
+			pconn->lastprobe = pconn->idlesince;
+			pconn->pkey->idle.push_front(pconn);
+			m_lock.unlock();
+			return;
+		}
+		_forget(pconn);
+		m_doomed.push_back(psock);
+		m_lock.unlock();
+		psock->beginDisconnect();
+	}
+
+	ConnectionPool::Stats ConnectionPool::getStats()
+	{
+		std::map<std::string, KeyEntry*>::iterator iter;
+		Stats stats;
+		m_lock.lock();
+		stats = m_stats;
+		stats.idle = 0;
+		stats.total = 0;
+		for(iter = m_keys.begin(); iter != m_keys.end(); iter++)
+		{
+			stats.idle += (int)iter->second->idle.size();
+			stats.total += (int)iter->second->conns.size();
+		}
+		m_lock.unlock();
+		return stats;
+	}
+
+	/*
+	 * Peer closed or reset : the loop normally notices first, this catches what it has not yet.
+	 */
+	int ConnectionPool::_defaultProbe(JsClientSocket *pclient)
+	{
+		char c;
+		int rc = (int)::recv(pclient->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+		if(rc == 0)
+			return 0;
+		if((rc < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			return 0;
+		return 1;
+	}
+
+	void ConnectionPool::MaintenanceTask::run()
+	{
+		lock.lock();
+		if(ppool != NULL)
+			ppool->_maintain();
+		lock.unlock();
+	}
+
+	/*
+	 * Timer thread : idle timeouts, probes, the minimum idle count, and deleting closed sockets.
+	 */
+	void ConnectionPool::_maintain()
+	{
+		std::map<std::string, KeyEntry*>::iterator iterKey;
+		std::list<Conn*>::iterator iter;
+		std::list<PooledSocket*> doomed;
+		std::list<PooledSocket*> probes;
+		std::list<PooledSocket*> warm;
+		std::list<PooledSocket*>::iterator iterSock;
+		int64_t now = Common::getTickCount();
+
+		m_lock.lock();
+		/* closed by checkin/checkout at least one round ago */
+		doomed.swap(m_doomed);
+		for(iterKey = m_keys.begin(); iterKey != m_keys.end(); iterKey++)
+		{
+			KeyEntry *pkey = iterKey->second;
+
+			/* least recently used at the back */
+			while((m_conf_idletimeoutms > 0) && ((int)pkey->idle.size() > m_conf_minidle))
+			{
+				Conn *pconn = pkey->idle.back();
+				if(pconn->probing || (now - pconn->idlesince < m_conf_idletimeoutms))
+					break;
+				pconn->psock->beginDisconnect();
+				doomed.push_back(pconn->psock);
+				_forget(pconn);
+				m_stats.idleclosed++;
+			}
+
+			if(m_conf_probeintervalms > 0)
+			{
+				for(iter = pkey->idle.begin(); iter != pkey->idle.end(); iter++)
+				{
+					Conn *pconn = *iter;
+					if(!pconn->probing && pconn->psock->isConnected() && (now - pconn->lastprobe >= m_conf_probeintervalms))
+					{
+						pconn->probing = true;
+						probes.push_back(pconn->psock);
+					}
+				}
+			}
+
+			while(((int)pkey->idle.size() < m_conf_minidle) && ((int)pkey->conns.size() < m_conf_maxtotal))
+				warm.push_back(_newSocket(pkey, false));
+		}
+		m_lock.unlock();
+
+		for(iterSock = probes.begin(); iterSock != probes.end(); iterSock++)
+		{
+			PooledSocket *psock = *iterSock;
+			int rc = (m_probehandler != NULL) ? m_probehandler(this, psock) : _defaultProbe(psock);
+			m_lock.lock();
+			if(psock->pconn != NULL)
+			{
+				psock->pconn->probing = false;
+				psock->pconn->lastprobe = Common::getTickCount();
+				if(rc != 1)
+				{
+					_forget(psock->pconn);
+					doomed.push_back(psock);
+					m_stats.probefailed++;
+					psock->beginDisconnect();
+				}
+			}
+			m_lock.unlock();
+		}
+
+		for(iterSock = warm.begin(); iterSock != warm.end(); iterSock++)
+		{
+			PooledSocket *psock = *iterSock;
+			/* not waited for : checkout() skips it until it is connected */
+			if(_connect(psock, 0) != 1)
+			{
+				m_lock.lock();
+				if(psock->pconn != NULL)
+					_forget(psock->pconn);
+				m_lock.unlock();
+				doomed.push_back(psock);
+			}
+		}
+
+		for(iterSock = doomed.begin(); iterSock != doomed.end(); iterSock++)
+			delete *iterSock;
+	}
+
+	int ConnectionPool::_clientConnectedProc(JsClientSocket *psockctx, void *pthreaduserctx, JSCUTILS_SOCKET_T clientsock)
+	{
+		return 1;
+	}
+
+	int ConnectionPool::_clientRecvProc(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf)
+	{
+		PooledSocket *psock = (PooledSocket*)psockctx;
+		ConnectionPool *ppool = psock->ppool;
+		bool bCheckedOut;
+
+		ppool->m_lock.lock();
+		bCheckedOut = (psock->pconn != NULL) && psock->pconn->checkedout;
+		ppool->m_lock.unlock();
+		/* data nobody asked for : the protocol state is unknown, start over */
+		if(!bCheckedOut)
+			return 0;
+		if(ppool->m_recvhandler == NULL)
+			return 1;
+		return ppool->m_recvhandler(ppool, psockctx, recv_len, recv_pbuf);
+	}
+
+	void ConnectionPool::_clientDisconnectedProc(JsClientSocket *psockctx, int code)
+	{
+		PooledSocket *psock = (PooledSocket*)psockctx;
+		ConnectionPool *ppool = psock->ppool;
+		bool bCheckedOut;
+
+		ppool->m_lock.lock();
+		bCheckedOut = (psock->pconn != NULL) && psock->pconn->checkedout;
+		ppool->m_lock.unlock();
+		if(bCheckedOut && (ppool->m_disconnectedhandler != NULL))
+			ppool->m_disconnectedhandler(ppool, psockctx, code);
+	}
+}
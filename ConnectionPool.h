@@ -0,0 +1,212 @@
+/**
+ * @file	ConnectionPool.h
+ * @class	ConnectionPool
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/24
+ * @brief	Keyed (host, port, SSL) pool of connected JsClientSocket objects with idle limits, timeouts and liveness probes
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_CONNECTIONPOOL_H__
+#define __JSCPPUTILS_CONNECTIONPOOL_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <stdint.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS, yet..."
+#endif
+
+#include <string>
+#include <list>
+#include <map>
+
+#include "JsClientSocket.h"
+#include "Lockable.h"
+#include "SmartPointer.h"
+#include "Timer.h"
+#include "TimerTask.h"
+
+namespace JsCPPUtils
+{
+	/**
+	 * Pooled sockets are connected with auto-reconnect : one the peer drops while idle comes back by itself,
+	 * and checkout() only hands out sockets that are connected right now.
+	 * A checked-out socket belongs to the caller until checkin(); its user pointer is free for the caller
+	 * and is reset on checkin.
+	 * Handlers run on the socket's loop thread; probes run on the timer thread.
+	 */
+	class ConnectionPool
+	{
+	public:
+		typedef int(*Pool_RecvHandler_t)(ConnectionPool *ppool, JsClientSocket *pclient, int recv_len, char *recv_pbuf);
+		typedef void(*Pool_DisconnectedHandler_t)(ConnectionPool *ppool, JsClientSocket *pclient, int code);
+		/**
+		 * Checks an idle socket (e.g. sends an application-level ping). 1 : keep it, otherwise it is closed.
+		 * Without one the pool peeks the socket for a pending EOF or error.
+		 */
+		typedef int(*Pool_ProbeHandler_t)(ConnectionPool *ppool, JsClientSocket *pclient);
+
+		struct Stats {
+			int64_t checkouts;
+			/* served by an idle socket */
+			int64_t reused;
+			/* served by a new connection */
+			int64_t connected;
+			int64_t failed;
+			/* refused because the key reached its maximum */
+			int64_t busy;
+			int64_t idleclosed;
+			int64_t probefailed;
+			/* time spent in checkout(), in microseconds */
+			int64_t latency_total_us;
+			int64_t latency_max_us;
+			int idle;
+			int total;
+		};
+
+	private:
+		struct KeyEntry;
+		class PooledSocket;
+
+		struct Conn {
+			PooledSocket *psock;
+			KeyEntry *pkey;
+			bool checkedout;
+			bool probing;
+			int64_t idlesince;
+			int64_t lastprobe;
+		};
+
+		struct KeyEntry {
+			std::string host;
+			uint16_t port;
+			bool ssl;
+			/* idle and checked out */
+			std::list<Conn*> conns;
+			/* most recently used first */
+			std::list<Conn*> idle;
+		};
+
+		class PooledSocket : public JsClientSocket
+		{
+		public:
+			ConnectionPool *ppool;
+			Conn *pconn;
+			PooledSocket(ConnectionPool *_ppool, Conn *_pconn) : ppool(_ppool), pconn(_pconn) {}
+		};
+
+		class MaintenanceTask : public TimerTask
+		{
+		public:
+			/* cleared by the pool's destructor; run() holds it while it works */
+			Lockable lock;
+			ConnectionPool *ppool;
+			MaintenanceTask(ConnectionPool *_ppool) : ppool(_ppool) {}
+			void run() override;
+		};
+
+		Lockable m_lock;
+		std::map<std::string, KeyEntry*> m_keys;
+		/* closed, deleted by the next maintenance run */
+		std::list<PooledSocket*> m_doomed;
+		Stats m_stats;
+
+		Timer *m_ptimer;
+		bool m_bOwnTimer;
+		JsCPPUtils::SmartPointer<MaintenanceTask> m_sptask;
+
+		JsSocketEngine *m_pengine;
+#ifdef USE_OPENSSL
+		const SSL_METHOD *m_ssl_method;
+		/* shared by every SSL socket of the pool, so reconnects resume */
+		JsCPPUtils::SmartPointer<JsSSLContext> m_spsslctx;
+#endif
+		long m_conf_recvdatabufsize;
+		int m_conf_minidle;
+		int m_conf_maxidle;
+		int m_conf_maxtotal;
+		int64_t m_conf_idletimeoutms;
+		int64_t m_conf_probeintervalms;
+		long m_conf_connecttimeoutms;
+
+		Pool_RecvHandler_t m_recvhandler;
+		Pool_DisconnectedHandler_t m_disconnectedhandler;
+		Pool_ProbeHandler_t m_probehandler;
+
+		KeyEntry *_getKey(const char *szHost, uint16_t port, bool bUseSSL);
+		PooledSocket *_newSocket(KeyEntry *pkey, bool bCheckedOut);
+		int _connect(PooledSocket *psock, long timeoutms);
+		void _forget(Conn *pconn);
+		void _maintain();
+		static int _defaultProbe(JsClientSocket *pclient);
+		static int64_t _nowUs();
+
+		static int _clientConnectedProc(JsClientSocket *psockctx, void *pthreaduserctx, JSCUTILS_SOCKET_T clientsock);
+		static int _clientRecvProc(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf);
+		static void _clientDisconnectedProc(JsClientSocket *psockctx, int code);
+
+	public:
+		/**
+		 * ptimer drives idle timeouts, probes and the minimum idle count (NULL : the pool runs its own Timer).
+		 * A given timer must outlive the pool.
+		 */
+		ConnectionPool(Timer *ptimer = NULL, int64_t maintenanceintervalms = 1000);
+		~ConnectionPool();
+
+		/**
+		 * Must be called before the first checkout().
+		 */
+		void setEngine(JsSocketEngine *pengine);
+#ifdef USE_OPENSSL
+		/**
+		 * The method of the context the pool creates on the first SSL checkout (SSLv23_client_method() by default).
+		 */
+		void setSSLMethod(const SSL_METHOD *ssl_method);
+		/**
+		 * Uses spctx for the SSL sockets instead (e.g. one context for several pools). Before the first checkout().
+		 */
+		void setSSLContext(const JsCPPUtils::SmartPointer<JsSSLContext> &spctx);
+		JsCPPUtils::SmartPointer<JsSSLContext> getSSLContext();
+#endif
+		int init(long recvdatabufsize, Pool_RecvHandler_t recvhandler, Pool_DisconnectedHandler_t disconnectedhandler, Pool_ProbeHandler_t probehandler = NULL);
+
+		/**
+		 * Per key. minidle sockets are kept connected in the background once a key has been used;
+		 * checkin() closes a socket beyond maxidle; maxtotal counts idle and checked-out ones.
+		 */
+		void setLimits(int minidle, int maxidle, int maxtotal);
+		/**
+		 * Idle sockets beyond minidle are closed after idletimeoutms (0 : never).
+		 * Idle sockets are probed every probeintervalms (0 : never).
+		 */
+		void setIdleTimeout(int64_t idletimeoutms);
+		void setProbeInterval(int64_t probeintervalms);
+		void setConnectTimeout(long timeoutms);
+
+		/**
+		 * A connected socket for the key, reusing an idle one when there is one.
+		 * A new connection is waited for (setConnectTimeout), so call it off the engine's loop threads;
+		 * there the new socket joins the idle ones instead and -EINPROGRESS is reported.
+		 * @return NULL on failure; *presult (optional) : 1, -EBUSY when the key is at maxtotal, or the connect error
+		 */
+		JsClientSocket *checkout(const char *szHost, uint16_t port, bool bUseSSL = false, int *presult = NULL);
+		/**
+		 * bReusable = false (e.g. the protocol state is unknown after an error) closes the socket.
+		 * May be called from a handler of the socket.
+		 */
+		void checkin(JsClientSocket *pclient, bool bReusable = true);
+
+		Stats getStats();
+	};
+
+}
+
+#endif /* __JSCPPUTILS_CONNECTIONPOOL_H__ */
@@ -25,6 +25,28 @@
 #include <pwd.h>
 #include <grp.h>
 #include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <stdarg.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "NumaTopology.h"
+#include "Timer.h"
+
+extern char **environ;
+
+/* exec'd process : the Unix socket to the one it replaces, and when SIGUSR2 arrived there */
+#define _JSCPPUTILS_DAEMON_ENV_HANDOVERFD "JSCPPUTILS_DAEMON_HANDOVERFD"
+#define _JSCPPUTILS_DAEMON_ENV_HANDOVERMS "JSCPPUTILS_DAEMON_HANDOVERMS"
+/* addListenFd() name of the metrics endpoint */
+#define _JSCPPUTILS_DAEMON_METRICSFD "daemon.metrics"
 #else
 #include "StringEncoding.h"
 #endif
@@ -100,6 +122,30 @@ namespace JsCPPUtils {
 		m_args_uid = -1;
 		m_args_gid = -1;
 
+#if defined(JSCUTILS_OS_LINUX)
+		m_conf_workers = 0;
+		m_conf_workerpincpu = false;
+		m_conf_workerstoptimeoutms = 10000;
+		m_workerindex = -1;
+		sigemptyset(&m_mainsigmask);
+
+		m_conf_gracefulrestart = false;
+		m_conf_handovertimeoutms = 30000;
+		m_conf_draintimeoutms = 30000;
+		m_handoverfd = -1;
+		m_handoverstartms = 0;
+		m_reloadlatencyms = -1;
+		m_handedover = false;
+		m_handoverpipe[0] = -1;
+		m_handoverpipe[1] = -1;
+
+		m_metricsfd = -1;
+		m_metricspipe[0] = -1;
+		m_metricspipe[1] = -1;
+		m_metricsthreadstarted = false;
+		m_metricsseq = 0;
+#endif
+
 		m_runstatus = 0;
 	}
 
@@ -125,6 +171,22 @@ namespace JsCPPUtils {
 		rc = main_parseArgs(argc, argv);
 		if (rc != 0)
 			return rc;
+
+		if (this->isArgContain("workers"))
+			m_conf_workers = atoi(this->getArg("workers").c_str());
+		if (this->isArgContain("pin-cpu"))
+			m_conf_workerpincpu = true;
+		if (this->isArgContain("metrics"))
+			m_conf_metricsendpoint = this->getArg("metrics");
+
+		sigprocmask(SIG_SETMASK, NULL, &m_mainsigmask);
+		if (m_conf_workers != 0)
+		{
+			/* blocked before the startup handler, so the threads it starts cannot take (and lose) them */
+			sigset_t sigs;
+			_masterSignals(&sigs);
+			sigprocmask(SIG_BLOCK, &sigs, NULL);
+		}
 	
 		if (m_isDaemon)
 		{
@@ -223,6 +285,12 @@ namespace JsCPPUtils {
 			m_plogger = new Logger(Logger::TYPE_STDOUT, NULL, NULL, NULL);
 		}
 	
+		if (_receiveHandover() < 0)
+		{
+			rc = 1;
+			goto FUNCEXIT;
+		}
+	
 		if(m_daemonstartup != NULL)
 		{
 			rc = m_daemonstartup(this, m_cbparam, argc, argv);
@@ -231,6 +299,13 @@ namespace JsCPPUtils {
 				goto FUNCEXIT;
 			}
 		}
+
+		/* optional : the daemon runs without it */
+		_openMetrics();
+
+		for (std::map<std::string, int>::iterator iter = m_inheritedfds.begin(); iter != m_inheritedfds.end(); iter++)
+			close(iter->second);
+		m_inheritedfds.clear();
 	
 		if ((!m_bnosetugid) && (this->getArgUid() >= 0))
 		{
@@ -247,10 +322,27 @@ namespace JsCPPUtils {
 				setuid(arg_uid);
 			}
 		}
+
+		if (m_conf_gracefulrestart)
+			_startHandoverThread();
+		if (_handoverReady() < 0)
+		{
+			rc = 1;
+			goto FUNCEXIT;
+		}
+
+		if (m_conf_workers != 0)
+		{
+			rc = _runMaster(argc, argv);
+			goto FUNCEXIT;
+		}
 	
 		signal(SIGINT, signalhandler);
 		signal(SIGTERM, signalhandler);
 		signal(SIGHUP, signalhandler);
+		if (m_handoverpipe[1] >= 0)
+			signal(SIGUSR2, signalhandler);
+		_startMetricsThread();
 	
 		m_runstatus = 1;
 		if(m_daemonmain != NULL)
@@ -259,10 +351,1410 @@ namespace JsCPPUtils {
 			rc = 1;
 
 	FUNCEXIT:
+		_stopMetrics();
+		sigprocmask(SIG_SETMASK, &m_mainsigmask, NULL);
 	
 		return rc;
 	}
 
+	int64_t Daemon::_monotonicMs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+
+	void Daemon::_masterSignals(sigset_t *psigs)
+	{
+		sigemptyset(psigs);
+		sigaddset(psigs, SIGCHLD);
+		sigaddset(psigs, SIGINT);
+		sigaddset(psigs, SIGTERM);
+		sigaddset(psigs, SIGHUP);
+		if (m_conf_gracefulrestart)
+			sigaddset(psigs, SIGUSR2);
+	}
+
+	/*
+	 * Signals are taken with sigtimedwait() instead of a handler, so the supervision runs in plain code.
+	 * Returns in a worker as well (with the main handler's result).
+	 */
+	int Daemon::_runMaster(int argc, char *argv[])
+	{
+		std::vector<int> cpus;
+		sigset_t sigs;
+		int64_t stopdeadline = 0;
+		int numofworkers = m_conf_workers;
+		int i;
+
+		if ((numofworkers < 0) || m_conf_workerpincpu)
+		{
+			NumaTopology topology;
+			std::vector<NumaTopology::CpuSlot> slots;
+			if (topology.load() > 0)
+				topology.layoutOnePerCore(slots);
+			for (i = 0; i < (int)slots.size(); i++)
+				cpus.push_back(slots[i].cpu);
+		}
+		if (numofworkers < 0)
+		{
+			long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+			numofworkers = !cpus.empty() ? (int)cpus.size() : ((ncpus > 0) ? (int)ncpus : 1);
+		}
+
+		m_workers.resize(numofworkers);
+		for (i = 0; i < numofworkers; i++)
+		{
+			WorkerProcess &worker = m_workers[i];
+			worker.pid = 0;
+			worker.cpu = (m_conf_workerpincpu && !cpus.empty()) ? cpus[i % cpus.size()] : -1;
+			worker.startedms = 0;
+			worker.respawnat = 0;
+			worker.backoffms = 0;
+			worker.restarts = 0;
+			worker.metricsfds[0] = -1;
+			worker.metricsfds[1] = -1;
+			if ((m_metricsfd >= 0) && (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, worker.metricsfds) < 0))
+			{
+				m_plogger->printf(Logger::LOGTYPE_WARNING, "metrics: socketpair() for worker %d failed: %d", i, errno);
+				worker.metricsfds[0] = -1;
+				worker.metricsfds[1] = -1;
+			}
+		}
+		_startMetricsThread();
+
+		/* an inherited SIG_IGN would make the kernel reap the workers for us */
+		signal(SIGCHLD, SIG_DFL);
+		_masterSignals(&sigs);
+		sigprocmask(SIG_BLOCK, &sigs, NULL);
+		m_masterthread = pthread_self();
+
+		m_runstatus = 1;
+		m_plogger->printf(Logger::LOGTYPE_INFO, "master %d: starting %d workers", (int)getpid(), numofworkers);
+
+		for (;;)
+		{
+			int64_t now = _monotonicMs();
+			int64_t waitms = 1000;
+			struct timespec ts;
+			siginfo_t info;
+			int alive = 0;
+			int sig;
+			int nrst;
+
+			if (m_runstatus.get() == 1)
+			{
+				for (i = 0; i < (int)m_workers.size(); i++)
+				{
+					WorkerProcess &worker = m_workers[i];
+					if (worker.pid != 0)
+						continue;
+					if (worker.respawnat <= now)
+					{
+						if (_spawnWorker(i) == 0)
+						{
+							int cpu = worker.cpu;
+							int metricsfd = worker.metricsfds[1];
+							m_workers.clear();
+							return _runWorker(i, cpu, metricsfd, argc, argv);
+						}
+					}else if ((worker.respawnat - now) < waitms)
+					{
+						waitms = worker.respawnat - now;
+					}
+				}
+			}else if (stopdeadline == 0)
+			{
+				/* reqStop() or a stop signal */
+				m_plogger->printf(Logger::LOGTYPE_INFO, "master %d: stopping workers", (int)getpid());
+				_signalWorkers(SIGTERM);
+				/* handed over : the workers drain while the new ones already serve */
+				stopdeadline = now + (m_handedover ? m_conf_draintimeoutms : m_conf_workerstoptimeoutms);
+			}
+
+			for (i = 0; i < (int)m_workers.size(); i++)
+			{
+				if (m_workers[i].pid != 0)
+					alive++;
+			}
+			if (stopdeadline != 0)
+			{
+				if (alive == 0)
+					break;
+				if (now >= stopdeadline)
+				{
+					m_plogger->printf(Logger::LOGTYPE_WARNING, "master %d: %d workers did not stop in time, killing them", (int)getpid(), alive);
+					_signalWorkers(SIGKILL);
+					stopdeadline = INT64_MAX;
+				}else if ((stopdeadline - now) < waitms)
+				{
+					waitms = stopdeadline - now;
+				}
+			}
+
+			ts.tv_sec = waitms / 1000;
+			ts.tv_nsec = (waitms % 1000) * 1000000;
+			sig = sigtimedwait(&sigs, &info, &ts);
+			if (sig < 0)
+				continue;
+
+			if (sig == SIGCHLD)
+			{
+				_reapWorkers();
+				continue;
+			}
+
+			nrst = 0;
+			if (m_sighandler != NULL)
+				nrst = m_sighandler(this, m_cbparam, sig);
+			if (nrst != 0)
+				continue;
+			switch (sig)
+			{
+			case SIGINT:
+			case SIGTERM:
+				m_runstatus.getifset(2, 1);
+				break;
+			case SIGHUP:
+				if (m_plogger != NULL)
+					m_plogger->requestReopen();
+				if (m_reloadhandler != NULL)
+					m_reloadhandler(this, m_cbparam);
+				_signalWorkers(SIGHUP);
+				break;
+			case SIGUSR2:
+				if ((m_handoverpipe[1] >= 0) && (write(m_handoverpipe[1], "r", 1) < 0))
+					m_plogger->printf(Logger::LOGTYPE_ERR, "master %d: graceful restart request failed: %d", (int)getpid(), errno);
+				break;
+			}
+		}
+
+		sigprocmask(SIG_SETMASK, &m_mainsigmask, NULL);
+		/* it reads m_workers */
+		_stopMetrics();
+		for (i = 0; i < (int)m_workers.size(); i++)
+		{
+			if (m_workers[i].metricsfds[0] >= 0)
+			{
+				close(m_workers[i].metricsfds[0]);
+				close(m_workers[i].metricsfds[1]);
+			}
+		}
+		m_workers.clear();
+		m_runstatus = 0;
+		m_plogger->printf(Logger::LOGTYPE_INFO, "master %d: all workers exited", (int)getpid());
+		return 0;
+	}
+
+	/*
+	 * @return the worker's pid in the master, 0 in the worker
+	 */
+	pid_t Daemon::_spawnWorker(int index)
+	{
+		WorkerProcess &worker = m_workers[index];
+		pid_t pid;
+
+		/* the logger's threads do not come along : the worker starts its own (async logging included) */
+		m_plogger->forkPrepare();
+		pid = fork();
+		if (pid == 0)
+		{
+			int i;
+			m_plogger->forkChild();
+			/* only the worker's own end of its metrics channel stays */
+			for (i = 0; i < (int)m_workers.size(); i++)
+			{
+				if (m_workers[i].metricsfds[0] < 0)
+					continue;
+				close(m_workers[i].metricsfds[0]);
+				if (i != index)
+					close(m_workers[i].metricsfds[1]);
+			}
+			return 0;
+		}
+		m_plogger->forkParent();
+		if (pid < 0)
+		{
+			m_plogger->printf(Logger::LOGTYPE_ERR, "master %d: fork() for worker %d failed: %d", (int)getpid(), index, errno);
+			worker.respawnat = _monotonicMs() + 1000;
+			return -1;
+		}
+		/* pid and restarts are read by the metrics thread */
+		__atomic_store_n(&worker.pid, pid, __ATOMIC_RELAXED);
+		worker.startedms = _monotonicMs();
+		return pid;
+	}
+
+	int Daemon::_runWorker(int index, int cpu, int metricsfd, int argc, char *argv[])
+	{
+		pid_t masterpid = getppid();
+
+		m_workerindex = index;
+		m_runstatus = 0;
+
+		/* restarts are the master's */
+		if (m_handoverpipe[0] >= 0)
+		{
+			close(m_handoverpipe[0]);
+			close(m_handoverpipe[1]);
+			m_handoverpipe[0] = -1;
+			m_handoverpipe[1] = -1;
+		}
+		/* and so is the endpoint; the thread was not forked along. The worker answers the master on its channel. */
+		if (m_metricsfd >= 0)
+		{
+			close(m_metricsfd);
+			close(m_metricspipe[0]);
+			close(m_metricspipe[1]);
+			m_metricsfd = -1;
+			m_metricspipe[0] = -1;
+			m_metricspipe[1] = -1;
+		}
+		m_metricsthreadstarted = false;
+		m_metricspath.clear();
+		m_metricsfd = metricsfd;
+
+		/* the master is gone : stop like on a stop request */
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (getppid() != masterpid)
+			return 1;
+
+		if ((cpu >= 0) && (cpu < CPU_SETSIZE))
+		{
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(cpu, &cpuset);
+			if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0)
+				m_plogger->printf(Logger::LOGTYPE_WARNING, "worker %d: pinning to cpu %d failed: %d", index, cpu, errno);
+		}
+
+		signal(SIGINT, signalhandler);
+		signal(SIGTERM, signalhandler);
+		signal(SIGHUP, signalhandler);
+		sigprocmask(SIG_SETMASK, &m_mainsigmask, NULL);
+		_startMetricsThread();
+
+		m_runstatus = 1;
+		if (m_daemonmain != NULL)
+			return m_daemonmain(this, m_cbparam, argc, argv);
+		return 1;
+	}
+
+	void Daemon::_reapWorkers()
+	{
+		int64_t now = _monotonicMs();
+		pid_t pid;
+		int status;
+		int i;
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		{
+			for (i = 0; i < (int)m_workers.size(); i++)
+			{
+				WorkerProcess &worker = m_workers[i];
+				int64_t uptime;
+				if (worker.pid != pid)
+					continue;
+				__atomic_store_n(&worker.pid, 0, __ATOMIC_RELAXED);
+				if (m_runstatus.get() != 1)
+					break;
+				if (WIFSIGNALED(status))
+					m_plogger->printf(Logger::LOGTYPE_ERR, "master %d: worker %d (pid %d) killed by signal %d", (int)getpid(), i, (int)pid, WTERMSIG(status));
+				else
+					m_plogger->printf(Logger::LOGTYPE_WARNING, "master %d: worker %d (pid %d) exited with %d", (int)getpid(), i, (int)pid, WEXITSTATUS(status));
+				/* dying right after start : back off instead of fork-looping */
+				uptime = now - worker.startedms;
+				if (uptime < 1000)
+					worker.backoffms = (worker.backoffms > 0) ? ((worker.backoffms < 15000) ? (worker.backoffms * 2) : 30000) : 100;
+				else
+					worker.backoffms = 0;
+				worker.respawnat = now + worker.backoffms;
+				__atomic_store_n(&worker.restarts, worker.restarts + 1, __ATOMIC_RELAXED);
+				break;
+			}
+		}
+	}
+
+	void Daemon::_signalWorkers(int sig)
+	{
+		int i;
+		for (i = 0; i < (int)m_workers.size(); i++)
+		{
+			if (m_workers[i].pid > 0)
+				kill(m_workers[i].pid, sig);
+		}
+	}
+
+	void Daemon::setWorkers(int numofworkers, bool bPinCpu)
+	{
+		m_conf_workers = numofworkers;
+		m_conf_workerpincpu = bPinCpu;
+	}
+
+	void Daemon::setWorkerStopTimeout(int64_t timeoutms)
+	{
+		m_conf_workerstoptimeoutms = timeoutms;
+	}
+
+	int Daemon::getWorkerIndex()
+	{
+		return m_workerindex;
+	}
+
+	/* one SOCK_SEQPACKET message of a handover : 'F' carries a socket (SCM_RIGHTS), 'E' ends them, 'R' : the new process is ready */
+	struct DaemonHandoverMessage {
+		char type;
+		char name[63];
+	};
+
+	static int _handoverSend(int fd, char type, const char *szName, int passfd)
+	{
+		DaemonHandoverMessage msg;
+		struct msghdr mh;
+		struct iovec iov;
+		char cmsgbuf[CMSG_SPACE(sizeof(int))];
+
+		memset(&msg, 0, sizeof(msg));
+		msg.type = type;
+		if (szName != NULL)
+			strncpy(msg.name, szName, sizeof(msg.name) - 1);
+
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = &msg;
+		iov.iov_len = sizeof(msg);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		if (passfd >= 0)
+		{
+			struct cmsghdr *pcmsg;
+			memset(cmsgbuf, 0, sizeof(cmsgbuf));
+			mh.msg_control = cmsgbuf;
+			mh.msg_controllen = sizeof(cmsgbuf);
+			pcmsg = CMSG_FIRSTHDR(&mh);
+			pcmsg->cmsg_level = SOL_SOCKET;
+			pcmsg->cmsg_type = SCM_RIGHTS;
+			pcmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(pcmsg), &passfd, sizeof(int));
+		}
+
+		while (sendmsg(fd, &mh, MSG_NOSIGNAL) < 0)
+		{
+			if (errno != EINTR)
+				return -errno;
+		}
+		return 1;
+	}
+
+	/*
+	 * @return 1, 0 : closed or timed out, negative errno
+	 * *ppassfd : the socket that came with the message, or -1
+	 */
+	static int _handoverRecv(int fd, int64_t timeoutms, DaemonHandoverMessage *pmsg, int *ppassfd)
+	{
+		struct pollfd pfd;
+		struct msghdr mh;
+		struct iovec iov;
+		struct cmsghdr *pcmsg;
+		char cmsgbuf[CMSG_SPACE(sizeof(int))];
+		ssize_t len;
+		int nrst;
+
+		*ppassfd = -1;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		do {
+			nrst = poll(&pfd, 1, (int)timeoutms);
+		} while ((nrst < 0) && (errno == EINTR));
+		if (nrst < 0)
+			return -errno;
+		if (nrst == 0)
+			return 0;
+
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = pmsg;
+		iov.iov_len = sizeof(*pmsg);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cmsgbuf;
+		mh.msg_controllen = sizeof(cmsgbuf);
+		do {
+			len = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+		} while ((len < 0) && (errno == EINTR));
+		if (len < 0)
+			return -errno;
+
+		for (pcmsg = CMSG_FIRSTHDR(&mh); pcmsg != NULL; pcmsg = CMSG_NXTHDR(&mh, pcmsg))
+		{
+			if ((pcmsg->cmsg_level == SOL_SOCKET) && (pcmsg->cmsg_type == SCM_RIGHTS) && (pcmsg->cmsg_len >= CMSG_LEN(sizeof(int))))
+				memcpy(ppassfd, CMSG_DATA(pcmsg), sizeof(int));
+		}
+
+		if (len == 0)
+			return 0;
+		if (len != sizeof(*pmsg))
+		{
+			if (*ppassfd >= 0)
+				close(*ppassfd);
+			*ppassfd = -1;
+			return -EPROTO;
+		}
+		pmsg->name[sizeof(pmsg->name) - 1] = 0;
+		return 1;
+	}
+
+	/*
+	 * Exec'd by _handover() : take the sockets before the startup handler runs.
+	 */
+	int Daemon::_receiveHandover()
+	{
+		const char *szFd = getenv(_JSCPPUTILS_DAEMON_ENV_HANDOVERFD);
+		const char *szMs = getenv(_JSCPPUTILS_DAEMON_ENV_HANDOVERMS);
+		DaemonHandoverMessage msg;
+		int passfd;
+		int nrst;
+
+		if (szFd == NULL)
+			return 0;
+		m_handoverfd = atoi(szFd);
+		m_handoverstartms = (szMs != NULL) ? atoll(szMs) : _monotonicMs();
+		unsetenv(_JSCPPUTILS_DAEMON_ENV_HANDOVERFD);
+		unsetenv(_JSCPPUTILS_DAEMON_ENV_HANDOVERMS);
+		fcntl(m_handoverfd, F_SETFD, FD_CLOEXEC);
+
+		while ((nrst = _handoverRecv(m_handoverfd, m_conf_handovertimeoutms, &msg, &passfd)) == 1)
+		{
+			if (msg.type == 'E')
+				return 1;
+			if ((msg.type == 'F') && (passfd >= 0))
+			{
+				std::map<std::string, int>::iterator iter = m_inheritedfds.find(msg.name);
+				if (iter != m_inheritedfds.end())
+					close(iter->second);
+				m_inheritedfds[msg.name] = passfd;
+			}else if (passfd >= 0)
+			{
+				close(passfd);
+			}
+		}
+
+		m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: receiving the sockets failed: %d", nrst);
+		for (std::map<std::string, int>::iterator iter = m_inheritedfds.begin(); iter != m_inheritedfds.end(); iter++)
+			close(iter->second);
+		m_inheritedfds.clear();
+		close(m_handoverfd);
+		m_handoverfd = -1;
+		return (nrst < 0) ? nrst : -ETIMEDOUT;
+	}
+
+	/*
+	 * The startup handler succeeded : tell the old process to drain.
+	 * Fails if it gave up meanwhile, and this one must not run next to it.
+	 */
+	int Daemon::_handoverReady()
+	{
+		int nrst;
+
+		if (m_handoverfd < 0)
+			return 0;
+		nrst = _handoverSend(m_handoverfd, 'R', NULL, -1);
+		close(m_handoverfd);
+		m_handoverfd = -1;
+		if (nrst != 1)
+		{
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: the old process gave up: %d", nrst);
+			return nrst;
+		}
+		m_reloadlatencyms = _monotonicMs() - m_handoverstartms;
+		m_plogger->printf(Logger::LOGTYPE_INFO, "graceful restart: %d took over in %lld ms", (int)getpid(), (long long)m_reloadlatencyms);
+		return 1;
+	}
+
+	int Daemon::_startHandoverThread()
+	{
+		pthread_t thread;
+		sigset_t allsigs;
+		sigset_t oldsigs;
+		char strbuf[1024];
+		ssize_t len;
+		int nrst;
+
+		len = readlink("/proc/self/exe", strbuf, sizeof(strbuf) - 1);
+		if (len <= 0)
+		{
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: readlink(/proc/self/exe) failed: %d", errno);
+			return -errno;
+		}
+		strbuf[len] = 0;
+		m_handoverexe = strbuf;
+
+		if (pipe2(m_handoverpipe, O_CLOEXEC) < 0)
+		{
+			nrst = -errno;
+			m_handoverpipe[0] = -1;
+			m_handoverpipe[1] = -1;
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: pipe() failed: %d", -nrst);
+			return nrst;
+		}
+
+		/* signals stay with the main thread (and sigtimedwait() of a master) */
+		sigfillset(&allsigs);
+		pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+		nrst = pthread_create(&thread, NULL, _handoverThreadProc, this);
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		if (nrst != 0)
+		{
+			close(m_handoverpipe[0]);
+			close(m_handoverpipe[1]);
+			m_handoverpipe[0] = -1;
+			m_handoverpipe[1] = -1;
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: pthread_create() failed: %d", nrst);
+			return -nrst;
+		}
+		pthread_detach(thread);
+		return 1;
+	}
+
+	void *Daemon::_handoverThreadProc(void *param)
+	{
+		Daemon *pdaemon = (Daemon*)param;
+		char cmd;
+
+		for (;;)
+		{
+			ssize_t len = read(pdaemon->m_handoverpipe[0], &cmd, 1);
+			int64_t deadline;
+			int64_t now;
+			if ((len < 0) && (errno == EINTR))
+				continue;
+			if (len <= 0)
+				break;
+			if (pdaemon->m_handedover || (pdaemon->m_runstatus.get() != 1))
+				continue;
+			if (pdaemon->_handover() != 1)
+				continue;
+			/* a master drains its workers itself : wake its sigtimedwait() (a SIGCHLD only makes it reap) */
+			if (pdaemon->m_conf_workers != 0)
+			{
+				pthread_kill(pdaemon->m_masterthread, SIGCHLD);
+				continue;
+			}
+
+			deadline = _monotonicMs() + pdaemon->m_conf_draintimeoutms;
+			while ((now = _monotonicMs()) < deadline)
+			{
+				int64_t waitms = deadline - now;
+				usleep((useconds_t)((waitms < 100) ? waitms : 100) * 1000);
+			}
+			pdaemon->m_plogger->printf(Logger::LOGTYPE_WARNING, "graceful restart: %d not drained in %lld ms, exiting", (int)getpid(), (long long)pdaemon->m_conf_draintimeoutms);
+			_exit(1);
+		}
+		return NULL;
+	}
+
+	/*
+	 * Old process : exec the binary again, pass the sockets, and on its ready stop like on SIGTERM.
+	 * @return 1 : handed over
+	 */
+	int Daemon::_handover()
+	{
+		int64_t startms = _monotonicMs();
+		std::map<std::string, int>::iterator iter;
+		std::vector<std::string> envstrs;
+		std::vector<char*> envp;
+		DaemonHandoverMessage msg;
+		char strbuf[64];
+		char **penv;
+		int sv[2];
+		pid_t pid;
+		int passfd;
+		int nrst;
+		size_t i;
+
+		m_plogger->printf(Logger::LOGTYPE_INFO, "graceful restart: %d starting %s", (int)getpid(), m_handoverexe.c_str());
+
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+		{
+			nrst = -errno;
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: socketpair() failed: %d", -nrst);
+			return nrst;
+		}
+
+		/* built before fork() : the child may only make async-signal-safe calls */
+		for (penv = environ; *penv != NULL; penv++)
+		{
+			if ((strncmp(*penv, _JSCPPUTILS_DAEMON_ENV_HANDOVERFD "=", sizeof(_JSCPPUTILS_DAEMON_ENV_HANDOVERFD)) == 0) ||
+				(strncmp(*penv, _JSCPPUTILS_DAEMON_ENV_HANDOVERMS "=", sizeof(_JSCPPUTILS_DAEMON_ENV_HANDOVERMS)) == 0))
+				continue;
+			envstrs.push_back(*penv);
+		}
+		snprintf(strbuf, sizeof(strbuf), "%s=%d", _JSCPPUTILS_DAEMON_ENV_HANDOVERFD, sv[1]);
+		envstrs.push_back(strbuf);
+		snprintf(strbuf, sizeof(strbuf), "%s=%lld", _JSCPPUTILS_DAEMON_ENV_HANDOVERMS, (long long)startms);
+		envstrs.push_back(strbuf);
+		for (i = 0; i < envstrs.size(); i++)
+			envp.push_back((char*)envstrs[i].c_str());
+		envp.push_back(NULL);
+
+		pid = fork();
+		if (pid == 0)
+		{
+			sigprocmask(SIG_SETMASK, &m_mainsigmask, NULL);
+			fcntl(sv[1], F_SETFD, 0);
+			execve(m_handoverexe.c_str(), m_main_argv, &envp[0]);
+			_exit(127);
+		}
+		nrst = errno;
+		close(sv[1]);
+		if (pid < 0)
+		{
+			close(sv[0]);
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: fork() failed: %d", nrst);
+			return -nrst;
+		}
+
+		nrst = 1;
+		for (iter = m_listenfds.begin(); (nrst == 1) && (iter != m_listenfds.end()); iter++)
+			nrst = _handoverSend(sv[0], 'F', iter->first.c_str(), iter->second);
+		if (nrst == 1)
+			nrst = _handoverSend(sv[0], 'E', NULL, -1);
+		if (nrst == 1)
+		{
+			nrst = _handoverRecv(sv[0], m_conf_handovertimeoutms, &msg, &passfd);
+			if (passfd >= 0)
+				close(passfd);
+			if ((nrst == 1) && (msg.type != 'R'))
+				nrst = -EPROTO;
+		}
+		close(sv[0]);
+
+		if (nrst != 1)
+		{
+			m_plogger->printf(Logger::LOGTYPE_ERR, "graceful restart: new process %d did not get ready (%d), %d keeps running", (int)pid, nrst, (int)getpid());
+			kill(pid, SIGKILL);
+			/* a master reaps it with its workers */
+			if (m_conf_workers == 0)
+				waitpid(pid, NULL, 0);
+			return (nrst < 0) ? nrst : -ETIMEDOUT;
+		}
+
+		m_reloadlatencyms = _monotonicMs() - startms;
+		m_handedover = true;
+		m_plogger->printf(Logger::LOGTYPE_INFO, "graceful restart: handed over to %d in %lld ms, %d draining", (int)pid, (long long)m_reloadlatencyms, (int)getpid());
+		m_runstatus.getifset(2, 1);
+		return 1;
+	}
+
+	void Daemon::setGracefulRestart(bool bEnable, int64_t handovertimeoutms, int64_t draintimeoutms)
+	{
+		m_conf_gracefulrestart = bEnable;
+		m_conf_handovertimeoutms = handovertimeoutms;
+		m_conf_draintimeoutms = draintimeoutms;
+	}
+
+	void Daemon::addListenFd(const char *szName, int fd)
+	{
+		m_listenfds[szName] = fd;
+	}
+
+	int Daemon::getInheritedFd(const char *szName)
+	{
+		std::map<std::string, int>::iterator iter = m_inheritedfds.find(szName);
+		int fd;
+		if (iter == m_inheritedfds.end())
+			return -1;
+		fd = iter->second;
+		m_inheritedfds.erase(iter);
+		return fd;
+	}
+
+	int64_t Daemon::getReloadLatencyMs()
+	{
+		return m_reloadlatencyms;
+	}
+
+	void Daemon::setMetricsEndpoint(const char *szEndpoint)
+	{
+		m_conf_metricsendpoint = (szEndpoint != NULL) ? szEndpoint : "";
+	}
+
+	void Daemon::_addMetricSource(const char *szName, const char *szHelp, bool bCounter, const void *psource, int64_t (*fnpeek)(const void *psource))
+	{
+		MetricSource source;
+		const char *p;
+
+		/* [a-zA-Z_:][a-zA-Z0-9_:]* */
+		for (p = szName; *p; p++)
+		{
+			char c = *p;
+			if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_') || (c == ':') || ((p != szName) && (c >= '0') && (c <= '9')))
+				source.name += c;
+			else
+				source.name += '_';
+		}
+		for (p = (szHelp != NULL) ? szHelp : ""; *p; p++)
+		{
+			if (*p == '\\')
+				source.help += "\\\\";
+			else if (*p == '\n')
+				source.help += "\\n";
+			else
+				source.help += *p;
+		}
+		source.counter = bCounter;
+		source.psource = psource;
+		source.fnpeek = fnpeek;
+		m_metricsources.push_back(source);
+	}
+
+	void Daemon::addTimerMetrics(const char *szName, Timer *ptimer)
+	{
+		std::string label;
+		const char *p;
+		for (p = szName; *p; p++)
+		{
+			if ((*p == '\\') || (*p == '"'))
+				label += '\\';
+			if (*p == '\n')
+				label += "\\n";
+			else
+				label += *p;
+		}
+		m_metricstimers.push_back(std::pair<std::string, Timer*>(label, ptimer));
+	}
+
+	/*
+	 * After the startup handler : takes over the socket of a graceful restart, and binds
+	 * before setuid (a privileged port, a root-only directory).
+	 */
+	int Daemon::_openMetrics()
+	{
+		const char *szEndpoint = m_conf_metricsendpoint.c_str();
+		struct sockaddr_storage addr;
+		socklen_t addrlen;
+		int fd;
+		int nrst;
+
+		if (m_conf_metricsendpoint.empty())
+			return 0;
+
+		memset(&addr, 0, sizeof(addr));
+		if (strncmp(szEndpoint, "unix:", 5) == 0)
+		{
+			struct sockaddr_un *paddr = (struct sockaddr_un*)&addr;
+			if (strlen(szEndpoint + 5) >= sizeof(paddr->sun_path))
+			{
+				m_plogger->printf(Logger::LOGTYPE_ERR, "metrics: path too long: %s", szEndpoint);
+				return -ENAMETOOLONG;
+			}
+			paddr->sun_family = AF_UNIX;
+			strcpy(paddr->sun_path, szEndpoint + 5);
+			addrlen = sizeof(struct sockaddr_un);
+		}else
+		{
+			struct sockaddr_in *paddr = (struct sockaddr_in*)&addr;
+			const char *szPort = strrchr(szEndpoint, ':');
+			std::string host = (szPort != NULL) ? std::string(szEndpoint, szPort - szEndpoint) : std::string("127.0.0.1");
+			int port = atoi((szPort != NULL) ? (szPort + 1) : szEndpoint);
+			paddr->sin_family = AF_INET;
+			paddr->sin_port = htons((uint16_t)port);
+			if ((port <= 0) || (port > 65535) || (inet_pton(AF_INET, host.c_str(), &paddr->sin_addr) != 1))
+			{
+				m_plogger->printf(Logger::LOGTYPE_ERR, "metrics: invalid endpoint: %s", szEndpoint);
+				return -EINVAL;
+			}
+			addrlen = sizeof(struct sockaddr_in);
+		}
+
+		fd = getInheritedFd(_JSCPPUTILS_DAEMON_METRICSFD);
+		if (fd < 0)
+		{
+			int one = 1;
+			fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+			{
+				nrst = -errno;
+				m_plogger->printf(Logger::LOGTYPE_ERR, "metrics: socket() failed: %d", -nrst);
+				return nrst;
+			}
+			if (addr.ss_family == AF_UNIX)
+				unlink(((struct sockaddr_un*)&addr)->sun_path);
+			else
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if ((bind(fd, (struct sockaddr*)&addr, addrlen) < 0) || (listen(fd, 16) < 0))
+			{
+				nrst = -errno;
+				close(fd);
+				m_plogger->printf(Logger::LOGTYPE_ERR, "metrics: cannot listen on %s: %d", szEndpoint, -nrst);
+				return nrst;
+			}
+			if ((addr.ss_family == AF_UNIX) && (this->getArgUid() >= 0))
+				chown(((struct sockaddr_un*)&addr)->sun_path, this->getArgUid(), this->getArgGid());
+		}
+		/* after a graceful restart both processes accept on it for a while */
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		m_metricsfd = fd;
+		if (addr.ss_family == AF_UNIX)
+			m_metricspath = ((struct sockaddr_un*)&addr)->sun_path;
+		if (m_conf_gracefulrestart)
+			addListenFd(_JSCPPUTILS_DAEMON_METRICSFD, fd);
+		m_plogger->printf(Logger::LOGTYPE_INFO, "metrics: serving on %s", szEndpoint);
+		return 1;
+	}
+
+	int Daemon::_startMetricsThread()
+	{
+		sigset_t allsigs;
+		sigset_t oldsigs;
+		int nrst;
+
+		if ((m_metricsfd < 0) || m_metricsthreadstarted)
+			return 0;
+
+		if (pipe2(m_metricspipe, O_CLOEXEC) < 0)
+		{
+			nrst = -errno;
+			m_metricspipe[0] = -1;
+			m_metricspipe[1] = -1;
+			m_plogger->printf(Logger::LOGTYPE_ERR, "metrics: pipe() failed: %d", -nrst);
+			return nrst;
+		}
+
+		/* signals stay with the main thread (and sigtimedwait() of a master) */
+		sigfillset(&allsigs);
+		pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+		nrst = pthread_create(&m_metricsthread, NULL, _metricsThreadProc, this);
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		if (nrst != 0)
+		{
+			m_plogger->printf(Logger::LOGTYPE_ERR, "metrics: pthread_create() failed: %d", nrst);
+			return -nrst;
+		}
+		m_metricsthreadstarted = true;
+		return 1;
+	}
+
+	void Daemon::_stopMetrics()
+	{
+		if (m_metricsthreadstarted)
+		{
+			if (write(m_metricspipe[1], "q", 1) == 1)
+				pthread_join(m_metricsthread, NULL);
+			else
+				pthread_detach(m_metricsthread);
+			m_metricsthreadstarted = false;
+		}
+		if (m_metricspipe[0] >= 0)
+		{
+			close(m_metricspipe[0]);
+			close(m_metricspipe[1]);
+			m_metricspipe[0] = -1;
+			m_metricspipe[1] = -1;
+		}
+		if (m_metricsfd >= 0)
+		{
+			close(m_metricsfd);
+			m_metricsfd = -1;
+		}
+		/* the new process serves on it now */
+		if (!m_metricspath.empty() && !m_handedover)
+			unlink(m_metricspath.c_str());
+		m_metricspath.clear();
+	}
+
+	void *Daemon::_metricsThreadProc(void *param)
+	{
+		Daemon *pdaemon = (Daemon*)param;
+
+		for (;;)
+		{
+			struct pollfd pfds[2];
+			int fd;
+			pfds[0].fd = pdaemon->m_metricsfd;
+			pfds[0].events = POLLIN;
+			pfds[0].revents = 0;
+			pfds[1].fd = pdaemon->m_metricspipe[0];
+			pfds[1].events = POLLIN;
+			pfds[1].revents = 0;
+			if (poll(pfds, 2, -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (pfds[1].revents != 0)
+				break;
+			if (pfds[0].revents == 0)
+				continue;
+			if (pdaemon->m_workerindex >= 0)
+			{
+				if (!pdaemon->_answerMetrics())
+					break;
+				continue;
+			}
+			/* EAGAIN : the other process of a graceful restart took it */
+			fd = accept4(pdaemon->m_metricsfd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0)
+				continue;
+			pdaemon->_serveMetrics(fd);
+			close(fd);
+		}
+		return NULL;
+	}
+
+	/*
+	 * One request per connection, one connection at a time : a scraper, not a web server.
+	 */
+	void Daemon::_serveMetrics(int fd)
+	{
+		char reqbuf[2048];
+		char header[256];
+		const char *szStatus = "200 OK";
+		const char *szType = "text/plain; charset=utf-8";
+		std::string body;
+		std::string path;
+		struct timeval tv;
+		size_t len = 0;
+		size_t pos;
+		const char *p;
+
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		reqbuf[0] = 0;
+		while (len < sizeof(reqbuf) - 1)
+		{
+			ssize_t n = recv(fd, &reqbuf[len], sizeof(reqbuf) - 1 - len, 0);
+			if (n <= 0)
+				break;
+			len += n;
+			reqbuf[len] = 0;
+			if ((strstr(reqbuf, "\r\n\r\n") != NULL) || (strstr(reqbuf, "\n\n") != NULL))
+				break;
+		}
+
+		if (strncmp(reqbuf, "GET ", 4) == 0)
+		{
+			for (p = &reqbuf[4]; *p && (*p != ' ') && (*p != '?') && (*p != '\r') && (*p != '\n'); p++)
+				path += *p;
+		}
+		if (path == "/metrics")
+		{
+			szType = "text/plain; version=0.0.4; charset=utf-8";
+			_writeMetrics(body);
+		}else if (path == "/health")
+		{
+			if (m_runstatus.peek() == 1)
+			{
+				body = "ok\n";
+			}else
+			{
+				szStatus = "503 Service Unavailable";
+				body = "stopping\n";
+			}
+		}else if (len == 0)
+		{
+			return;
+		}else if (strncmp(reqbuf, "GET ", 4) != 0)
+		{
+			szStatus = "405 Method Not Allowed";
+			body = "GET only\n";
+		}else
+		{
+			szStatus = "404 Not Found";
+			body = "/metrics or /health\n";
+		}
+
+		snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", szStatus, szType, (int)body.size());
+		body.insert(0, header);
+		for (pos = 0; pos < body.size(); )
+		{
+			ssize_t n = send(fd, body.data() + pos, body.size() - pos, MSG_NOSIGNAL);
+			if (n <= 0)
+				break;
+			pos += n;
+		}
+	}
+
+	struct DaemonProcStat {
+		/* the series label, "" : this process */
+		std::string label;
+		double cpuseconds;
+		int64_t rssbytes;
+		int64_t vsizebytes;
+		int64_t threads;
+		int64_t fds;
+	};
+
+	/*
+	 * /proc/<pid>/stat and /proc/<pid>/fd; pid 0 : this process
+	 */
+	static bool _readProcStat(pid_t pid, DaemonProcStat *pstat)
+	{
+		char path[64];
+		char buf[1024];
+		const char *p;
+		unsigned long long utime = 0;
+		unsigned long long stime = 0;
+		unsigned long long vsize = 0;
+		long long threads = 0;
+		long long rss = 0;
+		long ticks = sysconf(_SC_CLK_TCK);
+		long pagesize = sysconf(_SC_PAGESIZE);
+		ssize_t len;
+		DIR *pdir;
+		int fd;
+
+		if (pid > 0)
+			snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+		else
+			snprintf(path, sizeof(path), "/proc/self/stat");
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		len = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (len <= 0)
+			return false;
+		buf[len] = 0;
+
+		/* the command name may contain anything : the fields start after its last ')' */
+		p = strrchr(buf, ')');
+		if ((p == NULL) || (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %lld %*d %*u %llu %lld",
+			&utime, &stime, &threads, &vsize, &rss) != 5))
+			return false;
+		pstat->cpuseconds = (double)(utime + stime) / (double)((ticks > 0) ? ticks : 100);
+		pstat->rssbytes = (int64_t)rss * pagesize;
+		pstat->vsizebytes = (int64_t)vsize;
+		pstat->threads = threads;
+
+		pstat->fds = 0;
+		if (pid > 0)
+			snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+		else
+			snprintf(path, sizeof(path), "/proc/self/fd");
+		pdir = opendir(path);
+		if (pdir != NULL)
+		{
+			struct dirent *pent;
+			while ((pent = readdir(pdir)) != NULL)
+			{
+				if (pent->d_name[0] != '.')
+					pstat->fds++;
+			}
+			closedir(pdir);
+			/* the one reading it */
+			if (pid <= 0)
+				pstat->fds--;
+		}
+		return true;
+	}
+
+	static void _metricsAppend(std::string &out, const char *format, ...)
+	{
+		char buf[512];
+		va_list args;
+		int len;
+		va_start(args, format);
+		len = vsnprintf(buf, sizeof(buf), format, args);
+		va_end(args);
+		if (len > 0)
+			out.append(buf, ((size_t)len < sizeof(buf)) ? (size_t)len : (sizeof(buf) - 1));
+	}
+
+	static void _metricsFamily(std::string &out, const char *szName, const char *szType, const char *szHelp)
+	{
+		if (*szHelp)
+			_metricsAppend(out, "# HELP %s %s\n", szName, szHelp);
+		_metricsAppend(out, "# TYPE %s %s\n", szName, szType);
+	}
+
+	struct DaemonMetricFamily {
+		std::string name;
+		/* # HELP and # TYPE lines */
+		std::string header;
+		std::string samples;
+	};
+
+	/*
+	 * Adds the samples of text (exposition format) to their families, with the label worker="N" unless worker < 0.
+	 */
+	static void _metricsMerge(std::vector<DaemonMetricFamily> &families, const std::string &text, int worker)
+	{
+		std::string help;
+		char label[32];
+		size_t current = families.size();
+		size_t pos = 0;
+
+		snprintf(label, sizeof(label), "worker=\"%d\"", worker);
+		while (pos < text.size())
+		{
+			size_t end = text.find('\n', pos);
+			std::string line;
+			if (end == std::string::npos)
+				end = text.size();
+			line = text.substr(pos, end - pos);
+			pos = end + 1;
+
+			if (line.compare(0, 7, "# HELP ") == 0)
+			{
+				help = line;
+				continue;
+			}
+			if (line.compare(0, 7, "# TYPE ") == 0)
+			{
+				std::string name = line.substr(7, line.find(' ', 7) - 7);
+				for (current = 0; current < families.size(); current++)
+				{
+					if (families[current].name == name)
+						break;
+				}
+				if (current == families.size())
+				{
+					DaemonMetricFamily family;
+					family.name = name;
+					if (help.compare(0, 7 + name.size() + 1, "# HELP " + name + " ") == 0)
+						family.header = help + "\n";
+					family.header += line + "\n";
+					families.push_back(family);
+				}
+				help.clear();
+				continue;
+			}
+			if (line.empty() || (line[0] == '#') || (current >= families.size()))
+				continue;
+
+			if (worker >= 0)
+			{
+				size_t brace = line.find('{');
+				size_t space = line.find(' ');
+				if (space == std::string::npos)
+					continue;
+				if ((brace != std::string::npos) && (brace < space))
+					line.insert(brace + 1, std::string(label) + ",");
+				else
+					line.insert(space, std::string("{") + label + "}");
+			}
+			families[current].samples += line;
+			families[current].samples += '\n';
+		}
+	}
+
+	/*
+	 * Only lock-free reads : AtomicNum::peek(), Timer::getLag(), Logger's counters, /proc.
+	 * The workers answer on their own threads (_answerMetrics()).
+	 */
+	void Daemon::_writeMetrics(std::string &out)
+	{
+		std::vector<DaemonProcStat> procs;
+		std::vector<DaemonMetricFamily> families;
+		std::vector<std::string> texts;
+		std::string local;
+		DaemonProcStat stat;
+		int workers = 0;
+		size_t i;
+
+		stat.label = "";
+		if (_readProcStat(0, &stat))
+			procs.push_back(stat);
+		for (i = 0; i < m_workers.size(); i++)
+		{
+			pid_t pid = __atomic_load_n(&m_workers[i].pid, __ATOMIC_RELAXED);
+			char label[32];
+			if (pid <= 0)
+				continue;
+			workers++;
+			snprintf(label, sizeof(label), "{worker=\"%d\"}", (int)i);
+			stat.label = label;
+			if (_readProcStat(pid, &stat))
+				procs.push_back(stat);
+		}
+
+		_metricsFamily(out, "process_cpu_seconds_total", "counter", "Total user and system CPU time spent in seconds.");
+		for (i = 0; i < procs.size(); i++)
+			_metricsAppend(out, "process_cpu_seconds_total%s %.2f\n", procs[i].label.c_str(), procs[i].cpuseconds);
+		_metricsFamily(out, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+		for (i = 0; i < procs.size(); i++)
+			_metricsAppend(out, "process_resident_memory_bytes%s %lld\n", procs[i].label.c_str(), (long long)procs[i].rssbytes);
+		_metricsFamily(out, "process_virtual_memory_bytes", "gauge", "Virtual memory size in bytes.");
+		for (i = 0; i < procs.size(); i++)
+			_metricsAppend(out, "process_virtual_memory_bytes%s %lld\n", procs[i].label.c_str(), (long long)procs[i].vsizebytes);
+		_metricsFamily(out, "process_threads", "gauge", "Number of OS threads.");
+		for (i = 0; i < procs.size(); i++)
+			_metricsAppend(out, "process_threads%s %lld\n", procs[i].label.c_str(), (long long)procs[i].threads);
+		_metricsFamily(out, "process_open_fds", "gauge", "Number of open file descriptors.");
+		for (i = 0; i < procs.size(); i++)
+			_metricsAppend(out, "process_open_fds%s %lld\n", procs[i].label.c_str(), (long long)procs[i].fds);
+
+		_metricsFamily(out, "daemon_run_status", "gauge", "0 : starting, 1 : running, 2 : stopping.");
+		_metricsAppend(out, "daemon_run_status %d\n", m_runstatus.peek());
+		if (m_reloadlatencyms >= 0)
+		{
+			_metricsFamily(out, "daemon_reload_latency_seconds", "gauge", "Graceful restart, from SIGUSR2 until the new process was ready.");
+			_metricsAppend(out, "daemon_reload_latency_seconds %.3f\n", (double)m_reloadlatencyms / 1000.0);
+		}
+		if (!m_workers.empty())
+		{
+			_metricsFamily(out, "daemon_workers", "gauge", "Worker processes running.");
+			_metricsAppend(out, "daemon_workers %d\n", workers);
+			_metricsFamily(out, "daemon_worker_restarts_total", "counter", "Worker processes started again after they exited.");
+			for (i = 0; i < m_workers.size(); i++)
+				_metricsAppend(out, "daemon_worker_restarts_total{worker=\"%d\"} %d\n", (int)i, __atomic_load_n(&m_workers[i].restarts, __ATOMIC_RELAXED));
+		}
+
+		_writeLocalMetrics(local);
+		if (m_workers.empty())
+		{
+			out += local;
+			return;
+		}
+		/* the same families from every worker : their samples go under the master's, labelled */
+		_scrapeWorkers(texts);
+		_metricsMerge(families, local, -1);
+		for (i = 0; i < texts.size(); i++)
+		{
+			if (!texts[i].empty())
+				_metricsMerge(families, texts[i], (int)i);
+		}
+		for (i = 0; i < families.size(); i++)
+		{
+			out += families[i].header;
+			out += families[i].samples;
+		}
+	}
+
+	/*
+	 * The series of this process only : Logger, timers and addMetric() sources.
+	 */
+	void Daemon::_writeLocalMetrics(std::string &out)
+	{
+		size_t i;
+
+		if (m_plogger != NULL)
+		{
+			_metricsFamily(out, "logger_async_dropped_total", "counter", "Log records discarded because the async ring was full.");
+			_metricsAppend(out, "logger_async_dropped_total %lld\n", (long long)m_plogger->getAsyncDropped());
+			_metricsFamily(out, "logger_suppressed_total", "counter", "Log records dropped by rate limiting or coalescing.");
+			_metricsAppend(out, "logger_suppressed_total %lld\n", (long long)m_plogger->getSuppressedCount());
+		}
+
+		if (!m_metricstimers.empty())
+		{
+			std::vector<int64_t> lags(m_metricstimers.size() * 4);
+			for (i = 0; i < m_metricstimers.size(); i++)
+				m_metricstimers[i].second->getLag(&lags[i * 4], &lags[i * 4 + 1], &lags[i * 4 + 2], &lags[i * 4 + 3]);
+			_metricsFamily(out, "timer_lag_seconds", "summary", "How late periodic timer tasks started.");
+			for (i = 0; i < m_metricstimers.size(); i++)
+			{
+				_metricsAppend(out, "timer_lag_seconds_sum{timer=\"%s\"} %.3f\n", m_metricstimers[i].first.c_str(), (double)lags[i * 4 + 2] / 1000.0);
+				_metricsAppend(out, "timer_lag_seconds_count{timer=\"%s\"} %lld\n", m_metricstimers[i].first.c_str(), (long long)lags[i * 4 + 3]);
+			}
+			_metricsFamily(out, "timer_lag_last_seconds", "gauge", "Lag of the latest periodic timer run.");
+			for (i = 0; i < m_metricstimers.size(); i++)
+				_metricsAppend(out, "timer_lag_last_seconds{timer=\"%s\"} %.3f\n", m_metricstimers[i].first.c_str(), (double)lags[i * 4] / 1000.0);
+			_metricsFamily(out, "timer_lag_max_seconds", "gauge", "Largest lag of a periodic timer run.");
+			for (i = 0; i < m_metricstimers.size(); i++)
+				_metricsAppend(out, "timer_lag_max_seconds{timer=\"%s\"} %.3f\n", m_metricstimers[i].first.c_str(), (double)lags[i * 4 + 1] / 1000.0);
+		}
+
+		for (i = 0; i < m_metricsources.size(); i++)
+		{
+			const MetricSource &source = m_metricsources[i];
+			_metricsFamily(out, source.name.c_str(), source.counter ? "counter" : "gauge", source.help.c_str());
+			_metricsAppend(out, "%s %lld\n", source.name.c_str(), (long long)source.fnpeek(source.psource));
+		}
+	}
+
+	/*
+	 * Master : asks every running worker at once and waits up to a second for the answers.
+	 * texts[i] : the series of worker i, empty if it did not answer in time.
+	 */
+	void Daemon::_scrapeWorkers(std::vector<std::string> &texts)
+	{
+		std::vector<struct pollfd> pfds;
+		std::vector<size_t> slots;
+		std::vector<char> buf(256 * 1024);
+		uint64_t seq = ++m_metricsseq;
+		int64_t deadline = _monotonicMs() + 1000;
+		size_t pending;
+		size_t i;
+
+		texts.assign(m_workers.size(), std::string());
+		for (i = 0; i < m_workers.size(); i++)
+		{
+			struct pollfd pfd;
+			int fd = m_workers[i].metricsfds[0];
+			if ((fd < 0) || (__atomic_load_n(&m_workers[i].pid, __ATOMIC_RELAXED) <= 0))
+				continue;
+			if (send(fd, &seq, sizeof(seq), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)sizeof(seq))
+				continue;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			pfds.push_back(pfd);
+			slots.push_back(i);
+		}
+
+		pending = pfds.size();
+		while (pending > 0)
+		{
+			int64_t waitms = deadline - _monotonicMs();
+			if (waitms <= 0)
+				break;
+			if (poll(&pfds[0], pfds.size(), (int)waitms) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			for (i = 0; i < pfds.size(); i++)
+			{
+				uint64_t answerseq;
+				ssize_t n;
+				if ((pfds[i].fd < 0) || (pfds[i].revents == 0))
+					continue;
+				/* MSG_TRUNC : the full length, so an answer larger than buf is told apart */
+				n = recv(pfds[i].fd, &buf[0], buf.size(), MSG_DONTWAIT | MSG_TRUNC);
+				if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+					continue;
+				if ((n >= (ssize_t)sizeof(answerseq)) && ((size_t)n <= buf.size()))
+				{
+					memcpy(&answerseq, &buf[0], sizeof(answerseq));
+					/* the answer to an earlier scrape that timed out */
+					if (answerseq != seq)
+						continue;
+					texts[slots[i]].assign(&buf[sizeof(answerseq)], n - sizeof(answerseq));
+				}
+				pfds[i].fd = -1;
+				pending--;
+			}
+		}
+	}
+
+	/*
+	 * Worker : one request of the master on the channel.
+	 * @return false once the master is gone
+	 */
+	bool Daemon::_answerMetrics()
+	{
+		std::string out;
+		uint64_t seq;
+		ssize_t n = recv(m_metricsfd, &seq, sizeof(seq), MSG_DONTWAIT);
+		if (n == 0)
+			return false;
+		if (n != (ssize_t)sizeof(seq))
+			return (n > 0) || (errno == EAGAIN) || (errno == EINTR);
+		out.assign((const char*)&seq, sizeof(seq));
+		_writeLocalMetrics(out);
+		/* never blocks : a master that stopped reading must not hold up _stopMetrics() */
+		send(m_metricsfd, out.data(), out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+		return true;
+	}
+
 	int Daemon::checkArg(const char *arg, const char *prefix)
 	{
 		char prefixbuf[64];
@@ -468,9 +1960,19 @@ namespace JsCPPUtils {
 			m_instance->m_runstatus.getifset(2, 1);
 			break;
 		case SIGHUP:
+			if(m_instance->m_plogger != NULL)
+				m_instance->m_plogger->requestReopen();
 			if(m_instance->m_reloadhandler != NULL)
 				m_instance->m_reloadhandler(m_instance, m_instance->m_cbparam);
 			break;
+		case SIGUSR2:
+			/* the handover thread does the work */
+			if (m_instance->m_handoverpipe[1] >= 0)
+			{
+				ssize_t wlen = write(m_instance->m_handoverpipe[1], "r", 1);
+				(void)wlen;
+			}
+			break;
 		}
 	}
 
@@ -849,6 +2351,11 @@ namespace JsCPPUtils {
 		printf("\t--pidfile FILEPATH\n");
 		printf("\t--user USERNAME\n");
 		printf("\t--logfile LOGFILE\n");
+#if defined(JSCUTILS_OS_LINUX)
+		printf("\t--workers N : prefork N worker processes (-1 : one per core)\n");
+		printf("\t--pin-cpu : pin each worker to its own core\n");
+		printf("\t--metrics ENDPOINT : serve /metrics and /health over HTTP (unix:PATH or [HOST:]PORT)\n");
+#endif
 		printf("\t--help\n");
 		if (m_helphandler != NULL)
 			m_helphandler(this, m_cbparam);
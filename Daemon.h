@@ -26,6 +26,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <errno.h>
+#include <pthread.h>
 
 #define _JSCPPUTILS_DAEMON_DEFCHARTYPE char
 #define _JSCPPUTILS_DAEMON_DEFCHARTYPE_T(T) T
@@ -41,9 +42,11 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace JsCPPUtils
 {
+	class Timer;
 
 	class Daemon
 	{
@@ -104,6 +107,101 @@ namespace JsCPPUtils
 		int m_args_uid;
 		int m_args_gid;
 
+#if defined(JSCUTILS_OS_LINUX)
+		struct WorkerProcess {
+			/* 0 : not running */
+			pid_t pid;
+			/* pinned to, or -1 */
+			int cpu;
+			int64_t startedms;
+			/* when to fork it again after it exited */
+			int64_t respawnat;
+			int64_t backoffms;
+			int restarts;
+			/* metrics channel (SOCK_SEQPACKET) : [0] the master's end, [1] the worker's; kept across respawns */
+			int metricsfds[2];
+		};
+
+		/* setWorkers() : 0 : no prefork, < 0 : one per physical core */
+		int m_conf_workers;
+		bool m_conf_workerpincpu;
+		int64_t m_conf_workerstoptimeoutms;
+		/* master only */
+		std::vector<WorkerProcess> m_workers;
+		/* -1 : the master, or no prefork */
+		int m_workerindex;
+		/* the mask main() was entered with : for the workers and the exec'd process of a graceful restart */
+		sigset_t m_mainsigmask;
+		/* the thread in _runMaster()'s sigtimedwait() */
+		pthread_t m_masterthread;
+
+		/* graceful restart (SIGUSR2) */
+		bool m_conf_gracefulrestart;
+		int64_t m_conf_handovertimeoutms;
+		int64_t m_conf_draintimeoutms;
+		std::map<std::string, int> m_listenfds;
+		/* from the replaced process; getInheritedFd() takes them out */
+		std::map<std::string, int> m_inheritedfds;
+		/* to the replaced process, until _handoverReady() */
+		int m_handoverfd;
+		int64_t m_handoverstartms;
+		int64_t m_reloadlatencyms;
+		volatile bool m_handedover;
+		/* SIGUSR2 -> the handover thread */
+		int m_handoverpipe[2];
+		/* resolved at startup : /proc/self/exe would still be the old binary once it is replaced on disk */
+		std::string m_handoverexe;
+
+		int _receiveHandover();
+		int _handoverReady();
+		int _startHandoverThread();
+		int _handover();
+		static void *_handoverThreadProc(void *param);
+
+		/* metrics endpoint (--metrics) : registered before it starts, then only read */
+		struct MetricSource {
+			std::string name;
+			std::string help;
+			bool counter;
+			const void *psource;
+			int64_t (*fnpeek)(const void *psource);
+		};
+		std::string m_conf_metricsendpoint;
+		std::vector<MetricSource> m_metricsources;
+		std::vector< std::pair<std::string, Timer*> > m_metricstimers;
+		int m_metricsfd;
+		/* unix: endpoint, removed on exit unless handed over */
+		std::string m_metricspath;
+		int m_metricspipe[2];
+		pthread_t m_metricsthread;
+		bool m_metricsthreadstarted;
+		/* master : tells the answers of one scrape of the workers from late ones */
+		uint64_t m_metricsseq;
+
+		template<typename T>
+		static int64_t _peekAtomicNum(const void *psource) {
+			return (int64_t)((const AtomicNum<T>*)psource)->peek();
+		}
+		void _addMetricSource(const char *szName, const char *szHelp, bool bCounter, const void *psource, int64_t (*fnpeek)(const void *psource));
+		int _openMetrics();
+		int _startMetricsThread();
+		void _stopMetrics();
+		static void *_metricsThreadProc(void *param);
+		void _serveMetrics(int fd);
+		void _writeMetrics(std::string &out);
+		void _writeLocalMetrics(std::string &out);
+		void _scrapeWorkers(std::vector<std::string> &texts);
+		bool _answerMetrics();
+
+		void _masterSignals(sigset_t *psigs);
+		int _runMaster(int argc, char *argv[]);
+		pid_t _spawnWorker(int index);
+		int _runWorker(int index, int cpu, int metricsfd, int argc, char *argv[]);
+		void _reapWorkers();
+		void _signalWorkers(int sig);
+		static int64_t _monotonicMs();
+#endif
+
 		int checkArg(const _JSCPPUTILS_DAEMON_DEFCHARTYPE *arg, const _JSCPPUTILS_DAEMON_DEFCHARTYPE *prefix);
 		
 		static int findBars(const _JSCPPUTILS_DAEMON_DEFCHARTYPE *str);
@@ -161,6 +259,82 @@ namespace JsCPPUtils
 		int getArgUid();
 		int getArgGid();
 
+#if defined(JSCUTILS_OS_LINUX)
+		/**
+		 * Prefork (call before main()) : main() runs the startup handler once in this process, the master,
+		 * then forks numofworkers worker processes (< 0 : one per physical core) that each run the main handler,
+		 * and supervises them until SIGINT/SIGTERM : a worker that exits is forked again (after a growing delay
+		 * when it keeps dying right after start). SIGTERM and SIGHUP are passed on to the workers; the sig and
+		 * reload handlers run in the master as well as in the workers.
+		 * bPinCpu : worker i is pinned to the i-th physical core (NumaTopology::layoutOnePerCore()).
+		 * --workers N and --pin-cpu on the command line override these.
+		 * Whatever the startup handler opens (e.g. listening sockets) is inherited by the workers, but its
+		 * threads are not : start threads and engines in the main handler. getLogger() is the exception,
+		 * its async mode (Logger::startAsync()) is started again in every worker (Logger::forkChild()).
+		 * In a worker main() returns the main handler's result; in the master 0 once every worker has exited.
+		 */
+		void setWorkers(int numofworkers, bool bPinCpu = false);
+		/**
+		 * How long the master waits for the workers after passing on SIGTERM before it sends SIGKILL.
+		 */
+		void setWorkerStopTimeout(int64_t timeoutms);
+		/**
+		 * 0 .. numofworkers - 1 in a worker, -1 in the master or without prefork.
+		 */
+		int getWorkerIndex();
+
+		/**
+		 * Graceful restart : on SIGUSR2 this process (the master, in prefork mode) execs its own binary again
+		 * with the same arguments and passes the sockets of addListenFd() to it over a Unix socket.
+		 * Once the new process has run its startup handler and reports ready, this one gets a stop request
+		 * (getRunStatus() == 2) while the new one already accepts on the same sockets, so no connection is
+		 * refused : close them, finish what is in flight and return from the main handler within
+		 * draintimeoutms, or the process is ended (prefork : the workers get SIGTERM, SIGKILL at the deadline).
+		 * A new process that fails or does not report ready within handovertimeoutms is killed and this one keeps running.
+		 * Must be called before main().
+		 */
+		void setGracefulRestart(bool bEnable, int64_t handovertimeoutms = 30000, int64_t draintimeoutms = 30000);
+		/**
+		 * From the startup handler : a listening socket to pass on at a graceful restart (szName : up to 62 characters).
+		 * For a JsServerSocket : JsServerSocket::createListenFds() on a cold start, and listen(const std::vector<int>&)
+		 * on these sockets from the main handler.
+		 */
+		void addListenFd(const char *szName, int fd);
+		/**
+		 * From the startup handler : the socket the replaced process registered as szName, to use instead of
+		 * binding again (and to addListenFd() for the next restart). -1 : none, e.g. on a cold start.
+		 * Sockets the startup handler did not take are closed after it returns.
+		 */
+		int getInheritedFd(const char *szName);
+		/**
+		 * Milliseconds from SIGUSR2 until the new process reported ready, known to both processes. -1 : not restarted.
+		 */
+		int64_t getReloadLatencyMs();
+
+		/**
+		 * Serves HTTP on szEndpoint, "unix:/path/to.sock" or "[host:]port" (host : 127.0.0.1 by default) :
+		 * GET /metrics : Prometheus text format; process CPU, memory, threads and fds, Logger drops, Timer lag
+		 *                and addMetric() values. In prefork mode the master serves : it asks every worker for its
+		 *                own series and adds them with the label worker="N", next to its own unlabelled ones.
+		 * GET /health  : 200 while running, 503 once stopping.
+		 * Nothing it reads takes an application lock. Also set by --metrics ENDPOINT. Must be called before main().
+		 */
+		void setMetricsEndpoint(const char *szEndpoint);
+		/**
+		 * Publish pnum as szName (invalid characters become '_'). Read with AtomicNum::peek().
+		 * Register before main() or from the startup handler, and keep pnum alive until main() returns.
+		 * In prefork mode every worker publishes its own values too, labelled worker="N" (see setMetricsEndpoint()).
+		 */
+		template<typename T>
+		void addMetric(const char *szName, AtomicNum<T> *pnum, const char *szHelp = NULL, bool bCounter = true) {
+			_addMetricSource(szName, szHelp, bCounter, pnum, _peekAtomicNum<T>);
+		}
+		/**
+		 * Publish the lag of ptimer (Timer::getLag()) with the label timer="szName".
+		 */
+		void addTimerMetrics(const char *szName, Timer *ptimer);
+#endif
+
 		
 #if defined(JSCUTILS_OS_WINDOWS)
 		static void sysDebugPrintf(const char *format, ...);
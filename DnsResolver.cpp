@@ -0,0 +1,543 @@
+/**
+ * @file	DnsResolver.cpp
+ * @class	DnsResolver
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/27
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "DnsResolver.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+namespace JsCPPUtils
+{
+	DnsResolver::DnsResolver(int numofthreads)
+	{
+		int i;
+
+		pthread_mutex_init(&m_mutex, NULL);
+		pthread_cond_init(&m_cond, NULL);
+		pthread_cond_init(&m_donecond, NULL);
+		m_stopping = false;
+		m_nextid = 0;
+		m_conf_maxentries = 4096;
+		m_conf_defaultttlms = 60000;
+		m_conf_minttlms = 1000;
+		m_conf_maxttlms = 3600000;
+		m_conf_negativettlms = 5000;
+		m_conf_ttlprobe = true;
+
+		if(numofthreads <= 0)
+			numofthreads = 1;
+		m_calling.resize(numofthreads, 0);
+		for(i = 0; i < numofthreads; i++)
+		{
+			JsCPPUtils::SmartPointer<WorkerThread> spthread = new WorkerThread();
+			spthread->presolver = this;
+			m_threads.push_back(spthread);
+			spthread->start(i, NULL, NULL, "DnsResolver");
+		}
+	}
+
+	DnsResolver::~DnsResolver()
+	{
+		std::list<Query*> queued;
+		std::list<Query*>::iterator iterQuery;
+		std::list<Waiter>::iterator iterWaiter;
+		Result result;
+		size_t i;
+
+		pthread_mutex_lock(&m_mutex);
+		m_stopping = true;
+		/* the running ones are answered by their threads before they exit */
+		queued.swap(m_queue);
+		for(iterQuery = queued.begin(); iterQuery != queued.end(); iterQuery++)
+			m_queries.erase(_key((*iterQuery)->host.c_str(), (*iterQuery)->family, (*iterQuery)->socktype));
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+
+		result.result = -ECANCELED;
+		result.cached = false;
+		result.resolve_us = 0;
+		for(iterQuery = queued.begin(); iterQuery != queued.end(); iterQuery++)
+		{
+			for(iterWaiter = (*iterQuery)->waiters.begin(); iterWaiter != (*iterQuery)->waiters.end(); iterWaiter++)
+				iterWaiter->handler(this, iterWaiter->param1, iterWaiter->param2, result);
+			delete *iterQuery;
+		}
+
+		for(i = 0; i < m_threads.size(); i++)
+			m_threads[i]->join();
+		m_threads.clear();
+
+		pthread_cond_destroy(&m_donecond);
+		pthread_cond_destroy(&m_cond);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	void DnsResolver::setTtl(int64_t defaultttlms, int64_t minttlms, int64_t maxttlms, int64_t negativettlms)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_conf_defaultttlms = defaultttlms;
+		m_conf_minttlms = minttlms;
+		m_conf_maxttlms = (maxttlms >= minttlms) ? maxttlms : minttlms;
+		m_conf_negativettlms = negativettlms;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	void DnsResolver::setTtlProbe(bool enabled)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_conf_ttlprobe = enabled;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	void DnsResolver::setMaxEntries(int maxentries)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_conf_maxentries = (maxentries > 0) ? maxentries : 0;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	void DnsResolver::clearCache()
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_cache.clear();
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	int64_t DnsResolver::_nowMs()
+	{
+		return Common::getTickCount();
+	}
+
+	std::string DnsResolver::_key(const char *szHost, int family, int socktype)
+	{
+		char szSuffix[32];
+		std::string key(szHost);
+		snprintf(szSuffix, sizeof(szSuffix), "|%d|%d", family, socktype);
+		key.append(szSuffix);
+		return key;
+	}
+
+	void DnsResolver::_setPort(std::vector<Address> &addrs, uint16_t port)
+	{
+		size_t i;
+		for(i = 0; i < addrs.size(); i++)
+		{
+			if(addrs[i].addr.ss_family == AF_INET)
+				((struct sockaddr_in*)&addrs[i].addr)->sin_port = htons(port);
+			else if(addrs[i].addr.ss_family == AF_INET6)
+				((struct sockaddr_in6*)&addrs[i].addr)->sin6_port = htons(port);
+		}
+	}
+
+	/*
+	 * Keeps getaddrinfo()'s preference within each family and alternates the families,
+	 * starting with the one it preferred, so a dead family costs one attempt delay only.
+	 */
+	void DnsResolver::_interleave(std::vector<Address> &addrs)
+	{
+		std::vector<Address> first;
+		std::vector<Address> second;
+		std::vector<Address> merged;
+		size_t i;
+
+		if(addrs.size() < 2)
+			return;
+		for(i = 0; i < addrs.size(); i++)
+		{
+			if(addrs[i].addr.ss_family == addrs[0].addr.ss_family)
+				first.push_back(addrs[i]);
+			else
+				second.push_back(addrs[i]);
+		}
+		for(i = 0; (i < first.size()) || (i < second.size()); i++)
+		{
+			if(i < first.size())
+				merged.push_back(first[i]);
+			if(i < second.size())
+				merged.push_back(second[i]);
+		}
+		addrs.swap(merged);
+	}
+
+	/*
+	 * The smallest TTL of the answer section (CNAMEs included), in milliseconds, or -1.
+	 */
+	int64_t DnsResolver::_probeTtl(void *pres, const char *szHost, int family)
+	{
+		unsigned char buf[2048];
+		int len;
+		int pos;
+		int skip;
+		int qdcount;
+		int ancount;
+		int i;
+		int64_t minttl = -1;
+
+		len = res_nquery((res_state)pres, szHost, ns_c_in, (family == AF_INET6) ? ns_t_aaaa : ns_t_a, buf, sizeof(buf));
+		if((len < NS_HFIXEDSZ) || (len > (int)sizeof(buf)))
+			return -1;
+
+		/* parsed by hand : ns_initparse() lives in libresolv, res_nquery() is in libc since glibc 2.34 */
+		qdcount = (buf[4] << 8) | buf[5];
+		ancount = (buf[6] << 8) | buf[7];
+		pos = NS_HFIXEDSZ;
+		for(i = 0; i < qdcount; i++)
+		{
+			if((skip = dn_skipname(buf + pos, buf + len)) < 0)
+				return -1;
+			pos += skip + NS_QFIXEDSZ;
+			if(pos > len)
+				return -1;
+		}
+		for(i = 0; i < ancount; i++)
+		{
+			uint32_t ttl;
+			int rdlen;
+			if((skip = dn_skipname(buf + pos, buf + len)) < 0)
+				return -1;
+			pos += skip;
+			if(pos + NS_RRFIXEDSZ > len)
+				return -1;
+			/* type(2) class(2) ttl(4) rdlength(2) */
+			ttl = ((uint32_t)buf[pos + 4] << 24) | ((uint32_t)buf[pos + 5] << 16) | ((uint32_t)buf[pos + 6] << 8) | (uint32_t)buf[pos + 7];
+			rdlen = (buf[pos + 8] << 8) | buf[pos + 9];
+			pos += NS_RRFIXEDSZ + rdlen;
+			if(pos > len)
+				return -1;
+			if((minttl < 0) || ((int64_t)ttl * 1000 < minttl))
+				minttl = (int64_t)ttl * 1000;
+		}
+		return minttl;
+	}
+
+	int DnsResolver::lookup(const char *szHost, uint16_t port, int family, int socktype, Result *presult)
+	{
+		std::map<std::string, CacheEntry>::iterator iter;
+		Address address;
+		int retval = 0;
+
+		memset(&address, 0, sizeof(address));
+		if(((family == AF_UNSPEC) || (family == AF_INET)) &&
+			(inet_pton(AF_INET, szHost, &((struct sockaddr_in*)&address.addr)->sin_addr) == 1))
+		{
+			address.addr.ss_family = AF_INET;
+			address.addrlen = sizeof(struct sockaddr_in);
+		}else if(((family == AF_UNSPEC) || (family == AF_INET6)) &&
+			(inet_pton(AF_INET6, szHost, &((struct sockaddr_in6*)&address.addr)->sin6_addr) == 1))
+		{
+			address.addr.ss_family = AF_INET6;
+			address.addrlen = sizeof(struct sockaddr_in6);
+		}
+		if(address.addrlen > 0)
+		{
+			presult->result = 1;
+			presult->addrs.assign(1, address);
+			presult->cached = false;
+			presult->resolve_us = 0;
+			_setPort(presult->addrs, port);
+			return 1;
+		}
+
+		pthread_mutex_lock(&m_mutex);
+		iter = m_cache.find(_key(szHost, family, socktype));
+		if(iter != m_cache.end())
+		{
+			if(iter->second.expires > _nowMs())
+			{
+				presult->result = iter->second.result;
+				presult->addrs = iter->second.addrs;
+				presult->cached = true;
+				presult->resolve_us = iter->second.resolve_us;
+				_setPort(presult->addrs, port);
+				retval = iter->second.result;
+			}else{
+				m_cache.erase(iter);
+			}
+		}
+		pthread_mutex_unlock(&m_mutex);
+		return retval;
+	}
+
+	int64_t DnsResolver::resolve(const char *szHost, uint16_t port, int family, int socktype, ResolveHandler_t handler, void *param1, void *param2)
+	{
+		std::map<std::string, Query*>::iterator iter;
+		std::string key = _key(szHost, family, socktype);
+		Query *pquery;
+		Waiter waiter;
+
+		if((szHost == NULL) || (handler == NULL))
+			return -EINVAL;
+
+		waiter.port = port;
+		waiter.handler = handler;
+		waiter.param1 = param1;
+		waiter.param2 = param2;
+
+		pthread_mutex_lock(&m_mutex);
+		if(m_stopping)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return -ECANCELED;
+		}
+		waiter.id = ++m_nextid;
+		iter = m_queries.find(key);
+		if(iter != m_queries.end())
+		{
+			pquery = iter->second;
+		}else{
+			pquery = new Query();
+			pquery->host = szHost;
+			pquery->family = family;
+			pquery->socktype = socktype;
+			m_queries[key] = pquery;
+			m_queue.push_back(pquery);
+			pthread_cond_signal(&m_cond);
+		}
+		pquery->waiters.push_back(waiter);
+		pthread_mutex_unlock(&m_mutex);
+
+		return waiter.id;
+	}
+
+	int DnsResolver::cancel(int64_t requestid)
+	{
+		std::map<std::string, Query*>::iterator iterQuery;
+		std::list<Waiter>::iterator iterWaiter;
+		bool bCalling;
+		size_t i;
+
+		pthread_mutex_lock(&m_mutex);
+		for(iterQuery = m_queries.begin(); iterQuery != m_queries.end(); iterQuery++)
+		{
+			std::list<Waiter> &waiters = iterQuery->second->waiters;
+			for(iterWaiter = waiters.begin(); iterWaiter != waiters.end(); iterWaiter++)
+			{
+				if(iterWaiter->id == requestid)
+				{
+					waiters.erase(iterWaiter);
+					pthread_mutex_unlock(&m_mutex);
+					return 1;
+				}
+			}
+		}
+		do {
+			bCalling = false;
+			for(i = 0; i < m_calling.size(); i++)
+			{
+				if(m_calling[i] == requestid)
+					bCalling = true;
+			}
+			if(bCalling)
+				pthread_cond_wait(&m_donecond, &m_mutex);
+		}while(bCalling);
+		pthread_mutex_unlock(&m_mutex);
+		return 0;
+	}
+
+	/*
+	 * under m_mutex
+	 */
+	void DnsResolver::_store(const std::string &key, const Result &result, int64_t ttlms)
+	{
+		std::map<std::string, CacheEntry>::iterator iter;
+		int64_t now = _nowMs();
+
+		if(ttlms <= 0)
+			return;
+		if((int)m_cache.size() >= m_conf_maxentries)
+		{
+			for(iter = m_cache.begin(); iter != m_cache.end(); )
+			{
+				if(iter->second.expires <= now)
+					m_cache.erase(iter++);
+				else
+					iter++;
+			}
+			if((int)m_cache.size() >= m_conf_maxentries)
+				return;
+		}
+
+		CacheEntry &entry = m_cache[key];
+		entry.result = result.result;
+		entry.addrs = result.addrs;
+		entry.resolve_us = result.resolve_us;
+		entry.expires = now + ttlms;
+	}
+
+	/*
+	 * Within the configured bounds, for a positive answer (under m_mutex).
+	 */
+	int64_t DnsResolver::_clampTtl(int64_t ttlms)
+	{
+		if(ttlms < m_conf_minttlms)
+			ttlms = m_conf_minttlms;
+		if(ttlms > m_conf_maxttlms)
+			ttlms = m_conf_maxttlms;
+		return ttlms;
+	}
+
+	void DnsResolver::_work(int index)
+	{
+		struct __res_state resstate;
+		bool bResInited;
+
+		memset(&resstate, 0, sizeof(resstate));
+		bResInited = (res_ninit(&resstate) == 0);
+		if(bResInited)
+		{
+			/* the probe only refines the cache lifetime : do not let it hold the thread for long */
+			resstate.retrans = 1;
+			resstate.retry = 1;
+		}
+
+		pthread_mutex_lock(&m_mutex);
+		while(!m_stopping || !m_queue.empty())
+		{
+			Query *pquery;
+			std::string host;
+			std::string key;
+			std::map<std::string, CacheEntry>::iterator iter;
+			int64_t storedexpires = 0;
+			struct addrinfo hints;
+			struct addrinfo *pres = NULL;
+			struct addrinfo *pai;
+			struct timespec ts;
+			int64_t starttime;
+			int64_t ttlms;
+			bool bProbe;
+			bool bHasV4 = false;
+			bool bHasV6 = false;
+			Result result;
+			int rc;
+
+			if(m_queue.empty())
+			{
+				pthread_cond_wait(&m_cond, &m_mutex);
+				continue;
+			}
+			pquery = m_queue.front();
+			m_queue.pop_front();
+			bProbe = m_conf_ttlprobe && bResInited;
+			pthread_mutex_unlock(&m_mutex);
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			starttime = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = pquery->family;
+			hints.ai_socktype = pquery->socktype;
+			hints.ai_flags = AI_ADDRCONFIG;
+			rc = ::getaddrinfo(pquery->host.c_str(), NULL, &hints, &pres);
+			if(rc == 0)
+			{
+				for(pai = pres; pai != NULL; pai = pai->ai_next)
+				{
+					Address address;
+					if((pai->ai_family != AF_INET) && (pai->ai_family != AF_INET6))
+						continue;
+					if(pai->ai_addrlen > sizeof(address.addr))
+						continue;
+					memset(&address, 0, sizeof(address));
+					memcpy(&address.addr, pai->ai_addr, pai->ai_addrlen);
+					address.addrlen = pai->ai_addrlen;
+					result.addrs.push_back(address);
+					if(pai->ai_family == AF_INET)
+						bHasV4 = true;
+					else
+						bHasV6 = true;
+				}
+				::freeaddrinfo(pres);
+				_interleave(result.addrs);
+				result.result = result.addrs.empty() ? -EHOSTUNREACH : 1;
+			}else if(rc == EAI_AGAIN)
+			{
+				result.result = -EAGAIN;
+			}else{
+				result.result = (rc == EAI_SYSTEM) ? -errno : -EHOSTUNREACH;
+			}
+			result.cached = false;
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			result.resolve_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - starttime;
+
+			/* cached with the default lifetime until the probe below (if any) knows better */
+			host = pquery->host;
+			key = _key(host.c_str(), pquery->family, pquery->socktype);
+			pthread_mutex_lock(&m_mutex);
+			if(result.result == 1)
+				ttlms = _clampTtl(m_conf_defaultttlms);
+			else
+				ttlms = (result.result == -EAGAIN) ? 0 : m_conf_negativettlms;
+			_store(key, result, ttlms);
+			iter = m_cache.find(key);
+			if(iter != m_cache.end())
+				storedexpires = iter->second.expires;
+
+			/* requests arriving meanwhile joined the waiters, they are answered too */
+			while(!pquery->waiters.empty())
+			{
+				Waiter waiter = pquery->waiters.front();
+				Result answer = result;
+				pquery->waiters.pop_front();
+				m_calling[index] = waiter.id;
+				pthread_mutex_unlock(&m_mutex);
+
+				_setPort(answer.addrs, waiter.port);
+				waiter.handler(this, waiter.param1, waiter.param2, answer);
+
+				pthread_mutex_lock(&m_mutex);
+				m_calling[index] = 0;
+				pthread_cond_broadcast(&m_donecond);
+			}
+			m_queries.erase(key);
+			delete pquery;
+
+			/* after the waiters got the answer : the probes may take a few seconds */
+			if((result.result == 1) && bProbe && (storedexpires != 0))
+			{
+				int64_t probed;
+				pthread_mutex_unlock(&m_mutex);
+				ttlms = -1;
+				if(bHasV4 && ((probed = _probeTtl(&resstate, host.c_str(), AF_INET)) >= 0))
+					ttlms = probed;
+				if(bHasV6 && ((probed = _probeTtl(&resstate, host.c_str(), AF_INET6)) >= 0) && ((ttlms < 0) || (probed < ttlms)))
+					ttlms = probed;
+				pthread_mutex_lock(&m_mutex);
+				/* unless the entry was replaced or dropped meanwhile */
+				iter = m_cache.find(key);
+				if((ttlms >= 0) && (iter != m_cache.end()) && (iter->second.expires == storedexpires))
+					iter->second.expires = _nowMs() + _clampTtl(ttlms);
+			}
+		}
+		pthread_mutex_unlock(&m_mutex);
+
+		if(bResInited)
+			res_nclose(&resstate);
+	}
+
+	int DnsResolver::WorkerThread::run(int param_idx, void *param_ptr)
+	{
+		presolver->_work(param_idx);
+		return 0;
+	}
+
+	DnsResolver *DnsResolver::getDefault()
+	{
+		static DnsResolver *s_pdefaultresolver = new DnsResolver(2);
+		return s_pdefaultresolver;
+	}
+}
@@ -0,0 +1,176 @@
+/**
+ * @file	DnsResolver.h
+ * @class	DnsResolver
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/27
+ * @brief	Hostname resolution on a few worker threads, with a TTL-bounded cache and happy-eyeballs address order
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_DNSRESOLVER_H__
+#define __JSCPPUTILS_DNSRESOLVER_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS, yet..."
+#endif
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+#include "Thread.h"
+#include "SmartPointer.h"
+
+namespace JsCPPUtils
+{
+	/**
+	 * getaddrinfo() blocks, so it runs here instead of on the caller's (or a loop's) thread.
+	 * Concurrent lookups of one name share a single getaddrinfo() call.
+	 *
+	 * Answers are cached for the TTL of the name's DNS records (read with a res_nquery() of the same
+	 * name, clamped to [minttl, maxttl]), or for the default TTL when the name does not come from DNS
+	 * (e.g. /etc/hosts). Failures are cached for the negative TTL, temporary ones (EAI_AGAIN) are not.
+	 */
+	class DnsResolver
+	{
+	public:
+		struct Address {
+			struct sockaddr_storage addr;
+			socklen_t addrlen;
+		};
+
+		struct Result {
+			/* 1, or negative errno (-EHOSTUNREACH : no such name, -EAGAIN : temporary failure) */
+			int result;
+			/* alternating families, in the order getaddrinfo() preferred them (RFC 8305 section 4) */
+			std::vector<Address> addrs;
+			bool cached;
+			/* how long the getaddrinfo() that produced it took */
+			int64_t resolve_us;
+		};
+
+		/**
+		 * Runs on a resolver thread, exactly once per resolve() unless cancel() returned 1.
+		 */
+		typedef void(*ResolveHandler_t)(DnsResolver *presolver, void *param1, void *param2, const Result &result);
+
+	private:
+		struct Waiter {
+			int64_t id;
+			uint16_t port;
+			ResolveHandler_t handler;
+			void *param1;
+			void *param2;
+		};
+
+		struct Query {
+			std::string host;
+			int family;
+			int socktype;
+			std::list<Waiter> waiters;
+		};
+
+		struct CacheEntry {
+			int result;
+			std::vector<Address> addrs;
+			int64_t resolve_us;
+			int64_t expires;
+		};
+
+		class WorkerThread : public Thread
+		{
+		public:
+			DnsResolver *presolver;
+			int run(int param_idx, void *param_ptr) override;
+		};
+
+		pthread_mutex_t m_mutex;
+		pthread_cond_t m_cond;
+		/* signalled when a handler returns, for cancel() */
+		pthread_cond_t m_donecond;
+		bool m_stopping;
+
+		std::vector< JsCPPUtils::SmartPointer<WorkerThread> > m_threads;
+		/* key -> lookup queued or running */
+		std::map<std::string, Query*> m_queries;
+		std::list<Query*> m_queue;
+		std::map<std::string, CacheEntry> m_cache;
+		int64_t m_nextid;
+		/* id of the handler running now, per thread */
+		std::vector<int64_t> m_calling;
+
+		int m_conf_maxentries;
+		int64_t m_conf_defaultttlms;
+		int64_t m_conf_minttlms;
+		int64_t m_conf_maxttlms;
+		int64_t m_conf_negativettlms;
+		bool m_conf_ttlprobe;
+
+		static std::string _key(const char *szHost, int family, int socktype);
+		static void _setPort(std::vector<Address> &addrs, uint16_t port);
+		static void _interleave(std::vector<Address> &addrs);
+		static int64_t _probeTtl(void *pres, const char *szHost, int family);
+		void _work(int index);
+		void _store(const std::string &key, const Result &result, int64_t ttlms);
+		int64_t _clampTtl(int64_t ttlms);
+		int64_t _nowMs();
+
+	public:
+		/**
+		 * numofthreads : lookups that may block at the same time.
+		 */
+		DnsResolver(int numofthreads = 2);
+		/**
+		 * Queued lookups are answered with -ECANCELED.
+		 */
+		~DnsResolver();
+
+		/**
+		 * ttlms when the TTL is unknown, clamped to [minttlms, maxttlms]; negativettlms for failures (0 : not cached).
+		 */
+		void setTtl(int64_t defaultttlms, int64_t minttlms, int64_t maxttlms, int64_t negativettlms);
+		/**
+		 * false : skip the res_nquery() that reads the TTL, every answer lives for the default TTL.
+		 */
+		void setTtlProbe(bool enabled);
+		void setMaxEntries(int maxentries);
+		void clearCache();
+
+		/**
+		 * Without blocking : numeric addresses and cached answers.
+		 * @return 1 (*presult filled), a cached failure (negative errno), 0 : not known, call resolve()
+		 */
+		int lookup(const char *szHost, uint16_t port, int family, int socktype, Result *presult);
+		/**
+		 * Resolves on a worker thread and calls handler there. family : AF_INET, AF_INET6 or AF_UNSPEC.
+		 * @return request id (> 0) for cancel(), or negative errno
+		 */
+		int64_t resolve(const char *szHost, uint16_t port, int family, int socktype, ResolveHandler_t handler, void *param1, void *param2);
+		/**
+		 * @return 1 : the handler will not be called; 0 : it has run already (waits for it if it is running).
+		 * Must not be called from the handler itself.
+		 */
+		int cancel(int64_t requestid);
+
+		/**
+		 * Process-wide resolver with two threads. It is never destroyed.
+		 */
+		static DnsResolver *getDefault();
+	};
+
+}
+
+#endif /* __JSCPPUTILS_DNSRESOLVER_H__ */
@@ -0,0 +1,521 @@
+/**
+ * @file	FrameCodec.cpp
+ * @class	FrameCodec
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/26
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "FrameCodec.h"
+
+#include <errno.h>
+#include <string.h>
+
+namespace JsCPPUtils
+{
+	enum {
+		/* 5 x 7 bits cover any int frame length */
+		VARINT_MAX_BYTES = 5
+	};
+
+	FrameCodec::FrameCodec()
+	{
+		m_format = FORMAT_FIXED;
+		m_fixed_bytes = 4;
+		m_fixed_bigendian = true;
+		m_fixed_includesheader = false;
+		memset(m_delimiter, 0, sizeof(m_delimiter));
+		m_delimiterlen = 0;
+		m_maxframesize = 16 * 1024 * 1024;
+	}
+
+	FrameCodec FrameCodec::fixed(int bytes, bool bBigEndian, bool bIncludesHeader)
+	{
+		FrameCodec codec;
+		if((bytes != 1) && (bytes != 2) && (bytes != 8))
+			bytes = 4;
+		codec.m_fixed_bytes = bytes;
+		codec.m_fixed_bigendian = bBigEndian;
+		codec.m_fixed_includesheader = bIncludesHeader;
+		return codec;
+	}
+
+	FrameCodec FrameCodec::varint()
+	{
+		FrameCodec codec;
+		codec.m_format = FORMAT_VARINT;
+		return codec;
+	}
+
+	FrameCodec FrameCodec::delimiter(const char *pdelim, int delimlen)
+	{
+		FrameCodec codec;
+		codec.m_format = FORMAT_DELIMITER;
+		if(delimlen > MAX_DELIMITER_SIZE)
+			delimlen = MAX_DELIMITER_SIZE;
+		if((pdelim == NULL) || (delimlen <= 0))
+		{
+			pdelim = "\n";
+			delimlen = 1;
+		}
+		memcpy(codec.m_delimiter, pdelim, delimlen);
+		codec.m_delimiterlen = delimlen;
+		return codec;
+	}
+
+	void FrameCodec::setMaxFrameSize(int bytes)
+	{
+		m_maxframesize = (bytes > 0) ? bytes : 0;
+	}
+
+	int FrameCodec::parseHeader(const char *pdata, int len, int *pheaderlen, int *pframelen) const
+	{
+		const unsigned char *p = (const unsigned char*)pdata;
+		uint64_t value = 0;
+		int i;
+
+		if(m_format == FORMAT_FIXED)
+		{
+			if(len < m_fixed_bytes)
+				return 0;
+			for(i = 0; i < m_fixed_bytes; i++)
+			{
+				if(m_fixed_bigendian)
+					value = (value << 8) | p[i];
+				else
+					value |= ((uint64_t)p[i]) << (8 * i);
+			}
+			if(m_fixed_includesheader)
+			{
+				if(value < (uint64_t)m_fixed_bytes)
+					return -EPROTO;
+				value -= m_fixed_bytes;
+			}
+			*pheaderlen = m_fixed_bytes;
+		}else if(m_format == FORMAT_VARINT)
+		{
+			for(i = 0; ; i++)
+			{
+				if(i >= VARINT_MAX_BYTES)
+					return -EPROTO;
+				if(i >= len)
+					return 0;
+				value |= ((uint64_t)(p[i] & 0x7f)) << (7 * i);
+				if(!(p[i] & 0x80))
+					break;
+			}
+			*pheaderlen = i + 1;
+		}else{
+			return -EINVAL;
+		}
+
+		if(value > (uint64_t)m_maxframesize)
+			return -EMSGSIZE;
+		*pframelen = (int)value;
+		return 1;
+	}
+
+	int FrameCodec::encodeHeader(char *pbuf, int framelen) const
+	{
+		unsigned char *p = (unsigned char*)pbuf;
+		uint64_t value = (uint64_t)framelen;
+		int i;
+
+		if(framelen < 0)
+			return -EINVAL;
+
+		if(m_format == FORMAT_FIXED)
+		{
+			if(m_fixed_includesheader)
+				value += m_fixed_bytes;
+			if((m_fixed_bytes < 8) && (value >> (8 * m_fixed_bytes)))
+				return -EMSGSIZE;
+			for(i = 0; i < m_fixed_bytes; i++)
+			{
+				if(m_fixed_bigendian)
+					p[m_fixed_bytes - 1 - i] = (unsigned char)(value >> (8 * i));
+				else
+					p[i] = (unsigned char)(value >> (8 * i));
+			}
+			return m_fixed_bytes;
+		}else if(m_format == FORMAT_VARINT)
+		{
+			i = 0;
+			do {
+				p[i] = (unsigned char)(value & 0x7f);
+				value >>= 7;
+				if(value)
+					p[i] |= 0x80;
+				i++;
+			}while(value);
+			return i;
+		}
+		return 0;
+	}
+
+	int FrameCodec::getEncodedSize(int framelen) const
+	{
+		char header[MAX_HEADER_SIZE];
+		int headerlen = encodeHeader(header, framelen);
+		if(headerlen < 0)
+			return headerlen;
+		return headerlen + framelen + ((m_format == FORMAT_DELIMITER) ? m_delimiterlen : 0);
+	}
+
+	FrameDecoder::FrameDecoder(const FrameCodec &codec, BufferPool *ppool)
+		: m_codec(codec)
+		, m_ppool((ppool != NULL) ? ppool : BufferPool::getDefault())
+		, m_handler(NULL)
+		, m_userptr(NULL)
+		, m_headerlen(0)
+		, m_ppartial(NULL)
+		, m_partiallen(0)
+		, m_partialneed(0)
+		, m_frames(0)
+		, m_copiedframes(0)
+	{
+	}
+
+	FrameDecoder::~FrameDecoder()
+	{
+		reset();
+	}
+
+	void FrameDecoder::setHandler(FrameHandler_t handler, void *userptr)
+	{
+		m_handler = handler;
+		m_userptr = userptr;
+	}
+
+	void FrameDecoder::reset()
+	{
+		if(m_ppartial != NULL)
+		{
+			m_ppartial->release();
+			m_ppartial = NULL;
+		}
+		m_partiallen = 0;
+		m_partialneed = 0;
+		m_headerlen = 0;
+	}
+
+	int FrameDecoder::feed(const char *pdata, int len)
+	{
+		return _feed(pdata, len, NULL);
+	}
+
+	int FrameDecoder::feedChunk(BufferPool::Chunk *pchunk, int len)
+	{
+		return _feed(pchunk->getData(), len, pchunk);
+	}
+
+	int FrameDecoder::_feed(const char *pdata, int len, BufferPool::Chunk *pchunk)
+	{
+		if(len <= 0)
+			return 1;
+		if(m_codec.getFormat() == FrameCodec::FORMAT_DELIMITER)
+			return _feedDelimiter(pdata, len, pchunk);
+		return _feedLength(pdata, len, pchunk);
+	}
+
+	int FrameDecoder::_deliver(char *pframe, int len, BufferPool::Chunk *pchunk)
+	{
+		m_frames++;
+		if(m_handler == NULL)
+			return 1;
+		return m_handler(this, m_userptr, pframe, len, pchunk);
+	}
+
+	int FrameDecoder::_deliverPartial()
+	{
+		BufferPool::Chunk *pchunk = m_ppartial;
+		int len = m_partiallen;
+		int rc;
+
+		m_ppartial = NULL;
+		m_partiallen = 0;
+		m_copiedframes++;
+		rc = _deliver(pchunk->getData(), len, pchunk);
+		pchunk->release();
+		return rc;
+	}
+
+	int FrameDecoder::_feedLength(const char *pdata, int len, BufferPool::Chunk *pchunk)
+	{
+		int pos = 0;
+		int headerlen;
+		int framelen;
+		int n;
+		int rc;
+
+		while(pos < len)
+		{
+			if(m_ppartial != NULL)
+			{
+				n = m_partialneed - m_partiallen;
+				if(n > len - pos)
+					n = len - pos;
+				memcpy(m_ppartial->getData() + m_partiallen, pdata + pos, n);
+				m_partiallen += n;
+				pos += n;
+				if(m_partiallen == m_partialneed)
+				{
+					if((rc = _deliverPartial()) != 1)
+						return rc;
+				}
+				continue;
+			}
+
+			if(m_headerlen > 0)
+			{
+				/* the prefix straddled the previous read */
+				n = FrameCodec::MAX_HEADER_SIZE - m_headerlen;
+				if(n > len - pos)
+					n = len - pos;
+				memcpy(m_header + m_headerlen, pdata + pos, n);
+				rc = m_codec.parseHeader(m_header, m_headerlen + n, &headerlen, &framelen);
+				if(rc < 0)
+					return rc;
+				if(rc == 0)
+				{
+					m_headerlen += n;
+					pos += n;
+					continue;
+				}
+				pos += headerlen - m_headerlen;
+				m_headerlen = 0;
+			}else{
+				rc = m_codec.parseHeader(pdata + pos, len - pos, &headerlen, &framelen);
+				if(rc < 0)
+					return rc;
+				if(rc == 0)
+				{
+					memcpy(m_header, pdata + pos, len - pos);
+					m_headerlen = len - pos;
+					break;
+				}
+				pos += headerlen;
+			}
+
+			if(framelen <= len - pos)
+			{
+				rc = _deliver((char*)pdata + pos, framelen, pchunk);
+				pos += framelen;
+				if(rc != 1)
+					return rc;
+				continue;
+			}
+
+			m_ppartial = m_ppool->acquire(framelen);
+			if(m_ppartial == NULL)
+				return -ENOMEM;
+			m_partiallen = 0;
+			m_partialneed = framelen;
+		}
+		return 1;
+	}
+
+	/*
+	 * The partial frame grows by doubling within the pool's classes.
+	 */
+	int FrameDecoder::_append(const char *pdata, int len)
+	{
+		BufferPool::Chunk *pnew;
+		int capacity;
+
+		if(len <= 0)
+			return 1;
+		/* room for a delimiter that straddles reads */
+		if(m_partiallen + len > m_codec.getMaxFrameSize() + m_codec.getDelimiterLength())
+			return -EMSGSIZE;
+		if((m_ppartial == NULL) || (m_partiallen + len > m_ppartial->getCapacity()))
+		{
+			capacity = (m_ppartial != NULL) ? (m_ppartial->getCapacity() * 2) : m_ppool->getMinSize();
+			if(capacity < m_partiallen + len)
+				capacity = m_partiallen + len;
+			pnew = m_ppool->acquire(capacity);
+			if(pnew == NULL)
+				return -ENOMEM;
+			if(m_ppartial != NULL)
+			{
+				memcpy(pnew->getData(), m_ppartial->getData(), m_partiallen);
+				m_ppartial->release();
+			}
+			m_ppartial = pnew;
+			m_partialneed = -1;
+		}
+		memcpy(m_ppartial->getData() + m_partiallen, pdata, len);
+		m_partiallen += len;
+		return 1;
+	}
+
+	static const char *_findDelimiter(const char *pdata, int len, const char *pdelim, int delimlen)
+	{
+		const char *p = pdata;
+		const char *pend = pdata + len - delimlen;
+
+		while(p <= pend)
+		{
+			p = (const char*)memchr(p, pdelim[0], pend - p + 1);
+			if(p == NULL)
+				return NULL;
+			if(memcmp(p, pdelim, delimlen) == 0)
+				return p;
+			p++;
+		}
+		return NULL;
+	}
+
+	int FrameDecoder::_feedDelimiter(const char *pdata, int len, BufferPool::Chunk *pchunk)
+	{
+		const char *pdelim = m_codec.getDelimiter();
+		int delimlen = m_codec.getDelimiterLength();
+		const char *pfound;
+		int pos = 0;
+		int k;
+		int rc;
+
+		if(m_ppartial != NULL)
+		{
+			/* a delimiter split between the partial frame and this read, longest overlap first */
+			for(k = delimlen - 1; k > 0; k--)
+			{
+				if((k > m_partiallen) || (delimlen - k > len))
+					continue;
+				if((memcmp(m_ppartial->getData() + m_partiallen - k, pdelim, k) == 0) &&
+					(memcmp(pdata, pdelim + k, delimlen - k) == 0))
+					break;
+			}
+			if(k > 0)
+			{
+				m_partiallen -= k;
+				pos = delimlen - k;
+			}else{
+				pfound = _findDelimiter(pdata, len, pdelim, delimlen);
+				if(pfound == NULL)
+					return _append(pdata, len);
+				if((rc = _append(pdata, (int)(pfound - pdata))) != 1)
+					return rc;
+				pos = (int)(pfound - pdata) + delimlen;
+			}
+			if(m_partiallen > m_codec.getMaxFrameSize())
+				return -EMSGSIZE;
+			if((rc = _deliverPartial()) != 1)
+				return rc;
+		}
+
+		while(pos < len)
+		{
+			pfound = _findDelimiter(pdata + pos, len - pos, pdelim, delimlen);
+			if(pfound == NULL)
+				return _append(pdata + pos, len - pos);
+			if((int)(pfound - (pdata + pos)) > m_codec.getMaxFrameSize())
+				return -EMSGSIZE;
+			rc = _deliver((char*)pdata + pos, (int)(pfound - (pdata + pos)), pchunk);
+			pos = (int)(pfound - pdata) + delimlen;
+			if(rc != 1)
+				return rc;
+		}
+		return 1;
+	}
+
+#if defined(JSCUTILS_OS_LINUX)
+	FrameWriter::FrameWriter(JsClientSocket *psock, const FrameCodec &codec, BufferPool *ppool)
+		: m_psock(psock)
+		, m_codec(codec)
+		, m_ppool((ppool != NULL) ? ppool : BufferPool::getDefault())
+		, m_batchsize(16384)
+		, m_pbatch(NULL)
+		, m_batchlen(0)
+		, m_batchframes(0)
+		, m_frames(0)
+		, m_sends(0)
+	{
+	}
+
+	FrameWriter::~FrameWriter()
+	{
+		if(m_pbatch != NULL)
+		{
+			m_pbatch->release();
+			m_pbatch = NULL;
+		}
+	}
+
+	void FrameWriter::setBatchSize(int bytes)
+	{
+		m_batchsize = (bytes > 0) ? bytes : 1;
+	}
+
+	int FrameWriter::write(const char *pdata, int len)
+	{
+		char header[FrameCodec::MAX_HEADER_SIZE];
+		int headerlen;
+		int total;
+		int rc;
+		char *p;
+
+		if(len < 0)
+			return -EINVAL;
+		if(len > m_codec.getMaxFrameSize())
+			return -EMSGSIZE;
+		headerlen = m_codec.encodeHeader(header, len);
+		if(headerlen < 0)
+			return headerlen;
+		total = headerlen + len;
+		if(m_codec.getFormat() == FrameCodec::FORMAT_DELIMITER)
+			total += m_codec.getDelimiterLength();
+
+		if((m_pbatch != NULL) && (m_batchlen + total > m_pbatch->getCapacity()))
+		{
+			if((rc = flush()) != 1)
+				return rc;
+		}
+		if(m_pbatch == NULL)
+		{
+			m_pbatch = m_ppool->acquire((total > m_batchsize) ? total : m_batchsize);
+			if(m_pbatch == NULL)
+				return -ENOMEM;
+			m_batchlen = 0;
+			m_batchframes = 0;
+		}
+
+		p = m_pbatch->getData() + m_batchlen;
+		memcpy(p, header, headerlen);
+		p += headerlen;
+		memcpy(p, pdata, len);
+		p += len;
+		if(m_codec.getFormat() == FrameCodec::FORMAT_DELIMITER)
+			memcpy(p, m_codec.getDelimiter(), m_codec.getDelimiterLength());
+		m_batchlen += total;
+		m_batchframes++;
+		m_frames++;
+
+		if(m_batchlen >= m_batchsize)
+			return flush();
+		return 1;
+	}
+
+	int FrameWriter::flush(JsClientSocket::Client_SentHandler_t senthandler)
+	{
+		BufferPool::Chunk *pbatch = m_pbatch;
+		int rc;
+
+		if((pbatch == NULL) || (m_batchlen == 0))
+			return 1;
+		m_pbatch = NULL;
+		m_batchframes = 0;
+		/* the socket releases the chunk once it is written */
+		rc = m_psock->sendOwned(pbatch->getData(), m_batchlen, senthandler, BufferPool::Chunk::releaseProc, pbatch);
+		if(rc <= 0)
+		{
+			pbatch->release();
+			return rc;
+		}
+		m_sends++;
+		return 1;
+	}
+#endif
+}
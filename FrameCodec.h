@@ -0,0 +1,245 @@
+/**
+ * @file	FrameCodec.h
+ * @class	FrameCodec
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/26
+ * @brief	Message framing (fixed / varint length prefix, delimiter) : a reassembling decoder and a batching writer
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_FRAMECODEC_H__
+#define __JSCPPUTILS_FRAMECODEC_H__
+
+#include "Common.h"
+
+#include <stdint.h>
+
+#include "BufferPool.h"
+#if defined(JSCUTILS_OS_LINUX)
+#include "JsClientSocket.h"
+#endif
+
+namespace JsCPPUtils
+{
+	/**
+	 * How frames are delimited on the wire. A value type : copy it into decoders and writers.
+	 */
+	class FrameCodec
+	{
+	public:
+		enum Format {
+			FORMAT_FIXED = 0,
+			/* unsigned LEB128 (protobuf style), at most 5 bytes */
+			FORMAT_VARINT,
+			/* frames end with a byte sequence, which is not part of the frame */
+			FORMAT_DELIMITER
+		};
+
+		enum {
+			MAX_HEADER_SIZE = 8,
+			MAX_DELIMITER_SIZE = 8
+		};
+
+	private:
+		Format m_format;
+		int m_fixed_bytes;
+		bool m_fixed_bigendian;
+		bool m_fixed_includesheader;
+		char m_delimiter[MAX_DELIMITER_SIZE];
+		int m_delimiterlen;
+		int m_maxframesize;
+
+	public:
+		/**
+		 * Default : 4-byte big-endian length of the payload.
+		 */
+		FrameCodec();
+
+		/**
+		 * bytes : 1, 2, 4 or 8. bIncludesHeader : the length counts the prefix itself.
+		 */
+		static FrameCodec fixed(int bytes = 4, bool bBigEndian = true, bool bIncludesHeader = false);
+		static FrameCodec varint();
+		static FrameCodec delimiter(const char *pdelim, int delimlen);
+
+		/**
+		 * Larger frames are a protocol error (-EMSGSIZE). Default 16 MB.
+		 */
+		void setMaxFrameSize(int bytes);
+		int getMaxFrameSize() const {
+			return m_maxframesize;
+		}
+		Format getFormat() const {
+			return m_format;
+		}
+		const char *getDelimiter() const {
+			return m_delimiter;
+		}
+		int getDelimiterLength() const {
+			return m_delimiterlen;
+		}
+
+		/**
+		 * Length-prefixed formats.
+		 * @return 1 : *pheaderlen and *pframelen are set, 0 : more bytes needed, negative errno : malformed or too large
+		 */
+		int parseHeader(const char *pdata, int len, int *pheaderlen, int *pframelen) const;
+		/**
+		 * Writes the prefix (nothing for FORMAT_DELIMITER) into pbuf (MAX_HEADER_SIZE bytes).
+		 * @return its length, or negative errno if framelen does not fit
+		 */
+		int encodeHeader(char *pbuf, int framelen) const;
+		/**
+		 * Bytes a frame of framelen takes on the wire.
+		 */
+		int getEncodedSize(int framelen) const;
+	};
+
+	/**
+	 * Splits a byte stream into frames. Not thread-safe : one per connection, fed in order.
+	 *
+	 * A frame that lies inside one received buffer is handed over in place, without a copy.
+	 * Only frames that straddle reads are assembled, into a chunk of the BufferPool.
+	 */
+	class FrameDecoder
+	{
+	public:
+		/**
+		 * pchunk : the chunk holding pframe. retain() it to keep the frame after the call.
+		 * NULL when pframe points into a buffer given to feed(), which is only valid during the call.
+		 * @return 1 to go on; anything else stops decoding and is returned by feed()
+		 */
+		typedef int(*FrameHandler_t)(FrameDecoder *pdecoder, void *userptr, char *pframe, int frame_len, BufferPool::Chunk *pchunk);
+
+	private:
+		FrameCodec m_codec;
+		BufferPool *m_ppool;
+		FrameHandler_t m_handler;
+		void *m_userptr;
+
+		/* prefix bytes of the next frame seen so far */
+		char m_header[FrameCodec::MAX_HEADER_SIZE];
+		int m_headerlen;
+		/* frame being assembled */
+		BufferPool::Chunk *m_ppartial;
+		int m_partiallen;
+		/* length-prefixed : the frame length; delimiter : -1 */
+		int m_partialneed;
+
+		int64_t m_frames;
+		int64_t m_copiedframes;
+
+		int _feed(const char *pdata, int len, BufferPool::Chunk *pchunk);
+		int _feedLength(const char *pdata, int len, BufferPool::Chunk *pchunk);
+		int _feedDelimiter(const char *pdata, int len, BufferPool::Chunk *pchunk);
+		int _append(const char *pdata, int len);
+		int _deliver(char *pframe, int len, BufferPool::Chunk *pchunk);
+		int _deliverPartial();
+
+	public:
+		/**
+		 * ppool : for frames that straddle reads (BufferPool::getDefault() if NULL).
+		 */
+		FrameDecoder(const FrameCodec &codec = FrameCodec(), BufferPool *ppool = NULL);
+		~FrameDecoder();
+
+		void setHandler(FrameHandler_t handler, void *userptr = NULL);
+		const FrameCodec &getCodec() const {
+			return m_codec;
+		}
+
+		/**
+		 * Frames in pdata are passed in place (pchunk NULL).
+		 * @return 1, a handler's result other than 1, or negative errno on a protocol error
+		 */
+		int feed(const char *pdata, int len);
+		/**
+		 * Frames in pchunk are passed with pchunk, so the handler can keep them without a copy.
+		 * The caller keeps its own reference.
+		 */
+		int feedChunk(BufferPool::Chunk *pchunk, int len);
+		/**
+		 * Drops a partial frame, e.g. when the connection is gone.
+		 */
+		void reset();
+		bool hasPartial() const {
+			return (m_headerlen > 0) || (m_ppartial != NULL);
+		}
+
+		int64_t getFrameCount() const {
+			return m_frames;
+		}
+		/* frames that had to be assembled from several reads */
+		int64_t getCopiedFrameCount() const {
+			return m_copiedframes;
+		}
+	};
+
+#if defined(JSCUTILS_OS_LINUX)
+	/**
+	 * Encodes frames into pooled chunks and sends several of them with one JsClientSocket::sendOwned().
+	 * Not thread-safe : one writer per thread and socket.
+	 */
+	class FrameWriter
+	{
+	private:
+		JsClientSocket *m_psock;
+		FrameCodec m_codec;
+		BufferPool *m_ppool;
+		int m_batchsize;
+
+		BufferPool::Chunk *m_pbatch;
+		int m_batchlen;
+		int m_batchframes;
+
+		int64_t m_frames;
+		int64_t m_sends;
+
+	public:
+		/**
+		 * ppool : batch chunks (BufferPool::getDefault() if NULL).
+		 */
+		FrameWriter(JsClientSocket *psock, const FrameCodec &codec = FrameCodec(), BufferPool *ppool = NULL);
+		/**
+		 * Unflushed frames are dropped.
+		 */
+		~FrameWriter();
+
+		/**
+		 * A batch is flushed once it reaches bytes (default 16 KB). Larger frames go out alone.
+		 */
+		void setBatchSize(int bytes);
+
+		/**
+		 * Appends a frame to the batch, flushing it first when the frame does not fit.
+		 * With FORMAT_DELIMITER the payload must not contain the delimiter.
+		 * @return 1, or negative errno (the frame is not written)
+		 */
+		int write(const char *pdata, int len);
+		/**
+		 * Sends the batch. senthandler (optional) runs once the kernel took it.
+		 * @return 1 (also with nothing to send), or what sendOwned() returned (the batch is dropped then)
+		 */
+		int flush(JsClientSocket::Client_SentHandler_t senthandler = NULL);
+		int getPendingFrames() const {
+			return m_batchframes;
+		}
+
+		int64_t getFrameCount() const {
+			return m_frames;
+		}
+		int64_t getSendCount() const {
+			return m_sends;
+		}
+	};
+#endif
+
+}
+
+#endif /* __JSCPPUTILS_FRAMECODEC_H__ */
@@ -904,9 +904,10 @@ namespace JsCPPUtils
 	 * _conf_incbucketsthresholdratio	Ŷ  Ͱ/Ŷ  Ѱ
 	 * _conf_incbucketfactor			Ŷ  
 	 * _conf_limitnumofbuckets			ִ Ŷ 
+	 * TLOCKRW					LockableRW or LockableRWScalable
 	 */
-	template<typename TKEY, typename TVALUE>
-		class HashMapRWLock : public basic_HashMapNTS<TKEY, TVALUE>, private LockableRW
+	template<typename TKEY, typename TVALUE, class TLOCKRW = LockableRW>
+		class HashMapRWLock : public basic_HashMapNTS<TKEY, TVALUE>, private TLOCKRW
 		{
 		public:
 			explicit HashMapRWLock(int _initial_numofbuckets = 127, int _initial_numofblocks = 256, int _conf_incblocksize = 16, float _conf_incbucketsthresholdratio = 0.8, float _conf_incbucketfactor = 2.0, int _conf_limitnumofbuckets = 4194304
@@ -944,52 +945,52 @@ namespace JsCPPUtils
 			
 			void iteratoring_readlock()
 			{
-				readlock();
+				TLOCKRW::readlock();
 			}
 			
 			void iteratoring_readunlock()
 			{
-				readunlock();
+				TLOCKRW::readunlock();
 			}
 			
 			void iteratoring_writelock()
 			{
-				writelock();
+				TLOCKRW::writelock();
 			}
 			
 			void iteratoring_writeunlock()
 			{
-				writeunlock();
+				TLOCKRW::writeunlock();
 			}
 			
 			// std::bad_alloc
 			const TVALUE& operator[](const TKEY &key) const
 			{
-				writelock();
+				TLOCKRW::writelock();
 				
 				const TVALUE& ref_value = basic_HashMapNTS<TKEY, TVALUE>::operator[](key);
 				
-				writeunlock();
+				TLOCKRW::writeunlock();
 				
 				return ref_value;
 			}
 		
 			TVALUE& operator[](const TKEY &key)
 			{
-				writelock();
+				TLOCKRW::writelock();
 				
 				TVALUE& ref_value = basic_HashMapNTS<TKEY, TVALUE>::operator[](key);
 				
-				writeunlock();
+				TLOCKRW::writeunlock();
 				
 				return ref_value;
 			}
 			
 			void erase(const TKEY &key)
 			{
-				writelock();
+				TLOCKRW::writelock();
 				basic_HashMapNTS<TKEY, TVALUE>::erase(key);
-				writeunlock();
+				TLOCKRW::writeunlock();
 			}
 		};
 }
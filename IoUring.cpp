@@ -0,0 +1,211 @@
+/**
+ * @file	IoUring.cpp
+ * @class	IoUring
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/20
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "IoUring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+namespace JsCPPUtils
+{
+	IoUring::IoUring()
+		: m_fd(-1)
+		, m_features(0)
+		, m_psqring(MAP_FAILED)
+		, m_sqringsize(0)
+		, m_pcqring(MAP_FAILED)
+		, m_cqringsize(0)
+		, m_psqes((struct io_uring_sqe*)MAP_FAILED)
+		, m_sqessize(0)
+		, m_psq_head(NULL)
+		, m_psq_tail(NULL)
+		, m_sq_mask(0)
+		, m_sq_entries(0)
+		, m_psq_array(NULL)
+		, m_sq_localtail(0)
+		, m_pcq_head(NULL)
+		, m_pcq_tail(NULL)
+		, m_cq_mask(0)
+		, m_pcqes(NULL)
+	{
+	}
+
+	IoUring::~IoUring()
+	{
+		close();
+	}
+
+	int IoUring::init(unsigned int entries, unsigned int flags)
+	{
+		struct io_uring_params params;
+		int nerr;
+
+		close();
+
+		memset(&params, 0, sizeof(params));
+		params.flags = flags;
+		m_fd = (int)::syscall(__NR_io_uring_setup, entries, &params);
+		if (m_fd < 0)
+		{
+			m_fd = -1;
+			return -errno;
+		}
+		m_features = params.features;
+
+		m_sqringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		m_cqringsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (m_features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (m_cqringsize > m_sqringsize)
+				m_sqringsize = m_cqringsize;
+			m_cqringsize = m_sqringsize;
+		}
+
+		m_psqring = ::mmap(NULL, m_sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (m_psqring == MAP_FAILED)
+			goto FAILED;
+		if (m_features & IORING_FEAT_SINGLE_MMAP)
+		{
+			m_pcqring = m_psqring;
+		}else{
+			m_pcqring = ::mmap(NULL, m_cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+			if (m_pcqring == MAP_FAILED)
+				goto FAILED;
+		}
+		m_sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+		m_psqes = (struct io_uring_sqe*)::mmap(NULL, m_sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_psqes == MAP_FAILED)
+			goto FAILED;
+
+		m_psq_head = (unsigned int*)((char*)m_psqring + params.sq_off.head);
+		m_psq_tail = (unsigned int*)((char*)m_psqring + params.sq_off.tail);
+		m_sq_mask = *(unsigned int*)((char*)m_psqring + params.sq_off.ring_mask);
+		m_sq_entries = params.sq_entries;
+		m_psq_array = (unsigned int*)((char*)m_psqring + params.sq_off.array);
+		m_sq_localtail = *m_psq_tail;
+
+		m_pcq_head = (unsigned int*)((char*)m_pcqring + params.cq_off.head);
+		m_pcq_tail = (unsigned int*)((char*)m_pcqring + params.cq_off.tail);
+		m_cq_mask = *(unsigned int*)((char*)m_pcqring + params.cq_off.ring_mask);
+		m_pcqes = (struct io_uring_cqe*)((char*)m_pcqring + params.cq_off.cqes);
+
+		return 1;
+
+	FAILED:
+		nerr = errno;
+		close();
+		return -nerr;
+	}
+
+	void IoUring::close()
+	{
+		if (m_psqes != MAP_FAILED)
+		{
+			::munmap(m_psqes, m_sqessize);
+			m_psqes = (struct io_uring_sqe*)MAP_FAILED;
+		}
+		if ((m_pcqring != MAP_FAILED) && (m_pcqring != m_psqring))
+			::munmap(m_pcqring, m_cqringsize);
+		m_pcqring = MAP_FAILED;
+		if (m_psqring != MAP_FAILED)
+		{
+			::munmap(m_psqring, m_sqringsize);
+			m_psqring = MAP_FAILED;
+		}
+		if (m_fd >= 0)
+		{
+			::close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+	int IoUring::_enter(unsigned int tosubmit, unsigned int waitnr, unsigned int flags, void *arg, size_t argsize)
+	{
+		int rc = (int)::syscall(__NR_io_uring_enter, m_fd, tosubmit, waitnr, flags, arg, argsize);
+		return (rc < 0) ? -errno : rc;
+	}
+
+	struct io_uring_sqe *IoUring::getSqe()
+	{
+		unsigned int head = __atomic_load_n(m_psq_head, __ATOMIC_ACQUIRE);
+		unsigned int index;
+		struct io_uring_sqe *psqe;
+
+		if (m_sq_localtail - head >= m_sq_entries)
+			return NULL;
+		index = m_sq_localtail & m_sq_mask;
+		psqe = &m_psqes[index];
+		m_psq_array[index] = index;
+		m_sq_localtail++;
+		memset(psqe, 0, sizeof(*psqe));
+		return psqe;
+	}
+
+	unsigned int IoUring::getUnsubmitted() const
+	{
+		return m_sq_localtail - *m_psq_tail;
+	}
+
+	int IoUring::submitAndWait(unsigned int waitnr, int timeoutms)
+	{
+		unsigned int tosubmit = m_sq_localtail - *m_psq_tail;
+		unsigned int flags = 0;
+		int rc;
+
+		__atomic_store_n(m_psq_tail, m_sq_localtail, __ATOMIC_RELEASE);
+
+		if (waitnr > 0)
+		{
+			flags |= IORING_ENTER_GETEVENTS;
+			if ((timeoutms >= 0) && (m_features & IORING_FEAT_EXT_ARG))
+			{
+				struct __kernel_timespec ts;
+				struct io_uring_getevents_arg arg;
+				ts.tv_sec = timeoutms / 1000;
+				ts.tv_nsec = (long long)(timeoutms % 1000) * 1000000;
+				memset(&arg, 0, sizeof(arg));
+				arg.ts = (uint64_t)(uintptr_t)&ts;
+				rc = _enter(tosubmit, waitnr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+				return ((rc == -ETIME) || (rc == -EINTR)) ? 0 : rc;
+			}
+		}else if (tosubmit == 0) {
+			return 0;
+		}
+
+		rc = _enter(tosubmit, waitnr, flags, NULL, 0);
+		return ((rc == -ETIME) || (rc == -EINTR)) ? 0 : rc;
+	}
+
+	struct io_uring_cqe *IoUring::peekCqe()
+	{
+		unsigned int head = *m_pcq_head;
+		if (head == __atomic_load_n(m_pcq_tail, __ATOMIC_ACQUIRE))
+			return NULL;
+		return &m_pcqes[head & m_cq_mask];
+	}
+
+	void IoUring::seenCqe()
+	{
+		__atomic_store_n(m_pcq_head, *m_pcq_head + 1, __ATOMIC_RELEASE);
+	}
+}
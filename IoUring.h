@@ -0,0 +1,105 @@
+/**
+ * @file	IoUring.h
+ * @class	IoUring
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/20
+ * @brief	Minimal io_uring wrapper on the raw syscalls (no liburing dependency)
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_IOURING_H__
+#define __JSCPPUTILS_IOURING_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* feature bits newer than some distribution headers; the running kernel reports them at setup */
+#ifndef IORING_FEAT_REG_REG_RING
+#define IORING_FEAT_REG_REG_RING (1U << 13)
+#endif
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS"
+#endif
+
+namespace JsCPPUtils
+{
+	/**
+	 * Not thread-safe : one thread owns the submission and completion queues.
+	 */
+	class IoUring
+	{
+	private:
+		int m_fd;
+		unsigned int m_features;
+
+		void *m_psqring;
+		size_t m_sqringsize;
+		void *m_pcqring;
+		size_t m_cqringsize;
+		struct io_uring_sqe *m_psqes;
+		size_t m_sqessize;
+
+		unsigned int *m_psq_head;
+		unsigned int *m_psq_tail;
+		unsigned int m_sq_mask;
+		unsigned int m_sq_entries;
+		unsigned int *m_psq_array;
+		unsigned int m_sq_localtail;
+
+		unsigned int *m_pcq_head;
+		unsigned int *m_pcq_tail;
+		unsigned int m_cq_mask;
+		struct io_uring_cqe *m_pcqes;
+
+		int _enter(unsigned int tosubmit, unsigned int waitnr, unsigned int flags, void *arg, size_t argsize);
+
+	public:
+		IoUring();
+		~IoUring();
+
+		/**
+		 * flags : IORING_SETUP_*
+		 * @return 1 on success, negative errno on failure (-ENOSYS / -EPERM when io_uring is unavailable)
+		 */
+		int init(unsigned int entries, unsigned int flags = 0);
+		void close();
+
+		bool isOpened() const {
+			return m_fd >= 0;
+		}
+		unsigned int getFeatures() const {
+			return m_features;
+		}
+
+		/**
+		 * Zeroed entry, or NULL when the queue is full (submit first).
+		 */
+		struct io_uring_sqe *getSqe();
+		unsigned int getUnsubmitted() const;
+		/**
+		 * Submits the queued entries and waits for at least waitnr completions.
+		 * timeoutms < 0 : no limit.
+		 * @return number of submitted entries, or negative errno (-ETIME is reported as 0)
+		 */
+		int submitAndWait(unsigned int waitnr, int timeoutms = -1);
+		int submit() {
+			return submitAndWait(0);
+		}
+
+		struct io_uring_cqe *peekCqe();
+		void seenCqe();
+	};
+
+}
+
+#endif /* __JSCPPUTILS_IOURING_H__ */
@@ -1,10 +1,55 @@
 #include "JsClientSocket.h"
+#include "FrameCodec.h"
 
 #include <stdio.h>
 #include <string.h>
 
+#if defined(JSCUTILS_OS_LINUX)
+#include <time.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#endif
+
 namespace JsCPPUtils
 {
+#if defined(JSCUTILS_OS_LINUX)
+	enum {
+		/* chunks gathered into one sendmsg */
+		SEND_IOV_MAX = 64
+	};
+
+	/*
+	 * msghdr and iovecs of the IORING_OP_SENDMSG in flight. If the socket closes meanwhile,
+	 * the chunks it covers are parked here until the kernel lets go of them.
+	 */
+	struct JsClientSocket::UringSendBatch {
+		struct msghdr msg;
+		struct iovec iov[SEND_IOV_MAX];
+		std::list<SendChunk> chunks;
+	};
+
+	/*
+	 * A resolve() in flight. The resolver's thread fills result and posts it to the loop;
+	 * a close meanwhile detaches it (psockctx NULL) and whoever sees it last deletes it.
+	 */
+	struct JsClientSocket::ResolveToken {
+		JsClientSocket *psockctx;
+		int64_t requestid;
+		bool posted;
+		DnsResolver::Result result;
+	};
+#endif
+
 	JsClientSocket::JsClientSocket(void *userptr)
 	{
 		m_userptr = userptr;
@@ -12,27 +57,94 @@ namespace JsCPPUtils
 		m_sock = INVALID_SOCKET;
 
 		m_conf_bautoreconnect = false;
+		m_bUseSSL = false;
+		m_sslstate = 0;
+		m_sock_state = SOCKSTATE_NOTINITED;
 
 #ifdef USE_OPENSSL
 		m_pSSLCtx = NULL;
 		m_sock_pSSL = NULL;
 #endif
+
+#if defined(JSCUTILS_OS_LINUX)
+		m_pengine = NULL;
+		m_ploop = NULL;
+		m_pengctx = NULL;
+		m_channel.psockctx = this;
+		m_uring_io = false;
+		m_sendinflight = false;
+		m_psendbatch = NULL;
+		m_sendbatchchunks = 0;
+		m_zc_threshold = 0;
+		m_zc_enabled = false;
+		m_zc_nextid = 0;
+		m_zc_done = 0;
+		m_reconnect_timerid = 0;
+		m_recvchunkhandler = NULL;
+		m_precvpool = NULL;
+		m_recvsize = 0;
+		m_recv_smallreads = 0;
+		m_conf_readbatch = 0;
+		m_read_timerid = 0;
+		m_pframedecoder = NULL;
+		m_pmetrics = NULL;
+		m_pmetricsaggr = NULL;
+		m_conf_tcpinfointervalms = 0;
+		m_tcpinfo_timerid = 0;
+		m_tcpinfo_lastretrans = 0;
+		m_presolver = NULL;
+		m_presolvetoken = NULL;
+		m_connect_next = 0;
+		m_connect_lasterror = 0;
+		m_attempt_timerid = 0;
+		m_phase_timerid = 0;
+		m_connect_start = 0;
+		m_connect_tcpstart = 0;
+		memset(&m_timings, 0, sizeof(m_timings));
+		m_conf_attemptdelayms = 250;
+		m_conf_resolvetimeoutms = 0;
+		m_conf_tcptimeoutms = 0;
+		m_conf_ssltimeoutms = 0;
+#ifdef USE_OPENSSL
+		m_ssl_handshakestart = 0;
+#endif
+		pthread_mutex_init(&m_connect_mutex, NULL);
+		pthread_cond_init(&m_connect_cond, NULL);
+#endif
 	}
 	
 	JsClientSocket::~JsClientSocket()
 	{
+#if defined(JSCUTILS_OS_LINUX)
+		if(m_ploop != NULL)
+		{
+			m_ploop->invoke(_engine_detachProc, this, NULL);
+			m_ploop = NULL;
+		}
+		if(m_psendbatch != NULL)
+		{
+			delete m_psendbatch;
+			m_psendbatch = NULL;
+		}
+		if(m_pmetrics != NULL)
+		{
+			delete m_pmetrics;
+			m_pmetrics = NULL;
+		}
+		pthread_cond_destroy(&m_connect_cond);
+		pthread_mutex_destroy(&m_connect_mutex);
+#else
 		_closeSocket();
+#endif
 
 		
 #ifdef USE_OPENSSL
-		if(m_pSSLCtx != NULL)
-		{
-			::SSL_CTX_free(m_pSSLCtx);
-			m_pSSLCtx = NULL;
-		}
+		m_spsslctx = NULL;
+		m_pSSLCtx = NULL;
 #endif
 	}
 
+#if defined(JSCUTILS_OS_WINDOWS)
 	int JsClientSocket::init(
 			int sock_domain,
 			int sock_type,
@@ -58,11 +170,8 @@ namespace JsCPPUtils
 		JSCUTILS_SOCKET_T win_tmpsock = INVALID_SOCKET;
 		
 #ifdef USE_OPENSSL
-		if(m_pSSLCtx != NULL)
-		{
-			::SSL_CTX_free(m_pSSLCtx);
-			m_pSSLCtx = NULL;
-		}
+		m_spsslctx = NULL;
+		m_pSSLCtx = NULL;
 #else
 		if(bUseSSL)
 		{
@@ -122,10 +231,8 @@ namespace JsCPPUtils
 #ifdef USE_OPENSSL
 			if (m_bUseSSL)
 			{
-				m_pSSLCtx = ::SSL_CTX_new(ssl_method);
-				if (m_pSSLCtx == NULL)
+				if (_sslInitContext(ssl_method) != 1)
 				{
-					ERR_print_errors_fp(stderr);
 					retval = -1;
 					break;
 				}
@@ -258,10 +365,55 @@ namespace JsCPPUtils
 		return 1;
 	}
 
-	int JsClientSocket::sslLoadCertificates(const char* szCertFile, const char* szKeyFile)
+#endif
+
+#ifdef USE_OPENSSL
+	void JsClientSocket::setSSLContext(const JsCPPUtils::SmartPointer<JsSSLContext> &spctx)
+	{
+		m_spsslctx_conf = spctx;
+	}
+
+	JsCPPUtils::SmartPointer<JsSSLContext> JsClientSocket::getSSLContext()
+	{
+		return m_spsslctx;
+	}
+
+	int JsClientSocket::_sslInitContext(const SSL_METHOD *ssl_method)
 	{
+		if(m_spsslctx_conf.getPtr() != NULL)
+		{
+			m_spsslctx = m_spsslctx_conf;
+		}else{
+			m_spsslctx = new JsSSLContext();
+			if(m_spsslctx->init(ssl_method) != 1)
+			{
+				m_spsslctx = NULL;
+				return 0;
+			}
+		}
+		m_pSSLCtx = m_spsslctx->getSSL_CTX();
+		if(m_pSSLCtx == NULL)
+		{
+			/* a shared context that was never init()'ed */
+			m_spsslctx = NULL;
+			return 0;
+		}
 		return 1;
 	}
+#endif
+
+	int JsClientSocket::sslLoadCertificates(const char* szCertFile, const char* szKeyFile)
+	{
+#ifdef USE_OPENSSL
+		if(m_spsslctx.getPtr() == NULL)
+			return 0;
+		return m_spsslctx->loadCertificates(szCertFile, szKeyFile);
+#else
+		return 0;
+#endif
+	}
+
+#if defined(JSCUTILS_OS_WINDOWS)
 
 	void JsClientSocket::workerThreadProc_CleanUp(void *param)
 	{
@@ -694,6 +846,8 @@ EXIT_STARTERR1:
 		return retval;
 	}
 
+#endif
+
 	void JsClientSocket::setUserPtr(void *userptr)
 	{
 		m_userptr = userptr;
@@ -709,6 +863,11 @@ EXIT_STARTERR1:
 		return m_bUseSSL;
 	}
 
+	bool JsClientSocket::isConnected()
+	{
+		return m_sock_state.get() == SOCKSTATE_CONNECTED;
+	}
+
 	JSCUTILS_SOCKET_T JsClientSocket::getSocket()
 	{
 		return m_sock;
@@ -721,7 +880,7 @@ EXIT_STARTERR1:
 	}
 #endif
 	
-
+#if defined(JSCUTILS_OS_WINDOWS)
 	int JsClientSocket::_worker_send(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg)
 	{
 		WorkerThreadMessage_Send *pmsg = (WorkerThreadMessage_Send*)spmsg.getPtr();
@@ -946,4 +1105,1883 @@ EXIT_STARTERR1:
 
 		return retval;
 	}
+#elif defined(JSCUTILS_OS_LINUX)
+
+	void JsClientSocket::EngineChannel::onEvent(uint32_t events)
+	{
+		psockctx->_engine_onEvent(events);
+	}
+
+	void JsClientSocket::EngineChannel::onRecvComplete(int res, char *pbuf)
+	{
+		psockctx->_engine_onRecvComplete(res, pbuf);
+	}
+
+	void JsClientSocket::EngineChannel::onSendComplete(int res)
+	{
+		psockctx->_engine_onSendComplete(res);
+	}
+
+	void JsClientSocket::setEngine(JsSocketEngine *pengine)
+	{
+		m_pengine = pengine;
+	}
+
+	JsSocketEngine *JsClientSocket::getEngine()
+	{
+		return m_pengine;
+	}
+
+	int JsClientSocket::init(
+			int sock_domain,
+			int sock_type,
+			int sock_proto,
+			bool bUseSSL,
+#ifdef USE_OPENSSL 
+			const SSL_METHOD *ssl_method,
+#else
+			void *ssl_method,
+#endif
+			long recvdatabufsize,
+			StartWorkerPostHandler_t startworkerposthandler,
+			StopWorkerHandler_t stopworkerhandler,
+			Client_ConnectedHandler_t connectedhandler,
+			Client_RecvHandler_t recvhandler,
+			Client_DisconnectedHandler_t disconnectedhandler)
+	{
+		int retval = 0;
+
+#ifndef USE_OPENSSL
+		if(bUseSSL)
+		{
+			return 0;
+		}
+#endif
+
+		if(m_ploop != NULL)
+		{
+			m_ploop->invoke(_engine_detachProc, this, NULL);
+			m_ploop = NULL;
+		}
+
+#ifdef USE_OPENSSL
+		m_spsslctx = NULL;
+		m_pSSLCtx = NULL;
+#endif
+
+		m_sock_state = SOCKSTATE_NOTINITED;
+
+		m_sock_domain = sock_domain;
+		m_sock_type = sock_type;
+		m_sock_proto = sock_proto;
+		m_bUseSSL = bUseSSL;
+		m_sslstate = 0;
+
+		m_conf_bautoreconnect = false;
+		m_autoreconn_spmsg = NULL;
+		m_conf_recvdatabufsize = recvdatabufsize;
+
+		m_startworkerposthandler = startworkerposthandler;
+		m_stopworkerhandler = stopworkerhandler;
+
+		m_connectedhandler = connectedhandler;
+		m_recvhandler = recvhandler;
+		m_disconnectedhandler = disconnectedhandler;
+
+		do {
+#ifdef USE_OPENSSL
+			if (m_bUseSSL)
+			{
+				if (_sslInitContext(ssl_method) != 1)
+				{
+					retval = -1;
+					break;
+				}
+			}
+#endif
+
+			if(m_pengine == NULL)
+				m_pengine = JsSocketEngine::getDefault();
+			if(m_pengine == NULL)
+			{
+				retval = -ENODEV;
+				break;
+			}
+			m_ploop = m_pengine->nextLoop();
+			if(m_ploop == NULL)
+			{
+				retval = -ENODEV;
+				break;
+			}
+
+			m_pengctx = new WorkerThreadInternalContext(this, m_ploop->getIndex(), this);
+			retval = _engine_initRecv();
+			if(retval <= 0)
+				break;
+
+			/* the start handler runs on the loop thread, as it did on the worker thread */
+			retval = 1;
+			m_ploop->invoke(_engine_attachProc, this, &retval);
+		}while(0);
+
+		if(retval <= 0)
+		{
+			if(m_pengctx != NULL)
+			{
+				if(m_pengctx->precvbuf != NULL)
+					free(m_pengctx->precvbuf);
+				delete m_pengctx;
+				m_pengctx = NULL;
+			}
+			m_ploop = NULL;
+		}else{
+			m_sock_state = SOCKSTATE_CLOSED;
+		}
+
+		return retval;
+	}
+
+	/*
+	 * Receive buffer of m_pengctx : a fixed one, or the starting read size of the pooled path.
+	 */
+	int JsClientSocket::_engine_initRecv()
+	{
+		if(m_recvchunkhandler != NULL)
+		{
+			if(m_precvpool == NULL)
+				m_precvpool = BufferPool::getDefault();
+			m_recvsize = (int)m_conf_recvdatabufsize;
+			if(m_recvsize < m_precvpool->getMinSize())
+				m_recvsize = m_precvpool->getMinSize();
+			if(m_recvsize > m_precvpool->getMaxSize())
+				m_recvsize = m_precvpool->getMaxSize();
+			m_recv_smallreads = 0;
+			return 1;
+		}
+		m_pengctx->precvbuf = (char*)malloc(m_conf_recvdatabufsize);
+		if(m_pengctx->precvbuf == NULL)
+			return -ENOMEM;
+		return 1;
+	}
+
+	/*
+	 * JsServerSocket : adopts an accepted descriptor on ploop (its thread only).
+	 * There is no start/stop worker handler per accepted socket, the server runs those per loop.
+	 * On failure sock stays with the caller.
+	 */
+	int JsClientSocket::_engine_accept(JsSocketEngine::Loop *ploop, JSCUTILS_SOCKET_T sock, void *pthreaduserctx, long recvdatabufsize, Client_ConnectedHandler_t connectedhandler, Client_RecvHandler_t recvhandler, Client_DisconnectedHandler_t disconnectedhandler)
+	{
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+		int rc;
+
+		if(::getsockname(sock, (struct sockaddr*)&addr, &addrlen) < 0)
+			return -errno;
+
+		m_sock_domain = addr.ss_family;
+		m_sock_type = SOCK_STREAM;
+		m_sock_proto = 0;
+		m_bUseSSL = false;
+		m_sslstate = 0;
+		m_conf_bautoreconnect = false;
+		m_autoreconn_spmsg = NULL;
+		m_conf_recvdatabufsize = recvdatabufsize;
+		m_startworkerposthandler = NULL;
+		m_stopworkerhandler = NULL;
+		m_connectedhandler = connectedhandler;
+		m_recvhandler = recvhandler;
+		m_disconnectedhandler = disconnectedhandler;
+
+		m_pengine = ploop->getEngine();
+		m_ploop = ploop;
+		m_pengctx = new WorkerThreadInternalContext(this, ploop->getIndex(), pthreaduserctx);
+		rc = _engine_initRecv();
+		if(rc <= 0)
+		{
+			delete m_pengctx;
+			m_pengctx = NULL;
+			m_ploop = NULL;
+			return rc;
+		}
+
+		m_sendlock.lock();
+		m_sock = sock;
+		m_sendlock.unlock();
+		m_sock_state = SOCKSTATE_CONNECTING;
+		rc = ploop->addChannel(&m_channel, sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		if(rc != 1)
+		{
+			m_sendlock.lock();
+			m_sock = INVALID_SOCKET;
+			m_sendlock.unlock();
+			m_sock_state = SOCKSTATE_CLOSED;
+			return rc;
+		}
+		_engine_established();
+		return 1;
+	}
+
+	void JsClientSocket::enableMetrics(SocketMetrics *paggregate, int tcpinfointervalms)
+	{
+		if(m_pmetrics == NULL)
+			m_pmetrics = new SocketMetrics();
+		m_pmetricsaggr = paggregate;
+		m_conf_tcpinfointervalms = (tcpinfointervalms > 0) ? tcpinfointervalms : 0;
+	}
+
+	void JsClientSocket::_metricsAdd(volatile int64_t SocketMetrics::*pfield, int64_t value)
+	{
+		m_pmetrics->add(&(m_pmetrics->*pfield), value);
+		if(m_pmetricsaggr != NULL)
+			m_pmetricsaggr->add(&(m_pmetricsaggr->*pfield), value);
+	}
+
+	void JsClientSocket::_metricsQueue(int delta)
+	{
+		int64_t depth = __sync_add_and_fetch(&m_pmetrics->sendqueue_depth, delta);
+		m_pmetrics->setMax(&m_pmetrics->sendqueue_depth_max, depth);
+		if(m_pmetricsaggr != NULL)
+		{
+			depth = __sync_add_and_fetch(&m_pmetricsaggr->sendqueue_depth, delta);
+			m_pmetricsaggr->setMax(&m_pmetricsaggr->sendqueue_depth_max, depth);
+		}
+	}
+
+	void JsClientSocket::_metricsRecv(int len, int64_t handlerns)
+	{
+		_metricsAdd(&SocketMetrics::bytes_received, len);
+		_metricsAdd(&SocketMetrics::messages_received, 1);
+		m_pmetrics->recordRecvHandler(handlerns);
+		if(m_pmetricsaggr != NULL)
+			m_pmetricsaggr->recordRecvHandler(handlerns);
+	}
+
+	void JsClientSocket::_metricsSent(int64_t startns)
+	{
+		int64_t ns = _nowNs() - startns;
+		m_pmetrics->recordSent(ns);
+		if(m_pmetricsaggr != NULL)
+			m_pmetricsaggr->recordSent(ns);
+	}
+
+	/*
+	 * Loop thread, while m_sock is open.
+	 */
+	void JsClientSocket::_engine_sampleTcpInfo()
+	{
+		struct tcp_info info;
+		socklen_t infolen = sizeof(info);
+		int64_t retrans;
+
+		memset(&info, 0, sizeof(info));
+		/* not TCP (e.g. AF_UNIX) : nothing to sample */
+		if(::getsockopt(m_sock, IPPROTO_TCP, TCP_INFO, &info, &infolen) < 0)
+			return;
+		m_pmetrics->store(&m_pmetrics->rtt_us, info.tcpi_rtt);
+		m_pmetrics->store(&m_pmetrics->rttvar_us, info.tcpi_rttvar);
+		if(m_pmetricsaggr != NULL)
+		{
+			m_pmetricsaggr->store(&m_pmetricsaggr->rtt_us, info.tcpi_rtt);
+			m_pmetricsaggr->store(&m_pmetricsaggr->rttvar_us, info.tcpi_rttvar);
+		}
+		_metricsAdd(&SocketMetrics::rtt_us_total, info.tcpi_rtt);
+		_metricsAdd(&SocketMetrics::rtt_samples, 1);
+		/* tcpi_total_retrans counts per connection; only what is new since the last sample is added */
+		retrans = info.tcpi_total_retrans;
+		if(retrans > m_tcpinfo_lastretrans)
+			_metricsAdd(&SocketMetrics::retransmits, retrans - m_tcpinfo_lastretrans);
+		m_tcpinfo_lastretrans = retrans;
+	}
+
+	void JsClientSocket::_engine_tcpInfoProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+
+		psockctx->m_tcpinfo_timerid = 0;
+		if(psockctx->m_sock_state < SOCKSTATE_CONNECTED)
+			return;
+		psockctx->_engine_sampleTcpInfo();
+		psockctx->m_tcpinfo_timerid = psockctx->m_ploop->addTimer(psockctx->m_conf_tcpinfointervalms, _engine_tcpInfoProc, psockctx, NULL);
+	}
+
+	void JsClientSocket::setResolver(DnsResolver *presolver)
+	{
+		m_presolver = presolver;
+	}
+
+	void JsClientSocket::setHappyEyeballsDelay(long delayms)
+	{
+		m_conf_attemptdelayms = delayms;
+	}
+
+	void JsClientSocket::setConnectTimeouts(long resolvems, long tcpms, long sslms)
+	{
+		m_conf_resolvetimeoutms = resolvems;
+		m_conf_tcptimeoutms = tcpms;
+		m_conf_ssltimeoutms = sslms;
+	}
+
+	void JsClientSocket::_engine_attachProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+		WorkerThreadInternalContext *pctx = psockctx->m_pengctx;
+		int *pretval = (int*)param2;
+		int nrst;
+
+		if(psockctx->m_startworkerposthandler != NULL)
+		{
+			if((nrst = psockctx->m_startworkerposthandler(psockctx, pctx->threadidx, &pctx->pthreaduserctx)) <= 0)
+			{
+				*pretval = nrst;
+				return;
+			}
+			pctx->inited_userhandler = true;
+		}
+	}
+
+	void JsClientSocket::_engine_detachProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+		WorkerThreadInternalContext *pctx = psockctx->m_pengctx;
+
+		psockctx->m_conf_bautoreconnect = false;
+		if(psockctx->m_reconnect_timerid != 0)
+		{
+			psockctx->m_ploop->cancelTimer(psockctx->m_reconnect_timerid);
+			psockctx->m_reconnect_timerid = 0;
+		}
+		psockctx->_engine_close(0, false);
+		psockctx->m_autoreconn_spmsg = NULL;
+
+		if(pctx != NULL)
+		{
+			if(psockctx->m_stopworkerhandler != NULL && pctx->inited_userhandler)
+			{
+				psockctx->m_stopworkerhandler(psockctx, pctx->threadidx, pctx->pthreaduserctx);
+				pctx->inited_userhandler = false;
+			}
+			if(pctx->precvbuf != NULL)
+			{
+				free(pctx->precvbuf);
+				pctx->precvbuf = NULL;
+			}
+			delete pctx;
+			psockctx->m_pengctx = NULL;
+		}
+	}
+
+	/*
+	 * The connected descriptor of the winning attempt becomes m_sock. On failure it is closed.
+	 */
+	int JsClientSocket::_engine_adoptSocket(JSCUTILS_SOCKET_T sock)
+	{
+#ifdef USE_OPENSSL
+		SSL *pSSL = NULL;
+
+		if(m_bUseSSL)
+		{
+			pSSL = SSL_new(m_pSSLCtx);
+			if(pSSL == NULL)
+			{
+				::closesocket(sock);
+				return -1;
+			}
+			/* the send queue retries from a moving offset */
+			SSL_set_mode(pSSL, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		}
+#endif
+
+		_closeSocket();
+		m_sendlock.lock();
+		m_sock = sock;
+		m_sendlock.unlock();
+#ifdef USE_OPENSSL
+		m_sock_pSSL = pSSL;
+#endif
+
+		return 1;
+	}
+
+	/*
+	 * Releases the descriptor only; state, handlers and reconnect are _engine_close's job.
+	 */
+	int JsClientSocket::_closeSocket(int code)
+	{
+#ifdef USE_OPENSSL
+		if(m_sock_pSSL != NULL)
+		{
+			/*
+			 * SSL_free() takes a connection that was not shut down for a broken one and makes its session
+			 * unresumable. Only an error should do that, not a plain close.
+			 */
+			if((m_sslstate == 2) && (code >= 0))
+				SSL_set_shutdown(m_sock_pSSL, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+			SSL_free(m_sock_pSSL);
+			m_sock_pSSL = NULL;
+		}
+#endif
+		m_sendlock.lock();
+		if(m_sock != INVALID_SOCKET)
+		{
+			::shutdown(m_sock, SHUT_RDWR);
+			::closesocket(m_sock);
+			m_sock = INVALID_SOCKET;
+		}
+		m_sendlock.unlock();
+
+		return 1;
+	}
+
+	void JsClientSocket::_engine_close(int code, bool bReconnect)
+	{
+		int state = m_sock_state.get();
+		std::list<SendChunk> pending;
+		std::list<Client_SentHandler_t> aborted;
+		std::list<Client_SentHandler_t>::iterator iter;
+		UringSendBatch *pbatch = NULL;
+		int i;
+
+		if(m_read_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_read_timerid);
+			m_read_timerid = 0;
+		}
+		if(m_phase_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_phase_timerid);
+			m_phase_timerid = 0;
+		}
+		if(m_tcpinfo_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_tcpinfo_timerid);
+			m_tcpinfo_timerid = 0;
+		}
+		if(m_pmetrics != NULL)
+		{
+			if(state >= SOCKSTATE_CONNECTED)
+			{
+				_engine_sampleTcpInfo();
+				_metricsAdd(&SocketMetrics::disconnects, 1);
+			}else if((m_connect_spmsg.getPtr() != NULL) && (code < 0))
+			{
+				_metricsAdd(&SocketMetrics::connect_failures, 1);
+			}
+		}
+		if(m_presolvetoken != NULL)
+		{
+			ResolveToken *ptoken = m_presolvetoken;
+			m_presolvetoken = NULL;
+			/* waits if the handler is running right now, so posted is settled afterwards */
+			if((m_presolver->cancel(ptoken->requestid) == 1) || !ptoken->posted)
+				delete ptoken;
+			else
+				ptoken->psockctx = NULL;
+		}
+		_engine_dropAttempts();
+		m_connect_addrs.clear();
+		m_sendlock.lock();
+		/* written with MSG_ZEROCOPY but never confirmed */
+		pending.swap(m_zcqueue);
+		if(m_sendinflight)
+		{
+			/* the kernel may still read the buffers of the request in flight */
+			pbatch = m_psendbatch;
+			m_psendbatch = NULL;
+			for(i = 0; (i < m_sendbatchchunks) && !m_sendqueue.empty(); i++)
+			{
+				if(m_sendqueue.front().senthandler != NULL)
+					aborted.push_back(m_sendqueue.front().senthandler);
+				pbatch->chunks.splice(pbatch->chunks.end(), m_sendqueue, m_sendqueue.begin());
+				if(m_pmetrics != NULL)
+					_metricsQueue(-1);
+			}
+			m_sendinflight = false;
+			m_sendbatchchunks = 0;
+		}
+		m_uring_io = false;
+		m_zc_enabled = false;
+		m_zc_ranges.clear();
+		m_sendlock.unlock();
+		if(pbatch != NULL)
+			m_ploop->deferRelease(&m_channel, _engine_releaseBatchProc, pbatch, NULL);
+		if(m_channel.isRegistered())
+			m_ploop->removeChannel(&m_channel);
+
+#ifdef USE_OPENSSL
+		/* closed or failed before the handshake completed */
+		if((m_sslstate == 1) && (m_sock_pSSL != NULL))
+			m_spsslctx->endHandshake(m_sock_pSSL, false, _nowUs() - m_ssl_handshakestart);
+#endif
+		_closeSocket(code);
+		m_sendlock.lock();
+		pending.splice(pending.end(), m_sendqueue);
+		m_sendlock.unlock();
+
+		m_sslstate = 0;
+		if(m_pframedecoder != NULL)
+			m_pframedecoder->reset();
+		if(state > SOCKSTATE_CLOSED)
+		{
+			m_sock_state = SOCKSTATE_CLOSED;
+		}
+
+		if(m_connect_spmsg.getPtr() != NULL)
+		{
+			_engine_connectDone((code < 0) ? code : -ECONNABORTED);
+		}
+		if(state >= SOCKSTATE_CONNECTED)
+		{
+			if(m_disconnectedhandler)
+			{
+				m_disconnectedhandler(this, code);
+			}
+		}
+		for(iter = aborted.begin(); iter != aborted.end(); iter++)
+			(*iter)(this, 0);
+		_engine_finishChunks(pending, 0);
+
+		if(bReconnect && m_conf_bautoreconnect && (m_autoreconn_spmsg.getPtr() != NULL) && (m_reconnect_timerid == 0))
+		{
+			m_reconnect_timerid = m_ploop->addTimer(1000, _engine_reconnectProc, this, NULL);
+		}
+	}
+
+	int JsClientSocket::beginDisconnect()
+	{
+		if(m_ploop == NULL)
+			return 0;
+		return m_ploop->post(_engine_disconnectProc, this, NULL);
+	}
+
+	void JsClientSocket::_engine_disconnectProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+		psockctx->m_conf_bautoreconnect = false;
+		if(psockctx->m_reconnect_timerid != 0)
+		{
+			psockctx->m_ploop->cancelTimer(psockctx->m_reconnect_timerid);
+			psockctx->m_reconnect_timerid = 0;
+		}
+		psockctx->_engine_close(0, false);
+	}
+
+	int JsClientSocket::_engine_beginConnect(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg, bool bAutoReconnect, long timeoutms)
+	{
+		WorkerThreadMessage_Connect *pmsg = (WorkerThreadMessage_Connect*)spmsg.getPtr();
+		void *pdetached;
+		int retval;
+
+		if((m_sock_state <= SOCKSTATE_NOTINITED) || (m_ploop == NULL))
+		{
+			return 0;
+		}
+
+		pmsg->autoreconnect = bAutoReconnect;
+
+		/* the task holds its own reference, taken back by _engine_connectProc */
+		pdetached = spmsg.detach();
+		if(pdetached == NULL)
+			return 0;
+		if(!m_ploop->post(_engine_connectProc, this, pdetached))
+		{
+			JsCPPUtils::SmartPointer<WorkerThreadMessage> spdropped;
+			spdropped.attach(pdetached);
+			return 0;
+		}
+
+		if((timeoutms == 0) || m_ploop->isInLoopThread())
+			return 1;
+
+		pthread_mutex_lock(&m_connect_mutex);
+		if(timeoutms < 0)
+		{
+			while(!pmsg->completed)
+				pthread_cond_wait(&m_connect_cond, &m_connect_mutex);
+		}else{
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += timeoutms / 1000;
+			ts.tv_nsec += (timeoutms % 1000) * 1000000;
+			if(ts.tv_nsec >= 1000000000)
+			{
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			while(!pmsg->completed)
+			{
+				if(pthread_cond_timedwait(&m_connect_cond, &m_connect_mutex, &ts) == ETIMEDOUT)
+					break;
+			}
+		}
+		retval = pmsg->completed ? pmsg->retval : 0;
+		pthread_mutex_unlock(&m_connect_mutex);
+
+		return retval;
+	}
+
+	void JsClientSocket::_engine_connectProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg;
+		WorkerThreadMessage_Connect *pmsg;
+
+		spmsg.attach(param2);
+		pmsg = (WorkerThreadMessage_Connect*)spmsg.getPtr();
+
+		psockctx->m_conf_bautoreconnect = pmsg->autoreconnect;
+		if(pmsg->autoreconnect)
+			psockctx->m_autoreconn_spmsg = spmsg;
+		else
+			psockctx->m_autoreconn_spmsg = NULL;
+		psockctx->_engine_connect(spmsg);
+	}
+
+	void JsClientSocket::_engine_reconnectProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+
+		psockctx->m_reconnect_timerid = 0;
+		if(psockctx->m_conf_bautoreconnect && (psockctx->m_autoreconn_spmsg.getPtr() != NULL) && (psockctx->m_sock_state == SOCKSTATE_CLOSED))
+		{
+			if(psockctx->m_pmetrics != NULL)
+				psockctx->_metricsAdd(&SocketMetrics::reconnects, 1);
+			psockctx->_engine_connect(psockctx->m_autoreconn_spmsg);
+		}
+	}
+
+	void JsClientSocket::_engine_readProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+
+		psockctx->m_read_timerid = 0;
+		if(psockctx->m_sock_state >= SOCKSTATE_CONNECTED)
+			psockctx->_engine_read();
+	}
+
+	void JsClientSocket::_engine_connect(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg)
+	{
+		WorkerThreadMessage_Connect *pmsg = (WorkerThreadMessage_Connect*)spmsg.getPtr();
+		DnsResolver::Result result;
+		ResolveToken *ptoken;
+		int64_t requestid;
+		int rc;
+
+		if(m_reconnect_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_reconnect_timerid);
+			m_reconnect_timerid = 0;
+		}
+		_engine_close(0, false);
+
+		pthread_mutex_lock(&m_connect_mutex);
+		pmsg->completed = false;
+		pmsg->retval = 0;
+		pthread_mutex_unlock(&m_connect_mutex);
+		m_connect_spmsg = spmsg;
+		m_sock_state = SOCKSTATE_CONNECTING;
+		memset(&m_timings, 0, sizeof(m_timings));
+		m_connect_start = _nowUs();
+#ifdef USE_OPENSSL
+		if(m_bUseSSL)
+			_engine_sslPrepare(pmsg);
+#endif
+
+		if(!pmsg->remote_bUseHostname)
+		{
+			DnsResolver::Address address;
+			memset(&address, 0, sizeof(address));
+			memcpy(&address.addr, &pmsg->remote_sockaddr, sizeof(address.addr));
+			address.addrlen = (socklen_t)pmsg->remote_sockaddrlen;
+			if(address.addr.ss_family == AF_UNSPEC)
+				address.addr.ss_family = m_sock_domain;
+			_engine_startAttempts(std::vector<DnsResolver::Address>(1, address));
+			return;
+		}
+
+		if(m_presolver == NULL)
+			m_presolver = DnsResolver::getDefault();
+		rc = m_presolver->lookup(pmsg->remote_strHostname.c_str(), pmsg->remote_port, m_sock_domain, m_sock_type, &result);
+		if(rc != 0)
+		{
+			m_timings.dns_cached = (rc == 1) ? result.cached : true;
+			if(rc != 1)
+				result.result = rc;
+			_engine_resolved(result);
+			return;
+		}
+
+		ptoken = new ResolveToken();
+		ptoken->psockctx = this;
+		ptoken->requestid = 0;
+		ptoken->posted = false;
+		m_presolvetoken = ptoken;
+		/* the handler only posts back here, so it cannot run into the token before requestid is set */
+		requestid = m_presolver->resolve(pmsg->remote_strHostname.c_str(), pmsg->remote_port, m_sock_domain, m_sock_type, _engine_resolveHandler, ptoken, NULL);
+		if(requestid <= 0)
+		{
+			m_presolvetoken = NULL;
+			delete ptoken;
+			_engine_close((requestid < 0) ? (int)requestid : -1, true);
+			return;
+		}
+		ptoken->requestid = requestid;
+		_engine_setPhaseTimer(m_conf_resolvetimeoutms);
+	}
+
+	/*
+	 * On a resolver thread.
+	 */
+	void JsClientSocket::_engine_resolveHandler(DnsResolver *presolver, void *param1, void *param2, const DnsResolver::Result &result)
+	{
+		ResolveToken *ptoken = (ResolveToken*)param1;
+		JsClientSocket *psockctx = ptoken->psockctx;
+
+		ptoken->result = result;
+		/* once posted the token may be gone at any time; if the loop is stopped it stays for _engine_close */
+		ptoken->posted = true;
+		if(psockctx->m_ploop->post(_engine_resolvedProc, ptoken, NULL) != 1)
+			ptoken->posted = false;
+	}
+
+	void JsClientSocket::_engine_resolvedProc(void *param1, void *param2)
+	{
+		ResolveToken *ptoken = (ResolveToken*)param1;
+		JsClientSocket *psockctx = ptoken->psockctx;
+
+		if((psockctx == NULL) || (psockctx->m_presolvetoken != ptoken))
+		{
+			delete ptoken;
+			return;
+		}
+		psockctx->m_presolvetoken = NULL;
+		psockctx->_engine_resolved(ptoken->result);
+		delete ptoken;
+	}
+
+	void JsClientSocket::_engine_resolved(const DnsResolver::Result &result)
+	{
+		if(m_phase_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_phase_timerid);
+			m_phase_timerid = 0;
+		}
+		m_timings.resolve_us = _nowUs() - m_connect_start;
+		if(result.result != 1)
+		{
+			_engine_close(result.result, true);
+			return;
+		}
+		_engine_startAttempts(result.addrs);
+	}
+
+	void JsClientSocket::_engine_startAttempts(const std::vector<DnsResolver::Address> &addrs)
+	{
+		WorkerThreadMessage_Connect *pmsg = (WorkerThreadMessage_Connect*)m_connect_spmsg.getPtr();
+		size_t i;
+
+		m_connect_addrs.clear();
+		for(i = 0; i < addrs.size(); i++)
+		{
+			/* a local address pins the family */
+			if(pmsg->local_bUse && (addrs[i].addr.ss_family != pmsg->local_sockaddr.ss_family))
+				continue;
+			m_connect_addrs.push_back(addrs[i]);
+		}
+		m_connect_next = 0;
+		m_connect_lasterror = m_connect_addrs.empty() ? -EAFNOSUPPORT : 0;
+		m_connect_tcpstart = _nowUs();
+		_engine_setPhaseTimer(m_conf_tcptimeoutms);
+		_engine_nextAttempt();
+	}
+
+	/*
+	 * Starts connect()s until one is in progress, or until the addresses run out.
+	 * Fails the connect once nothing is left in flight.
+	 */
+	void JsClientSocket::_engine_nextAttempt()
+	{
+		WorkerThreadMessage_Connect *pmsg = (WorkerThreadMessage_Connect*)m_connect_spmsg.getPtr();
+
+		if(m_attempt_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_attempt_timerid);
+			m_attempt_timerid = 0;
+		}
+
+		while(m_connect_next < m_connect_addrs.size())
+		{
+			const DnsResolver::Address &address = m_connect_addrs[m_connect_next++];
+			ConnectAttempt *pattempt = new ConnectAttempt();
+			int nrst;
+			int rc;
+
+			pattempt->psockctx = this;
+			pattempt->paddr = &address.addr;
+			pattempt->addrlen = address.addrlen;
+			m_timings.attempts++;
+			do {
+				pattempt->sock = ::socket(address.addr.ss_family, m_sock_type | SOCK_NONBLOCK | SOCK_CLOEXEC, m_sock_proto);
+				if(pattempt->sock == INVALID_SOCKET)
+				{
+					nrst = -errno;
+					break;
+				}
+				if(pmsg->local_bUse)
+				{
+					rc = ::bind(pattempt->sock, (struct sockaddr*)&pmsg->local_sockaddr, pmsg->local_sockaddrlen);
+					if(rc < 0)
+					{
+						nrst = -errno;
+						break;
+					}
+				}
+				rc = ::connect(pattempt->sock, (const struct sockaddr*)&address.addr, address.addrlen);
+				if((rc < 0) && (errno != EINPROGRESS))
+				{
+					nrst = -errno;
+					break;
+				}
+				nrst = m_ploop->addChannel(pattempt, pattempt->sock, EPOLLOUT);
+				if(nrst != 1)
+					break;
+				m_attempts.push_back(pattempt);
+				/* an immediate connect (e.g. AF_UNIX) still reports EPOLLOUT */
+				if((m_conf_attemptdelayms > 0) && (m_connect_next < m_connect_addrs.size()))
+					m_attempt_timerid = m_ploop->addTimer(m_conf_attemptdelayms, _engine_attemptTimerProc, this, NULL);
+				return;
+			}while(0);
+
+			m_connect_lasterror = (nrst < 0) ? nrst : -1;
+			_engine_dropAttempt(pattempt, true);
+		}
+
+		if(m_attempts.empty())
+			_engine_close((m_connect_lasterror < 0) ? m_connect_lasterror : -ECONNREFUSED, true);
+	}
+
+	void JsClientSocket::ConnectAttempt::onEvent(uint32_t events)
+	{
+		psockctx->_engine_attemptEvent(this, events);
+	}
+
+	void JsClientSocket::_engine_attemptEvent(ConnectAttempt *pattempt, uint32_t events)
+	{
+		int soerr = 0;
+		socklen_t soerrlen = sizeof(soerr);
+		WorkerThreadMessage_Connect *pmsg = (WorkerThreadMessage_Connect*)m_connect_spmsg.getPtr();
+		JSCUTILS_SOCKET_T sock;
+		int nrst;
+
+		if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+			return;
+		if(::getsockopt(pattempt->sock, SOL_SOCKET, SO_ERROR, &soerr, &soerrlen) < 0)
+			soerr = errno;
+		m_attempts.remove(pattempt);
+		if(soerr != 0)
+		{
+			m_connect_lasterror = -soerr;
+			_engine_dropAttempt(pattempt, true);
+			_engine_nextAttempt();
+			return;
+		}
+
+		/* the winner : the others are given up */
+		sock = pattempt->sock;
+		m_timings.tcp_us = _nowUs() - m_connect_tcpstart;
+		m_timings.family = pattempt->paddr->ss_family;
+		if(pmsg != NULL)
+		{
+			memcpy(&pmsg->remote_sockaddr, pattempt->paddr, pattempt->addrlen);
+			pmsg->remote_sockaddrlen = pattempt->addrlen;
+		}
+		_engine_dropAttempt(pattempt, false);
+		_engine_dropAttempts();
+		m_connect_addrs.clear();
+		if(m_attempt_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_attempt_timerid);
+			m_attempt_timerid = 0;
+		}
+		if(m_phase_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_phase_timerid);
+			m_phase_timerid = 0;
+		}
+
+		nrst = _engine_adoptSocket(sock);
+		if(nrst == 1)
+			nrst = m_ploop->addChannel(&m_channel, m_sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+		if(nrst != 1)
+		{
+			_engine_close((nrst < 0) ? nrst : -1, true);
+			return;
+		}
+		_engine_established();
+	}
+
+	/*
+	 * Loop thread. The attempt is deleted by a task, as this may run from its own onEvent.
+	 */
+	void JsClientSocket::_engine_dropAttempt(ConnectAttempt *pattempt, bool bCloseSocket)
+	{
+		if(pattempt->isRegistered())
+			m_ploop->removeChannel(pattempt);
+		if(bCloseSocket && (pattempt->sock != INVALID_SOCKET))
+			::closesocket(pattempt->sock);
+		pattempt->sock = INVALID_SOCKET;
+		pattempt->psockctx = NULL;
+		if(!m_ploop->post(_engine_deleteAttemptProc, pattempt, NULL))
+			delete pattempt;
+	}
+
+	void JsClientSocket::_engine_dropAttempts()
+	{
+		std::list<ConnectAttempt*> attempts;
+		std::list<ConnectAttempt*>::iterator iter;
+
+		if(m_attempt_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_attempt_timerid);
+			m_attempt_timerid = 0;
+		}
+		attempts.swap(m_attempts);
+		for(iter = attempts.begin(); iter != attempts.end(); iter++)
+			_engine_dropAttempt(*iter, true);
+	}
+
+	void JsClientSocket::_engine_deleteAttemptProc(void *param1, void *param2)
+	{
+		delete (ConnectAttempt*)param1;
+	}
+
+	void JsClientSocket::_engine_attemptTimerProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+
+		psockctx->m_attempt_timerid = 0;
+		psockctx->_engine_nextAttempt();
+	}
+
+	void JsClientSocket::_engine_setPhaseTimer(long timeoutms)
+	{
+		if(m_phase_timerid != 0)
+		{
+			m_ploop->cancelTimer(m_phase_timerid);
+			m_phase_timerid = 0;
+		}
+		if(timeoutms > 0)
+			m_phase_timerid = m_ploop->addTimer(timeoutms, _engine_phaseTimerProc, this, NULL);
+	}
+
+	void JsClientSocket::_engine_phaseTimerProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+
+		psockctx->m_phase_timerid = 0;
+		psockctx->_engine_close(-ETIMEDOUT, true);
+	}
+
+#ifdef USE_OPENSSL
+	/*
+	 * Sessions are cached per host:port as given to beginConnect : the hostname when there is one
+	 * (also sent as SNI unless it is an address literal), otherwise the numeric address.
+	 */
+	void JsClientSocket::_engine_sslPrepare(WorkerThreadMessage_Connect *pmsg)
+	{
+		char szHost[NI_MAXHOST];
+		char szPort[NI_MAXSERV];
+		unsigned char addrbuf[sizeof(struct in6_addr)];
+
+		m_ssl_strServerName.clear();
+		if(pmsg->remote_bUseHostname)
+		{
+			snprintf(szPort, sizeof(szPort), "%u", (unsigned int)pmsg->remote_port);
+			m_ssl_strSessionKey = pmsg->remote_strHostname;
+			if((inet_pton(AF_INET, pmsg->remote_strHostname.c_str(), addrbuf) != 1) &&
+				(inet_pton(AF_INET6, pmsg->remote_strHostname.c_str(), addrbuf) != 1))
+				m_ssl_strServerName = pmsg->remote_strHostname;
+		}else{
+			if(::getnameinfo((const struct sockaddr*)&pmsg->remote_sockaddr, pmsg->remote_sockaddrlen, szHost, sizeof(szHost), szPort, sizeof(szPort), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+			{
+				szHost[0] = 0;
+				szPort[0] = 0;
+			}
+			m_ssl_strSessionKey = szHost;
+		}
+		m_ssl_strSessionKey.append(":");
+		m_ssl_strSessionKey.append(szPort);
+	}
+#endif
+
+	int64_t JsClientSocket::_nowUs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	int64_t JsClientSocket::_nowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	void JsClientSocket::_engine_connectDone(int result)
+	{
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg = m_connect_spmsg;
+		WorkerThreadMessage_Connect *pmsg = (WorkerThreadMessage_Connect*)spmsg.getPtr();
+
+		if(pmsg == NULL)
+			return;
+		m_connect_spmsg = NULL;
+
+		pthread_mutex_lock(&m_connect_mutex);
+		pmsg->retval = result;
+		pmsg->completed = true;
+		pthread_cond_broadcast(&m_connect_cond);
+		pthread_mutex_unlock(&m_connect_mutex);
+	}
+
+	void JsClientSocket::_engine_established()
+	{
+		int nrst;
+
+#ifdef USE_OPENSSL
+		if(m_bUseSSL)
+		{
+			int rc;
+			if(m_sslstate == 0)
+			{
+				ERR_clear_error();
+				if(SSL_set_fd(m_sock_pSSL, (int)m_sock) != 1)
+				{
+					_engine_close(-1, true);
+					return;
+				}
+				SSL_set_connect_state(m_sock_pSSL);
+				m_spsslctx->beginHandshake(m_sock_pSSL, m_ssl_strSessionKey, m_ssl_strServerName.empty() ? NULL : m_ssl_strServerName.c_str());
+				m_ssl_handshakestart = _nowUs();
+				m_sslstate = 1;
+				m_sock_state = SOCKSTATE_CONNECTING_SSL;
+				_engine_setPhaseTimer(m_conf_ssltimeoutms);
+			}
+			ERR_clear_error();
+			rc = SSL_do_handshake(m_sock_pSSL);
+			if(rc != 1)
+			{
+				int sslerr = SSL_get_error(m_sock_pSSL, rc);
+				if((sslerr == SSL_ERROR_WANT_READ) || (sslerr == SSL_ERROR_WANT_WRITE))
+					return;
+				ERR_print_errors_fp(stderr);
+				_engine_close(-1, true);
+				return;
+			}
+			m_timings.ssl_us = _nowUs() - m_ssl_handshakestart;
+			m_spsslctx->endHandshake(m_sock_pSSL, true, m_timings.ssl_us);
+			m_sslstate = 2;
+			if(m_phase_timerid != 0)
+			{
+				m_ploop->cancelTimer(m_phase_timerid);
+				m_phase_timerid = 0;
+			}
+		}
+#endif
+
+		m_sendlock.lock();
+		m_uring_io = !m_bUseSSL && m_ploop->hasCompletionIo();
+		m_zc_nextid = 0;
+		m_zc_done = 0;
+		m_zc_ranges.clear();
+		m_zc_enabled = false;
+		if((m_zc_threshold > 0) && !m_bUseSSL && !m_uring_io)
+		{
+			int one = 1;
+			m_zc_enabled = (::setsockopt(m_sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+		}
+		m_sendlock.unlock();
+		m_sock_state = SOCKSTATE_CONNECTED;
+		if(m_connect_spmsg.getPtr() != NULL)
+			m_timings.total_us = _nowUs() - m_connect_start;
+		if(m_pmetrics != NULL)
+		{
+			_metricsAdd(&SocketMetrics::connects, 1);
+			m_tcpinfo_lastretrans = 0;
+			_engine_sampleTcpInfo();
+			if(m_conf_tcpinfointervalms > 0)
+				m_tcpinfo_timerid = m_ploop->addTimer(m_conf_tcpinfointervalms, _engine_tcpInfoProc, this, NULL);
+		}
+
+		nrst = (m_connectedhandler != NULL) ? m_connectedhandler(this, m_pengctx->pthreaduserctx, m_sock) : 1;
+		_engine_connectDone(nrst);
+		if(nrst != 1)
+		{
+			m_sock_state = SOCKSTATE_CLOSED;
+			_engine_close(nrst, true);
+			return;
+		}
+
+		if(m_uring_io)
+		{
+			/* data and EOF now arrive as recv completions, readiness is no longer needed */
+			m_ploop->modChannel(&m_channel, 0);
+			m_ploop->startRecv(&m_channel);
+			_engine_flush();
+			return;
+		}
+
+		/* data may have arrived with the edge that completed the connect */
+		_engine_read();
+		if(m_sock_state >= SOCKSTATE_CONNECTED)
+			_engine_flush();
+	}
+
+	void JsClientSocket::_engine_onEvent(uint32_t events)
+	{
+		int state = m_sock_state.get();
+
+		if(state == SOCKSTATE_CONNECTING_SSL)
+		{
+			_engine_established();
+			return;
+		}
+		if(state < SOCKSTATE_CONNECTED)
+			return;
+
+		if(events & EPOLLERR)
+		{
+			std::list<SendChunk> done;
+			m_sendlock.lock();
+			if(m_zc_nextid != m_zc_done)
+				_engine_readErrQueue(done);
+			m_sendlock.unlock();
+			_engine_finishChunks(done, 1);
+		}
+		if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			_engine_read();
+		if((m_sock_state >= SOCKSTATE_CONNECTED) && (events & EPOLLOUT))
+			_engine_flush();
+	}
+
+	/*
+	 * @return bytes read, 0 on orderly close, -EAGAIN when drained, negative errno on error
+	 */
+	int JsClientSocket::_engine_rawRead(char *pbuf, int size)
+	{
+		int rc;
+#ifdef USE_OPENSSL
+		if(m_bUseSSL)
+		{
+			ERR_clear_error();
+			errno = 0;
+			rc = ::SSL_read(m_sock_pSSL, pbuf, size);
+			if(rc <= 0)
+			{
+				int sslerr = SSL_get_error(m_sock_pSSL, rc);
+				switch(sslerr)
+				{
+				case SSL_ERROR_WANT_READ:
+				case SSL_ERROR_WANT_WRITE:
+					return -EAGAIN;
+				case SSL_ERROR_ZERO_RETURN:
+					return 0;
+				case SSL_ERROR_SYSCALL:
+					if(rc == 0 || errno == 0)
+						return 0;
+					return -errno;
+				default:
+					ERR_print_errors_fp(stderr);
+					return -EPROTO;
+				}
+			}
+			return rc;
+		}
+#endif
+		do {
+			rc = ::recv(m_sock, pbuf, size, 0);
+		}while((rc < 0) && (errno == EINTR));
+		if(rc < 0)
+			return (errno == EWOULDBLOCK) ? -EAGAIN : -errno;
+		return rc;
+	}
+
+	/*
+	 * @return bytes written, -EAGAIN when the socket buffer is full, negative errno on error
+	 */
+	int JsClientSocket::_engine_rawWrite(const char *pbuf, int size)
+	{
+		int rc;
+#ifdef USE_OPENSSL
+		if(m_bUseSSL)
+		{
+			ERR_clear_error();
+			errno = 0;
+			rc = ::SSL_write(m_sock_pSSL, pbuf, size);
+			if(rc <= 0)
+			{
+				int sslerr = SSL_get_error(m_sock_pSSL, rc);
+				if((sslerr == SSL_ERROR_WANT_READ) || (sslerr == SSL_ERROR_WANT_WRITE))
+					return -EAGAIN;
+				ERR_print_errors_fp(stderr);
+				return (errno != 0) ? -errno : -EPROTO;
+			}
+			return rc;
+		}
+#endif
+		do {
+			rc = ::send(m_sock, pbuf, size, MSG_NOSIGNAL);
+		}while((rc < 0) && (errno == EINTR));
+		if(rc < 0)
+			return (errno == EWOULDBLOCK) ? -EAGAIN : -errno;
+		return rc;
+	}
+
+	void JsClientSocket::_engine_read()
+	{
+		char *precvbuf = (m_pengctx != NULL) ? m_pengctx->precvbuf : NULL;
+		BufferPool::Chunk *pchunk;
+		int reads = 0;
+		int nrst;
+		int rc;
+
+		/* edge-triggered : read until the socket is drained, a handler may close it meanwhile */
+		while(m_sock_state >= SOCKSTATE_CONNECTED)
+		{
+			if((m_conf_readbatch > 0) && (reads >= m_conf_readbatch))
+			{
+				/* no further edge comes for the unread rest : pick it up after the other channels */
+				if(m_read_timerid == 0)
+					m_read_timerid = m_ploop->addTimer(0, _engine_readProc, this, NULL);
+				break;
+			}
+			reads++;
+
+			if(m_recvchunkhandler != NULL)
+			{
+				pchunk = m_precvpool->acquire(m_recvsize);
+				if(pchunk == NULL)
+				{
+					_engine_close(-ENOMEM, true);
+					break;
+				}
+				rc = _engine_rawRead(pchunk->getData(), m_recvsize);
+				if(rc > 0)
+				{
+					_engine_adaptRecvSize(rc);
+					nrst = _engine_deliverChunk(pchunk, rc);
+				}
+				pchunk->release();
+			}else{
+				rc = _engine_rawRead(precvbuf, m_conf_recvdatabufsize);
+				nrst = 1;
+				if((rc > 0) && m_recvhandler)
+				{
+					int64_t startns = (m_pmetrics != NULL) ? _nowNs() : 0;
+					nrst = m_recvhandler(this, m_pengctx->pthreaduserctx, rc, precvbuf);
+					if(m_pmetrics != NULL)
+						_metricsRecv(rc, _nowNs() - startns);
+				}
+			}
+			if(rc == -EAGAIN)
+				break;
+			if(rc <= 0)
+			{
+				_engine_close(rc, true);
+				break;
+			}
+			if(nrst != 1)
+			{
+				_engine_close(nrst, true);
+				break;
+			}
+		}
+	}
+
+	int JsClientSocket::_engine_deliverChunk(BufferPool::Chunk *pchunk, int len)
+	{
+		int64_t startns;
+		int nrst;
+
+		if(m_pmetrics == NULL)
+			return m_recvchunkhandler(this, m_pengctx->pthreaduserctx, pchunk, len);
+		startns = _nowNs();
+		nrst = m_recvchunkhandler(this, m_pengctx->pthreaduserctx, pchunk, len);
+		_metricsRecv(len, _nowNs() - startns);
+		return nrst;
+	}
+
+	/*
+	 * A read that filled the chunk means more was waiting : double the next one.
+	 * Only a run of reads using under a quarter of it shrinks it, so one short read in a burst does not.
+	 */
+	void JsClientSocket::_engine_adaptRecvSize(int len)
+	{
+		if(len >= m_recvsize)
+		{
+			m_recv_smallreads = 0;
+			if(m_recvsize < m_precvpool->getMaxSize())
+				m_recvsize *= 2;
+		}else if(len < m_recvsize / 4)
+		{
+			if((++m_recv_smallreads >= 16) && (m_recvsize > m_precvpool->getMinSize()))
+			{
+				m_recvsize /= 2;
+				m_recv_smallreads = 0;
+			}
+		}else{
+			m_recv_smallreads = 0;
+		}
+	}
+
+	void JsClientSocket::_engine_flush()
+	{
+		std::list<SendChunk> done;
+		bool bZeroCopy;
+		int rc;
+
+		m_sendlock.lock();
+		if(m_uring_io)
+		{
+			_engine_submitBatch();
+			m_sendlock.unlock();
+			return;
+		}
+		while(!m_sendqueue.empty() && (m_sock != INVALID_SOCKET))
+		{
+			bZeroCopy = false;
+			if(m_bUseSSL)
+			{
+				SendChunk &chunk = m_sendqueue.front();
+				rc = _engine_rawWrite(chunk.pbuf + chunk.offset, chunk.size - chunk.offset);
+			}else{
+				rc = _engine_writeBatch(&bZeroCopy);
+			}
+			/* errors other than EAGAIN come back as EPOLLERR / EPOLLHUP on the loop */
+			if(rc <= 0)
+				break;
+			/* a partial write (one SSL record) is no EAGAIN : keep going until the socket is full */
+			_engine_consume(rc, bZeroCopy, done);
+		}
+		m_sendlock.unlock();
+
+		_engine_finishChunks(done, 1);
+	}
+
+	/*
+	 * One sendmsg over the queued chunks (plain sockets, under m_sendlock).
+	 * @return bytes written, -EAGAIN or negative errno
+	 */
+	int JsClientSocket::_engine_writeBatch(bool *pbZeroCopy)
+	{
+		struct iovec iov[SEND_IOV_MAX];
+		struct msghdr msg;
+		std::list<SendChunk>::iterator iter;
+		size_t total = 0;
+		int count = 0;
+		bool bZeroCopy;
+		int rc;
+
+		for(iter = m_sendqueue.begin(); (iter != m_sendqueue.end()) && (count < SEND_IOV_MAX); iter++, count++)
+		{
+			iov[count].iov_base = iter->pbuf + iter->offset;
+			iov[count].iov_len = iter->size - iter->offset;
+			total += iov[count].iov_len;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		bZeroCopy = m_zc_enabled && (total >= (size_t)m_zc_threshold);
+		for(;;)
+		{
+			rc = ::sendmsg(m_sock, &msg, MSG_NOSIGNAL | (bZeroCopy ? MSG_ZEROCOPY : 0));
+			if(rc >= 0)
+				break;
+			if(errno == EINTR)
+				continue;
+			/* too many notifications outstanding (optmem_max) : this one goes out copied */
+			if(bZeroCopy && (errno == ENOBUFS))
+			{
+				bZeroCopy = false;
+				continue;
+			}
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? -EAGAIN : -errno;
+		}
+		/* the kernel numbers every zero-copy sendmsg that took data, starting at 0 */
+		if(bZeroCopy && (rc > 0))
+			m_zc_nextid++;
+		*pbZeroCopy = bZeroCopy && (rc > 0);
+		return rc;
+	}
+
+	/*
+	 * io_uring : submits the queued chunks as one IORING_OP_SENDMSG unless one is in flight (under m_sendlock).
+	 */
+	void JsClientSocket::_engine_submitBatch()
+	{
+		std::list<SendChunk>::iterator iter;
+		int count = 0;
+
+		if(m_sendinflight || m_sendqueue.empty() || (m_sock == INVALID_SOCKET))
+			return;
+		if(m_psendbatch == NULL)
+			m_psendbatch = new UringSendBatch();
+		for(iter = m_sendqueue.begin(); (iter != m_sendqueue.end()) && (count < SEND_IOV_MAX); iter++, count++)
+		{
+			m_psendbatch->iov[count].iov_base = iter->pbuf + iter->offset;
+			m_psendbatch->iov[count].iov_len = iter->size - iter->offset;
+		}
+		memset(&m_psendbatch->msg, 0, sizeof(m_psendbatch->msg));
+		m_psendbatch->msg.msg_iov = m_psendbatch->iov;
+		m_psendbatch->msg.msg_iovlen = count;
+		if(m_ploop->submitSendMsg(&m_channel, &m_psendbatch->msg) == 1)
+		{
+			m_sendinflight = true;
+			m_sendbatchchunks = count;
+		}
+	}
+
+	/*
+	 * Takes len written bytes off the front of m_sendqueue (under m_sendlock).
+	 * Finished chunks go to done, or to m_zcqueue while the kernel may still read them;
+	 * later ones queue up behind those so that senthandlers keep the send order.
+	 */
+	void JsClientSocket::_engine_consume(int len, bool bZeroCopy, std::list<SendChunk> &done)
+	{
+		if(m_pmetrics != NULL)
+			_metricsAdd(&SocketMetrics::bytes_sent, len);
+		while((len > 0) && !m_sendqueue.empty())
+		{
+			SendChunk &chunk = m_sendqueue.front();
+			int n = chunk.size - chunk.offset;
+			if(n > len)
+				n = len;
+			chunk.offset += n;
+			len -= n;
+			if(bZeroCopy)
+			{
+				chunk.zc = true;
+				chunk.zcid = m_zc_nextid - 1;
+			}
+			if(chunk.offset < chunk.size)
+				break;
+			if(chunk.zc || !m_zcqueue.empty())
+				m_zcqueue.splice(m_zcqueue.end(), m_sendqueue, m_sendqueue.begin());
+			else
+				done.splice(done.end(), m_sendqueue, m_sendqueue.begin());
+		}
+	}
+
+	/*
+	 * MSG_ZEROCOPY notifications (under m_sendlock). Each covers the sendmsg ids [ee_info, ee_data];
+	 * they may arrive out of order, so only the contiguous prefix releases chunks.
+	 */
+	void JsClientSocket::_engine_readErrQueue(std::list<SendChunk> &done)
+	{
+		char control[128];
+		struct msghdr msg;
+		struct cmsghdr *pcmsg;
+		struct sock_extended_err *perr;
+		bool bAdvanced = true;
+		size_t i;
+
+		for(;;)
+		{
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			if(::recvmsg(m_sock, &msg, MSG_ERRQUEUE) < 0)
+				break;
+			for(pcmsg = CMSG_FIRSTHDR(&msg); pcmsg != NULL; pcmsg = CMSG_NXTHDR(&msg, pcmsg))
+			{
+				if(!(((pcmsg->cmsg_level == SOL_IP) && (pcmsg->cmsg_type == IP_RECVERR)) ||
+					((pcmsg->cmsg_level == SOL_IPV6) && (pcmsg->cmsg_type == IPV6_RECVERR))))
+					continue;
+				perr = (struct sock_extended_err*)CMSG_DATA(pcmsg);
+				if(perr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+					continue;
+				/* the kernel had to copy anyway : the page pinning is pure overhead from here on */
+				if(perr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+					m_zc_enabled = false;
+				m_zc_ranges.push_back(std::make_pair(perr->ee_info, perr->ee_data));
+			}
+		}
+
+		while(bAdvanced)
+		{
+			bAdvanced = false;
+			for(i = 0; i < m_zc_ranges.size(); )
+			{
+				if((int32_t)(m_zc_ranges[i].first - m_zc_done) > 0)
+				{
+					i++;
+					continue;
+				}
+				if((int32_t)(m_zc_ranges[i].second + 1 - m_zc_done) > 0)
+					m_zc_done = m_zc_ranges[i].second + 1;
+				m_zc_ranges.erase(m_zc_ranges.begin() + i);
+				bAdvanced = true;
+			}
+		}
+
+		while(!m_zcqueue.empty())
+		{
+			SendChunk &chunk = m_zcqueue.front();
+			if(chunk.zc && ((int32_t)(chunk.zcid - m_zc_done) >= 0))
+				break;
+			done.splice(done.end(), m_zcqueue, m_zcqueue.begin());
+		}
+	}
+
+	/*
+	 * Not under m_sendlock : senthandlers and free functions may call send() again.
+	 */
+	void JsClientSocket::_engine_finishChunks(std::list<SendChunk> &done, int code)
+	{
+		std::list<SendChunk>::iterator iter;
+		for(iter = done.begin(); iter != done.end(); iter++)
+		{
+			if(m_pmetrics != NULL)
+			{
+				_metricsQueue(-1);
+				if(code == 1)
+					_metricsSent(iter->queuedns);
+			}
+			if(iter->senthandler != NULL)
+				iter->senthandler(this, code);
+			_releaseChunk(*iter);
+		}
+		done.clear();
+	}
+
+	void JsClientSocket::_releaseChunk(SendChunk &chunk)
+	{
+		if(chunk.pbuf == NULL)
+			return;
+		if(chunk.freefunc != NULL)
+			chunk.freefunc(chunk.pbuf, chunk.freeparam);
+		else
+			free(chunk.pbuf);
+		chunk.pbuf = NULL;
+	}
+
+	void JsClientSocket::_engine_releaseBatchProc(void *param1, void *param2)
+	{
+		UringSendBatch *pbatch = (UringSendBatch*)param1;
+		std::list<SendChunk>::iterator iter;
+		for(iter = pbatch->chunks.begin(); iter != pbatch->chunks.end(); iter++)
+			_releaseChunk(*iter);
+		delete pbatch;
+	}
+
+	void JsClientSocket::_engine_onSendComplete(int res)
+	{
+		std::list<SendChunk> done;
+
+		m_sendlock.lock();
+		m_sendinflight = false;
+		m_sendbatchchunks = 0;
+		if(res > 0)
+			_engine_consume(res, false, done);
+		m_sendlock.unlock();
+
+		if(res < 0)
+		{
+			if(m_sock_state >= SOCKSTATE_CONNECTED)
+				_engine_close(res, true);
+			return;
+		}
+		_engine_finishChunks(done, 1);
+		if(m_sock_state >= SOCKSTATE_CONNECTED)
+			_engine_flush();
+	}
+
+	void JsClientSocket::_engine_onRecvComplete(int res, char *pbuf)
+	{
+		int nrst;
+
+		if(m_sock_state < SOCKSTATE_CONNECTED)
+			return;
+		if(res <= 0)
+		{
+			_engine_close(res, true);
+			return;
+		}
+		if(m_recvchunkhandler != NULL)
+		{
+			/* the loop recycles pbuf after this call, so a chunk the handler may keep is a copy */
+			BufferPool::Chunk *pchunk = m_precvpool->acquire(res);
+			if(pchunk == NULL)
+			{
+				_engine_close(-ENOMEM, true);
+				return;
+			}
+			memcpy(pchunk->getData(), pbuf, res);
+			nrst = _engine_deliverChunk(pchunk, res);
+			pchunk->release();
+			if(nrst != 1)
+				_engine_close(nrst, true);
+		}else if(m_recvhandler)
+		{
+			int64_t startns = (m_pmetrics != NULL) ? _nowNs() : 0;
+			nrst = m_recvhandler(this, m_pengctx->pthreaduserctx, res, pbuf);
+			if(m_pmetrics != NULL)
+				_metricsRecv(res, _nowNs() - startns);
+			if(nrst != 1)
+				_engine_close(nrst, true);
+		}
+	}
+
+	void JsClientSocket::_engine_flushProc(void *param1, void *param2)
+	{
+		JsClientSocket *psockctx = (JsClientSocket*)param1;
+		psockctx->_engine_flush();
+	}
+
+	int JsClientSocket::beginConnect(const struct sockaddr *local_psockaddr, int local_sockaddrlen, const struct sockaddr *server_psockaddr, int server_sockaddrlen, bool bAutoReconnect, long timeoutms)
+	{
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg = new WorkerThreadMessage_Connect(local_psockaddr, local_sockaddrlen, server_psockaddr, server_sockaddrlen, (const JSCUTILS_TYPE_DEFCHAR*)NULL, 0);
+		return _engine_beginConnect(spmsg, bAutoReconnect, timeoutms);
+	}
+
+	int JsClientSocket::beginConnect(const struct sockaddr *local_psockaddr, int local_sockaddrlen, const std::basic_string<JSCUTILS_TYPE_DEFCHAR>& report_strHostname, uint16_t remote_port, bool bAutoReconnect, long timeoutms)
+	{
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg = new WorkerThreadMessage_Connect(local_psockaddr, local_sockaddrlen, NULL, 0, report_strHostname, remote_port);
+		return _engine_beginConnect(spmsg, bAutoReconnect, timeoutms);
+	}
+
+	int JsClientSocket::beginConnect(const struct sockaddr *local_psockaddr, int local_sockaddrlen, const JSCUTILS_TYPE_DEFCHAR* report_cszHostname, uint16_t remote_port, bool bAutoReconnect, long timeoutms)
+	{
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg = new WorkerThreadMessage_Connect(local_psockaddr, local_sockaddrlen, NULL, 0, report_cszHostname, remote_port);
+		return _engine_beginConnect(spmsg, bAutoReconnect, timeoutms);
+	}
+
+	int JsClientSocket::_worker_recv(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg)
+	{
+		WorkerThreadMessage_Recv *pmsg = (WorkerThreadMessage_Recv*)spmsg.getPtr();
+		int64_t deadline = (pmsg->recv_timeout >= 0) ? (Common::getTickCount() + pmsg->recv_timeout) : 0;
+		int processedLen = 0;
+		int rc;
+
+		spmsg->retval = 0;
+		while(processedLen < pmsg->data_size)
+		{
+			rc = _engine_rawRead(&pmsg->data_pbuf[processedLen], pmsg->data_size - processedLen);
+			if(rc > 0)
+			{
+				processedLen += rc;
+				spmsg->retval = 1;
+				if(!pmsg->readfixedsize)
+					break;
+				continue;
+			}
+			if(rc == -EAGAIN)
+			{
+				struct pollfd pfd;
+				int waitms = -1;
+				if(pmsg->recv_timeout >= 0)
+				{
+					int64_t remain = deadline - Common::getTickCount();
+					waitms = (remain > 0) ? (int)remain : 0;
+				}
+				pfd.fd = m_sock;
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+				rc = ::poll(&pfd, 1, waitms);
+				if(rc > 0)
+					continue;
+				spmsg->retval = (rc == 0) ? -ETIMEDOUT : -errno;
+				break;
+			}
+			spmsg->retval = rc;
+			break;
+		}
+		if(pmsg->readfixedsize && (processedLen < pmsg->data_size) && (spmsg->retval == 1))
+			spmsg->retval = 0;
+
+		pmsg->recv_readsize = processedLen;
+
+		return pmsg->retval;
+	}
+
+	int JsClientSocket::send(char *pdata, int size, int timeoutms, Client_SentHandler_t senthandler)
+	{
+		return _engine_send(pdata, size, senthandler, false, NULL, NULL);
+	}
+
+	int JsClientSocket::sendOwned(char *pdata, int size, Client_SentHandler_t senthandler, SendBufferFree_t freefunc, void *freeparam)
+	{
+		return _engine_send(pdata, size, senthandler, true, freefunc, freeparam);
+	}
+
+	void JsClientSocket::setZeroCopyThreshold(int bytes)
+	{
+		m_zc_threshold = (bytes > 0) ? bytes : 0;
+	}
+
+	void JsClientSocket::setRecvChunkHandler(Client_RecvChunkHandler_t handler, BufferPool *ppool)
+	{
+		m_recvchunkhandler = handler;
+		m_precvpool = ppool;
+	}
+
+	void JsClientSocket::setReadBatch(int maxreads)
+	{
+		m_conf_readbatch = (maxreads > 0) ? maxreads : 0;
+	}
+
+	void JsClientSocket::setFrameDecoder(FrameDecoder *pdecoder, BufferPool *ppool)
+	{
+		m_pframedecoder = pdecoder;
+		setRecvChunkHandler((pdecoder != NULL) ? _engine_frameChunkProc : NULL, ppool);
+	}
+
+	int JsClientSocket::_engine_frameChunkProc(JsClientSocket *psockctx, void *pthreaduserctx, BufferPool::Chunk *pchunk, int recv_len)
+	{
+		return psockctx->m_pframedecoder->feedChunk(pchunk, recv_len);
+	}
+
+	int JsClientSocket::_engine_send(char *pdata, int size, Client_SentHandler_t senthandler, bool bOwned, SendBufferFree_t freefunc, void *freeparam)
+	{
+		bool bInLoop;
+		bool bDirect;
+		bool bUring;
+		bool bZeroCopy;
+		bool bWrite;
+		bool bQueued = false;
+		bool bWasEmpty;
+		int64_t startns;
+		int rc = 0;
+
+		if((m_sock_state < SOCKSTATE_CONNECTED) || (m_ploop == NULL))
+		{
+			return 0;
+		}
+		startns = (m_pmetrics != NULL) ? _nowNs() : 0;
+
+		/* an SSL object must not be used concurrently with the loop's SSL_read */
+		bInLoop = m_ploop->isInLoopThread();
+		bDirect = !m_bUseSSL || bInLoop;
+
+		m_sendlock.lock();
+		if(m_sock == INVALID_SOCKET)
+		{
+			m_sendlock.unlock();
+			return 0;
+		}
+		bWasEmpty = m_sendqueue.empty();
+		/* io_uring : everything goes through the queue and is submitted with the loop's next batch */
+		bUring = m_uring_io;
+		/* zero-copy needs the buffer to outlive the call, so only owned ones and only through the queue */
+		bZeroCopy = bOwned && m_zc_enabled && (size >= m_zc_threshold);
+		/* a zero-copy chunk still awaiting its notification would otherwise complete after this one */
+		bWrite = bDirect && bWasEmpty && !bUring && !bZeroCopy && m_zcqueue.empty();
+		if(bWrite)
+		{
+			/* until EAGAIN, otherwise the edge-triggered loop may never report EPOLLOUT for the rest */
+			while(rc < size)
+			{
+				int written = _engine_rawWrite(pdata + rc, size - rc);
+				if(written == -EAGAIN)
+					break;
+				if(written < 0)
+				{
+					/* once part of it is out, failing would make a retrying caller send that part twice :
+					 * the rest is queued as on EAGAIN, and the EPOLLERR / EPOLLHUP that follows closes
+					 * the connection, calling senthandler with 0 */
+					if(rc > 0)
+						break;
+					m_sendlock.unlock();
+					return written;
+				}
+				rc += written;
+			}
+			if((m_pmetrics != NULL) && (rc > 0))
+				_metricsAdd(&SocketMetrics::bytes_sent, rc);
+		}
+		if(rc < size)
+		{
+			SendChunk chunk;
+			chunk.senthandler = senthandler;
+			chunk.zc = false;
+			chunk.zcid = 0;
+			chunk.queuedns = startns;
+			if(bOwned)
+			{
+				chunk.pbuf = pdata;
+				chunk.size = size;
+				chunk.offset = rc;
+				chunk.freefunc = freefunc;
+				chunk.freeparam = freeparam;
+			}else{
+				chunk.size = size - rc;
+				chunk.offset = 0;
+				chunk.freefunc = NULL;
+				chunk.freeparam = NULL;
+				chunk.pbuf = (char*)malloc(chunk.size);
+				if(chunk.pbuf == NULL)
+				{
+					m_sendlock.unlock();
+					return -ENOMEM;
+				}
+				memcpy(chunk.pbuf, pdata + rc, chunk.size);
+			}
+			m_sendqueue.push_back(chunk);
+			bQueued = true;
+			if(m_pmetrics != NULL)
+				_metricsQueue(1);
+		}
+		m_sendlock.unlock();
+
+		if(m_pmetrics != NULL)
+			_metricsAdd(&SocketMetrics::messages_sent, 1);
+		if(!bQueued)
+		{
+			if(m_pmetrics != NULL)
+				_metricsSent(startns);
+			if(senthandler != NULL)
+				senthandler(this, 1);
+			if(bOwned)
+			{
+				if(freefunc != NULL)
+					freefunc(pdata, freeparam);
+				else
+					free(pdata);
+			}
+		}else if(bWasEmpty && !bWrite)
+		{
+			if(bInLoop)
+				_engine_flush();
+			else
+				m_ploop->post(_engine_flushProc, this, NULL);
+		}
+
+		return 1;
+	}
+
+	int JsClientSocket::recv(char *pdata, int size, int *preadbytes, bool readfixedsize, int timeoutms)
+	{
+		int retval;
+		WorkerThreadMessage_Recv *pmsg;
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg;
+
+		if(m_sock_state < SOCKSTATE_CONNECTED)
+		{
+			return 0;
+		}
+		if(!m_ploop->isInLoopThread())
+		{
+			return 0;
+		}
+
+		pmsg = new WorkerThreadMessage_Recv(pdata, size, readfixedsize, timeoutms);
+		spmsg = pmsg;
+
+		retval = _worker_recv(spmsg);
+		if(preadbytes != NULL)
+			*preadbytes = pmsg->recv_readsize;
+
+		return retval;
+	}
+#endif
 }
@@ -24,10 +24,12 @@
 #include <stdlib.h>
 
 #if defined(JSCUTILS_OS_LINUX)
-#error "NOT SUPPORTED LINUX, yet..."
-
 #include <unistd.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 #elif defined(JSCUTILS_OS_WINDOWS)
 #include <WinSock2.h>
 #include <mswsock.h>
@@ -41,12 +43,21 @@
 #ifdef USE_OPENSSL
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include "JsSSLContext.h"
 #endif
 
 #include "JsThread.h"
 #include "SmartPointer.h"
+#if defined(JSCUTILS_OS_LINUX)
+#include "JsSocketEngine.h"
+#include "BufferPool.h"
+#include "DnsResolver.h"
+#include "SocketMetrics.h"
+#endif
 
 #include <string>
+#include <list>
+#include <vector>
 
 #ifndef JSCUTILS_SOCKET_T
 #if defined(JSCUTILS_OS_LINUX)
@@ -67,8 +78,17 @@
 
 namespace JsCPPUtils
 {
+#if defined(JSCUTILS_OS_LINUX)
+	class JsServerSocket;
+	class FrameDecoder;
+#endif
+
 	class JsClientSocket
 	{
+#if defined(JSCUTILS_OS_LINUX)
+		friend class JsServerSocket;
+#endif
+
 	public:	
 		typedef int(*StartWorkerPostHandler_t)(JsClientSocket *psockctx, int threadidx, void **out_pthreaduserctx);
 		typedef void(*StopWorkerHandler_t)(JsClientSocket *psockctx, int threadidx, void *pthreaduserctx);
@@ -77,6 +97,12 @@ namespace JsCPPUtils
 		typedef int(*Client_RecvHandler_t)(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf);
 		typedef void(*Client_DisconnectedHandler_t)(JsClientSocket *psockctx, int code);
 		typedef void(*Client_SentHandler_t)(JsClientSocket *psockctx, int code);
+		/* releases a buffer handed over with sendOwned (freeparam : e.g. the owner of a refcounted slice) */
+		typedef void(*SendBufferFree_t)(char *pbuf, void *freeparam);
+#if defined(JSCUTILS_OS_LINUX)
+		/* pchunk is referenced for the duration of the call; retain() it to keep the data without copying */
+		typedef int(*Client_RecvChunkHandler_t)(JsClientSocket *psockctx, void *pthreaduserctx, BufferPool::Chunk *pchunk, int recv_len);
+#endif
 
 		enum SOCKSTATE
 		{
@@ -89,6 +115,26 @@ namespace JsCPPUtils
 			SOCKSTATE_DISCONNECTREQ,
 		};
 
+#if defined(JSCUTILS_OS_LINUX)
+		/**
+		 * How the last connect went, in microseconds. Valid from the connected handler on.
+		 */
+		struct ConnectTimings {
+			/* beginConnect (or the reconnect) until the addresses were known; ~0 for an address or a cached name */
+			int64_t resolve_us;
+			/* first connect() until one of them was accepted */
+			int64_t tcp_us;
+			int64_t ssl_us;
+			/* until the connected handler */
+			int64_t total_us;
+			bool dns_cached;
+			/* connect()s started, > 1 when the first address did not answer in time */
+			int attempts;
+			/* of the address that won */
+			int family;
+		};
+#endif
+
 	private:
 		class WorkerThreadInternalContext {
 		public:
@@ -151,6 +197,9 @@ namespace JsCPPUtils
 			bool remote_bUseHostname;
 			std::basic_string<JSCUTILS_TYPE_DEFCHAR> remote_strHostname;
 			uint16_t remote_port;
+			/* set once the connect attempt has finished (retval is its result) */
+			bool completed;
+			bool autoreconnect;
 			
 			WorkerThreadMessage_Connect(
 				const struct sockaddr *_local_sockaddr,
@@ -160,6 +209,8 @@ namespace JsCPPUtils
 				const std::basic_string<JSCUTILS_TYPE_DEFCHAR>& _remote_strHostname,
 				uint16_t _remote_port
 				) : WorkerThreadMessage(WorkerThreadMessage::CMD_CONNECT)
+				, completed(false)
+				, autoreconnect(false)
 			{
 				memset(&local_sockaddr, 0, sizeof(local_sockaddr));
 				memset(&remote_sockaddr, 0, sizeof(remote_sockaddr));
@@ -192,6 +243,8 @@ namespace JsCPPUtils
 				const JSCUTILS_TYPE_DEFCHAR* _remote_cszHostname,
 				uint16_t _remote_port
 				) : WorkerThreadMessage(WorkerThreadMessage::CMD_CONNECT)
+				, completed(false)
+				, autoreconnect(false)
 			{
 				memset(&local_sockaddr, 0, sizeof(local_sockaddr));
 				memset(&remote_sockaddr, 0, sizeof(remote_sockaddr));
@@ -280,15 +333,136 @@ namespace JsCPPUtils
 #endif
 
 #ifdef USE_OPENSSL
+		/* setSSLContext() */
+		JsCPPUtils::SmartPointer<JsSSLContext> m_spsslctx_conf;
+		/* since init() : the configured one or a private one */
+		JsCPPUtils::SmartPointer<JsSSLContext> m_spsslctx;
 		SSL_CTX *m_pSSLCtx;
 		SSL *m_sock_pSSL;
 #endif
 
 		long m_conf_recvdatabufsize;
 
+#if defined(JSCUTILS_OS_WINDOWS)
 		JsCPPUtils::SmartPointer<JsCPPUtils::JsThread::ThreadContext> m_worker_thread;
 		JsCPPUtils::JsThread::MessageHandler<WorkerThreadMessage> m_worker_msg;
 		JSTHREAD_THREADID_TYPE m_worker_tid;
+#elif defined(JSCUTILS_OS_LINUX)
+		/*
+		 * No thread per socket : the socket is a channel on one loop of a shared JsSocketEngine.
+		 * All handlers run on that loop thread.
+		 */
+		class EngineChannel : public JsSocketEngine::Channel
+		{
+		public:
+			JsClientSocket *psockctx;
+			EngineChannel() : psockctx(NULL) {}
+			void onEvent(uint32_t events) override;
+			void onRecvComplete(int res, char *pbuf) override;
+			void onSendComplete(int res) override;
+		};
+
+		struct SendChunk {
+			char *pbuf;
+			int size;
+			int offset;
+			Client_SentHandler_t senthandler;
+			/* NULL : pbuf was malloc'ed by send() */
+			SendBufferFree_t freefunc;
+			void *freeparam;
+			/* written with MSG_ZEROCOPY : zcid is the last sendmsg that referenced it */
+			bool zc;
+			uint32_t zcid;
+			/* when send() was called, with metrics enabled */
+			int64_t queuedns;
+		};
+		struct UringSendBatch;
+
+		/*
+		 * One racing connect() (happy eyeballs) on its own descriptor. The one that connects first
+		 * becomes m_sock, the others are closed.
+		 */
+		class ConnectAttempt : public JsSocketEngine::Channel
+		{
+		public:
+			JsClientSocket *psockctx;
+			JSCUTILS_SOCKET_T sock;
+			const struct sockaddr_storage *paddr;
+			socklen_t addrlen;
+			ConnectAttempt() : psockctx(NULL), sock(INVALID_SOCKET), paddr(NULL), addrlen(0) {}
+			void onEvent(uint32_t events) override;
+		};
+		struct ResolveToken;
+
+		JsSocketEngine *m_pengine;
+		JsSocketEngine::Loop *m_ploop;
+		EngineChannel m_channel;
+		WorkerThreadInternalContext *m_pengctx;
+
+		/* guards m_sock and m_sendqueue against send() from other threads */
+		Lockable m_sendlock;
+		std::list<SendChunk> m_sendqueue;
+		/* plain sockets on an io_uring loop : multishot recv, one IORING_OP_SENDMSG in flight */
+		bool m_uring_io;
+		bool m_sendinflight;
+		UringSendBatch *m_psendbatch;
+		int m_sendbatchchunks;
+
+		/* MSG_ZEROCOPY (under m_sendlock) : fully written chunks wait in m_zcqueue for the kernel's notification */
+		int m_zc_threshold;
+		bool m_zc_enabled;
+		uint32_t m_zc_nextid;
+		uint32_t m_zc_done;
+		std::vector< std::pair<uint32_t, uint32_t> > m_zc_ranges;
+		std::list<SendChunk> m_zcqueue;
+
+		JsCPPUtils::SmartPointer<WorkerThreadMessage> m_connect_spmsg;
+		pthread_mutex_t m_connect_mutex;
+		pthread_cond_t m_connect_cond;
+		int64_t m_reconnect_timerid;
+
+		/* connect phases : resolve, TCP (racing attempts), SSL */
+		DnsResolver *m_presolver;
+		ResolveToken *m_presolvetoken;
+		std::vector<DnsResolver::Address> m_connect_addrs;
+		size_t m_connect_next;
+		int m_connect_lasterror;
+		std::list<ConnectAttempt*> m_attempts;
+		int64_t m_attempt_timerid;
+		int64_t m_phase_timerid;
+		int64_t m_connect_start;
+		int64_t m_connect_tcpstart;
+		ConnectTimings m_timings;
+		long m_conf_attemptdelayms;
+		long m_conf_resolvetimeoutms;
+		long m_conf_tcptimeoutms;
+		long m_conf_ssltimeoutms;
+
+		/* pooled receive (setRecvChunkHandler) : the read size follows what the reads actually return */
+		Client_RecvChunkHandler_t m_recvchunkhandler;
+		BufferPool *m_precvpool;
+		int m_recvsize;
+		int m_recv_smallreads;
+		/* reads per wakeup before yielding to the other channels of the loop (0 : until EAGAIN) */
+		int m_conf_readbatch;
+		int64_t m_read_timerid;
+		/* setFrameDecoder() : receives go through it as chunks */
+		FrameDecoder *m_pframedecoder;
+
+		/* enableMetrics() : the socket's own counters, and a shared aggregate */
+		SocketMetrics *m_pmetrics;
+		SocketMetrics *m_pmetricsaggr;
+		int m_conf_tcpinfointervalms;
+		int64_t m_tcpinfo_timerid;
+		int64_t m_tcpinfo_lastretrans;
+
+#ifdef USE_OPENSSL
+		/* the session cache key (host:port) and SNI name of the current connect */
+		std::string m_ssl_strSessionKey;
+		std::string m_ssl_strServerName;
+		int64_t m_ssl_handshakestart;
+#endif
+#endif
 
 		void *m_userptr;
 
@@ -304,18 +478,96 @@ namespace JsCPPUtils
 		Client_RecvHandler_t			m_recvhandler;
 		Client_DisconnectedHandler_t	m_disconnectedhandler;
 
+#if defined(JSCUTILS_OS_WINDOWS)
 		static void workerThreadProc_CleanUp(void *param);
 		static int workerThreadProc(JsCPPUtils::JsThread::ThreadContext *pThreadCtx, int threadindex, void *threadparam);
+#endif
 
+#if defined(JSCUTILS_OS_WINDOWS)
 		int _newSocket();
+#endif
 		int _closeSocket(int code = 0);
+#ifdef USE_OPENSSL
+		int _sslInitContext(const SSL_METHOD *ssl_method);
+#endif
 		
+#if defined(JSCUTILS_OS_WINDOWS)
 		int _worker_send(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg);
+#endif
 		int _worker_recv(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg);
 
+#if defined(JSCUTILS_OS_LINUX)
+		int _engine_initRecv();
+		int _engine_accept(JsSocketEngine::Loop *ploop, JSCUTILS_SOCKET_T sock, void *pthreaduserctx, long recvdatabufsize, Client_ConnectedHandler_t connectedhandler, Client_RecvHandler_t recvhandler, Client_DisconnectedHandler_t disconnectedhandler);
+		int _engine_beginConnect(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg, bool bAutoReconnect, long timeoutms);
+		void _engine_connect(JsCPPUtils::SmartPointer<WorkerThreadMessage> spmsg);
+		void _engine_resolved(const DnsResolver::Result &result);
+		void _engine_startAttempts(const std::vector<DnsResolver::Address> &addrs);
+		void _engine_nextAttempt();
+		void _engine_attemptEvent(ConnectAttempt *pattempt, uint32_t events);
+		void _engine_dropAttempt(ConnectAttempt *pattempt, bool bCloseSocket);
+		void _engine_dropAttempts();
+		int _engine_adoptSocket(JSCUTILS_SOCKET_T sock);
+		void _engine_setPhaseTimer(long timeoutms);
+		void _engine_connectDone(int result);
+		void _engine_established();
+		void _engine_onEvent(uint32_t events);
+		int _engine_rawRead(char *pbuf, int size);
+		int _engine_rawWrite(const char *pbuf, int size);
+		void _engine_read();
+		int _engine_deliverChunk(BufferPool::Chunk *pchunk, int len);
+		void _engine_adaptRecvSize(int len);
+		void _engine_flush();
+		int _engine_writeBatch(bool *pbZeroCopy);
+		void _engine_submitBatch();
+		void _engine_consume(int len, bool bZeroCopy, std::list<SendChunk> &done);
+		void _engine_readErrQueue(std::list<SendChunk> &done);
+		void _engine_finishChunks(std::list<SendChunk> &done, int code);
+		int _engine_send(char *pdata, int size, Client_SentHandler_t senthandler, bool bOwned, SendBufferFree_t freefunc, void *freeparam);
+		static void _releaseChunk(SendChunk &chunk);
+		static void _engine_releaseBatchProc(void *param1, void *param2);
+		void _engine_onRecvComplete(int res, char *pbuf);
+		void _engine_onSendComplete(int res);
+		void _engine_close(int code, bool bReconnect);
+#ifdef USE_OPENSSL
+		void _engine_sslPrepare(WorkerThreadMessage_Connect *pmsg);
+#endif
+		void _metricsAdd(volatile int64_t SocketMetrics::*pfield, int64_t value);
+		void _metricsQueue(int delta);
+		void _metricsRecv(int len, int64_t handlerns);
+		void _metricsSent(int64_t startns);
+		void _engine_sampleTcpInfo();
+		static void _engine_tcpInfoProc(void *param1, void *param2);
+		static int64_t _nowUs();
+		static int64_t _nowNs();
+		static void _engine_attachProc(void *param1, void *param2);
+		static void _engine_detachProc(void *param1, void *param2);
+		static void _engine_connectProc(void *param1, void *param2);
+		static void _engine_disconnectProc(void *param1, void *param2);
+		static void _engine_flushProc(void *param1, void *param2);
+		static void _engine_reconnectProc(void *param1, void *param2);
+		static void _engine_readProc(void *param1, void *param2);
+		static void _engine_resolveHandler(DnsResolver *presolver, void *param1, void *param2, const DnsResolver::Result &result);
+		static void _engine_resolvedProc(void *param1, void *param2);
+		static void _engine_attemptTimerProc(void *param1, void *param2);
+		static void _engine_phaseTimerProc(void *param1, void *param2);
+		static void _engine_deleteAttemptProc(void *param1, void *param2);
+		static int _engine_frameChunkProc(JsClientSocket *psockctx, void *pthreaduserctx, BufferPool::Chunk *pchunk, int recv_len);
+#endif
+
 	public:
 		JsClientSocket(void *userptr = NULL);
 		~JsClientSocket();
+#if defined(JSCUTILS_OS_LINUX)
+		/**
+		 * Attaches the socket to pengine instead of the process-wide JsSocketEngine::getDefault().
+		 * Must be called before init(). The engine must outlive the socket.
+		 * On an io_uring engine (JsSocketEngine::BACKEND_IOURING) a plain socket receives into the
+		 * loop's buffers, so recv_len is bounded by Loop::getRecvBufferSize() instead of recvdatabufsize.
+		 */
+		void setEngine(JsSocketEngine *pengine);
+		JsSocketEngine *getEngine();
+#endif
 		int init(
 			int sock_domain,
 			int sock_type,
@@ -332,7 +584,28 @@ namespace JsCPPUtils
 			Client_ConnectedHandler_t connectedhandler,
 			Client_RecvHandler_t recvhandler,
 			Client_DisconnectedHandler_t disconnectedhandler);
+#ifdef USE_OPENSSL
+		/**
+		 * Uses spctx (and its session cache) instead of a private SSL_CTX created from the ssl_method of init().
+		 * Sockets sharing one context resume each other's sessions to the same host.
+		 * Must be called before init().
+		 */
+		void setSSLContext(const JsCPPUtils::SmartPointer<JsSSLContext> &spctx);
+		/**
+		 * The context in use since init() (e.g. for its handshake counters).
+		 */
+		JsCPPUtils::SmartPointer<JsSSLContext> getSSLContext();
+#endif
+		/**
+		 * Loads into the SSL_CTX in use, so after init(); a shared context is changed for all its sockets.
+		 */
 		int sslLoadCertificates(const char* szCertFile, const char* szKeyFile);
+		/**
+		 * timeoutms != 0 waits for the result of the connect attempt (-1 : infinite).
+		 * Linux : a hostname is resolved by the DnsResolver (setResolver()) without blocking the loop, and
+		 * its addresses are raced (setHappyEyeballsDelay()). Waiting is skipped on the loop thread.
+		 * The family of init() limits the addresses (AF_UNSPEC : IPv6 and IPv4).
+		 */
 		int beginConnect(const struct sockaddr *local_psockaddr, int local_sockaddrlen, const struct sockaddr *server_psockaddr, int server_sockaddrlen, bool bAutoReconnect = false, long timeoutms = 0);
 		int beginConnect(const struct sockaddr *local_psockaddr, int local_sockaddrlen, const std::basic_string<JSCUTILS_TYPE_DEFCHAR>& report_strHostname, uint16_t remote_port, bool bAutoReconnect = false, long timeoutms = 0);
 		int beginConnect(const struct sockaddr *local_psockaddr, int local_sockaddrlen, const JSCUTILS_TYPE_DEFCHAR* report_cszHostname, uint16_t remote_port, bool bAutoReconnect = false, long timeoutms = 0);
@@ -341,13 +614,101 @@ namespace JsCPPUtils
 		void setUserPtr(void *userptr);
 		void *getUserPtr();
 		bool isUseSSL();
+		bool isConnected();
 
 		JSCUTILS_SOCKET_T getSocket();
 #ifdef USE_OPENSSL 
 		SSL_CTX *getSSL_CTX();
 #endif
 			
+		/**
+		 * Linux : never blocks. What the kernel does not take at once is queued and written by the loop
+		 * when the socket becomes writable; senthandler is called with 1 once everything is written,
+		 * or with 0 if the connection closes first. timeoutms is ignored.
+		 * A failure (<= 0) means none of pdata was sent. An error after part of it was written
+		 * is reported the other way : 1 here, then the connection closes and senthandler gets 0.
+		 */
 		int send(char *pdata, int size, int timeoutms = -1, Client_SentHandler_t senthandler = NULL);
+#if defined(JSCUTILS_OS_LINUX)
+		/**
+		 * send() without the copy : the socket takes pdata over and releases it with
+		 * freefunc(pdata, freeparam) (free() if NULL) once it is written, or when the connection closes.
+		 * Queued buffers go out together in one sendmsg / IORING_OP_SENDMSG.
+		 * On failure (<= 0) pdata stays with the caller.
+		 */
+		int sendOwned(char *pdata, int size, Client_SentHandler_t senthandler = NULL, SendBufferFree_t freefunc = NULL, void *freeparam = NULL);
+		/**
+		 * Batches of at least bytes are sent with MSG_ZEROCOPY (plain sockets on the epoll path; 0 : off).
+		 * Their senthandler runs when the kernel reports the pages released, and that is also when
+		 * the buffer is freed. Zero-copy is dropped for the connection once the kernel reports that it
+		 * copied anyway (e.g. loopback). Takes effect on the next connect.
+		 */
+		void setZeroCopyThreshold(int bytes);
+
+		/**
+		 * Receives into chunks of ppool (BufferPool::getDefault() if NULL) and calls handler instead of
+		 * the recvhandler of init(). The handler may retain() a chunk and release() it later on any thread,
+		 * e.g. to forward it with sendOwned(pchunk->getData(), len, NULL, BufferPool::Chunk::releaseProc, pchunk).
+		 * The read size starts at recvdatabufsize and adapts within the pool's size classes :
+		 * it doubles after reads that filled the chunk and halves after a run of small ones.
+		 * Must be called before init(). io_uring plain sockets copy out of the loop's buffers once.
+		 */
+		void setRecvChunkHandler(Client_RecvChunkHandler_t handler, BufferPool *ppool = NULL);
+		/**
+		 * At most maxreads reads per readiness event before the loop serves its other channels
+		 * (the rest is read on the next loop iteration). 0 (default) : read until EAGAIN.
+		 */
+		void setReadBatch(int maxreads);
+		/**
+		 * Passes what is received to pdecoder (FrameDecoder::feedChunk()) instead of the handlers of init(),
+		 * so the socket delivers whole frames to the decoder's handler. Frames within one read are not copied.
+		 * A partial frame is dropped when the connection closes, and the decoder's result other than 1
+		 * closes the connection. Uses setRecvChunkHandler(); must be called before init().
+		 * The decoder must outlive the socket; NULL : back to the handlers of init().
+		 */
+		void setFrameDecoder(FrameDecoder *pdecoder, BufferPool *ppool = NULL);
+
+		/**
+		 * Counts the socket's traffic into getMetrics() and, unless paggregate is NULL, into paggregate too
+		 * (shared by any number of sockets; it must outlive them). TCP_INFO (RTT, retransmits) is sampled when
+		 * a connection is established, every tcpinfointervalms while it lasts (0 : not in between), and as it closes.
+		 * Must be called before init(). A socket without metrics pays one pointer check per operation.
+		 */
+		void enableMetrics(SocketMetrics *paggregate = NULL, int tcpinfointervalms = 1000);
+		/**
+		 * NULL unless enableMetrics() was called. Readable from any thread without locking,
+		 * for as long as the socket exists.
+		 */
+		const SocketMetrics *getMetrics() const {
+			return m_pmetrics;
+		}
+
+		/**
+		 * Resolves hostnames with presolver instead of DnsResolver::getDefault(). It must outlive the socket.
+		 */
+		void setResolver(DnsResolver *presolver);
+		/**
+		 * Happy eyeballs (RFC 8305) : when a connect() has not completed after delayms (default 250),
+		 * the next address is tried alongside it, and the first to connect wins. A refused connect()
+		 * moves on at once. 0 : one address at a time, each until it fails.
+		 */
+		void setHappyEyeballsDelay(long delayms);
+		/**
+		 * Limits per connect phase, failing the connect with -ETIMEDOUT (and reconnecting if enabled) :
+		 * resolvems for the name, tcpms from the first connect() to the connection, sslms for the handshake.
+		 * 0 (default) : no limit. Take effect on the next connect.
+		 */
+		void setConnectTimeouts(long resolvems, long tcpms, long sslms);
+		/**
+		 * Loop thread (e.g. the connected handler).
+		 */
+		const ConnectTimings &getConnectTimings() const {
+			return m_timings;
+		}
+#endif
+		/**
+		 * Only from a handler (the worker thread / the loop thread of this socket).
+		 */
 		int recv(char *pdata, int size, int *preadbytes, bool readfixedsize = false, int timeoutms = -1);
 	};
 }
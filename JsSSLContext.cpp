@@ -0,0 +1,252 @@
+/**
+ * @file	JsSSLContext.cpp
+ * @class	JsSSLContext
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/25
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "JsSSLContext.h"
+
+#ifdef USE_OPENSSL
+
+#include <stdio.h>
+#include <string.h>
+
+namespace JsCPPUtils
+{
+	/*
+	 * ex_data of an SSL handed to beginHandshake(), freed with the SSL
+	 */
+	struct JsSSLContextHandshake {
+		std::string key;
+		bool offered;
+	};
+
+	JsSSLContext::JsSSLContext()
+	{
+		m_pctx = NULL;
+		m_conf_maxsessions = 1024;
+		memset(&m_stats, 0, sizeof(m_stats));
+	}
+
+	JsSSLContext::~JsSSLContext()
+	{
+		clearSessions();
+		if(m_pctx != NULL)
+		{
+			/* SSL objects still alive keep the SSL_CTX, their new sessions are dropped */
+			SSL_CTX_set_app_data(m_pctx, NULL);
+			::SSL_CTX_free(m_pctx);
+			m_pctx = NULL;
+		}
+	}
+
+	int JsSSLContext::init(const SSL_METHOD *ssl_method)
+	{
+		if(m_pctx != NULL)
+			return 1;
+		if(_exIndex() < 0)
+			return 0;
+		m_pctx = ::SSL_CTX_new(ssl_method);
+		if(m_pctx == NULL)
+		{
+			ERR_print_errors_fp(stderr);
+			return 0;
+		}
+		SSL_CTX_set_app_data(m_pctx, this);
+		/* sessions are kept by key here, OpenSSL's own cache is keyed by session id */
+		SSL_CTX_set_session_cache_mode(m_pctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(m_pctx, _newSessionProc);
+		return 1;
+	}
+
+	SSL_CTX *JsSSLContext::getSSL_CTX()
+	{
+		return m_pctx;
+	}
+
+	int JsSSLContext::loadCertificates(const char *szCertFile, const char *szKeyFile)
+	{
+		if(m_pctx == NULL)
+			return 0;
+		if(SSL_CTX_use_certificate_file(m_pctx, szCertFile, SSL_FILETYPE_PEM) != 1)
+			return 0;
+		if(SSL_CTX_use_PrivateKey_file(m_pctx, szKeyFile, SSL_FILETYPE_PEM) != 1)
+			return 0;
+		if(SSL_CTX_check_private_key(m_pctx) != 1)
+			return 0;
+		return 1;
+	}
+
+	void JsSSLContext::setSessionCacheSize(int maxsessions)
+	{
+		m_sessionlock.lock();
+		m_conf_maxsessions = (maxsessions > 0) ? maxsessions : 0;
+		while((int)m_sessions.size() > m_conf_maxsessions)
+			_removeSession(m_sessionlru.back());
+		m_sessionlock.unlock();
+	}
+
+	void JsSSLContext::clearSessions()
+	{
+		std::map<std::string, SessionEntry>::iterator iter;
+		m_sessionlock.lock();
+		for(iter = m_sessions.begin(); iter != m_sessions.end(); iter++)
+			SSL_SESSION_free(iter->second.psession);
+		m_sessions.clear();
+		m_sessionlru.clear();
+		m_sessionlock.unlock();
+	}
+
+	/*
+	 * under m_sessionlock
+	 */
+	void JsSSLContext::_putSession(const std::string &strKey, SSL_SESSION *psession)
+	{
+		std::map<std::string, SessionEntry>::iterator iter = m_sessions.find(strKey);
+		if(iter != m_sessions.end())
+		{
+			SSL_SESSION_free(iter->second.psession);
+			m_sessionlru.erase(iter->second.lruiter);
+		}else{
+			while(!m_sessionlru.empty() && ((int)m_sessions.size() >= m_conf_maxsessions))
+				_removeSession(m_sessionlru.back());
+		}
+		m_sessionlru.push_front(strKey);
+		SessionEntry &entry = m_sessions[strKey];
+		entry.psession = psession;
+		entry.lruiter = m_sessionlru.begin();
+	}
+
+	/*
+	 * under m_sessionlock
+	 */
+	void JsSSLContext::_removeSession(const std::string &strKey)
+	{
+		std::map<std::string, SessionEntry>::iterator iter = m_sessions.find(strKey);
+		if(iter == m_sessions.end())
+			return;
+		SSL_SESSION_free(iter->second.psession);
+		m_sessionlru.erase(iter->second.lruiter);
+		m_sessions.erase(iter);
+	}
+
+	int JsSSLContext::_exIndex()
+	{
+		static int idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, _exFreeProc);
+		return idx;
+	}
+
+	void JsSSLContext::_exFreeProc(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+	{
+		delete (JsSSLContextHandshake*)ptr;
+	}
+
+	/*
+	 * OpenSSL calls it once a session can be resumed : at the end of a TLS 1.2 handshake,
+	 * on each TLS 1.3 NewSessionTicket. Returning 1 keeps the reference.
+	 */
+	int JsSSLContext::_newSessionProc(SSL *pssl, SSL_SESSION *psession)
+	{
+		JsSSLContext *pself = (JsSSLContext*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(pssl));
+		JsSSLContextHandshake *phs = (JsSSLContextHandshake*)SSL_get_ex_data(pssl, _exIndex());
+
+		if((pself == NULL) || (phs == NULL))
+			return 0;
+		pself->m_sessionlock.lock();
+		if(pself->m_conf_maxsessions <= 0)
+		{
+			pself->m_sessionlock.unlock();
+			return 0;
+		}
+		pself->_putSession(phs->key, psession);
+		pself->m_sessionlock.unlock();
+		return 1;
+	}
+
+	int JsSSLContext::beginHandshake(SSL *pssl, const std::string &strSessionKey, const char *szServerName)
+	{
+		std::map<std::string, SessionEntry>::iterator iter;
+		JsSSLContextHandshake *phs = new JsSSLContextHandshake();
+
+		phs->key = strSessionKey;
+		phs->offered = false;
+		if(SSL_set_ex_data(pssl, _exIndex(), phs) != 1)
+		{
+			delete phs;
+			return 0;
+		}
+
+		if(szServerName != NULL)
+			SSL_set_tlsext_host_name(pssl, szServerName);
+
+		m_sessionlock.lock();
+		iter = m_sessions.find(strSessionKey);
+		if(iter != m_sessions.end())
+		{
+			bool bResumable = true;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+			bResumable = (SSL_SESSION_is_resumable(iter->second.psession) == 1);
+#endif
+			/* SSL_set_session takes its own reference */
+			if(bResumable)
+				phs->offered = (SSL_set_session(pssl, iter->second.psession) == 1);
+			else
+				_removeSession(strSessionKey);
+		}
+		m_sessionlock.unlock();
+
+		return phs->offered ? 1 : 0;
+	}
+
+	void JsSSLContext::endHandshake(SSL *pssl, bool bSuccess, int64_t elapsed_us)
+	{
+		JsSSLContextHandshake *phs = (JsSSLContextHandshake*)SSL_get_ex_data(pssl, _exIndex());
+		bool bOffered = (phs != NULL) && phs->offered;
+
+		if(!bSuccess && bOffered)
+		{
+			/* e.g. the server forgot its ticket key : the next one starts over with a full handshake */
+			m_sessionlock.lock();
+			_removeSession(phs->key);
+			m_sessionlock.unlock();
+		}
+
+		m_statslock.lock();
+		if(bOffered)
+			m_stats.offered++;
+		if(!bSuccess)
+		{
+			m_stats.failed++;
+		}else if(SSL_session_reused(pssl))
+		{
+			m_stats.resumed++;
+			m_stats.resumed_time_total_us += elapsed_us;
+			if(elapsed_us > m_stats.resumed_time_max_us)
+				m_stats.resumed_time_max_us = elapsed_us;
+		}else{
+			m_stats.full++;
+			m_stats.full_time_total_us += elapsed_us;
+			if(elapsed_us > m_stats.full_time_max_us)
+				m_stats.full_time_max_us = elapsed_us;
+		}
+		m_statslock.unlock();
+	}
+
+	JsSSLContext::HandshakeStats JsSSLContext::getHandshakeStats()
+	{
+		HandshakeStats stats;
+		m_statslock.lock();
+		stats = m_stats;
+		m_statslock.unlock();
+		m_sessionlock.lock();
+		stats.sessions = (int)m_sessions.size();
+		m_sessionlock.unlock();
+		return stats;
+	}
+}
+
+#endif /* USE_OPENSSL */
@@ -0,0 +1,120 @@
+/**
+ * @file	JsSSLContext.h
+ * @class	JsSSLContext
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/25
+ * @brief	SSL_CTX shared by many sockets, with a client session cache keyed by host for resumption and handshake counters
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_JSSSLCONTEXT_H__
+#define __JSCPPUTILS_JSSSLCONTEXT_H__
+
+#include "Common.h"
+
+#ifdef USE_OPENSSL
+
+#include <stdint.h>
+
+#include <string>
+#include <list>
+#include <map>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "Lockable.h"
+
+namespace JsCPPUtils
+{
+	/**
+	 * Shared through SmartPointer<JsSSLContext> : the SSL_CTX lives until the last socket using it lets go.
+	 * Thread-safe.
+	 *
+	 * Client sessions (TLS 1.2 sessions and TLS 1.3 tickets) are cached per session key (host:port)
+	 * and offered on the next handshake to the same key, so reconnects resume instead of
+	 * doing a full handshake.
+	 */
+	class JsSSLContext
+	{
+	public:
+		struct HandshakeStats {
+			int64_t full;
+			int64_t resumed;
+			int64_t failed;
+			/* handshakes that offered a cached session (resumed or not) */
+			int64_t offered;
+			/* from the start of the handshake to its completion, in microseconds */
+			int64_t full_time_total_us;
+			int64_t full_time_max_us;
+			int64_t resumed_time_total_us;
+			int64_t resumed_time_max_us;
+			int sessions;
+		};
+
+	private:
+		struct SessionEntry {
+			SSL_SESSION *psession;
+			std::list<std::string>::iterator lruiter;
+		};
+
+		SSL_CTX *m_pctx;
+
+		Lockable m_sessionlock;
+		std::map<std::string, SessionEntry> m_sessions;
+		/* most recently stored first */
+		std::list<std::string> m_sessionlru;
+		int m_conf_maxsessions;
+
+		Lockable m_statslock;
+		HandshakeStats m_stats;
+
+		void _putSession(const std::string &strKey, SSL_SESSION *psession);
+		void _removeSession(const std::string &strKey);
+		static int _exIndex();
+		static void _exFreeProc(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+		static int _newSessionProc(SSL *pssl, SSL_SESSION *psession);
+
+	public:
+		JsSSLContext();
+		~JsSSLContext();
+
+		/**
+		 * @return 1 on success, 0 if the SSL_CTX could not be created
+		 */
+		int init(const SSL_METHOD *ssl_method);
+		SSL_CTX *getSSL_CTX();
+
+		int loadCertificates(const char *szCertFile, const char *szKeyFile);
+		/**
+		 * At most maxsessions session keys are remembered, the least recently stored one is dropped first.
+		 * 0 : no resumption.
+		 */
+		void setSessionCacheSize(int maxsessions);
+		void clearSessions();
+
+		/**
+		 * Client side, before SSL_do_handshake : sets SNI (szServerName, NULL : none),
+		 * offers the cached session of strSessionKey and has new sessions of pssl stored under it.
+		 * @return 1 if a session was offered, 0 if not
+		 */
+		int beginHandshake(SSL *pssl, const std::string &strSessionKey, const char *szServerName);
+		/**
+		 * Counts the handshake. A failed one that offered a session drops that session.
+		 */
+		void endHandshake(SSL *pssl, bool bSuccess, int64_t elapsed_us);
+
+		HandshakeStats getHandshakeStats();
+	};
+
+}
+
+#endif /* USE_OPENSSL */
+
+#endif /* __JSCPPUTILS_JSSSLCONTEXT_H__ */
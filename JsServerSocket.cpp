@@ -0,0 +1,430 @@
+/**
+ * @file	JsServerSocket.cpp
+ * @class	JsServerSocket
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/23
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "JsServerSocket.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace JsCPPUtils
+{
+	JsServerSocket::JsServerSocket(void *userptr)
+		: m_userptr(userptr)
+		, m_pengine(NULL)
+		, m_localaddrlen(0)
+		, m_conf_recvdatabufsize(4096)
+		, m_startworkerposthandler(NULL)
+		, m_stopworkerhandler(NULL)
+		, m_connectedhandler(NULL)
+		, m_recvhandler(NULL)
+		, m_disconnectedhandler(NULL)
+	{
+		memset(&m_localaddr, 0, sizeof(m_localaddr));
+	}
+
+	JsServerSocket::~JsServerSocket()
+	{
+		close();
+	}
+
+	void JsServerSocket::setEngine(JsSocketEngine *pengine)
+	{
+		m_pengine = pengine;
+	}
+
+	JsSocketEngine *JsServerSocket::getEngine()
+	{
+		return m_pengine;
+	}
+
+	void JsServerSocket::setUserPtr(void *userptr)
+	{
+		m_userptr = userptr;
+	}
+
+	void *JsServerSocket::getUserPtr()
+	{
+		return m_userptr;
+	}
+
+	int JsServerSocket::init(
+		long recvdatabufsize,
+		StartWorkerPostHandler_t startworkerposthandler,
+		StopWorkerHandler_t stopworkerhandler,
+		Server_ConnectedHandler_t connectedhandler,
+		Server_RecvHandler_t recvhandler,
+		Server_DisconnectedHandler_t disconnectedhandler)
+	{
+		if(!m_listeners.empty())
+			return -EISCONN;
+		m_conf_recvdatabufsize = recvdatabufsize;
+		m_startworkerposthandler = startworkerposthandler;
+		m_stopworkerhandler = stopworkerhandler;
+		m_connectedhandler = connectedhandler;
+		m_recvhandler = recvhandler;
+		m_disconnectedhandler = disconnectedhandler;
+		return 1;
+	}
+
+	int JsServerSocket::createListenFds(const struct sockaddr *psockaddr, int sockaddrlen, int backlog, int count, std::vector<int> &fds)
+	{
+		struct sockaddr_storage localaddr;
+		socklen_t localaddrlen;
+		int retval = 1;
+		int one = 1;
+		int fd;
+		int i;
+
+		fds.clear();
+		if((psockaddr == NULL) || (sockaddrlen <= 0) || (sockaddrlen > (int)sizeof(localaddr)) || (count <= 0))
+			return -EINVAL;
+		memcpy(&localaddr, psockaddr, sockaddrlen);
+		localaddrlen = sockaddrlen;
+
+		for(i = 0; i < count; i++)
+		{
+			fd = ::socket(localaddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if(fd < 0)
+			{
+				retval = -errno;
+				break;
+			}
+			::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if((::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) ||
+				(::bind(fd, (const struct sockaddr*)&localaddr, localaddrlen) < 0) ||
+				(::listen(fd, backlog) < 0))
+			{
+				retval = -errno;
+				::close(fd);
+				break;
+			}
+			if(i == 0)
+			{
+				/* port 0 : the others join the port the first one got */
+				localaddrlen = sizeof(localaddr);
+				::getsockname(fd, (struct sockaddr*)&localaddr, &localaddrlen);
+			}
+			fds.push_back(fd);
+		}
+
+		if(retval != 1)
+		{
+			for(i = 0; i < (int)fds.size(); i++)
+				::close(fds[i]);
+			fds.clear();
+		}
+		return retval;
+	}
+
+	int JsServerSocket::listen(const struct sockaddr *psockaddr, int sockaddrlen, int backlog, int numoflisteners)
+	{
+		std::vector<int> fds;
+		int retval;
+
+		if(!m_listeners.empty())
+			return -EISCONN;
+		if(m_pengine == NULL)
+			m_pengine = JsSocketEngine::getDefault();
+		if((m_pengine == NULL) || (m_pengine->getLoopCount() <= 0))
+			return -ENODEV;
+		if(numoflisteners <= 0)
+			numoflisteners = m_pengine->getLoopCount();
+
+		retval = createListenFds(psockaddr, sockaddrlen, backlog, numoflisteners, fds);
+		if(retval != 1)
+			return retval;
+		return _listen(fds);
+	}
+
+	int JsServerSocket::listen(const std::vector<int> &fds)
+	{
+		std::vector<int> ownfds;
+		int retval = 1;
+		size_t i;
+
+		if(!m_listeners.empty())
+			return -EISCONN;
+		if(fds.empty())
+			return -EINVAL;
+		if(m_pengine == NULL)
+			m_pengine = JsSocketEngine::getDefault();
+		if((m_pengine == NULL) || (m_pengine->getLoopCount() <= 0))
+			return -ENODEV;
+
+		for(i = 0; i < fds.size(); i++)
+		{
+			int acceptconn = 0;
+			socklen_t optlen = sizeof(acceptconn);
+			int fd;
+			int flags;
+			if(::getsockopt(fds[i], SOL_SOCKET, SO_ACCEPTCONN, &acceptconn, &optlen) < 0)
+			{
+				retval = -errno;
+				break;
+			}
+			if(!acceptconn)
+			{
+				retval = -EINVAL;
+				break;
+			}
+			/* the caller keeps its descriptors, e.g. registered with Daemon::addListenFd() */
+			fd = ::fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+			if(fd < 0)
+			{
+				retval = -errno;
+				break;
+			}
+			ownfds.push_back(fd);
+			/* a file status flag : the caller's descriptors share it */
+			flags = ::fcntl(fd, F_GETFL);
+			if((flags < 0) || (::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+			{
+				retval = -errno;
+				break;
+			}
+		}
+
+		if(retval != 1)
+		{
+			for(i = 0; i < ownfds.size(); i++)
+				::close(ownfds[i]);
+			return retval;
+		}
+		return _listen(ownfds);
+	}
+
+	int JsServerSocket::_listen(const std::vector<int> &fds)
+	{
+		int retval = 1;
+		int i;
+
+		m_localaddrlen = sizeof(m_localaddr);
+		::getsockname(fds[0], (struct sockaddr*)&m_localaddr, &m_localaddrlen);
+
+		for(i = 0; i < (int)fds.size(); i++)
+		{
+			Listener *plistener = new Listener(this, i, m_pengine->getLoop(i % m_pengine->getLoopCount()));
+			plistener->fd = fds[i];
+			m_listeners.push_back(plistener);
+		}
+
+		for(i = 0; (retval == 1) && (i < (int)m_listeners.size()); i++)
+		{
+			Listener *plistener = m_listeners[i].getPtr();
+			plistener->ploop->invoke(_openProc, plistener, &retval);
+		}
+
+		if(retval != 1)
+			close();
+		return retval;
+	}
+
+	std::vector<int> JsServerSocket::getListenFds() const
+	{
+		std::vector<int> fds;
+		size_t i;
+		for(i = 0; i < m_listeners.size(); i++)
+			fds.push_back(m_listeners[i]->fd);
+		return fds;
+	}
+
+	void JsServerSocket::close()
+	{
+		size_t i;
+		for(i = 0; i < m_listeners.size(); i++)
+		{
+			Listener *plistener = m_listeners[i].getPtr();
+			plistener->ploop->invoke(_closeProc, plistener, NULL);
+		}
+		/* a connection released just before _closeProc has its delete queued behind it : let it run while we exist */
+		for(i = 0; i < m_listeners.size(); i++)
+			m_listeners[i]->ploop->invoke(_barrierProc, NULL, NULL);
+		m_listeners.clear();
+	}
+
+	int JsServerSocket::getLocalAddress(struct sockaddr *psockaddr, socklen_t *psockaddrlen)
+	{
+		if(m_listeners.empty())
+			return 0;
+		if(*psockaddrlen < m_localaddrlen)
+			return -EINVAL;
+		memcpy(psockaddr, &m_localaddr, m_localaddrlen);
+		*psockaddrlen = m_localaddrlen;
+		return 1;
+	}
+
+	void JsServerSocket::_openProc(void *param1, void *param2)
+	{
+		Listener *plistener = (Listener*)param1;
+		JsServerSocket *pserver = plistener->pserver;
+		int *pretval = (int*)param2;
+		int nrst;
+
+		if(pserver->m_startworkerposthandler != NULL)
+		{
+			if((nrst = pserver->m_startworkerposthandler(pserver, plistener->index, &plistener->pthreaduserctx)) <= 0)
+			{
+				*pretval = nrst;
+				return;
+			}
+			plistener->inited_userhandler = true;
+		}
+		nrst = plistener->ploop->addChannel(plistener, plistener->fd, EPOLLIN);
+		if(nrst != 1)
+			*pretval = nrst;
+	}
+
+	void JsServerSocket::_closeProc(void *param1, void *param2)
+	{
+		Listener *plistener = (Listener*)param1;
+		JsServerSocket *pserver = plistener->pserver;
+		std::set<JsClientSocket*> clients;
+		std::set<JsClientSocket*>::iterator iter;
+
+		plistener->closing = true;
+		if(plistener->retry_timerid != 0)
+		{
+			plistener->ploop->cancelTimer(plistener->retry_timerid);
+			plistener->retry_timerid = 0;
+		}
+		if(plistener->isRegistered())
+			plistener->ploop->removeChannel(plistener);
+		if(plistener->fd >= 0)
+		{
+			::close(plistener->fd);
+			plistener->fd = -1;
+		}
+
+		/* runs their disconnected handlers on this thread */
+		clients.swap(plistener->clients);
+		for(iter = clients.begin(); iter != clients.end(); iter++)
+		{
+			delete *iter;
+			pserver->m_connectioncount.decget();
+		}
+
+		if(plistener->inited_userhandler && (pserver->m_stopworkerhandler != NULL))
+			pserver->m_stopworkerhandler(pserver, plistener->index, plistener->pthreaduserctx);
+		plistener->inited_userhandler = false;
+	}
+
+	void JsServerSocket::_barrierProc(void *param1, void *param2)
+	{
+	}
+
+	void JsServerSocket::Listener::onEvent(uint32_t events)
+	{
+		if(events & EPOLLIN)
+			pserver->_accept(this);
+	}
+
+	void JsServerSocket::_retryProc(void *param1, void *param2)
+	{
+		Listener *plistener = (Listener*)param1;
+		plistener->retry_timerid = 0;
+		if(!plistener->closing)
+			plistener->pserver->_accept(plistener);
+	}
+
+	/*
+	 * Edge-triggered : accepts until the backlog is empty.
+	 */
+	void JsServerSocket::_accept(Listener *plistener)
+	{
+		JsClientSocket *pclient;
+		int fd;
+		int rc;
+
+		while(!plistener->closing)
+		{
+			fd = ::accept4(plistener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(fd < 0)
+			{
+				if((errno == EINTR) || (errno == ECONNABORTED) || (errno == EPROTO))
+					continue;
+				/* out of descriptors or memory : no new edge comes for the waiting ones, look again later */
+				if(((errno == EMFILE) || (errno == ENFILE) || (errno == ENOBUFS) || (errno == ENOMEM)) && (plistener->retry_timerid == 0))
+					plistener->retry_timerid = plistener->ploop->addTimer(100, _retryProc, plistener, NULL);
+				break;
+			}
+
+			pclient = new JsClientSocket();
+			plistener->clients.insert(pclient);
+			m_connectioncount.incget();
+			rc = pclient->_engine_accept(plistener->ploop, fd, plistener, m_conf_recvdatabufsize, _clientConnectedProc, _clientRecvProc, _clientDisconnectedProc);
+			if(rc != 1)
+			{
+				plistener->clients.erase(pclient);
+				delete pclient;
+				m_connectioncount.decget();
+				::close(fd);
+				continue;
+			}
+			/* refused by the connected handler, or gone already */
+			if(pclient->m_sock_state < JsClientSocket::SOCKSTATE_CONNECTED)
+				_releaseClient(plistener, pclient);
+		}
+	}
+
+	/*
+	 * A connection is deleted from a task of its loop, never inside one of its own handlers.
+	 */
+	void JsServerSocket::_releaseClient(Listener *plistener, JsClientSocket *pclient)
+	{
+		if(plistener->closing)
+			return;
+		if(plistener->clients.find(pclient) == plistener->clients.end())
+			return;
+		if(plistener->ploop->post(_deleteClientProc, this, pclient) == 1)
+			plistener->clients.erase(pclient);
+	}
+
+	void JsServerSocket::_deleteClientProc(void *param1, void *param2)
+	{
+		JsServerSocket *pserver = (JsServerSocket*)param1;
+		JsClientSocket *pclient = (JsClientSocket*)param2;
+		delete pclient;
+		pserver->m_connectioncount.decget();
+	}
+
+	JsServerSocket::Listener *JsServerSocket::_listenerOf(JsClientSocket *pclient)
+	{
+		return (Listener*)pclient->m_pengctx->pthreaduserctx;
+	}
+
+	int JsServerSocket::_clientConnectedProc(JsClientSocket *psockctx, void *pthreaduserctx, JSCUTILS_SOCKET_T clientsock)
+	{
+		Listener *plistener = (Listener*)pthreaduserctx;
+		JsServerSocket *pserver = plistener->pserver;
+		if(pserver->m_connectedhandler == NULL)
+			return 1;
+		return pserver->m_connectedhandler(pserver, psockctx, plistener->pthreaduserctx);
+	}
+
+	int JsServerSocket::_clientRecvProc(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf)
+	{
+		Listener *plistener = (Listener*)pthreaduserctx;
+		JsServerSocket *pserver = plistener->pserver;
+		if(pserver->m_recvhandler == NULL)
+			return 1;
+		return pserver->m_recvhandler(pserver, psockctx, plistener->pthreaduserctx, recv_len, recv_pbuf);
+	}
+
+	void JsServerSocket::_clientDisconnectedProc(JsClientSocket *psockctx, int code)
+	{
+		Listener *plistener = _listenerOf(psockctx);
+		JsServerSocket *pserver = plistener->pserver;
+		if(pserver->m_disconnectedhandler != NULL)
+			pserver->m_disconnectedhandler(pserver, psockctx, plistener->pthreaduserctx, code);
+		pserver->_releaseClient(plistener, psockctx);
+	}
+}
@@ -0,0 +1,179 @@
+/**
+ * @file	JsServerSocket.h
+ * @class	JsServerSocket
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/23
+ * @brief	TCP listener on JsSocketEngine : one SO_REUSEPORT listening socket per loop, accepted connections stay on that loop
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_JSSERVERSOCKET_H__
+#define __JSCPPUTILS_JSSERVERSOCKET_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <sys/socket.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS, yet..."
+#endif
+
+#include <vector>
+#include <set>
+
+#include "JsSocketEngine.h"
+#include "JsClientSocket.h"
+#include "SmartPointer.h"
+#include "AtomicNum.h"
+
+namespace JsCPPUtils
+{
+	/**
+	 * The kernel spreads incoming connections over the listeners (SO_REUSEPORT), so accepting
+	 * takes no shared lock and every connection is served by the loop that accepted it.
+	 * Accepted connections are JsClientSocket objects owned by the server : send() and the other
+	 * JsClientSocket calls work on them, and they are deleted once the disconnected handler returns.
+	 */
+	class JsServerSocket
+	{
+	public:
+		/* once per listener, on its loop thread; threadidx is the listener index */
+		typedef int(*StartWorkerPostHandler_t)(JsServerSocket *pserver, int threadidx, void **out_pthreaduserctx);
+		typedef void(*StopWorkerHandler_t)(JsServerSocket *pserver, int threadidx, void *pthreaduserctx);
+
+		/* pthreaduserctx : the context of the listener (loop) the connection belongs to */
+		typedef int(*Server_ConnectedHandler_t)(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx);
+		typedef int(*Server_RecvHandler_t)(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx, int recv_len, char *recv_pbuf);
+		typedef void(*Server_DisconnectedHandler_t)(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx, int code);
+		/* sent handlers are per send() call : JsClientSocket::Client_SentHandler_t */
+
+	private:
+		class Listener : public JsSocketEngine::Channel
+		{
+		public:
+			JsServerSocket *pserver;
+			int index;
+			JsSocketEngine::Loop *ploop;
+			int fd;
+			void *pthreaduserctx;
+			bool inited_userhandler;
+			bool closing;
+			int64_t retry_timerid;
+			/* loop thread only */
+			std::set<JsClientSocket*> clients;
+
+			Listener(JsServerSocket *_pserver, int _index, JsSocketEngine::Loop *_ploop)
+				: pserver(_pserver)
+				, index(_index)
+				, ploop(_ploop)
+				, fd(-1)
+				, pthreaduserctx(NULL)
+				, inited_userhandler(false)
+				, closing(false)
+				, retry_timerid(0)
+			{}
+			void onEvent(uint32_t events) override;
+		};
+
+		void *m_userptr;
+		JsSocketEngine *m_pengine;
+		std::vector< JsCPPUtils::SmartPointer<Listener> > m_listeners;
+		struct sockaddr_storage m_localaddr;
+		socklen_t m_localaddrlen;
+		JsCPPUtils::AtomicNum<int> m_connectioncount;
+
+		long m_conf_recvdatabufsize;
+		StartWorkerPostHandler_t m_startworkerposthandler;
+		StopWorkerHandler_t m_stopworkerhandler;
+		Server_ConnectedHandler_t m_connectedhandler;
+		Server_RecvHandler_t m_recvhandler;
+		Server_DisconnectedHandler_t m_disconnectedhandler;
+
+		int _listen(const std::vector<int> &fds);
+		void _accept(Listener *plistener);
+		void _releaseClient(Listener *plistener, JsClientSocket *pclient);
+		static Listener *_listenerOf(JsClientSocket *pclient);
+		static void _openProc(void *param1, void *param2);
+		static void _closeProc(void *param1, void *param2);
+		static void _barrierProc(void *param1, void *param2);
+		static void _retryProc(void *param1, void *param2);
+		static void _deleteClientProc(void *param1, void *param2);
+		static int _clientConnectedProc(JsClientSocket *psockctx, void *pthreaduserctx, JSCUTILS_SOCKET_T clientsock);
+		static int _clientRecvProc(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf);
+		static void _clientDisconnectedProc(JsClientSocket *psockctx, int code);
+
+	public:
+		JsServerSocket(void *userptr = NULL);
+		~JsServerSocket();
+
+		/**
+		 * Uses pengine instead of JsSocketEngine::getDefault(). Must be called before listen().
+		 */
+		void setEngine(JsSocketEngine *pengine);
+		JsSocketEngine *getEngine();
+
+		int init(
+			long recvdatabufsize,
+			StartWorkerPostHandler_t startworkerposthandler,
+			StopWorkerHandler_t stopworkerhandler,
+			Server_ConnectedHandler_t connectedhandler,
+			Server_RecvHandler_t recvhandler,
+			Server_DisconnectedHandler_t disconnectedhandler);
+
+		/**
+		 * numoflisteners <= 0 : one per engine loop. Port 0 binds every listener to the same ephemeral port.
+		 * @return 1 on success, negative errno on failure (a start handler's result if it refused)
+		 */
+		int listen(const struct sockaddr *psockaddr, int sockaddrlen, int backlog = SOMAXCONN, int numoflisteners = 0);
+		/**
+		 * Listens on sockets that are already listening, one listener per socket (spread over the loops).
+		 * The server works on duplicates and closes only those : the caller keeps fds.
+		 * This is how the server takes part in Daemon's graceful restart. In the startup handler, take the
+		 * sockets with Daemon::getInheritedFd(), or make them with createListenFds() on a cold start, and
+		 * register each with Daemon::addListenFd(). Then pass them here from the main handler (in prefork mode,
+		 * every worker does). The new process accepts on the very sockets the old one drains, so the
+		 * connections waiting in their backlogs are not lost.
+		 * @return 1 on success, -EINVAL if one of fds is not a listening socket, negative errno on failure
+		 */
+		int listen(const std::vector<int> &fds);
+		/**
+		 * count SO_REUSEPORT sockets bound to psockaddr and listening, without an engine (e.g. in the master
+		 * before the workers are forked). Port 0 binds all of them to the same ephemeral port.
+		 * @return 1 on success, negative errno on failure (fds is then empty)
+		 */
+		static int createListenFds(const struct sockaddr *psockaddr, int sockaddrlen, int backlog, int count, std::vector<int> &fds);
+		/**
+		 * Closes the listeners and every accepted connection (their disconnected handlers run),
+		 * then the stop handlers. Waits for the loops.
+		 */
+		void close();
+
+		/**
+		 * The bound address (after listen).
+		 */
+		int getLocalAddress(struct sockaddr *psockaddr, socklen_t *psockaddrlen);
+		int getListenerCount() const {
+			return (int)m_listeners.size();
+		}
+		/**
+		 * The listening sockets, one per listener (after listen); close() closes them. Without prefork, a server
+		 * that listens from the startup handler can register these with Daemon::addListenFd() itself.
+		 */
+		std::vector<int> getListenFds() const;
+		int getConnectionCount() {
+			return m_connectioncount.get();
+		}
+
+		void setUserPtr(void *userptr);
+		void *getUserPtr();
+	};
+
+}
+
+#endif /* __JSCPPUTILS_JSSERVERSOCKET_H__ */
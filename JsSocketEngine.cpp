@@ -0,0 +1,933 @@
+/**
+ * @file	JsSocketEngine.cpp
+ * @class	JsSocketEngine
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/19
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "JsSocketEngine.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+namespace JsCPPUtils
+{
+	struct JsSocketEngine::Loop::InvokeWaiter {
+		TaskFunc_t fn;
+		void *param1;
+		void *param2;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		bool done;
+	};
+
+	/*
+	 * Outstanding io_uring requests of one channel. Completions carry (slot | op) as user_data,
+	 * so the slot outlives the channel until its last request has completed.
+	 */
+	struct JsSocketEngine::Loop::UringSlot {
+		Channel *pchannel;
+		int fd;
+		uint32_t events;
+		int inflight;
+		bool polling;
+		bool receiving;
+		std::vector<Task> deferred;
+	};
+
+	/* the loop running on the current thread */
+	static __thread JsSocketEngine::Loop *t_pcurloop = NULL;
+
+	enum {
+		LOOP_MAX_EVENTS = 256,
+		LOOP_IDLE_TIMEOUT = 1000
+	};
+
+	enum {
+		URING_ENTRIES = 1024,
+		URING_BUF_COUNT = 512,
+		URING_BUF_SIZE = 16384,
+		URING_BUF_GROUP = 0
+	};
+
+	enum {
+		URING_OP_IGNORE = 0,
+		URING_OP_WAKE = 1,
+		URING_OP_POLL = 2,
+		URING_OP_RECV = 3,
+		URING_OP_SEND = 4,
+		URING_OP_MASK = 7
+	};
+
+	#define _URING_USERDATA(pslot, op) ((uint64_t)(uintptr_t)(pslot) | (uint64_t)(op))
+
+	JsSocketEngine::Loop::Loop(JsSocketEngine *pengine, int index)
+		: m_pengine(pengine)
+		, m_index(index)
+		, m_epfd(-1)
+		, m_wakefd(-1)
+		, m_puring(NULL)
+		, m_uringrecv(false)
+		, m_pbufmem(NULL)
+		, m_accepting(false)
+		, m_wakepending(0)
+		, m_pbatch(NULL)
+		, m_batchpos(0)
+		, m_batchcount(0)
+		, m_nexttimerid(0)
+		, m_channelcount(0)
+	{
+	}
+
+	JsSocketEngine::Loop::~Loop()
+	{
+		_close();
+	}
+
+	int JsSocketEngine::Loop::_create(Backend backend)
+	{
+		struct epoll_event ev;
+
+		m_wakefd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_wakefd < 0)
+			return -errno;
+
+		if (backend == BACKEND_IOURING)
+		{
+			if (_createUring() > 0)
+			{
+				m_accepting = true;
+				return 1;
+			}
+		}
+
+		m_epfd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (m_epfd < 0)
+		{
+			int nerr = errno;
+			_close();
+			return -nerr;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (::epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd, &ev) < 0)
+		{
+			int nerr = errno;
+			_close();
+			return -nerr;
+		}
+
+		m_accepting = true;
+		return 1;
+	}
+
+	int JsSocketEngine::Loop::_createUring()
+	{
+		int rc;
+
+		m_puring = new IoUring();
+		rc = m_puring->init(URING_ENTRIES, IORING_SETUP_SUBMIT_ALL);
+		if (rc == -EINVAL)
+			rc = m_puring->init(URING_ENTRIES, 0);
+		/* timed waits need EXT_ARG (5.11) */
+		if ((rc > 0) && !(m_puring->getFeatures() & IORING_FEAT_EXT_ARG))
+			rc = -ENOSYS;
+		if (rc <= 0)
+		{
+			delete m_puring;
+			m_puring = NULL;
+			return rc;
+		}
+
+		_uringArmWake();
+
+		/*
+		 * Receive buffers go through IORING_OP_PROVIDE_BUFFERS rather than a registered
+		 * buffer ring, which some kernels accept but never select from.
+		 * Multishot recv (6.0) has no feature bit; REG_REG_RING (6.3) is the nearest one implying it.
+		 */
+		if (m_puring->getFeatures() & IORING_FEAT_REG_REG_RING)
+		{
+			m_pbufmem = (char*)malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+			if (m_pbufmem != NULL)
+			{
+				_uringProvide(0, URING_BUF_COUNT);
+				m_uringrecv = true;
+			}
+		}
+
+		return 1;
+	}
+
+	void JsSocketEngine::Loop::_close()
+	{
+		if (m_puring != NULL)
+		{
+			delete m_puring;
+			m_puring = NULL;
+		}
+		if (m_pbufmem != NULL)
+		{
+			free(m_pbufmem);
+			m_pbufmem = NULL;
+		}
+		m_uringrecv = false;
+		m_uringprime.clear();
+		if (m_wakefd >= 0)
+		{
+			::close(m_wakefd);
+			m_wakefd = -1;
+		}
+		if (m_epfd >= 0)
+		{
+			::close(m_epfd);
+			m_epfd = -1;
+		}
+	}
+
+	bool JsSocketEngine::Loop::isInLoopThread() const
+	{
+		return t_pcurloop == this;
+	}
+
+	void JsSocketEngine::Loop::_wakeup()
+	{
+		uint64_t one = 1;
+		if (__sync_lock_test_and_set(&m_wakepending, 1) == 0)
+		{
+			if (::write(m_wakefd, &one, sizeof(one)) < 0)
+			{
+				/* EAGAIN : counter is saturated, the loop is awake anyway */
+			}
+		}
+	}
+
+	/*
+	 * io_uring queues are owned by the loop thread; channel calls from elsewhere are marshalled.
+	 */
+	struct ChannelCall {
+		int op;
+		JsSocketEngine::Channel *pchannel;
+		int fd;
+		uint32_t events;
+		int retval;
+	};
+
+	void JsSocketEngine::Loop::_channelProc(void *param1, void *param2)
+	{
+		Loop *ploop = (Loop*)param1;
+		ChannelCall *pcall = (ChannelCall*)param2;
+		switch (pcall->op)
+		{
+		case 0:
+			pcall->retval = ploop->addChannel(pcall->pchannel, pcall->fd, pcall->events);
+			break;
+		case 1:
+			pcall->retval = ploop->modChannel(pcall->pchannel, pcall->events);
+			break;
+		case 2:
+			pcall->retval = ploop->removeChannel(pcall->pchannel);
+			break;
+		}
+	}
+
+	int JsSocketEngine::Loop::addChannel(Channel *pchannel, int fd, uint32_t events)
+	{
+		struct epoll_event ev;
+
+		if (m_puring != NULL)
+		{
+			UringSlot *pslot;
+			if ((isRunning() > 0) && !isInLoopThread())
+			{
+				ChannelCall call = { 0, pchannel, fd, events, 0 };
+				invoke(_channelProc, this, &call);
+				return call.retval;
+			}
+			pslot = new UringSlot();
+			pslot->pchannel = pchannel;
+			pslot->fd = fd;
+			pslot->events = events | EPOLLET;
+			pslot->inflight = 0;
+			pslot->polling = false;
+			pslot->receiving = false;
+			pchannel->m_fd = fd;
+			pchannel->m_ploop = this;
+			pchannel->m_events = pslot->events;
+			pchannel->m_pslot = pslot;
+			if (events != 0)
+				_uringArmPoll(pslot);
+			m_channelcount.incget();
+			return 1;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events | EPOLLET;
+		ev.data.ptr = pchannel;
+		pchannel->m_fd = fd;
+		pchannel->m_ploop = this;
+		pchannel->m_events = ev.events;
+		if (::epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			int nerr = errno;
+			pchannel->m_fd = -1;
+			pchannel->m_ploop = NULL;
+			return -nerr;
+		}
+		m_channelcount.incget();
+		return 1;
+	}
+
+	int JsSocketEngine::Loop::modChannel(Channel *pchannel, uint32_t events)
+	{
+		struct epoll_event ev;
+
+		if (pchannel->m_ploop != this)
+			return 0;
+
+		if (m_puring != NULL)
+		{
+			UringSlot *pslot = (UringSlot*)pchannel->m_pslot;
+			struct io_uring_sqe *psqe;
+			if ((isRunning() > 0) && !isInLoopThread())
+			{
+				ChannelCall call = { 1, pchannel, -1, events, 0 };
+				invoke(_channelProc, this, &call);
+				return call.retval;
+			}
+			pslot->events = (events != 0) ? (events | EPOLLET) : 0;
+			pchannel->m_events = pslot->events;
+			if (!pslot->polling)
+			{
+				if (events != 0)
+					_uringArmPoll(pslot);
+			}else if (events != 0) {
+				/* update the armed multishot poll in place */
+				psqe = _uringSqe();
+				psqe->opcode = IORING_OP_POLL_REMOVE;
+				psqe->fd = -1;
+				psqe->addr = _URING_USERDATA(pslot, URING_OP_POLL);
+				psqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+				psqe->poll32_events = pslot->events;
+				psqe->user_data = _URING_USERDATA(NULL, URING_OP_IGNORE);
+			}else{
+				_uringCancel(pslot, URING_OP_POLL);
+			}
+			return 1;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events | EPOLLET;
+		ev.data.ptr = pchannel;
+		if (::epoll_ctl(m_epfd, EPOLL_CTL_MOD, pchannel->m_fd, &ev) < 0)
+			return -errno;
+		pchannel->m_events = ev.events;
+		return 1;
+	}
+
+	int JsSocketEngine::Loop::removeChannel(Channel *pchannel)
+	{
+		int i;
+		int retval = 1;
+
+		if (pchannel->m_ploop != this)
+			return 0;
+
+		if (m_puring != NULL)
+		{
+			UringSlot *pslot = (UringSlot*)pchannel->m_pslot;
+			if ((isRunning() > 0) && !isInLoopThread())
+			{
+				ChannelCall call = { 2, pchannel, -1, 0, 0 };
+				invoke(_channelProc, this, &call);
+				return call.retval;
+			}
+			pslot->pchannel = NULL;
+			pslot->events = 0;
+			if (pslot->polling)
+				_uringCancel(pslot, URING_OP_POLL);
+			if (pslot->receiving)
+				_uringCancel(pslot, URING_OP_RECV);
+			if (pslot->inflight == 0)
+				_uringReleaseSlot(pslot);
+		}else{
+			if (::epoll_ctl(m_epfd, EPOLL_CTL_DEL, pchannel->m_fd, NULL) < 0)
+				retval = -errno;
+		}
+		if (isInLoopThread())
+		{
+			for (i = m_batchpos; i < m_batchcount; i++)
+			{
+				if (m_pbatch[i].data.ptr == pchannel)
+					m_pbatch[i].events = 0;
+			}
+		}
+		pchannel->m_fd = -1;
+		pchannel->m_ploop = NULL;
+		pchannel->m_events = 0;
+		pchannel->m_pslot = NULL;
+		m_channelcount.decget();
+		return retval;
+	}
+
+	int JsSocketEngine::Loop::getRecvBufferSize() const
+	{
+		return URING_BUF_SIZE;
+	}
+
+	int JsSocketEngine::Loop::startRecv(Channel *pchannel)
+	{
+		UringSlot *pslot = (UringSlot*)pchannel->m_pslot;
+		if (!m_uringrecv || (pslot == NULL))
+			return 0;
+		if (!pslot->receiving)
+			_uringArmRecv(pslot);
+		return 1;
+	}
+
+	int JsSocketEngine::Loop::submitSendMsg(Channel *pchannel, const struct msghdr *pmsg)
+	{
+		UringSlot *pslot = (UringSlot*)pchannel->m_pslot;
+		struct io_uring_sqe *psqe;
+
+		if (!m_uringrecv || (pslot == NULL))
+			return 0;
+		psqe = _uringSqe();
+		psqe->opcode = IORING_OP_SENDMSG;
+		psqe->fd = pslot->fd;
+		psqe->addr = (uint64_t)(uintptr_t)pmsg;
+		psqe->len = 1;
+		psqe->msg_flags = MSG_NOSIGNAL;
+		psqe->user_data = _URING_USERDATA(pslot, URING_OP_SEND);
+		pslot->inflight++;
+		return 1;
+	}
+
+	void JsSocketEngine::Loop::deferRelease(Channel *pchannel, TaskFunc_t fn, void *param1, void *param2)
+	{
+		UringSlot *pslot = (UringSlot*)pchannel->m_pslot;
+		if (pslot != NULL)
+		{
+			Task task;
+			task.fn = fn;
+			task.param1 = param1;
+			task.param2 = param2;
+			pslot->deferred.push_back(task);
+		}else{
+			fn(param1, param2);
+		}
+	}
+
+	struct io_uring_sqe *JsSocketEngine::Loop::_uringSqe()
+	{
+		struct io_uring_sqe *psqe = m_puring->getSqe();
+		if (psqe == NULL)
+		{
+			/* queue full : push the batch out early */
+			m_puring->submit();
+			psqe = m_puring->getSqe();
+		}
+		return psqe;
+	}
+
+	void JsSocketEngine::Loop::_uringArmWake()
+	{
+		struct io_uring_sqe *psqe = _uringSqe();
+		psqe->opcode = IORING_OP_POLL_ADD;
+		psqe->fd = m_wakefd;
+		psqe->poll32_events = EPOLLIN;
+		psqe->len = IORING_POLL_ADD_MULTI;
+		psqe->user_data = _URING_USERDATA(NULL, URING_OP_WAKE);
+		m_uringprime.push_back(NULL);
+	}
+
+	void JsSocketEngine::Loop::_uringArmPoll(UringSlot *pslot)
+	{
+		struct io_uring_sqe *psqe = _uringSqe();
+		psqe->opcode = IORING_OP_POLL_ADD;
+		psqe->fd = pslot->fd;
+		psqe->poll32_events = pslot->events;
+		psqe->len = IORING_POLL_ADD_MULTI;
+		psqe->user_data = _URING_USERDATA(pslot, URING_OP_POLL);
+		pslot->inflight++;
+		pslot->polling = true;
+		m_uringprime.push_back(pslot);
+	}
+
+	void JsSocketEngine::Loop::_uringArmRecv(UringSlot *pslot)
+	{
+		struct io_uring_sqe *psqe = _uringSqe();
+		psqe->opcode = IORING_OP_RECV;
+		psqe->fd = pslot->fd;
+		psqe->ioprio = IORING_RECV_MULTISHOT;
+		psqe->flags = IOSQE_BUFFER_SELECT;
+		psqe->buf_group = URING_BUF_GROUP;
+		psqe->user_data = _URING_USERDATA(pslot, URING_OP_RECV);
+		pslot->inflight++;
+		pslot->receiving = true;
+	}
+
+	void JsSocketEngine::Loop::_uringProvide(int bid, int count)
+	{
+		struct io_uring_sqe *psqe = _uringSqe();
+		psqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+		psqe->fd = count;
+		psqe->addr = (uint64_t)(uintptr_t)(m_pbufmem + (size_t)bid * URING_BUF_SIZE);
+		psqe->len = URING_BUF_SIZE;
+		psqe->off = (uint64_t)bid;
+		psqe->buf_group = URING_BUF_GROUP;
+		psqe->user_data = _URING_USERDATA(NULL, URING_OP_IGNORE);
+	}
+
+	void JsSocketEngine::Loop::_uringCancel(UringSlot *pslot, int op)
+	{
+		struct io_uring_sqe *psqe = _uringSqe();
+		psqe->opcode = IORING_OP_ASYNC_CANCEL;
+		psqe->fd = -1;
+		psqe->addr = _URING_USERDATA(pslot, op);
+		psqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+		psqe->user_data = _URING_USERDATA(NULL, URING_OP_IGNORE);
+	}
+
+	void JsSocketEngine::Loop::_uringReleaseSlot(UringSlot *pslot)
+	{
+		std::vector<Task>::iterator iter;
+		for (iter = pslot->deferred.begin(); iter != pslot->deferred.end(); iter++)
+			iter->fn(iter->param1, iter->param2);
+		delete pslot;
+	}
+
+	/*
+	 * An edge-triggered io_uring poll only reports transitions after it is armed, whereas
+	 * EPOLL_CTL_ADD also reports a descriptor that is already ready. Called right after the
+	 * submit, before any completion is reaped (so the slots are still alive).
+	 * @return true if the wake fd was drained or an event was delivered
+	 */
+	bool JsSocketEngine::Loop::_uringPrime()
+	{
+		std::vector<UringSlot*>::iterator iter;
+		bool bActive = false;
+
+		m_uringpriming.swap(m_uringprime);
+		for (iter = m_uringpriming.begin(); iter != m_uringpriming.end(); iter++)
+		{
+			UringSlot *pslot = *iter;
+			struct pollfd pfd;
+			if (pslot == NULL)
+			{
+				uint64_t value;
+				__sync_lock_release(&m_wakepending);
+				while (::read(m_wakefd, &value, sizeof(value)) > 0);
+				bActive = true;
+				continue;
+			}
+			if ((pslot->pchannel == NULL) || !pslot->polling || (pslot->events == 0))
+				continue;
+			pfd.fd = pslot->fd;
+			pfd.events = (short)(pslot->events & (POLLIN | POLLOUT | POLLPRI | POLLRDHUP));
+			pfd.revents = 0;
+			if ((::poll(&pfd, 1, 0) > 0) && (pfd.revents != 0))
+			{
+				pslot->pchannel->onEvent((uint32_t)pfd.revents);
+				bActive = true;
+			}
+		}
+		m_uringpriming.clear();
+		return bActive;
+	}
+
+	void JsSocketEngine::Loop::_uringComplete(uint64_t userdata, int res, uint32_t flags)
+	{
+		UringSlot *pslot = (UringSlot*)(uintptr_t)(userdata & ~(uint64_t)URING_OP_MASK);
+		int op = (int)(userdata & URING_OP_MASK);
+		bool bMore = (flags & IORING_CQE_F_MORE) != 0;
+
+		if (op == URING_OP_WAKE)
+		{
+			uint64_t value;
+			__sync_lock_release(&m_wakepending);
+			while (::read(m_wakefd, &value, sizeof(value)) > 0);
+			if (!bMore)
+				_uringArmWake();
+			return;
+		}
+		if ((op < URING_OP_POLL) || (op > URING_OP_SEND))
+			return;
+
+		/* pinned while the handlers run : they may remove the channel */
+		pslot->inflight++;
+		switch (op)
+		{
+		case URING_OP_POLL:
+			if (!bMore)
+			{
+				pslot->inflight--;
+				pslot->polling = false;
+			}
+			if ((pslot->pchannel != NULL) && (res != -ECANCELED))
+				pslot->pchannel->onEvent((res >= 0) ? (uint32_t)res : (uint32_t)(EPOLLERR | EPOLLHUP));
+			/* a multishot poll may end on its own (e.g. CQ overflow) */
+			if ((pslot->pchannel != NULL) && !pslot->polling && (pslot->events != 0) && (res >= 0))
+				_uringArmPoll(pslot);
+			break;
+
+		case URING_OP_RECV:
+			{
+				char *pbuf = NULL;
+				if (!bMore)
+				{
+					pslot->inflight--;
+					pslot->receiving = false;
+				}
+				if (flags & IORING_CQE_F_BUFFER)
+					pbuf = m_pbufmem + (size_t)(flags >> IORING_CQE_BUFFER_SHIFT) * URING_BUF_SIZE;
+				if ((pslot->pchannel != NULL) && (res != -ECANCELED) && (res != -ENOBUFS))
+					pslot->pchannel->onRecvComplete(res, pbuf);
+				if (pbuf != NULL)
+				{
+					_uringProvide((int)(flags >> IORING_CQE_BUFFER_SHIFT), 1);
+				}
+				/* out of buffers, or ended on its own : re-arm while the channel still wants data */
+				if ((pslot->pchannel != NULL) && !pslot->receiving && ((res > 0) || (res == -ENOBUFS)))
+					_uringArmRecv(pslot);
+			}
+			break;
+
+		case URING_OP_SEND:
+			pslot->inflight--;
+			if (pslot->pchannel != NULL)
+				pslot->pchannel->onSendComplete(res);
+			break;
+		}
+		pslot->inflight--;
+
+		if ((pslot->pchannel == NULL) && (pslot->inflight == 0))
+			_uringReleaseSlot(pslot);
+	}
+
+	int JsSocketEngine::Loop::post(TaskFunc_t fn, void *param1, void *param2)
+	{
+		Task task;
+		task.fn = fn;
+		task.param1 = param1;
+		task.param2 = param2;
+
+		m_tasklock.lock();
+		if (!m_accepting)
+		{
+			m_tasklock.unlock();
+			return 0;
+		}
+		m_tasks.push_back(task);
+		m_tasklock.unlock();
+		_wakeup();
+		return 1;
+	}
+
+	void JsSocketEngine::Loop::_invokeProc(void *param1, void *param2)
+	{
+		InvokeWaiter *pwaiter = (InvokeWaiter*)param1;
+		pwaiter->fn(pwaiter->param1, pwaiter->param2);
+		pthread_mutex_lock(&pwaiter->mutex);
+		pwaiter->done = true;
+		pthread_cond_signal(&pwaiter->cond);
+		pthread_mutex_unlock(&pwaiter->mutex);
+	}
+
+	void JsSocketEngine::Loop::invoke(TaskFunc_t fn, void *param1, void *param2)
+	{
+		InvokeWaiter waiter;
+
+		if (isInLoopThread())
+		{
+			fn(param1, param2);
+			return;
+		}
+
+		waiter.fn = fn;
+		waiter.param1 = param1;
+		waiter.param2 = param2;
+		waiter.done = false;
+		pthread_mutex_init(&waiter.mutex, NULL);
+		pthread_cond_init(&waiter.cond, NULL);
+
+		if (post(_invokeProc, &waiter, NULL))
+		{
+			pthread_mutex_lock(&waiter.mutex);
+			while (!waiter.done)
+				pthread_cond_wait(&waiter.cond, &waiter.mutex);
+			pthread_mutex_unlock(&waiter.mutex);
+		}else{
+			fn(param1, param2);
+		}
+
+		pthread_cond_destroy(&waiter.cond);
+		pthread_mutex_destroy(&waiter.mutex);
+	}
+
+	void JsSocketEngine::Loop::_runTasks()
+	{
+		std::vector<Task>::iterator iter;
+
+		m_tasklock.lock();
+		m_runningtasks.swap(m_tasks);
+		m_tasklock.unlock();
+
+		for (iter = m_runningtasks.begin(); iter != m_runningtasks.end(); iter++)
+			iter->fn(iter->param1, iter->param2);
+		m_runningtasks.clear();
+	}
+
+	int64_t JsSocketEngine::Loop::addTimer(int64_t delayms, TaskFunc_t fn, void *param1, void *param2)
+	{
+		TimerEntry entry;
+		entry.id = ++m_nexttimerid;
+		entry.fn = fn;
+		entry.param1 = param1;
+		entry.param2 = param2;
+		m_timerids[entry.id] = m_timers.insert(std::make_pair(Common::getTickCount() + delayms, entry));
+		return entry.id;
+	}
+
+	bool JsSocketEngine::Loop::cancelTimer(int64_t timerid)
+	{
+		std::map<int64_t, std::multimap<int64_t, TimerEntry>::iterator>::iterator iter = m_timerids.find(timerid);
+		if (iter == m_timerids.end())
+			return false;
+		m_timers.erase(iter->second);
+		m_timerids.erase(iter);
+		return true;
+	}
+
+	/*
+	 * Fires due timers and returns the epoll_wait timeout until the next one.
+	 */
+	int JsSocketEngine::Loop::_runTimers()
+	{
+		int64_t now = Common::getTickCount();
+		int64_t wait;
+
+		while (!m_timers.empty())
+		{
+			std::multimap<int64_t, TimerEntry>::iterator iter = m_timers.begin();
+			TimerEntry entry;
+			if (iter->first > now)
+				break;
+			entry = iter->second;
+			m_timers.erase(iter);
+			m_timerids.erase(entry.id);
+			entry.fn(entry.param1, entry.param2);
+		}
+
+		if (m_timers.empty())
+			return LOOP_IDLE_TIMEOUT;
+		wait = m_timers.begin()->first - Common::getTickCount();
+		if (wait < 0)
+			return 0;
+		if (wait > LOOP_IDLE_TIMEOUT)
+			return LOOP_IDLE_TIMEOUT;
+		return (int)wait;
+	}
+
+	int JsSocketEngine::Loop::run(int param_idx, void *param_ptr)
+	{
+		t_pcurloop = this;
+		if (m_puring != NULL)
+			_runUring();
+		else
+			_runEpoll();
+		t_pcurloop = NULL;
+		return 0;
+	}
+
+	/*
+	 * One io_uring_enter per iteration both submits what the previous batch queued and waits.
+	 */
+	void JsSocketEngine::Loop::_runUring()
+	{
+		int timeout = LOOP_IDLE_TIMEOUT;
+		struct io_uring_cqe *pcqe;
+
+		while (isRun())
+		{
+			int rc = 0;
+			/* polls armed by the handlers _uringPrime() runs are primed too, before anything is reaped */
+			while (!m_uringprime.empty())
+			{
+				/* the new polls must be in the kernel before their descriptors are checked */
+				rc = m_puring->submit();
+				if ((rc < 0) && (rc != -EBUSY) && (rc != -EAGAIN))
+					break;
+				if (_uringPrime())
+					timeout = 0;
+			}
+			if ((rc < 0) && (rc != -EBUSY) && (rc != -EAGAIN))
+				break;
+			rc = m_puring->submitAndWait((timeout != 0) ? 1 : 0, timeout);
+			if ((rc < 0) && (rc != -EBUSY) && (rc != -EAGAIN))
+				break;
+
+			while ((pcqe = m_puring->peekCqe()) != NULL)
+			{
+				uint64_t userdata = pcqe->user_data;
+				int res = pcqe->res;
+				uint32_t flags = pcqe->flags;
+				m_puring->seenCqe();
+				_uringComplete(userdata, res, flags);
+			}
+
+			_runTasks();
+			timeout = _runTimers();
+		}
+	}
+
+	void JsSocketEngine::Loop::_runEpoll()
+	{
+		struct epoll_event events[LOOP_MAX_EVENTS];
+		int timeout = LOOP_IDLE_TIMEOUT;
+
+		while (isRun())
+		{
+			int n = ::epoll_wait(m_epfd, events, LOOP_MAX_EVENTS, timeout);
+			if (n < 0)
+			{
+				if (errno != EINTR)
+					break;
+				n = 0;
+			}
+
+			m_pbatch = events;
+			m_batchcount = n;
+			for (m_batchpos = 0; m_batchpos < m_batchcount; )
+			{
+				struct epoll_event *pev = &events[m_batchpos++];
+				if (pev->data.ptr == NULL)
+				{
+					uint64_t value;
+					__sync_lock_release(&m_wakepending);
+					while (::read(m_wakefd, &value, sizeof(value)) > 0);
+				}else if (pev->events != 0) {
+					((Channel*)pev->data.ptr)->onEvent(pev->events);
+				}
+			}
+			m_pbatch = NULL;
+			m_batchcount = 0;
+
+			_runTasks();
+			timeout = _runTimers();
+		}
+	}
+
+	JsSocketEngine::JsSocketEngine()
+		: m_nextloop(0)
+		, m_started(false)
+		, m_backend(BACKEND_EPOLL)
+	{
+	}
+
+	JsSocketEngine::~JsSocketEngine()
+	{
+		stop();
+		m_loops.clear();
+	}
+
+	int JsSocketEngine::start(int numofloops, const char *szName, Backend backend)
+	{
+		int i;
+		int rc;
+		char szThreadName[16];
+
+		if (m_started)
+			return 0;
+		m_loops.clear();
+
+		if (numofloops <= 0)
+		{
+			long ncpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+			numofloops = (ncpus > 0) ? (int)ncpus : 1;
+		}
+
+		for (i = 0; i < numofloops; i++)
+		{
+			JsCPPUtils::SmartPointer<Loop> sploop = new Loop(this, i);
+			rc = sploop->_create(backend);
+			if (rc <= 0)
+			{
+				m_loops.push_back(sploop);
+				stop();
+				return rc;
+			}
+			/* all loops share the backend the first one got */
+			backend = sploop->getBackend();
+			/* within the 15 characters a thread name has (the index only repeats past 9999 loops) */
+			snprintf(szThreadName, sizeof(szThreadName), "%.10s/%u", szName, (unsigned int)i % 10000);
+			m_loops.push_back(sploop);
+			sploop->start(i, NULL, NULL, szThreadName);
+		}
+
+		m_backend = backend;
+		m_started = true;
+		return 1;
+	}
+
+	void JsSocketEngine::stop()
+	{
+		std::vector< JsCPPUtils::SmartPointer<Loop> >::iterator iter;
+
+		for (iter = m_loops.begin(); iter != m_loops.end(); iter++)
+		{
+			Loop *ploop = iter->getPtr();
+			if (ploop->isRunning() > 0)
+			{
+				ploop->reqStop();
+				ploop->_wakeup();
+				ploop->join();
+			}
+			/* tasks that raced with the shutdown still run, so invoke() never hangs */
+			ploop->m_tasklock.lock();
+			ploop->m_accepting = false;
+			ploop->m_tasklock.unlock();
+			ploop->_runTasks();
+		}
+		/* the loops stay allocated so that sockets still attached can detach */
+		m_started = false;
+	}
+
+	JsSocketEngine::Loop *JsSocketEngine::nextLoop()
+	{
+		unsigned int n = (unsigned int)m_loops.size();
+		if (!m_started || (n == 0))
+			return NULL;
+		return m_loops[(m_nextloop.incget() - 1) % n].getPtr();
+	}
+
+	static JsSocketEngine *s_pdefaultengine = NULL;
+	static pthread_once_t s_defaultengine_once = PTHREAD_ONCE_INIT;
+
+	static void _createDefaultEngine()
+	{
+		JsSocketEngine *pengine = new JsSocketEngine();
+		if (pengine->start() <= 0)
+		{
+			delete pengine;
+			return;
+		}
+		s_pdefaultengine = pengine;
+	}
+
+	JsSocketEngine *JsSocketEngine::getDefault()
+	{
+		pthread_once(&s_defaultengine_once, _createDefaultEngine);
+		return s_pdefaultengine;
+	}
+}
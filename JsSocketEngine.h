@@ -0,0 +1,284 @@
+/**
+ * @file	JsSocketEngine.h
+ * @class	JsSocketEngine
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/19
+ * @brief	Shared event loops (epoll or io_uring, edge-triggered) that many sockets attach to instead of owning a thread each
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_JSSOCKETENGINE_H__
+#define __JSCPPUTILS_JSSOCKETENGINE_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS, yet..."
+#endif
+
+#include <vector>
+#include <map>
+
+#include "Lockable.h"
+#include "Thread.h"
+#include "SmartPointer.h"
+#include "AtomicNum.h"
+#include "IoUring.h"
+
+namespace JsCPPUtils
+{
+	class JsSocketEngine
+	{
+	public:
+		typedef void(*TaskFunc_t)(void *param1, void *param2);
+
+		enum Backend {
+			BACKEND_EPOLL = 0,
+			/* io_uring poll + multishot recv into per-loop provided buffers; falls back to epoll */
+			BACKEND_IOURING = 1
+		};
+
+		class Loop;
+
+		/**
+		 * A descriptor registered on one loop.
+		 * Events are edge-triggered, so onEvent must consume until EAGAIN.
+		 * onEvent always runs on the owning loop thread.
+		 */
+		class Channel
+		{
+			friend class Loop;
+		protected:
+			int m_fd;
+			Loop *m_ploop;
+			uint32_t m_events;
+			/* backend bookkeeping (io_uring : outstanding requests of this channel) */
+			void *m_pslot;
+
+		public:
+			Channel() : m_fd(-1), m_ploop(NULL), m_events(0), m_pslot(NULL) {}
+			virtual ~Channel() {}
+
+			int getFd() const {
+				return m_fd;
+			}
+			Loop *getLoop() const {
+				return m_ploop;
+			}
+			bool isRegistered() const {
+				return m_ploop != NULL;
+			}
+
+			virtual void onEvent(uint32_t events) = 0;
+			/**
+			 * Completion I/O (Loop::hasCompletionIo).
+			 * onRecvComplete : res > 0 bytes in pbuf (owned by the loop, valid during the call), 0 on EOF, negative errno.
+			 * onSendComplete : bytes sent or negative errno, once per submitSend.
+			 */
+			virtual void onRecvComplete(int res, char *pbuf) {}
+			virtual void onSendComplete(int res) {}
+		};
+
+		class Loop : public Thread
+		{
+			friend class JsSocketEngine;
+
+		private:
+			struct Task {
+				TaskFunc_t fn;
+				void *param1;
+				void *param2;
+			};
+			struct TimerEntry {
+				int64_t id;
+				TaskFunc_t fn;
+				void *param1;
+				void *param2;
+			};
+			struct InvokeWaiter;
+			struct UringSlot;
+
+			JsSocketEngine *m_pengine;
+			int m_index;
+			int m_epfd;
+			int m_wakefd;
+
+			IoUring *m_puring;
+			bool m_uringrecv;
+			char *m_pbufmem;
+			/* polls armed since the last submit (NULL : the wake poll), checked once it went out */
+			std::vector<UringSlot*> m_uringprime;
+			std::vector<UringSlot*> m_uringpriming;
+
+			Lockable m_tasklock;
+			std::vector<Task> m_tasks;
+			std::vector<Task> m_runningtasks;
+			bool m_accepting;
+			volatile int m_wakepending;
+
+			/* events fetched by the current epoll_wait; removeChannel clears pending entries */
+			struct epoll_event *m_pbatch;
+			int m_batchpos;
+			int m_batchcount;
+
+			/* touched only on the loop thread */
+			std::multimap<int64_t, TimerEntry> m_timers;
+			std::map<int64_t, std::multimap<int64_t, TimerEntry>::iterator> m_timerids;
+			int64_t m_nexttimerid;
+
+			JsCPPUtils::AtomicNum<int> m_channelcount;
+
+			Loop(JsSocketEngine *pengine, int index);
+			int _create(Backend backend);
+			int _createUring();
+			void _close();
+			void _runEpoll();
+			void _runUring();
+			struct io_uring_sqe *_uringSqe();
+			void _uringArmPoll(UringSlot *pslot);
+			void _uringArmWake();
+			void _uringArmRecv(UringSlot *pslot);
+			void _uringProvide(int bid, int count);
+			void _uringCancel(UringSlot *pslot, int op);
+			void _uringComplete(uint64_t userdata, int res, uint32_t flags);
+			bool _uringPrime();
+			void _uringReleaseSlot(UringSlot *pslot);
+			static void _channelProc(void *param1, void *param2);
+			void _wakeup();
+			void _runTasks();
+			int _runTimers();
+			static void _invokeProc(void *param1, void *param2);
+
+		protected:
+			int run(int param_idx, void *param_ptr) override;
+
+		public:
+			~Loop();
+
+			JsSocketEngine *getEngine() const {
+				return m_pengine;
+			}
+			int getIndex() const {
+				return m_index;
+			}
+			int getChannelCount() {
+				return m_channelcount.get();
+			}
+			bool isInLoopThread() const;
+			Backend getBackend() const {
+				return (m_puring != NULL) ? BACKEND_IOURING : BACKEND_EPOLL;
+			}
+
+			/**
+			 * events : EPOLLIN | EPOLLOUT | EPOLLRDHUP ... (EPOLLET is always added)
+			 * May be called from any thread (io_uring : marshalled to the loop thread).
+			 * @return 1 on success, negative errno on failure
+			 */
+			int addChannel(Channel *pchannel, int fd, uint32_t events);
+			int modChannel(Channel *pchannel, uint32_t events);
+			/**
+			 * After this returns on the loop thread no further onEvent is delivered for the channel,
+			 * even for events already fetched in the current batch.
+			 */
+			int removeChannel(Channel *pchannel);
+
+			/**
+			 * Completion I/O, loop thread only.
+			 * startRecv arms a multishot receive; the channel's poll events are left as they are.
+			 * submitSendMsg (IORING_OP_SENDMSG) keeps pmsg and the buffers it points to referenced until
+			 * onSendComplete; if the channel is removed first, release them through deferRelease
+			 * (before removeChannel) instead.
+			 * @return 1 on success, 0 if not supported
+			 */
+			bool hasCompletionIo() const {
+				return m_uringrecv;
+			}
+			int getRecvBufferSize() const;
+			int startRecv(Channel *pchannel);
+			int submitSendMsg(Channel *pchannel, const struct msghdr *pmsg);
+			/**
+			 * Runs fn on the loop thread once the kernel no longer references the channel's requests
+			 * (at once if there are none).
+			 */
+			void deferRelease(Channel *pchannel, TaskFunc_t fn, void *param1, void *param2);
+
+			/**
+			 * Queues fn to run on the loop thread after the current event batch.
+			 * @return 1 if queued, 0 if the loop is stopped
+			 */
+			int post(TaskFunc_t fn, void *param1, void *param2);
+			/**
+			 * Runs fn on the loop thread and waits for it.
+			 * Runs it directly when called on the loop thread or when the loop is stopped.
+			 */
+			void invoke(TaskFunc_t fn, void *param1, void *param2);
+
+			/**
+			 * Loop thread only.
+			 * @return timer id (> 0)
+			 */
+			int64_t addTimer(int64_t delayms, TaskFunc_t fn, void *param1, void *param2);
+			bool cancelTimer(int64_t timerid);
+		};
+
+	private:
+		std::vector< JsCPPUtils::SmartPointer<Loop> > m_loops;
+		JsCPPUtils::AtomicNum<unsigned int> m_nextloop;
+		bool m_started;
+		Backend m_backend;
+
+	public:
+		JsSocketEngine();
+		~JsSocketEngine();
+
+		/**
+		 * numofloops <= 0 : one loop per online CPU
+		 * BACKEND_IOURING falls back to epoll when the kernel lacks io_uring (or it is forbidden);
+		 * getBackend() tells which one runs.
+		 * @return 1 on success, negative errno on failure
+		 */
+		int start(int numofloops = 0, const char *szName = "JsSocketEngine", Backend backend = BACKEND_EPOLL);
+		/**
+		 * Joins the loop threads. Attached sockets may still be destroyed afterwards;
+		 * their handlers then run on the destroying thread.
+		 */
+		void stop();
+		bool isStarted() const {
+			return m_started;
+		}
+		Backend getBackend() const {
+			return m_backend;
+		}
+
+		int getLoopCount() const {
+			return (int)m_loops.size();
+		}
+		Loop *getLoop(int index) {
+			return m_loops[index].getPtr();
+		}
+		/**
+		 * Picks the loop for a new channel (round robin).
+		 */
+		Loop *nextLoop();
+
+		/**
+		 * Process-wide engine started on first use with one loop per online CPU.
+		 * It is never destroyed.
+		 */
+		static JsSocketEngine *getDefault();
+	};
+
+}
+
+#endif /* __JSCPPUTILS_JSSOCKETENGINE_H__ */
@@ -22,6 +22,8 @@
 
 #if defined(JSCUTILS_OS_LINUX)
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 
 #define JSTHREAD_THREADID_TYPE pthread_t
 #elif defined(JSCUTILS_OS_WINDOWS)
@@ -451,6 +453,459 @@ namespace JsCPPUtils
 		};
 #endif
 
+		/**
+		 * Buffered message channel.
+		 * Unlike MessageHandler, post() does not wait for the receiver to pick
+		 * the message up. It only blocks (up to timeoutms) while the ring is full.
+		 * There must be a single receiver thread. If bSingleProducer is set,
+		 * post() must be called from a single thread and does not take the mutex
+		 * unless the receiver is sleeping (Linux only).
+		 */
+#if defined(JSCUTILS_OS_LINUX)
+		template<class T>
+		class MessageQueue
+		{
+		private:
+			pthread_mutex_t m_mutex;
+			pthread_cond_t m_cond_send;
+			pthread_cond_t m_cond_ack;
+			JsCPPUtils::SmartPointer<T> *m_ring;
+			size_t m_capacity;
+			size_t m_mask;
+			bool m_bSingleProducer;
+			volatile size_t m_head;
+			volatile size_t m_tail;
+			volatile int m_cancelreq;
+			volatile int m_recvwaiting;
+			volatile int m_sendwaiting;
+
+			MessageQueue(const MessageQueue&);
+			MessageQueue& operator=(const MessageQueue&);
+
+			static void _makeAbsTime(struct timespec *pts, long timeoutms)
+			{
+				clock_gettime(CLOCK_REALTIME, pts);
+				pts->tv_sec += timeoutms / 1000;
+				pts->tv_nsec += (timeoutms % 1000) * 1000000;
+				if (pts->tv_nsec >= 1000000000)
+				{
+					pts->tv_sec++;
+					pts->tv_nsec -= 1000000000;
+				}
+			}
+
+			// Receiver side only. Never takes the mutex.
+			bool _tryPop(JsCPPUtils::SmartPointer<T> *pspmsg)
+			{
+				size_t head = m_head;
+				if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+					return false;
+				if (pspmsg != NULL)
+					(*pspmsg) = m_ring[head & m_mask];
+				m_ring[head & m_mask] = NULL;
+				__atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+
+			void _notifySenders(bool bLocked)
+			{
+				__sync_synchronize();
+				if (m_sendwaiting == 0)
+					return;
+				if (!bLocked)
+					pthread_mutex_lock(&m_mutex);
+				pthread_cond_broadcast(&m_cond_ack);
+				if (!bLocked)
+					pthread_mutex_unlock(&m_mutex);
+			}
+
+			void _push(const JsCPPUtils::SmartPointer<T> &spmsg)
+			{
+				size_t tail = m_tail;
+				m_ring[tail & m_mask] = spmsg;
+				__atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+				__sync_synchronize();
+			}
+
+			bool _isFull()
+			{
+				return (m_tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) >= m_capacity;
+			}
+
+		public:
+			explicit MessageQueue(size_t capacity = 1024, bool bSingleProducer = false)
+			{
+				m_capacity = 1;
+				while (m_capacity < capacity)
+					m_capacity <<= 1;
+				m_mask = m_capacity - 1;
+				m_ring = new JsCPPUtils::SmartPointer<T>[m_capacity];
+				m_bSingleProducer = bSingleProducer;
+				m_head = 0;
+				m_tail = 0;
+				m_cancelreq = 0;
+				m_recvwaiting = 0;
+				m_sendwaiting = 0;
+				pthread_mutex_init(&m_mutex, NULL);
+				pthread_cond_init(&m_cond_send, NULL);
+				pthread_cond_init(&m_cond_ack, NULL);
+			}
+
+			~MessageQueue()
+			{
+				pthread_cond_destroy(&m_cond_ack);
+				pthread_cond_destroy(&m_cond_send);
+				pthread_mutex_destroy(&m_mutex);
+				delete[] m_ring;
+				m_ring = NULL;
+			}
+
+			size_t capacity() const
+			{
+				return m_capacity;
+			}
+
+			size_t size() const
+			{
+				return __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+			}
+
+			/**
+			 * @return 1 : queued, 0 : queue full until timeout
+			 */
+			int post(JsCPPUtils::SmartPointer<T> spmsg, long timeoutms = -1)
+			{
+				int retval = 0;
+				struct timespec ts;
+
+				if (m_bSingleProducer)
+				{
+					if (!_isFull())
+					{
+						_push(spmsg);
+						if (m_recvwaiting)
+						{
+							pthread_mutex_lock(&m_mutex);
+							pthread_cond_signal(&m_cond_send);
+							pthread_mutex_unlock(&m_mutex);
+						}
+						return 1;
+					}
+					if (timeoutms == 0)
+						return 0;
+				}
+
+				if (timeoutms > 0)
+					_makeAbsTime(&ts, timeoutms);
+
+				pthread_mutex_lock(&m_mutex);
+				if (_isFull() && (timeoutms != 0))
+				{
+					m_sendwaiting++;
+					__sync_synchronize();
+					while (_isFull())
+					{
+						if (timeoutms < 0)
+							pthread_cond_wait(&m_cond_ack, &m_mutex);
+						else if (pthread_cond_timedwait(&m_cond_ack, &m_mutex, &ts) == ETIMEDOUT)
+							break;
+					}
+					m_sendwaiting--;
+				}
+				if (!_isFull())
+				{
+					_push(spmsg);
+					if (m_recvwaiting)
+						pthread_cond_signal(&m_cond_send);
+					retval = 1;
+				}
+				pthread_mutex_unlock(&m_mutex);
+
+				return retval;
+			}
+
+			int postCancel()
+			{
+				pthread_mutex_lock(&m_mutex);
+				m_cancelreq = 1;
+				pthread_cond_signal(&m_cond_send);
+				pthread_mutex_unlock(&m_mutex);
+				return 1;
+			}
+
+			/**
+			 * @return 1 : message received, 0 : timeout or postCancel()
+			 */
+			int getmsg(JsCPPUtils::SmartPointer<T> *pspmsg, long timeoutms = -1)
+			{
+				int retval = 0;
+				struct timespec ts;
+
+				if (_tryPop(pspmsg))
+				{
+					_notifySenders(false);
+					return 1;
+				}
+				if (timeoutms == 0)
+				{
+					m_cancelreq = 0;
+					return 0;
+				}
+				if (timeoutms > 0)
+					_makeAbsTime(&ts, timeoutms);
+
+				pthread_mutex_lock(&m_mutex);
+				m_recvwaiting = 1;
+				__sync_synchronize();
+				while (1)
+				{
+					if (_tryPop(pspmsg))
+					{
+						retval = 1;
+						break;
+					}
+					if (m_cancelreq)
+					{
+						m_cancelreq = 0;
+						break;
+					}
+					if (timeoutms < 0)
+					{
+						pthread_cond_wait(&m_cond_send, &m_mutex);
+					}
+					else if (pthread_cond_timedwait(&m_cond_send, &m_mutex, &ts) == ETIMEDOUT)
+					{
+						if (_tryPop(pspmsg))
+							retval = 1;
+						break;
+					}
+				}
+				m_recvwaiting = 0;
+				if (retval == 1)
+					_notifySenders(true);
+				pthread_mutex_unlock(&m_mutex);
+
+				return retval;
+			}
+
+			/**
+			 * Waits up to timeoutms for the first message, then takes whatever
+			 * else is already queued without waiting.
+			 * @return number of messages stored into pspmsgs
+			 */
+			int getmsgs(JsCPPUtils::SmartPointer<T> *pspmsgs, int maxcount, long timeoutms = -1)
+			{
+				int count = 0;
+
+				if (maxcount <= 0)
+					return 0;
+				if (getmsg(&pspmsgs[0], timeoutms) != 1)
+					return 0;
+				count = 1;
+				while ((count < maxcount) && _tryPop(&pspmsgs[count]))
+					count++;
+				if (count > 1)
+					_notifySenders(false);
+
+				return count;
+			}
+
+			int handlemsg_begin(JsCPPUtils::SmartPointer<T> *pspmsg, long timeoutms = -1)
+			{
+				return getmsg(pspmsg, timeoutms);
+			}
+
+			// The slot is already released by handlemsg_begin; kept for MessageHandler compatibility.
+			void handlemsg_end()
+			{
+			}
+		};
+#elif defined(JSCUTILS_OS_WINDOWS)
+		template<class T>
+		class MessageQueue
+		{
+		private:
+			CRITICAL_SECTION m_cs;
+			HANDLE m_cond_send; // manual-reset, signaled while the ring is not empty
+			HANDLE m_cond_ack;  // auto-reset, signaled when a slot is freed
+			JsCPPUtils::SmartPointer<T> *m_ring;
+			size_t m_capacity;
+			size_t m_mask;
+			volatile size_t m_head;
+			volatile size_t m_tail;
+			volatile int m_cancelreq;
+
+			MessageQueue(const MessageQueue&);
+			MessageQueue& operator=(const MessageQueue&);
+
+			static DWORD _remainTime(long timeoutms, int64_t starttick)
+			{
+				int64_t elapsed;
+				if (timeoutms < 0)
+					return INFINITE;
+				elapsed = JsCPPUtils::Common::getTickCount() - starttick;
+				if (elapsed >= timeoutms)
+					return 0;
+				return (DWORD)(timeoutms - elapsed);
+			}
+
+			// Must be called in m_cs
+			bool _pop(JsCPPUtils::SmartPointer<T> *pspmsg)
+			{
+				if (m_head == m_tail)
+					return false;
+				if (pspmsg != NULL)
+					(*pspmsg) = m_ring[m_head & m_mask];
+				m_ring[m_head & m_mask] = NULL;
+				m_head++;
+				if (m_head == m_tail)
+					::ResetEvent(m_cond_send);
+				::SetEvent(m_cond_ack);
+				return true;
+			}
+
+		public:
+			explicit MessageQueue(size_t capacity = 1024, bool bSingleProducer = false)
+			{
+				m_capacity = 1;
+				while (m_capacity < capacity)
+					m_capacity <<= 1;
+				m_mask = m_capacity - 1;
+				m_ring = new JsCPPUtils::SmartPointer<T>[m_capacity];
+				m_head = 0;
+				m_tail = 0;
+				m_cancelreq = 0;
+				::InitializeCriticalSectionAndSpinCount(&m_cs, 5000);
+				m_cond_send = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+				m_cond_ack = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+			}
+
+			~MessageQueue()
+			{
+				if(m_cond_send != INVALID_HANDLE_VALUE)
+				{
+					::CloseHandle(m_cond_send);
+					m_cond_send = INVALID_HANDLE_VALUE;
+				}
+				if(m_cond_ack != INVALID_HANDLE_VALUE)
+				{
+					::CloseHandle(m_cond_ack);
+					m_cond_ack = INVALID_HANDLE_VALUE;
+				}
+				::DeleteCriticalSection(&m_cs);
+				delete[] m_ring;
+				m_ring = NULL;
+			}
+
+			size_t capacity() const
+			{
+				return m_capacity;
+			}
+
+			size_t size() const
+			{
+				return m_tail - m_head;
+			}
+
+			HANDLE getEventHandle()
+			{
+				return m_cond_send;
+			}
+
+			int post(JsCPPUtils::SmartPointer<T> spmsg, long timeoutms = -1)
+			{
+				int64_t starttick = JsCPPUtils::Common::getTickCount();
+				DWORD dwWait;
+
+				while (1)
+				{
+					::EnterCriticalSection(&m_cs);
+					if ((m_tail - m_head) < m_capacity)
+					{
+						m_ring[m_tail & m_mask] = spmsg;
+						m_tail++;
+						::SetEvent(m_cond_send);
+						::LeaveCriticalSection(&m_cs);
+						return 1;
+					}
+					::LeaveCriticalSection(&m_cs);
+
+					dwWait = ::WaitForSingleObject(m_cond_ack, _remainTime(timeoutms, starttick));
+					if (dwWait == WAIT_TIMEOUT)
+						return 0;
+					else if (dwWait != WAIT_OBJECT_0)
+						return -((int)dwWait);
+				}
+			}
+
+			int postCancel()
+			{
+				::EnterCriticalSection(&m_cs);
+				m_cancelreq = 1;
+				::SetEvent(m_cond_send);
+				::LeaveCriticalSection(&m_cs);
+				return 1;
+			}
+
+			int getmsg(JsCPPUtils::SmartPointer<T> *pspmsg, long timeoutms = -1, bool bProcessedEvent = false)
+			{
+				int64_t starttick = JsCPPUtils::Common::getTickCount();
+				DWORD dwWait;
+
+				while (1)
+				{
+					::EnterCriticalSection(&m_cs);
+					if (_pop(pspmsg))
+					{
+						::LeaveCriticalSection(&m_cs);
+						return 1;
+					}
+					if (m_cancelreq)
+					{
+						m_cancelreq = 0;
+						::ResetEvent(m_cond_send);
+						::LeaveCriticalSection(&m_cs);
+						return 0;
+					}
+					::ResetEvent(m_cond_send);
+					::LeaveCriticalSection(&m_cs);
+
+					dwWait = ::WaitForSingleObject(m_cond_send, _remainTime(timeoutms, starttick));
+					if (dwWait == WAIT_TIMEOUT)
+						return 0;
+					else if (dwWait != WAIT_OBJECT_0)
+						return -((int)dwWait);
+				}
+			}
+
+			int getmsgs(JsCPPUtils::SmartPointer<T> *pspmsgs, int maxcount, long timeoutms = -1)
+			{
+				int count = 0;
+
+				if (maxcount <= 0)
+					return 0;
+				if (getmsg(&pspmsgs[0], timeoutms) != 1)
+					return 0;
+				count = 1;
+				::EnterCriticalSection(&m_cs);
+				while ((count < maxcount) && _pop(&pspmsgs[count]))
+					count++;
+				::LeaveCriticalSection(&m_cs);
+
+				return count;
+			}
+
+			int handlemsg_begin(JsCPPUtils::SmartPointer<T> *pspmsg, long timeoutms = -1, bool bProcessedEvent = false)
+			{
+				return getmsg(pspmsg, timeoutms, bProcessedEvent);
+			}
+
+			void handlemsg_end()
+			{
+			}
+		};
+#endif
+
 	private:
 #if defined(JSCUTILS_OS_LINUX)
 		static void *threadProc(void *param);
@@ -0,0 +1,350 @@
+/**
+ * @file	LockBenchmark.cpp
+ * @class	LockBenchmark
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/13
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "LockBenchmark.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+
+#define _LOCKBENCH_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _LOCKBENCH_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+namespace JsCPPUtils
+{
+	LockBenchmark::LockBenchmark()
+		: m_plockable(NULL)
+		, m_padaptive(NULL)
+		, m_pspin(NULL)
+		, m_counter(0)
+		, m_started(0)
+		, m_phase(-1)
+	{
+	}
+
+	LockBenchmark::~LockBenchmark()
+	{
+		delete m_plockable;
+		delete m_padaptive;
+		delete m_pspin;
+	}
+
+	int64_t LockBenchmark::_nowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	static void _sleepMs(int64_t ms)
+	{
+		struct timespec ts;
+		ts.tv_sec = (time_t)(ms / 1000);
+		ts.tv_nsec = (long)(ms % 1000) * 1000000;
+		while ((nanosleep(&ts, &ts) < 0) && (errno == EINTR))
+			;
+	}
+
+	template<class L>
+	void LockBenchmark::_loop(L *plock, ThreadCtx *pctx)
+	{
+		int64_t acquisitions = 0;
+		int64_t measured = 0;
+		unsigned long work = 0;
+		int phase;
+		int i;
+
+		__sync_fetch_and_add(&m_started, 1);
+		while ((phase = _LOCKBENCH_LOAD(&m_phase)) < 0)
+			sched_yield();
+
+		while (phase != 2)
+		{
+			plock->lock();
+			for (i = 0; i < m_params.csloops; i++)
+			{
+				work += i;
+				__asm__ __volatile__("" : "+r"(work));
+			}
+			m_counter = m_counter + 1;
+			plock->unlock();
+
+			acquisitions++;
+			if (phase == 1)
+				measured++;
+
+			for (i = 0; i < m_params.idleloops; i++)
+			{
+				work += i;
+				__asm__ __volatile__("" : "+r"(work));
+			}
+			phase = _LOCKBENCH_LOAD(&m_phase);
+		}
+
+		pctx->acquisitions = acquisitions;
+		pctx->measured = measured;
+	}
+
+	void *LockBenchmark::_threadProc(void *param)
+	{
+		ThreadCtx *pctx = (ThreadCtx*)param;
+		LockBenchmark *pbench = pctx->pbench;
+		switch (pbench->m_params.lock)
+		{
+		case LOCK_PTHREAD:
+			pbench->_loop(pbench->m_plockable, pctx);
+			break;
+		case LOCK_ADAPTIVE:
+			pbench->_loop(pbench->m_padaptive, pctx);
+			break;
+		case LOCK_SPIN:
+			pbench->_loop(pbench->m_pspin, pctx);
+			break;
+		}
+		return NULL;
+	}
+
+	int LockBenchmark::run(const Params &params, Result *presult)
+	{
+		std::vector<ThreadCtx> ctxs;
+		int64_t total = 0;
+		int64_t starttime = 0;
+		int64_t endtime = 0;
+		int started = 0;
+		int nrst = 0;
+		int i;
+
+		*presult = Result();
+		presult->params = params;
+		if ((params.threads <= 0) || (params.csloops < 0) || (params.idleloops < 0) || (params.durationms <= 0))
+		{
+			presult->result = -EINVAL;
+			return presult->result;
+		}
+
+		delete m_plockable;
+		delete m_padaptive;
+		delete m_pspin;
+		m_plockable = NULL;
+		m_padaptive = NULL;
+		m_pspin = NULL;
+		m_params = params;
+		m_counter = 0;
+		m_started = 0;
+		m_phase = -1;
+		switch (params.lock)
+		{
+		case LOCK_PTHREAD:
+			m_plockable = new Lockable();
+			break;
+		case LOCK_ADAPTIVE:
+			m_padaptive = (params.spin >= 0) ? new LockableAdaptive(params.spin) : new LockableAdaptive();
+			break;
+		case LOCK_SPIN:
+			m_pspin = (params.spin >= 0) ? new LockableSpin(params.spin) : new LockableSpin();
+			break;
+		default:
+			presult->result = -EINVAL;
+			return presult->result;
+		}
+
+		ctxs.resize(params.threads);
+		for (i = 0; i < params.threads; i++)
+		{
+			ctxs[i].pbench = this;
+			ctxs[i].acquisitions = 0;
+			ctxs[i].measured = 0;
+			nrst = pthread_create(&ctxs[i].thread, NULL, _threadProc, &ctxs[i]);
+			if (nrst != 0)
+				break;
+			started++;
+		}
+		/* every thread is at the gate before the clock starts, so thread creation is not measured */
+		while (_LOCKBENCH_LOAD(&m_started) < started)
+			sched_yield();
+
+		if (nrst == 0)
+		{
+			_LOCKBENCH_STORE(&m_phase, 0);
+			_sleepMs(params.warmupms);
+			starttime = _nowNs();
+			_LOCKBENCH_STORE(&m_phase, 1);
+			_sleepMs(params.durationms);
+			_LOCKBENCH_STORE(&m_phase, 2);
+			endtime = _nowNs();
+		}else{
+			_LOCKBENCH_STORE(&m_phase, 2);
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(ctxs[i].thread, NULL);
+
+		if (nrst != 0)
+		{
+			presult->result = -nrst;
+			return presult->result;
+		}
+
+		presult->thread_min = ctxs[0].measured;
+		presult->thread_max = ctxs[0].measured;
+		for (i = 0; i < params.threads; i++)
+		{
+			total += ctxs[i].acquisitions;
+			presult->acquisitions += ctxs[i].measured;
+			if (ctxs[i].measured < presult->thread_min)
+				presult->thread_min = ctxs[i].measured;
+			if (ctxs[i].measured > presult->thread_max)
+				presult->thread_max = ctxs[i].measured;
+		}
+		presult->consistent = (m_counter == total);
+		if (endtime > starttime)
+			presult->acquisitions_per_sec = (double)presult->acquisitions * 1000000000.0 / (double)(endtime - starttime);
+		if (presult->acquisitions > 0)
+			presult->ns_per_acquisition = (double)(endtime - starttime) / (double)presult->acquisitions;
+		presult->result = 1;
+		return presult->result;
+	}
+
+	void LockBenchmark::writeJson(FILE *fp, const Result &result)
+	{
+		const Params &params = result.params;
+		static const char *lockNames[] = { "pthread", "adaptive", "spin" };
+
+		fprintf(fp, "{\"lock\":\"%s\",\"threads\":%d,\"csloops\":%d,\"idleloops\":%d,\"spin\":%d,\"warmupms\":%lld,\"durationms\":%lld",
+			((params.lock >= LOCK_PTHREAD) && (params.lock <= LOCK_SPIN)) ? lockNames[params.lock] : "?",
+			params.threads,
+			params.csloops,
+			params.idleloops,
+			params.spin,
+			(long long)params.warmupms,
+			(long long)params.durationms);
+		fprintf(fp, ",\"result\":%d,\"acquisitions\":%lld,\"acquisitions_per_sec\":%.1f,\"ns_per_acquisition\":%.1f,\"thread_min\":%lld,\"thread_max\":%lld,\"consistent\":%s}\n",
+			result.result,
+			(long long)result.acquisitions,
+			result.acquisitions_per_sec,
+			result.ns_per_acquisition,
+			(long long)result.thread_min,
+			(long long)result.thread_max,
+			result.consistent ? "true" : "false");
+		fflush(fp);
+	}
+
+}
+
+#ifdef JSCPPUTILS_LOCKBENCHMARK_MAIN
+
+#include <getopt.h>
+
+static void usage(const char *szProgram)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -l pthread|adaptive|spin[,...]  lock types (all three)\n"
+		"  -t N[,N...]      threads (1,2,4,8)\n"
+		"  -i N[,N...]      loops between two acquisitions (0,100,1000)\n"
+		"  -c N             loops with the lock held (20)\n"
+		"  -s N             adaptive : spincount, spin : maxbackoff (the class default)\n"
+		"  -d MS            measured duration per run (1000)\n"
+		"  -w MS            warmup per run (200)\n"
+		"Prints one JSON object per run on stdout.\n",
+		szProgram);
+}
+
+static std::vector<int> parseList(const char *szList)
+{
+	std::vector<int> values;
+	const char *p = szList;
+	while (*p)
+	{
+		char *pend;
+		long v = strtol(p, &pend, 10);
+		if (pend == p)
+			break;
+		values.push_back((int)v);
+		p = (*pend == ',') ? (pend + 1) : pend;
+	}
+	return values;
+}
+
+static std::vector<JsCPPUtils::LockBenchmark::LockType> parseLocks(const char *szList)
+{
+	std::vector<JsCPPUtils::LockBenchmark::LockType> values;
+	if (strstr(szList, "pthread"))
+		values.push_back(JsCPPUtils::LockBenchmark::LOCK_PTHREAD);
+	if (strstr(szList, "adaptive"))
+		values.push_back(JsCPPUtils::LockBenchmark::LOCK_ADAPTIVE);
+	if (strstr(szList, "spin"))
+		values.push_back(JsCPPUtils::LockBenchmark::LOCK_SPIN);
+	return values;
+}
+
+int main(int argc, char *argv[])
+{
+	JsCPPUtils::LockBenchmark::Params params;
+	std::vector<JsCPPUtils::LockBenchmark::LockType> locks = parseLocks("pthread,adaptive,spin");
+	std::vector<int> threads = parseList("1,2,4,8");
+	std::vector<int> idles = parseList("0,100,1000");
+	size_t l, t, i;
+	int opt;
+	int failed = 0;
+
+	while ((opt = getopt(argc, argv, "l:t:i:c:s:d:w:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l':
+			locks = parseLocks(optarg);
+			break;
+		case 't':
+			threads = parseList(optarg);
+			break;
+		case 'i':
+			idles = parseList(optarg);
+			break;
+		case 'c':
+			params.csloops = atoi(optarg);
+			break;
+		case 's':
+			params.spin = atoi(optarg);
+			break;
+		case 'd':
+			params.durationms = atoll(optarg);
+			break;
+		case 'w':
+			params.warmupms = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	for (i = 0; i < idles.size(); i++)
+	{
+		for (t = 0; t < threads.size(); t++)
+		{
+			for (l = 0; l < locks.size(); l++)
+			{
+				JsCPPUtils::LockBenchmark bench;
+				JsCPPUtils::LockBenchmark::Result result;
+				params.lock = locks[l];
+				params.threads = threads[t];
+				params.idleloops = idles[i];
+				if ((bench.run(params, &result) != 1) || !result.consistent)
+					failed++;
+				JsCPPUtils::LockBenchmark::writeJson(stdout, result);
+			}
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+#endif /* JSCPPUTILS_LOCKBENCHMARK_MAIN */
@@ -0,0 +1,138 @@
+/**
+ * @file	LockBenchmark.h
+ * @class	LockBenchmark
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/13
+ * @brief	Microbenchmark of Lockable, LockableAdaptive and LockableSpin under varying contention
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_LOCKBENCHMARK_H__
+#define __JSCPPUTILS_LOCKBENCHMARK_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS, yet..."
+#endif
+
+#include <vector>
+
+#include "Lockable.h"
+
+namespace JsCPPUtils
+{
+	/**
+	 * Runs threads that take one shared lock in a loop and measures one configuration per run().
+	 * Contention is set by the work done with the lock held (csloops) against the work done between
+	 * two acquisitions (idleloops) : idleloops 0 is a fully contended lock, a large idleloops
+	 * a mostly uncontended one.
+	 *
+	 * Build LockBenchmark.cpp with JSCPPUTILS_LOCKBENCHMARK_MAIN defined for a command-line benchmark
+	 * sweeping the lock types, thread counts and idle loops; it prints one JSON object per run (see writeJson()).
+	 */
+	class LockBenchmark
+	{
+	public:
+		enum LockType {
+			/* Lockable : pthread mutex */
+			LOCK_PTHREAD = 0,
+			LOCK_ADAPTIVE = 1,
+			LOCK_SPIN = 2
+		};
+
+		struct Params {
+			LockType lock;
+			int threads;
+			/* iterations of a dependent add : with the lock held, and between two acquisitions */
+			int csloops;
+			int idleloops;
+			/* LockableAdaptive : spincount, LockableSpin : maxbackoff */
+			int spin;
+			/* not measured, then measured */
+			int64_t warmupms;
+			int64_t durationms;
+
+			Params()
+				: lock(LOCK_PTHREAD)
+				, threads(4)
+				, csloops(20)
+				, idleloops(0)
+				, spin(-1)
+				, warmupms(200)
+				, durationms(1000)
+			{}
+		};
+
+		struct Result {
+			Params params;
+			/* 1, or negative errno : the run could not be set up (nothing else is valid) */
+			int result;
+			/* within durationms */
+			int64_t acquisitions;
+			double acquisitions_per_sec;
+			/* wall time of the run divided by the acquisitions : the cost of one handover of the lock */
+			double ns_per_acquisition;
+			/* fewest and most acquisitions of a single thread */
+			int64_t thread_min;
+			int64_t thread_max;
+			/* the counter updated under the lock matches the acquisitions of the whole run */
+			bool consistent;
+		};
+
+	private:
+		/* written by its thread once it is done, so the threads share nothing but the lock and the counter */
+		struct ThreadCtx {
+			LockBenchmark *pbench;
+			pthread_t thread;
+			int64_t acquisitions;
+			int64_t measured;
+		};
+
+		Params m_params;
+		Lockable *m_plockable;
+		LockableAdaptive *m_padaptive;
+		LockableSpin *m_pspin;
+		/* updated with the lock held */
+		volatile int64_t m_counter;
+		volatile int m_started;
+		/* 1 : measuring, 2 : stop */
+		volatile int m_phase;
+
+		template<class L>
+		void _loop(L *plock, ThreadCtx *pctx);
+		static void *_threadProc(void *param);
+		static int64_t _nowNs();
+
+		LockBenchmark(const LockBenchmark&);
+		LockBenchmark& operator=(const LockBenchmark&);
+
+	public:
+		LockBenchmark();
+		~LockBenchmark();
+
+		/**
+		 * Blocks for about warmupms + durationms.
+		 * @return presult->result
+		 */
+		int run(const Params &params, Result *presult);
+
+		/**
+		 * One line : a JSON object with the parameters and the results.
+		 */
+		static void writeJson(FILE *fp, const Result &result);
+	};
+
+}
+
+#endif /* __JSCPPUTILS_LOCKBENCHMARK_H__ */
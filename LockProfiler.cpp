@@ -0,0 +1,225 @@
+/**
+ * @file	LockProfiler.cpp
+ * @class	LockProfiler
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/14
+ * @brief	Contention profiling for Lockable, LockableEx and LockableRW.
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "LockProfiler.h"
+#include "Lockable.h"
+#include "Logger.h"
+
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#if defined(JSCUTILS_OS_WINDOWS)
+#define _LOCKPROFILER_ATOMIC_ADD(p, v) ::InterlockedExchangeAdd64((volatile LONGLONG*)(p), (LONGLONG)(v))
+#define _LOCKPROFILER_ATOMIC_CAS(p, o, n) (::InterlockedCompareExchange64((volatile LONGLONG*)(p), (LONGLONG)(n), (LONGLONG)(o)) == (LONGLONG)(o))
+#elif defined(JSCUTILS_OS_LINUX)
+#define _LOCKPROFILER_ATOMIC_ADD(p, v) __sync_fetch_and_add((p), (v))
+#define _LOCKPROFILER_ATOMIC_CAS(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#endif
+
+namespace JsCPPUtils
+{
+	volatile int LockProfiler::s_enabled = 1;
+	volatile int LockProfiler::s_samplerate = 1;
+
+	static LockProfile *s_profiles = NULL;
+
+	static Lockable &_registryLock()
+	{
+		static Lockable s_lock;
+		return s_lock;
+	}
+
+	LockProfile *LockProfiler::registerLock(const char *szName)
+	{
+		LockProfile *pprofile = new LockProfile();
+		memset(pprofile, 0, sizeof(LockProfile));
+		if (szName != NULL)
+		{
+			strncpy(pprofile->name, szName, sizeof(pprofile->name) - 1);
+		}
+		_registryLock().lock();
+		pprofile->next = s_profiles;
+		s_profiles = pprofile;
+		_registryLock().unlock();
+		return pprofile;
+	}
+
+	void LockProfiler::unregisterLock(LockProfile *pprofile)
+	{
+		LockProfile **pplink;
+		if (pprofile == NULL)
+			return;
+		_registryLock().lock();
+		for (pplink = &s_profiles; *pplink != NULL; pplink = &(*pplink)->next)
+		{
+			if (*pplink == pprofile)
+			{
+				*pplink = pprofile->next;
+				break;
+			}
+		}
+		_registryLock().unlock();
+		delete pprofile;
+	}
+
+	void LockProfiler::renameLock(LockProfile *pprofile, const char *szName)
+	{
+		if (pprofile == NULL)
+			return;
+		// snapshot() copies the name under the same lock
+		_registryLock().lock();
+		memset(pprofile->name, 0, sizeof(pprofile->name));
+		if (szName != NULL)
+		{
+			strncpy(pprofile->name, szName, sizeof(pprofile->name) - 1);
+		}
+		_registryLock().unlock();
+	}
+
+	void LockProfiler::setEnabled(bool bEnabled)
+	{
+		s_enabled = bEnabled ? 1 : 0;
+	}
+
+	bool LockProfiler::isEnabled()
+	{
+		return s_enabled != 0;
+	}
+
+	void LockProfiler::setSampleRate(int samplerate)
+	{
+		s_samplerate = (samplerate < 1) ? 1 : samplerate;
+	}
+
+	int LockProfiler::getSampleRate()
+	{
+		return s_samplerate;
+	}
+
+	int64_t LockProfiler::now()
+	{
+#if defined(JSCUTILS_OS_WINDOWS)
+		static LARGE_INTEGER s_freq = {0};
+		LARGE_INTEGER counter;
+		if (s_freq.QuadPart == 0)
+			::QueryPerformanceFrequency(&s_freq);
+		::QueryPerformanceCounter(&counter);
+		return (int64_t)(counter.QuadPart * 1000000000.0 / s_freq.QuadPart);
+#elif defined(JSCUTILS_OS_LINUX)
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((int64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+	}
+
+	void LockProfiler::recordAcquire(LockProfile *pprofile, bool bContended, int64_t waitns)
+	{
+		int64_t oldmax;
+		_LOCKPROFILER_ATOMIC_ADD(&pprofile->acquisitions, 1);
+		if (!bContended)
+			return;
+		_LOCKPROFILER_ATOMIC_ADD(&pprofile->contended, 1);
+		_LOCKPROFILER_ATOMIC_ADD(&pprofile->waitns_total, waitns);
+		do {
+			oldmax = pprofile->waitns_max;
+			if (oldmax >= waitns)
+				break;
+		} while (!_LOCKPROFILER_ATOMIC_CAS(&pprofile->waitns_max, oldmax, waitns));
+	}
+
+	void LockProfiler::recordHold(LockProfile *pprofile, int64_t holdns)
+	{
+		int64_t us = holdns / 1000;
+		int bucket = 0;
+		while ((us > 0) && (bucket < JSCPPUTILS_LOCKPROFILE_HIST_BUCKETS - 1))
+		{
+			bucket++;
+			us >>= 1;
+		}
+		_LOCKPROFILER_ATOMIC_ADD(&pprofile->holdns_total, holdns);
+		_LOCKPROFILER_ATOMIC_ADD(&pprofile->holdhist[bucket], 1);
+	}
+
+	void LockProfiler::snapshot(std::vector<LockProfile>& profiles)
+	{
+		LockProfile *pprofile;
+		profiles.clear();
+		_registryLock().lock();
+		for (pprofile = s_profiles; pprofile != NULL; pprofile = pprofile->next)
+		{
+			profiles.push_back(*pprofile);
+			profiles.back().next = NULL;
+		}
+		_registryLock().unlock();
+	}
+
+	void LockProfiler::reset()
+	{
+		LockProfile *pprofile;
+		_registryLock().lock();
+		for (pprofile = s_profiles; pprofile != NULL; pprofile = pprofile->next)
+		{
+			pprofile->acquisitions = 0;
+			pprofile->contended = 0;
+			pprofile->waitns_total = 0;
+			pprofile->waitns_max = 0;
+			pprofile->holdns_total = 0;
+			memset((void*)pprofile->holdhist, 0, sizeof(pprofile->holdhist));
+		}
+		_registryLock().unlock();
+	}
+
+	static bool _compareContended(const LockProfile& a, const LockProfile& b)
+	{
+		if (a.contended != b.contended)
+			return a.contended > b.contended;
+		return a.waitns_total > b.waitns_total;
+	}
+
+	void LockProfiler::dumpTopContended(Logger *plogger, int topn)
+	{
+		std::vector<LockProfile> profiles;
+		int i;
+
+		if (plogger == NULL)
+			return;
+
+		snapshot(profiles);
+		std::sort(profiles.begin(), profiles.end(), _compareContended);
+
+		plogger->printf(Logger::LOGTYPE_INFO, "lock profile: %d locks, sample rate 1/%d", (int)profiles.size(), s_samplerate);
+		for (i = 0; (i < topn) && (i < (int)profiles.size()); i++)
+		{
+			const LockProfile& prof = profiles[i];
+			char histbuf[256];
+			int histlen = 0;
+			int b;
+			histbuf[0] = 0;
+			for (b = 0; b < JSCPPUTILS_LOCKPROFILE_HIST_BUCKETS; b++)
+			{
+				int len = snprintf(&histbuf[histlen], sizeof(histbuf) - histlen, "%s%lld", b ? "," : "", (long long)prof.holdhist[b]);
+				// snprintf returns the untruncated length : stop at a full buffer (the list is cut short)
+				if ((len < 0) || (len >= (int)sizeof(histbuf) - histlen))
+					break;
+				histlen += len;
+			}
+			plogger->printf(Logger::LOGTYPE_INFO, "lock[%s] acq=%lld contended=%lld wait_total=%lldus wait_max=%lldus hold_total=%lldus hold_hist=[%s]",
+				prof.name,
+				(long long)prof.acquisitions,
+				(long long)prof.contended,
+				(long long)(prof.waitns_total / 1000),
+				(long long)(prof.waitns_max / 1000),
+				(long long)(prof.holdns_total / 1000),
+				histbuf);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/**
+ * @file	LockProfiler.h
+ * @class	LockProfiler
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/14
+ * @brief	Contention profiling for Lockable, LockableEx and LockableRW.
+ *          Only compiled in when JSCPPUTILS_LOCK_PROFILE is defined.
+ *          Name a lock with setProfileName() to have it tracked.
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_LOCKPROFILER_H__
+#define __JSCPPUTILS_LOCKPROFILER_H__
+
+#include "Common.h"
+
+#include <vector>
+#include <string>
+
+#define JSCPPUTILS_LOCKPROFILE_HIST_BUCKETS 16
+
+namespace JsCPPUtils
+{
+	class Logger;
+
+	/**
+	 * Statistics of one named lock.
+	 * With a sample rate of N, only one of every N acquisitions is measured;
+	 * all counts below are sampled counts.
+	 */
+	struct LockProfile
+	{
+		char name[64];
+		volatile int64_t acquisitions;
+		volatile int64_t contended;
+		volatile int64_t waitns_total;
+		volatile int64_t waitns_max;
+		volatile int64_t holdns_total;
+		/**
+		 * Hold time histogram. Bucket 0 : < 1us, bucket i : [2^(i-1), 2^i) us,
+		 * last bucket : everything longer.
+		 */
+		volatile int64_t holdhist[JSCPPUTILS_LOCKPROFILE_HIST_BUCKETS];
+		volatile uint32_t samplecounter;
+		LockProfile *next;
+	};
+
+	class LockProfiler
+	{
+	private:
+		static volatile int s_enabled;
+		static volatile int s_samplerate;
+
+	public:
+		static LockProfile *registerLock(const char *szName);
+		static void unregisterLock(LockProfile *pprofile);
+		/**
+		 * Renames a registered profile in place; its statistics are kept.
+		 */
+		static void renameLock(LockProfile *pprofile, const char *szName);
+
+		/**
+		 * Runtime switch. Named locks cost one branch per acquisition while disabled.
+		 */
+		static void setEnabled(bool bEnabled);
+		static bool isEnabled();
+		/**
+		 * Measure one of every samplerate acquisitions (1 : all).
+		 */
+		static void setSampleRate(int samplerate);
+		static int getSampleRate();
+
+		static inline bool beginSample(LockProfile *pprofile)
+		{
+			if ((pprofile == NULL) || !s_enabled)
+				return false;
+			if (s_samplerate <= 1)
+				return true;
+			return ((pprofile->samplecounter++) % (uint32_t)s_samplerate) == 0;
+		}
+
+		static int64_t now();
+		static void recordAcquire(LockProfile *pprofile, bool bContended, int64_t waitns);
+		static void recordHold(LockProfile *pprofile, int64_t holdns);
+
+		static void snapshot(std::vector<LockProfile>& profiles);
+		static void reset();
+		/**
+		 * Writes the topn locks with the most contended acquisitions to the logger.
+		 */
+		static void dumpTopContended(Logger *plogger, int topn = 10);
+	};
+}
+
+#endif /* __JSCPPUTILS_LOCKPROFILER_H__ */
@@ -14,11 +14,75 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#include <malloc.h>
 #endif
 #include <exception>
+#include <new>
+
+#ifdef JSCPPUTILS_LOCK_PROFILE
+#define _LOCKPROFILE_INIT() \
+		m_pprofile = NULL; \
+		m_holdstart = 0;
+#define _LOCKPROFILE_DESTROY() \
+		if (m_pprofile != NULL) { \
+			LockProfiler::unregisterLock(m_pprofile); \
+			m_pprofile = NULL; \
+		}
+// Takes the lock with TRYLOCK_OK_EXPR first so contended acquisitions can be told apart.
+#define _LOCKPROFILE_ACQUIRE(TRYLOCK_OK_EXPR, LOCK_STMT, SETHOLD) \
+		if (LockProfiler::beginSample(m_pprofile)) { \
+			int64_t _lp_t0 = LockProfiler::now(); \
+			int64_t _lp_t1; \
+			bool _lp_contended = !(TRYLOCK_OK_EXPR); \
+			if (_lp_contended) { LOCK_STMT; } \
+			_lp_t1 = LockProfiler::now(); \
+			LockProfiler::recordAcquire(m_pprofile, _lp_contended, _lp_t1 - _lp_t0); \
+			if (SETHOLD) *((int64_t*)&m_holdstart) = _lp_t1; \
+		} else { LOCK_STMT; }
+// Without a try function, an acquisition that waited 1us or more counts as contended.
+#define _LOCKPROFILE_ACQUIRE_TIMED(LOCK_STMT, SETHOLD) \
+		if (LockProfiler::beginSample(m_pprofile)) { \
+			int64_t _lp_t0 = LockProfiler::now(); \
+			int64_t _lp_t1; \
+			LOCK_STMT; \
+			_lp_t1 = LockProfiler::now(); \
+			LockProfiler::recordAcquire(m_pprofile, (_lp_t1 - _lp_t0) >= 1000, _lp_t1 - _lp_t0); \
+			if (SETHOLD) *((int64_t*)&m_holdstart) = _lp_t1; \
+		} else { LOCK_STMT; }
+#define _LOCKPROFILE_RELEASE() \
+		if (m_holdstart != 0) { \
+			LockProfiler::recordHold(m_pprofile, LockProfiler::now() - m_holdstart); \
+			*((int64_t*)&m_holdstart) = 0; \
+		}
+// A named lock keeps its profile : lock() and unlock() may be using it on other threads.
+#define _LOCKPROFILE_SETNAME(CLASSNAME) \
+	void CLASSNAME::setProfileName(const char *szName) \
+	{ \
+		if (m_pprofile != NULL) \
+			LockProfiler::renameLock(m_pprofile, szName); \
+		else \
+			m_pprofile = LockProfiler::registerLock(szName); \
+	}
+#else
+#define _LOCKPROFILE_INIT()
+#define _LOCKPROFILE_DESTROY()
+#define _LOCKPROFILE_ACQUIRE(TRYLOCK_OK_EXPR, LOCK_STMT, SETHOLD) LOCK_STMT;
+#define _LOCKPROFILE_ACQUIRE_TIMED(LOCK_STMT, SETHOLD) LOCK_STMT;
+#define _LOCKPROFILE_RELEASE()
+#define _LOCKPROFILE_SETNAME(CLASSNAME)
+#endif
 
 namespace JsCPPUtils
 {
+	_LOCKPROFILE_SETNAME(Lockable)
+	_LOCKPROFILE_SETNAME(LockableEx)
+	_LOCKPROFILE_SETNAME(LockableRW)
+
 #if defined(JSCUTILS_OS_WINDOWS)
 	Lockable::Lockable()
 	{
@@ -27,17 +91,19 @@ namespace JsCPPUtils
 			DWORD dwErr = ::GetLastError();
 			throw std::exception("InitializeCriticalSectionAndSpinCount failed: ", dwErr);
 		}
+		_LOCKPROFILE_INIT();
 	}
 
 	Lockable::~Lockable()
 	{
+		_LOCKPROFILE_DESTROY();
 		::DeleteCriticalSection(&m_cs);
 	}
 
 	int Lockable::lock() const
 	{
 		DWORD *pownertid = (DWORD*)&m_ownertid;
-		::EnterCriticalSection((LPCRITICAL_SECTION)&m_cs);
+		_LOCKPROFILE_ACQUIRE(::TryEnterCriticalSection((LPCRITICAL_SECTION)&m_cs), ::EnterCriticalSection((LPCRITICAL_SECTION)&m_cs), true);
 		*pownertid =::GetCurrentThreadId();
 		return 1;
 	}
@@ -58,6 +124,7 @@ namespace JsCPPUtils
 	{
 		DWORD *pownertid = (DWORD*)&m_ownertid;
 		*pownertid = 0;
+		_LOCKPROFILE_RELEASE();
 		::LeaveCriticalSection((LPCRITICAL_SECTION)&m_cs);
 		return 1;
 	}
@@ -65,21 +132,35 @@ namespace JsCPPUtils
 	LockableEx::LockableEx()
 	{
 		::InitializeCriticalSectionAndSpinCount(&m_cs, 5000);
+		_LOCKPROFILE_INIT();
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		m_profiledepth = 0;
+#endif
 	}
 
 	LockableEx::~LockableEx()
 	{
+		_LOCKPROFILE_DESTROY();
 		::DeleteCriticalSection(&m_cs);
 	}
 
 	int LockableEx::lock() const
 	{
-		::EnterCriticalSection((LPCRITICAL_SECTION)&m_cs);
+		_LOCKPROFILE_ACQUIRE(::TryEnterCriticalSection((LPCRITICAL_SECTION)&m_cs), ::EnterCriticalSection((LPCRITICAL_SECTION)&m_cs), m_profiledepth == 0);
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		((LockableEx*)this)->m_profiledepth++;
+#endif
 		return 1;
 	}
 
 	int LockableEx::unlock() const
 	{
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		if (--((LockableEx*)this)->m_profiledepth == 0)
+		{
+			_LOCKPROFILE_RELEASE();
+		}
+#endif
 		::LeaveCriticalSection((LPCRITICAL_SECTION)&m_cs);
 		return 1;
 	}
@@ -99,14 +180,21 @@ namespace JsCPPUtils
 		{
 			m_fnInitializeSRWLock((PVOID*)&m_srwlock);
 		}
+		_LOCKPROFILE_INIT();
 	}
 	
 	LockableRW::~LockableRW()
 	{
-		
+		_LOCKPROFILE_DESTROY();
 	}
 	
 	int LockableRW::writelock() const
+	{
+		_LOCKPROFILE_ACQUIRE_TIMED(_syswritelock(), true);
+		return 1;
+	}
+
+	int LockableRW::_syswritelock() const
 	{
 		if (m_fnInitializeSRWLock)
 		{
@@ -131,6 +219,7 @@ namespace JsCPPUtils
 	
 	int LockableRW::writeunlock() const
 	{
+		_LOCKPROFILE_RELEASE();
 		if (m_fnInitializeSRWLock)
 		{
 			m_fnReleaseSRWLockExclusive((PVOID*)&m_srwlock);
@@ -142,6 +231,12 @@ namespace JsCPPUtils
 	}
 	
 	int LockableRW::readlock() const
+	{
+		_LOCKPROFILE_ACQUIRE_TIMED(_sysreadlock(), false);
+		return 1;
+	}
+
+	int LockableRW::_sysreadlock() const
 	{
 		if (m_fnInitializeSRWLock)
 		{
@@ -174,22 +269,123 @@ namespace JsCPPUtils
 		return 1;
 	}
 	
+	LockableAdaptive::LockableAdaptive(int spincount)
+	{
+		m_state = 0;
+		m_spincount = spincount;
+		m_hEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	LockableAdaptive::~LockableAdaptive()
+	{
+		if (m_hEvent != NULL)
+		{
+			::CloseHandle(m_hEvent);
+			m_hEvent = NULL;
+		}
+	}
+
+	int LockableAdaptive::lock() const
+	{
+		volatile LONG *pstate = (volatile LONG*)&m_state;
+		LONG c;
+		int i;
+
+		c = ::InterlockedCompareExchange(pstate, 1, 0);
+		if (c == 0)
+			return 1;
+
+		for (i = 0; i < m_spincount; i++)
+		{
+			_JSCPPUTILS_CPU_RELAX();
+			if (*pstate == 0)
+			{
+				c = ::InterlockedCompareExchange(pstate, 1, 0);
+				if (c == 0)
+					return 1;
+			}
+		}
+
+		// The event is auto-reset, so a stale signal only costs one extra loop.
+		while (::InterlockedExchange(pstate, 2) != 0)
+			::WaitForSingleObject(m_hEvent, INFINITE);
+		return 1;
+	}
+
+	int LockableAdaptive::trylock() const
+	{
+		if (::InterlockedCompareExchange((volatile LONG*)&m_state, 1, 0) == 0)
+			return 1;
+		return 0;
+	}
+
+	int LockableAdaptive::unlock() const
+	{
+		if (::InterlockedExchange((volatile LONG*)&m_state, 0) == 2)
+			::SetEvent(m_hEvent);
+		return 1;
+	}
+
+	LockableSpin::LockableSpin(int maxbackoff)
+	{
+		m_state = 0;
+		m_maxbackoff = maxbackoff;
+	}
+
+	LockableSpin::~LockableSpin()
+	{
+	}
+
+	int LockableSpin::lock() const
+	{
+		volatile LONG *pstate = (volatile LONG*)&m_state;
+		int backoff = 1;
+		int i;
+
+		while (1)
+		{
+			if ((*pstate == 0) && (::InterlockedExchange(pstate, 1) == 0))
+				return 1;
+			for (i = 0; i < backoff; i++)
+				_JSCPPUTILS_CPU_RELAX();
+			if (backoff < m_maxbackoff)
+				backoff <<= 1;
+			else
+				::SwitchToThread();
+		}
+	}
+
+	int LockableSpin::trylock() const
+	{
+		if (::InterlockedExchange((volatile LONG*)&m_state, 1) == 0)
+			return 1;
+		return 0;
+	}
+
+	int LockableSpin::unlock() const
+	{
+		::InterlockedExchange((volatile LONG*)&m_state, 0);
+		return 1;
+	}
+
 #elif defined(JSCUTILS_OS_LINUX)
 	Lockable::Lockable()
 	{
 		pthread_mutex_init(&m_mutex, NULL);
 		m_ownertid = 0;
+		_LOCKPROFILE_INIT();
 	}
 
 	Lockable::~Lockable()
 	{
+		_LOCKPROFILE_DESTROY();
 		pthread_mutex_destroy(&m_mutex);
 	}
 
 	int Lockable::lock() const
 	{
 		pthread_t *pownertid = (pthread_t*)&m_ownertid;
-		pthread_mutex_lock((pthread_mutex_t*)&m_mutex);
+		_LOCKPROFILE_ACQUIRE(pthread_mutex_trylock((pthread_mutex_t*)&m_mutex) == 0, pthread_mutex_lock((pthread_mutex_t*)&m_mutex), true);
 		*pownertid = pthread_self();
 		return 1;
 	}
@@ -212,6 +408,7 @@ namespace JsCPPUtils
 	{
 		pthread_t *pownertid = (pthread_t*)&m_ownertid;
 		*pownertid = 0;
+		_LOCKPROFILE_RELEASE();
 		pthread_mutex_unlock((pthread_mutex_t*)&m_mutex);
 		return 1;
 	}
@@ -223,21 +420,35 @@ namespace JsCPPUtils
 		pthread_mutexattr_settype(&a, PTHREAD_MUTEX_RECURSIVE);
 		pthread_mutex_init(&m_mutex, &a);
 		pthread_mutexattr_destroy(&a);
+		_LOCKPROFILE_INIT();
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		m_profiledepth = 0;
+#endif
 	}
 
 	LockableEx::~LockableEx()
 	{
+		_LOCKPROFILE_DESTROY();
 		pthread_mutex_destroy(&m_mutex);
 	}
 
 	int LockableEx::lock() const
 	{
-		pthread_mutex_lock((pthread_mutex_t*)&m_mutex);
+		_LOCKPROFILE_ACQUIRE(pthread_mutex_trylock((pthread_mutex_t*)&m_mutex) == 0, pthread_mutex_lock((pthread_mutex_t*)&m_mutex), m_profiledepth == 0);
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		((LockableEx*)this)->m_profiledepth++;
+#endif
 		return 1;
 	}
 
 	int LockableEx::unlock() const
 	{
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		if (--((LockableEx*)this)->m_profiledepth == 0)
+		{
+			_LOCKPROFILE_RELEASE();
+		}
+#endif
 		pthread_mutex_unlock((pthread_mutex_t*)&m_mutex);
 		return 1;
 	}
@@ -246,21 +457,24 @@ namespace JsCPPUtils
 	LockableRW::LockableRW()
 	{
 		pthread_rwlock_init(&m_syslock, NULL);
+		_LOCKPROFILE_INIT();
 	}
 	
 	LockableRW::~LockableRW()
 	{
+		_LOCKPROFILE_DESTROY();
 		pthread_rwlock_destroy(&m_syslock);
 	}
 	
 	int LockableRW::writelock() const
 	{
-		pthread_rwlock_wrlock((pthread_rwlock_t*)&m_syslock);
+		_LOCKPROFILE_ACQUIRE(pthread_rwlock_trywrlock((pthread_rwlock_t*)&m_syslock) == 0, pthread_rwlock_wrlock((pthread_rwlock_t*)&m_syslock), true);
 		return 1;
 	}
 	
 	int LockableRW::writeunlock() const
 	{
+		_LOCKPROFILE_RELEASE();
 		pthread_rwlock_unlock((pthread_rwlock_t*)&m_syslock);
 		return 1;
 	}
@@ -268,6 +482,22 @@ namespace JsCPPUtils
 	int LockableRW::readlock() const
 	{
 		int rc;
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		if (LockProfiler::beginSample(m_pprofile))
+		{
+			int64_t t0 = LockProfiler::now();
+			bool bContended = pthread_rwlock_tryrdlock((pthread_rwlock_t*)&m_syslock) != 0;
+			if (bContended)
+			{
+				while ((rc = pthread_rwlock_rdlock((pthread_rwlock_t*)&m_syslock)) == EAGAIN)
+				{
+					::usleep(1);
+				}
+			}
+			LockProfiler::recordAcquire(m_pprofile, bContended, LockProfiler::now() - t0);
+			return 1;
+		}
+#endif
 		while ((rc = pthread_rwlock_rdlock((pthread_rwlock_t*)&m_syslock)) == EAGAIN)
 		{
 			::usleep(1);
@@ -280,5 +510,245 @@ namespace JsCPPUtils
 		pthread_rwlock_unlock((pthread_rwlock_t*)&m_syslock);
 		return 1;
 	}
+
+	LockableAdaptive::LockableAdaptive(int spincount)
+	{
+		m_state = 0;
+		m_spincount = spincount;
+	}
+
+	LockableAdaptive::~LockableAdaptive()
+	{
+	}
+
+	int LockableAdaptive::lock() const
+	{
+		volatile int *pstate = (volatile int*)&m_state;
+		int c;
+		int i;
+
+		c = __sync_val_compare_and_swap(pstate, 0, 1);
+		if (c == 0)
+			return 1;
+
+		for (i = 0; i < m_spincount; i++)
+		{
+			_JSCPPUTILS_CPU_RELAX();
+			if (__atomic_load_n(pstate, __ATOMIC_RELAXED) == 0)
+			{
+				c = __sync_val_compare_and_swap(pstate, 0, 1);
+				if (c == 0)
+					return 1;
+			}
+		}
+
+		if (c != 2)
+			c = __atomic_exchange_n(pstate, 2, __ATOMIC_ACQUIRE);
+		while (c != 0)
+		{
+			::syscall(SYS_futex, pstate, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+			c = __atomic_exchange_n(pstate, 2, __ATOMIC_ACQUIRE);
+		}
+		return 1;
+	}
+
+	int LockableAdaptive::trylock() const
+	{
+		if (__sync_val_compare_and_swap((volatile int*)&m_state, 0, 1) == 0)
+			return 1;
+		return -EBUSY;
+	}
+
+	int LockableAdaptive::unlock() const
+	{
+		volatile int *pstate = (volatile int*)&m_state;
+		if (__atomic_exchange_n(pstate, 0, __ATOMIC_RELEASE) == 2)
+			::syscall(SYS_futex, pstate, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		return 1;
+	}
+
+	LockableSpin::LockableSpin(int maxbackoff)
+	{
+		m_state = 0;
+		m_maxbackoff = maxbackoff;
+	}
+
+	LockableSpin::~LockableSpin()
+	{
+	}
+
+	int LockableSpin::lock() const
+	{
+		volatile int *pstate = (volatile int*)&m_state;
+		int backoff = 1;
+		int i;
+
+		while (1)
+		{
+			if ((__atomic_load_n(pstate, __ATOMIC_RELAXED) == 0) && (__atomic_exchange_n(pstate, 1, __ATOMIC_ACQUIRE) == 0))
+				return 1;
+			for (i = 0; i < backoff; i++)
+				_JSCPPUTILS_CPU_RELAX();
+			if (backoff < m_maxbackoff)
+				backoff <<= 1;
+			else
+				::sched_yield();
+		}
+	}
+
+	int LockableSpin::trylock() const
+	{
+		if (__atomic_exchange_n((volatile int*)&m_state, 1, __ATOMIC_ACQUIRE) == 0)
+			return 1;
+		return -EBUSY;
+	}
+
+	int LockableSpin::unlock() const
+	{
+		__atomic_store_n((volatile int*)&m_state, 0, __ATOMIC_RELEASE);
+		return 1;
+	}
 #endif
+
+#if defined(JSCUTILS_OS_WINDOWS)
+#define _LOCKABLERW_ATOMIC_INC(p) ::InterlockedIncrement(p)
+#define _LOCKABLERW_ATOMIC_DEC(p) ::InterlockedDecrement(p)
+#define _LOCKABLERW_ATOMIC_SET(p, v) ::InterlockedExchange(p, v)
+#define _LOCKABLERW_YIELD() ::SwitchToThread()
+#elif defined(JSCUTILS_OS_LINUX)
+#define _LOCKABLERW_ATOMIC_INC(p) __sync_add_and_fetch(p, 1)
+#define _LOCKABLERW_ATOMIC_DEC(p) __sync_sub_and_fetch(p, 1)
+#define _LOCKABLERW_ATOMIC_SET(p, v) __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define _LOCKABLERW_YIELD() ::sched_yield()
+#endif
+
+	LockableRWScalable::LockableRWScalable(int numofslots)
+	{
+		int count = 1;
+		if (numofslots <= 0)
+		{
+#if defined(JSCUTILS_OS_WINDOWS)
+			SYSTEM_INFO sysinfo;
+			::GetSystemInfo(&sysinfo);
+			numofslots = (int)sysinfo.dwNumberOfProcessors * 2;
+#elif defined(JSCUTILS_OS_LINUX)
+			numofslots = (int)::sysconf(_SC_NPROCESSORS_ONLN) * 2;
+#endif
+		}
+		while (count < numofslots)
+			count <<= 1;
+		// new[] only guarantees 16 bytes : each slot must start its own cache line.
+#if defined(JSCUTILS_OS_WINDOWS)
+		m_slots = (ReaderSlot*)::_aligned_malloc(sizeof(ReaderSlot) * count, sizeof(ReaderSlot));
+#elif defined(JSCUTILS_OS_LINUX)
+		void *pmem = NULL;
+		if (::posix_memalign(&pmem, sizeof(ReaderSlot), sizeof(ReaderSlot) * count) != 0)
+			pmem = NULL;
+		m_slots = (ReaderSlot*)pmem;
+#endif
+		if (m_slots == NULL)
+			throw std::bad_alloc();
+		memset(m_slots, 0, sizeof(ReaderSlot) * count);
+		m_slotmask = count - 1;
+		m_writer = 0;
+	}
+
+	LockableRWScalable::~LockableRWScalable()
+	{
+#if defined(JSCUTILS_OS_WINDOWS)
+		::_aligned_free(m_slots);
+#elif defined(JSCUTILS_OS_LINUX)
+		::free(m_slots);
+#endif
+		m_slots = NULL;
+	}
+
+	LockableRWScalable::ReaderSlot *LockableRWScalable::_mySlot() const
+	{
+		// The slot must not change between readlock and readunlock, so it is keyed by thread rather than CPU.
+#if defined(JSCUTILS_OS_WINDOWS)
+		uint64_t h = (uint64_t)::GetCurrentThreadId();
+#elif defined(JSCUTILS_OS_LINUX)
+		uint64_t h = (uint64_t)(uintptr_t)::pthread_self();
+#endif
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return &m_slots[(int)h & m_slotmask];
+	}
+
+	void LockableRWScalable::_waitReaders() const
+	{
+		for (int i = 0; i <= m_slotmask; i++)
+		{
+			int spins = 0;
+			while (m_slots[i].count != 0)
+			{
+				if (++spins < 1000)
+					_JSCPPUTILS_CPU_RELAX();
+				else
+					_LOCKABLERW_YIELD();
+			}
+		}
+	}
+
+	int LockableRWScalable::writelock() const
+	{
+		m_writerlock.lock();
+		_LOCKABLERW_ATOMIC_SET(&((LockableRWScalable*)this)->m_writer, 1);
+		_waitReaders();
+		return 1;
+	}
+
+	int LockableRWScalable::writeunlock() const
+	{
+		_LOCKABLERW_ATOMIC_SET(&((LockableRWScalable*)this)->m_writer, 0);
+		m_writerlock.unlock();
+		return 1;
+	}
+
+	int LockableRWScalable::readlock() const
+	{
+		ReaderSlot *pslot = _mySlot();
+		while (1)
+		{
+			int spins = 0;
+			_LOCKABLERW_ATOMIC_INC(&pslot->count);
+			if (m_writer == 0)
+				return 1;
+			_LOCKABLERW_ATOMIC_DEC(&pslot->count);
+			while (m_writer != 0)
+			{
+				if (++spins < 1000)
+					_JSCPPUTILS_CPU_RELAX();
+				else
+					_LOCKABLERW_YIELD();
+			}
+		}
+	}
+
+	int LockableRWScalable::readunlock() const
+	{
+		_LOCKABLERW_ATOMIC_DEC(&_mySlot()->count);
+		return 1;
+	}
+
+	int LockableRWScalable::upgradelock() const
+	{
+		m_writerlock.lock();
+		return 1;
+	}
+
+	int LockableRWScalable::upgradeunlock() const
+	{
+		m_writerlock.unlock();
+		return 1;
+	}
+
+	int LockableRWScalable::upgrade() const
+	{
+		_LOCKABLERW_ATOMIC_SET(&((LockableRWScalable*)this)->m_writer, 1);
+		_waitReaders();
+		return 1;
+	}
 }
@@ -17,12 +17,35 @@
 
 #include "Common.h"
 
+#ifdef JSCPPUTILS_LOCK_PROFILE
+#include "LockProfiler.h"
+#define _JSCPPUTILS_LOCKPROFILE_MEMBERS \
+		LockProfile *m_pprofile; \
+		int64_t m_holdstart;
+#define _JSCPPUTILS_LOCKPROFILE_METHODS \
+		void setProfileName(const char *szName);
+#else
+#define _JSCPPUTILS_LOCKPROFILE_MEMBERS
+#define _JSCPPUTILS_LOCKPROFILE_METHODS \
+		void setProfileName(const char *) { }
+#endif
+
 #if defined(JSCUTILS_OS_WINDOWS)
 #include <windows.h>
 #elif defined(JSCUTILS_OS_LINUX)
 #include <pthread.h>
 #endif
 
+#if defined(JSCUTILS_OS_WINDOWS)
+#define _JSCPPUTILS_CPU_RELAX() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define _JSCPPUTILS_CPU_RELAX() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__) || defined(__arm__)
+#define _JSCPPUTILS_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define _JSCPPUTILS_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
 namespace JsCPPUtils
 {
 
@@ -36,6 +59,7 @@ namespace JsCPPUtils
 		pthread_mutex_t m_mutex;
 		pthread_t m_ownertid;
 #endif
+		_JSCPPUTILS_LOCKPROFILE_MEMBERS
 
 	public:
 		Lockable();
@@ -43,6 +67,11 @@ namespace JsCPPUtils
 		int lock() const;
 		int trylock() const;
 		int unlock() const;
+		/**
+		 * Tracks this lock in LockProfiler (only with JSCPPUTILS_LOCK_PROFILE).
+		 * Calling it again renames the profile in place, so the lock may be in use meanwhile.
+		 */
+		_JSCPPUTILS_LOCKPROFILE_METHODS
 		
 #if defined(JSCUTILS_OS_WINDOWS)
 		DWORD getOwnerTid() { return m_ownertid; }
@@ -61,12 +90,70 @@ namespace JsCPPUtils
 #elif defined(JSCUTILS_OS_LINUX)
 		pthread_mutex_t m_mutex;
 #endif
+		_JSCPPUTILS_LOCKPROFILE_MEMBERS
+#ifdef JSCPPUTILS_LOCK_PROFILE
+		int m_profiledepth;
+#endif
 
 	public:
 		LockableEx();
 		~LockableEx();
 		int lock() const;
 		int unlock() const;
+		_JSCPPUTILS_LOCKPROFILE_METHODS
+	};
+
+	/**
+	 * Spin-then-park mutex.
+	 * Spins up to spincount times, then sleeps on a futex (an event on Windows).
+	 * Does not record the owner thread. Not recursive.
+	 */
+	class LockableAdaptive
+	{
+	private:
+		// 0 : unlocked, 1 : locked, 2 : locked and maybe waiters
+#if defined(JSCUTILS_OS_WINDOWS)
+		volatile LONG m_state;
+		HANDLE m_hEvent;
+#elif defined(JSCUTILS_OS_LINUX)
+		volatile int m_state;
+#endif
+		int m_spincount;
+
+		LockableAdaptive(const LockableAdaptive&);
+		LockableAdaptive& operator=(const LockableAdaptive&);
+
+	public:
+		explicit LockableAdaptive(int spincount = 100);
+		~LockableAdaptive();
+		int lock() const;
+		int trylock() const;
+		int unlock() const;
+	};
+
+	/**
+	 * Pure spinlock with exponential backoff.
+	 * Only for very short critical sections. Yields the CPU once the backoff reaches maxbackoff.
+	 */
+	class LockableSpin
+	{
+	private:
+#if defined(JSCUTILS_OS_WINDOWS)
+		volatile LONG m_state;
+#elif defined(JSCUTILS_OS_LINUX)
+		volatile int m_state;
+#endif
+		int m_maxbackoff;
+
+		LockableSpin(const LockableSpin&);
+		LockableSpin& operator=(const LockableSpin&);
+
+	public:
+		explicit LockableSpin(int maxbackoff = 1024);
+		~LockableSpin();
+		int lock() const;
+		int trylock() const;
+		int unlock() const;
 	};
 
 	class LockableRW
@@ -96,9 +183,14 @@ namespace JsCPPUtils
 #else
 		PVOID m_srwlock;
 #endif
+
+		int _syswritelock() const;
+		int _sysreadlock() const;
 #elif defined(JSCUTILS_OS_LINUX)
 		pthread_rwlock_t m_syslock;
 #endif
+		// Hold times are only measured for the write side.
+		_JSCPPUTILS_LOCKPROFILE_MEMBERS
 
 	public:
 		LockableRW();
@@ -107,6 +199,62 @@ namespace JsCPPUtils
 		int writeunlock() const;
 		int readlock() const;
 		int readunlock() const;
+		_JSCPPUTILS_LOCKPROFILE_METHODS
+	};
+
+	/**
+	 * Reader-scalable, writer-preferring reader-writer lock.
+	 * Readers only touch their own cache-line sized slot, chosen by a hash of the thread id,
+	 * so they do not contend with each other. A pending writer blocks new readers.
+	 * An upgradeable reader (upgradelock) runs alongside plain readers, excludes writers and
+	 * other upgradeable readers, and can turn into a writer with upgrade().
+	 * Not recursive. Waits spin and then yield; meant for short critical sections.
+	 */
+	class LockableRWScalable
+	{
+	private:
+		struct ReaderSlot
+		{
+#if defined(JSCUTILS_OS_WINDOWS)
+			volatile LONG count;
+#elif defined(JSCUTILS_OS_LINUX)
+			volatile int count;
+#endif
+			char pad[64 - sizeof(int)];
+		};
+
+		ReaderSlot *m_slots;
+		int m_slotmask;
+#if defined(JSCUTILS_OS_WINDOWS)
+		volatile LONG m_writer;
+#elif defined(JSCUTILS_OS_LINUX)
+		volatile int m_writer;
+#endif
+		LockableAdaptive m_writerlock;
+
+		LockableRWScalable(const LockableRWScalable&);
+		LockableRWScalable& operator=(const LockableRWScalable&);
+
+		ReaderSlot *_mySlot() const;
+		void _waitReaders() const;
+
+	public:
+		/**
+		 * @param numofslots	number of reader slots (rounded up to a power of 2, 0 : 2 x number of CPUs)
+		 */
+		explicit LockableRWScalable(int numofslots = 0);
+		~LockableRWScalable();
+		int writelock() const;
+		int writeunlock() const;
+		int readlock() const;
+		int readunlock() const;
+		int upgradelock() const;
+		int upgradeunlock() const;
+		/**
+		 * Turns the upgradeable read lock held by the caller into a write lock.
+		 * Release it with writeunlock().
+		 */
+		int upgrade() const;
 	};
 
 };
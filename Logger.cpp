@@ -17,6 +17,7 @@
 #include <time.h>
 
 #include "Logger.h"
+#include "Thread.h"
 
 #ifdef JSCUTILS_OS_WINDOWS
 #include <io.h>
@@ -24,12 +25,295 @@
 #include "StringEncoding.h"
 #endif
 
+#ifdef JSCUTILS_OS_LINUX
+#include <unistd.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
 #ifdef HAS_SYSLOG
 #include <syslog.h>
 #endif
 
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#include <list>
+
+#ifdef JSCUTILS_OS_LINUX
+extern char **environ;
+#endif
+
 namespace JsCPPUtils
 {
+	/*
+	 * Single-producer (the owning thread) / single-consumer (whoever holds m_asyncringslock) byte ring.
+	 * Only complete, already formatted lines are stored, so a drained range can be written as-is.
+	 */
+	struct Logger::AsyncRing
+	{
+		char *buf;
+		size_t mask;
+		volatile size_t head;
+		char _pad1[64 - sizeof(size_t)];
+		volatile size_t tail;
+		char _pad2[64 - sizeof(size_t)];
+		size_t drainto;
+		volatile int closed;
+		AsyncRing *next;
+	};
+
+	class Logger::AsyncWriterThread : public Thread
+	{
+	public:
+		Logger *logger;
+		int run(int param_idx, void *param_ptr) override
+		{
+			while (isRun())
+			{
+				logger->_asyncWait();
+				logger->_asyncDrain();
+			}
+			logger->_asyncDrain();
+			return 0;
+		}
+	};
+
+	/*
+	 * Compresses rotated segments so that rotate() itself only has to rename the file.
+	 */
+	class Logger::CompressThread : public Thread
+	{
+	public:
+		Lockable queuelock;
+		std::list<std::string> queue;
+
+		void push(const std::string& strPath)
+		{
+			queuelock.lock();
+			queue.push_back(strPath);
+			queuelock.unlock();
+		}
+
+		static int compressFile(const std::string& strPath)
+		{
+#if defined(HAS_ZLIB)
+			char buf[65536];
+			size_t readlen;
+			int retval = 1;
+			FILE *fp = fopen(strPath.c_str(), "rb");
+			gzFile gz;
+			if (fp == NULL)
+				return -errno;
+			gz = gzopen((strPath + ".gz").c_str(), "wb");
+			if (gz == NULL)
+			{
+				fclose(fp);
+				return -ENOMEM;
+			}
+			while ((readlen = fread(buf, 1, sizeof(buf), fp)) > 0)
+			{
+				if (gzwrite(gz, buf, (unsigned)readlen) != (int)readlen)
+				{
+					retval = -EIO;
+					break;
+				}
+			}
+			fclose(fp);
+			if (gzclose(gz) != Z_OK)
+				retval = -EIO;
+			if (retval == 1)
+				remove(strPath.c_str());
+			else
+				remove((strPath + ".gz").c_str());
+			return retval;
+#elif defined(JSCUTILS_OS_LINUX)
+			char *argv[] = { (char*)"gzip", (char*)"-f", (char*)strPath.c_str(), NULL };
+			pid_t pid;
+			int status = 0;
+			int rc = posix_spawnp(&pid, "gzip", NULL, NULL, argv, environ);
+			if (rc != 0)
+				return -rc;
+			while (waitpid(pid, &status, 0) < 0)
+			{
+				if (errno != EINTR)
+					return -errno;
+			}
+			return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 1 : -EIO;
+#else
+			return 0;
+#endif
+		}
+
+		int run(int param_idx, void *param_ptr) override
+		{
+			bool bStop = false;
+			while (!bStop)
+			{
+				std::string strPath;
+				bool bHasItem;
+
+				// Queued segments are still compressed after a stop request.
+				bStop = !isRun();
+				queuelock.lock();
+				bHasItem = !queue.empty();
+				if (bHasItem)
+				{
+					strPath = queue.front();
+					queue.pop_front();
+				}
+				queuelock.unlock();
+
+				if (bHasItem)
+				{
+					compressFile(strPath);
+					bStop = false;
+				} else if (!bStop) {
+#if defined(JSCUTILS_OS_WINDOWS)
+					::Sleep(200);
+#else
+					::usleep(200000);
+#endif
+				}
+			}
+			return 0;
+		}
+	};
+
+	static inline size_t _asyncLoadAcquire(volatile size_t *p)
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		size_t v = *p;
+		MemoryBarrier();
+		return v;
+#endif
+	}
+
+	static inline void _asyncStoreRelease(volatile size_t *p, size_t v)
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		__atomic_store_n(p, v, __ATOMIC_RELEASE);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		MemoryBarrier();
+		*p = v;
+#endif
+	}
+
+#if defined(JSCUTILS_OS_LINUX)
+#define _JSLOGGER_ATOMIC_INC(p) __sync_add_and_fetch((p), 1)
+#define _JSLOGGER_ATOMIC_DEC(p) __sync_sub_and_fetch((p), 1)
+#define _JSLOGGER_ATOMIC_INC64(p) __sync_add_and_fetch((p), 1)
+#define _JSLOGGER_LOAD_INT(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _JSLOGGER_EXCHANGE_INT(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define _JSLOGGER_ASYNC_BACKOFF() ::usleep(200)
+#elif defined(JSCUTILS_OS_WINDOWS)
+#define _JSLOGGER_ATOMIC_INC(p) ::InterlockedIncrement((volatile LONG*)(p))
+#define _JSLOGGER_ATOMIC_DEC(p) ::InterlockedDecrement((volatile LONG*)(p))
+#define _JSLOGGER_ATOMIC_INC64(p) ::InterlockedIncrement64((volatile LONGLONG*)(p))
+#define _JSLOGGER_LOAD_INT(p) (*(p))
+#define _JSLOGGER_EXCHANGE_INT(p, v) ::InterlockedExchange((volatile LONG*)(p), (v))
+#define _JSLOGGER_ASYNC_BACKOFF() ::Sleep(1)
+#endif
+
+#if defined(JSCUTILS_OS_WINDOWS)
+#define _JSLOGGER_TLS __declspec(thread)
+#define _JSLOGGER_EOL "\r\n"
+#define _JSLOGGER_EOL_LEN 2
+#else
+#define _JSLOGGER_TLS __thread
+#define _JSLOGGER_EOL "\n"
+#define _JSLOGGER_EOL_LEN 1
+#endif
+
+	/*
+	 * The date part of the header only changes once a second, so each thread keeps
+	 * the last one it formatted and skips localtime (and its tz lock) otherwise.
+	 */
+	struct LoggerTimeCache
+	{
+		time_t cachedtime;
+		size_t len;
+		char text[40];
+	};
+	static _JSLOGGER_TLS LoggerTimeCache g_loggertimecache;
+
+	static const char *_logTypeName(Logger::LogType logtype, size_t *plen)
+	{
+		static const char *names[] = { "EMERG", "ALERT", "CRIT", "ERR", "WARN", "NOTI", "INFO", "DEBUG" };
+		static const size_t lens[] = { 5, 5, 4, 3, 4, 4, 4, 5 };
+		if (((int)logtype < 0) || ((int)logtype >= (int)(sizeof(names) / sizeof(names[0]))))
+		{
+			*plen = 9;
+			return "UNDEFINED";
+		}
+		*plen = lens[logtype];
+		return names[logtype];
+	}
+
+	/*
+	 * Returns the length that the complete output would have (like C99 vsnprintf).
+	 */
+	static int _jslogger_vsnprintf(char *buf, size_t size, const char *format, va_list args)
+	{
+#if defined(JSCUTILS_OS_WINDOWS)
+		va_list args2;
+		int rc;
+		va_copy(args2, args);
+		rc = _vsnprintf_s(buf, size, _TRUNCATE, format, args);
+		if (rc < 0)
+			rc = _vscprintf(format, args2);
+		va_end(args2);
+		return rc;
+#else
+		return vsnprintf(buf, size, format, args);
+#endif
+	}
+
+	/*
+	 * Writes "[TYPE] Mon dd hh:mm:ss yyyy] " into buf, which must hold at least 64 bytes.
+	 */
+	size_t Logger::_formatHeader(char *buf, LogType logtype)
+	{
+		static const char strmonths[][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+		LoggerTimeCache *pcache = &g_loggertimecache;
+		time_t rawtime = time(NULL);
+		const char *strlogtype;
+		size_t typelen;
+		size_t pos = 0;
+
+		if ((pcache->len == 0) || (pcache->cachedtime != rawtime))
+		{
+			struct tm timeinfo;
+			int len;
+#if defined(JSCUTILS_OS_WINDOWS)
+			localtime_s(&timeinfo, &rawtime);
+#elif defined(JSCUTILS_OS_LINUX)
+			localtime_r(&rawtime, &timeinfo);
+#endif
+			len = snprintf(pcache->text, sizeof(pcache->text), "%s %02d %02d:%02d:%02d %d] ", strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900);
+			if ((len < 0) || (len >= (int)sizeof(pcache->text)))
+				len = 0;
+			pcache->len = len;
+			pcache->cachedtime = rawtime;
+		}
+
+		strlogtype = _logTypeName(logtype, &typelen);
+		buf[pos++] = '[';
+		memcpy(buf + pos, strlogtype, typelen);
+		pos += typelen;
+		buf[pos++] = ']';
+		buf[pos++] = ' ';
+		memcpy(buf + pos, pcache->text, pcache->len);
+		pos += pcache->len;
+		return pos;
+	}
+
 	Logger::Logger()
 	{
 		_clearInstance();
@@ -44,6 +328,31 @@ namespace JsCPPUtils
 		m_cbfuncW = NULL;
 		m_cbuserptr = NULL;
 		m_lasterrno = 0;
+		m_minlevel = -1;
+		m_filesize = 0;
+		m_rotatemaxbytes = 0;
+		m_rotateinterval = 0;
+		m_nextrotatetime = 0;
+		m_rotatecompress = false;
+		m_reopenreq = 0;
+		m_suppressedcount = 0;
+		m_coalesce = false;
+		m_coalesceinterval = 30;
+		m_lastlogtype = LOGTYPE_INFO;
+		m_repeatcount = 0;
+		m_lastnoticetime = 0;
+		m_asyncenabled = 0;
+		m_asyncinflight = 0;
+		m_asyncringsize = 0;
+		m_asyncflushinterval = 0;
+		m_asyncpolicy = ASYNC_OVERFLOW_BLOCK;
+		m_asyncdropped = 0;
+		m_asyncrings = NULL;
+		m_asyncthread = NULL;
+#if defined(JSCUTILS_OS_WINDOWS)
+		m_asynctlsidx = TLS_OUT_OF_INDEXES;
+		m_hasyncwakeevent = NULL;
+#endif
 	}
 
 	Logger::Logger(OutputType outputType, const char *szFilePath, CallbackFuncA_t cbfuncA, CallbackFuncW_t cbfuncW, void *cbuserptr)
@@ -54,11 +363,27 @@ namespace JsCPPUtils
 
 	void Logger::close()
 	{
+		_flushRepeats();
+		m_coalesce = false;
+		m_strLastMsg.clear();
+		stopAsync();
+		if (m_compressthread.getPtr() != NULL)
+		{
+			m_compressthread->reqStop();
+			m_compressthread->join();
+			m_compressthread = NULL;
+		}
 		if (m_fp != NULL)
 		{
 			fclose(m_fp);
 			m_fp = NULL;
 		}
+		m_strFilePath.clear();
+		m_filesize = 0;
+		m_rotatemaxbytes = 0;
+		m_rotateinterval = 0;
+		m_rotatecompress = false;
+		m_reopenreq = 0;
 		m_pParent = NULL;
 		m_outtype = TYPE_NULL;
 		m_fp = NULL;
@@ -68,6 +393,64 @@ namespace JsCPPUtils
 		m_lasterrno = 0;
 	}
 
+	int Logger::_openFile()
+	{
+#ifdef JSCUTILS_OS_WINDOWS
+		unsigned char bom[2] = { 0xFF, 0xFE };
+		DWORD dwWinErr = 0;
+		HANDLE hFile;
+		int fd;
+		::SetLastError(0);
+		hFile = ::CreateFileA(m_strFilePath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+		if ((hFile == NULL) || (hFile == INVALID_HANDLE_VALUE))
+		{
+			DWORD dwErr = ::GetLastError();
+			m_lasterrno = dwErr;
+			return -((int)dwErr);
+		}
+		dwWinErr = ::GetLastError();
+		if (dwWinErr != ERROR_ALREADY_EXISTS)
+		{
+			DWORD dwWrittenBytes = 0;
+			::WriteFile(hFile, bom, sizeof(bom), &dwWrittenBytes, NULL);
+		}
+
+		fd = ::_open_osfhandle((intptr_t)hFile, _O_RDWR);
+		if (fd < 0)
+		{
+			DWORD dwErr = ::GetLastError();
+			m_lasterrno = dwErr;
+			return -((int)dwErr);
+		}
+		m_fp = _fdopen(fd, "a,ccs=UTF-8");
+		if (m_fp == NULL)
+		{
+			DWORD dwErr = ::GetLastError();
+			m_lasterrno = dwErr;
+			_close(fd);
+			return -((int)dwErr);
+		}
+#else
+		m_fp = fopen(m_strFilePath.c_str(), "a+");
+		if(m_fp == NULL)
+		{
+			m_lasterrno = errno;
+			return -errno;
+		}
+#endif
+
+#if defined(JSCUTILS_OS_WINDOWS)
+		m_filesize = _filelengthi64(_fileno(m_fp));
+#else
+		{
+			struct stat st;
+			m_filesize = (fstat(fileno(m_fp), &st) == 0) ? (int64_t)st.st_size : 0;
+		}
+#endif
+		return 1;
+	}
+
 	int Logger::init(OutputType outputType, const char *szFilePath, CallbackFuncA_t cbfuncA, CallbackFuncW_t cbfuncW, void *cbuserptr)
 	{
 		int retval = 1;
@@ -82,52 +465,9 @@ namespace JsCPPUtils
 		case TYPE_STDERR:
 			m_fp = stderr;
 			break;
-		case TYPE_FILE: {
-#ifdef JSCUTILS_OS_WINDOWS
-			unsigned char bom[2] = { 0xFF, 0xFE };
-			DWORD dwWinErr = 0;
-			HANDLE hFile;
-			int fd;
-			::SetLastError(0);
-			hFile = ::CreateFileA(szFilePath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-
-			if ((hFile == NULL) || (hFile == INVALID_HANDLE_VALUE))
-			{
-				DWORD dwErr = ::GetLastError();
-				m_lasterrno = dwErr;
-				retval = -((int)dwErr);
-				break;
-			}
-			dwWinErr = ::GetLastError();
-			if (dwWinErr != ERROR_ALREADY_EXISTS)
-			{
-				DWORD dwWrittenBytes = 0;
-				::WriteFile(hFile, bom, sizeof(bom), &dwWrittenBytes, NULL);
-			}
-
-			fd = ::_open_osfhandle((intptr_t)hFile, _O_RDWR);
-			if (fd < 0)
-			{
-				DWORD dwErr = ::GetLastError();
-				m_lasterrno = dwErr;
-				retval = -((int)dwErr);
-				break;
-			}
-			m_fp = _fdopen(fd, "a,ccs=UTF-8");
-			if (m_fp == NULL)
-			{
-				DWORD dwErr = ::GetLastError();
-				m_lasterrno = dwErr;
-				retval = -((int)dwErr);
-				_close(fd);
-				break;
-			}
-#else
-			m_fp = fopen(szFilePath, "a+");
-			if(m_fp == NULL)
-				m_lasterrno = errno;
-#endif
-			}
+		case TYPE_FILE:
+			m_strFilePath = szFilePath;
+			retval = _openFile();
 			break;
 		case TYPE_CALLBACK:
 			m_cbfuncA = cbfuncA;
@@ -269,16 +609,43 @@ namespace JsCPPUtils
 		m_pParent = spParent.getPtr();
 	}
 
-	void Logger::_child_puts(LogType logtype, const std::string& strPrefixName, const char* szLog)
+	/*
+	 * pchild : the logger the record was written to; the root puts the prefixes in front of it.
+	 */
+	void Logger::_child_puts(LogType logtype, const Logger *pchild, const char* szLog)
 	{
 		if (m_pParent != NULL)
 		{
-			m_pParent->_child_puts(logtype, m_strPrefixName + ": " + strPrefixName, szLog);
+			m_pParent->_child_puts(logtype, pchild, szLog);
 		} else {
-			this->printf(logtype, "%s: %s", strPrefixName.c_str(), szLog);
+			// The originating child already applied its level threshold.
+			_puts(logtype, szLog, pchild);
 		}
 	}
 
+	/*
+	 * "name: " of pchild and of each parent below the root, outermost first.
+	 */
+	size_t Logger::_prefixLen(const Logger *pchild)
+	{
+		size_t len = 0;
+		for (; (pchild != NULL) && (pchild->m_pParent != NULL); pchild = pchild->m_pParent)
+			len += pchild->m_strPrefixName.length() + 2;
+		return len;
+	}
+
+	char *Logger::_writePrefix(char *p, const Logger *pchild)
+	{
+		if ((pchild == NULL) || (pchild->m_pParent == NULL))
+			return p;
+		p = _writePrefix(p, pchild->m_pParent);
+		memcpy(p, pchild->m_strPrefixName.data(), pchild->m_strPrefixName.length());
+		p += pchild->m_strPrefixName.length();
+		*p++ = ':';
+		*p++ = ' ';
+		return p;
+	}
+
 	void Logger::_child_puts(LogType logtype, const std::string& strPrefixName, const wchar_t* szLog)
 	{
 		if (m_pParent != NULL)
@@ -289,15 +656,117 @@ namespace JsCPPUtils
 		}
 	}
 
+	void Logger::_putLine(LogType logtype, const char *line, size_t linelen, const char *text, size_t textlen)
+	{
+		if (m_coalesce)
+		{
+			char szNotice[128];
+			size_t noticelen = 0;
+			size_t noticehdrlen = 0;
+			bool bWrite = _coalesce(logtype, text, textlen, szNotice, &noticelen, &noticehdrlen);
+			if (noticelen > 0)
+				_emitLine(logtype, szNotice, noticelen, szNotice + noticehdrlen, noticelen - noticehdrlen - _JSLOGGER_EOL_LEN);
+			if (!bWrite)
+				return;
+		}
+		_emitLine(logtype, line, linelen, text, textlen);
+	}
+
+	void Logger::_emitLine(LogType logtype, const char *line, size_t linelen, const char *text, size_t textlen)
+	{
+		if (m_asyncenabled && _asyncPush(line, linelen))
+			return;
+
+		lock();
+		switch (m_outtype)
+		{
+		case TYPE_FILE:
+			_checkRotate(linelen);
+			if (m_fp == NULL)
+				break;
+			m_filesize += linelen;
+			/* fall through */
+		case TYPE_STDOUT:
+		case TYPE_STDERR:
+#if defined(JSCUTILS_OS_WINDOWS)
+		{
+			fputws(StringEncoding::StringToUnicode(line).c_str(), m_fp);
+			fflush(m_fp);
+		}
+#else
+			fwrite(line, 1, linelen, m_fp);
+			fflush(m_fp);
+#endif
+			break;
+		case TYPE_CALLBACK:
+			m_cbfuncA(m_cbuserptr, line);
+			break;
+		case TYPE_SYSLOG:
+#ifdef HAS_SYSLOG
+			syslog(logtype, "%.*s", (int)textlen, text);
+#endif
+			break;
+		default:
+			break;
+		}
+		unlock();
+	}
+
 	void Logger::puts(LogType logtype, const char* text)
 	{
-		static char strmonths[][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+		if (!isEnabled(logtype))
+			return;
+		_puts(logtype, text);
+	}
+
+	void Logger::_puts(LogType logtype, const char* text, const Logger *pchild)
+	{
+		char stackbuf[JSLOGGER_LINEBUF_SIZE];
+		char *pbuf = stackbuf;
+		size_t headerlen;
+		size_t prefixlen;
+		size_t textlen;
+		size_t linelen;
+
+		if (m_pParent != NULL)
+		{
+			m_pParent->_child_puts(logtype, this, text);
+			return;
+		}
+		if (m_outtype == TYPE_NULL)
+			return;
+
+		headerlen = _formatHeader(stackbuf, logtype);
+		prefixlen = _prefixLen(pchild);
+		textlen = prefixlen + strlen(text);
+		linelen = headerlen + textlen + _JSLOGGER_EOL_LEN;
+		if (linelen >= sizeof(stackbuf))
+		{
+			pbuf = (char*)malloc(linelen + 1);
+			if (pbuf == NULL)
+				return;
+			memcpy(pbuf, stackbuf, headerlen);
+		}
+		_writePrefix(pbuf + headerlen, pchild);
+		memcpy(pbuf + headerlen + prefixlen, text, textlen - prefixlen);
+		memcpy(pbuf + headerlen + textlen, _JSLOGGER_EOL, _JSLOGGER_EOL_LEN + 1);
+
+		_putLine(logtype, pbuf, linelen, pbuf + headerlen, textlen);
+
+		if (pbuf != stackbuf)
+			free(pbuf);
+	}
+
+#if defined(JSCUTILS_OS_WINDOWS)
+	void Logger::puts(LogType logtype, const wchar_t* text)
+	{
+		static wchar_t strmonths[][4] = { L"Jan", L"Feb", L"Mar", L"Apr", L"May", L"Jun", L"Jul", L"Aug", L"Sep", L"Oct", L"Nov", L"Dec" };
 
 		long buf2size = 1536;
 #ifdef JSLOGGER_USE_STACK
-		char pbuf2[1536];
+		wchar_t pbuf2[1536];
 #else
-		char *pbuf2 = NULL;
+		wchar_t *pbuf2 = NULL;
 #endif
 
 		va_list args;
@@ -305,8 +774,8 @@ namespace JsCPPUtils
 		time_t rawtime;
 		struct tm timeinfo;
 
-		const char *strlogtype = NULL;
-		const char *stroutput = NULL;
+		const wchar_t *strlogtype = NULL;
+		const wchar_t *stroutput = NULL;
 
 		do {
 			time(&rawtime);
@@ -324,31 +793,31 @@ namespace JsCPPUtils
 				switch (logtype)
 				{
 				case LOGTYPE_EMERG:
-					strlogtype = "EMERG";
+					strlogtype = L"EMERG";
 					break;
 				case LOGTYPE_ALERT:
-					strlogtype = "ALERT";
+					strlogtype = L"ALERT";
 					break;
 				case LOGTYPE_CRIT:
-					strlogtype = "CRIT";
+					strlogtype = L"CRIT";
 					break;
 				case LOGTYPE_ERR:
-					strlogtype = "ERR";
+					strlogtype = L"ERR";
 					break;
 				case LOGTYPE_WARNING:
-					strlogtype = "WARN";
+					strlogtype = L"WARN";
 					break;
 				case LOGTYPE_NOTICE:
-					strlogtype = "NOTI";
+					strlogtype = L"NOTI";
 					break;
 				case LOGTYPE_INFO:
-					strlogtype = "INFO";
+					strlogtype = L"INFO";
 					break;
 				case LOGTYPE_DEBUG:
-					strlogtype = "DEBUG";
+					strlogtype = L"DEBUG";
 					break;
 				default:
-					strlogtype = "UNDEFINED";
+					strlogtype = L"UNDEFINED";
 					break;
 				}
 
@@ -365,15 +834,15 @@ namespace JsCPPUtils
 #endif
 #ifdef JSCUTILS_OS_WINDOWS
 #ifdef _JSCUTILS_MSVC_CRT_SECURE
-					sprintf_s(pbuf2, buf2size, "[%s] %s %02d %02d:%02d:%02d %d] %s\r\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
+					swprintf_s(pbuf2, buf2size, L"[%s] %s %02d %02d:%02d:%02d %d] %s\r\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
 #else
-					sprintf(pbuf2, "[%s] %s %02d %02d:%02d:%02d %d] %s\r\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
+					swprintf(pbuf2, L"[%s] %s %02d %02d:%02d:%02d %d] %s\r\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
 #endif
 #else
 #ifdef _JSCUTILS_MSVC_CRT_SECURE
-					sprintf_s(pbuf2, buf2size, "[%s] %s %02d %02d:%02d:%02d %d] %s\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
+					swprintf_s(pbuf2, buf2size, L"[%s] %s %02d %02d:%02d:%02d %d] %s\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
 #else
-					sprintf(pbuf2, "[%s] %s %02d %02d:%02d:%02d %d] %s\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
+					swprintf(pbuf2, L"[%s] %s %02d %02d:%02d:%02d %d] %s\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
 #endif
 #endif
 					stroutput = pbuf2;
@@ -395,18 +864,11 @@ namespace JsCPPUtils
 				case TYPE_STDOUT:
 				case TYPE_STDERR:
 				case TYPE_FILE:
-#if defined(JSCUTILS_OS_WINDOWS)
-				{
-					fputws(StringEncoding::StringToUnicode(stroutput).c_str(), m_fp);
-					fflush(m_fp);
-				}
-#else
-					fputs(stroutput, m_fp);
+					fputws(stroutput, m_fp);
 					fflush(m_fp);
-#endif
 					break;
 				case TYPE_CALLBACK:
-					m_cbfuncA(m_cbuserptr, stroutput);
+					m_cbfuncW(m_cbuserptr, stroutput);
 					break;
 				case TYPE_SYSLOG:
 #ifdef HAS_SYSLOG
@@ -429,166 +891,83 @@ namespace JsCPPUtils
 		}
 #endif
 	}
-
-#if defined(JSCUTILS_OS_WINDOWS)
-	void Logger::puts(LogType logtype, const wchar_t* text)
-	{
-		static wchar_t strmonths[][4] = { L"Jan", L"Feb", L"Mar", L"Apr", L"May", L"Jun", L"Jul", L"Aug", L"Sep", L"Oct", L"Nov", L"Dec" };
-
-		long buf2size = 1536;
-#ifdef JSLOGGER_USE_STACK
-		wchar_t pbuf2[1536];
-#else
-		wchar_t *pbuf2 = NULL;
 #endif
 
+	void Logger::printf(LogType logtype, const char* format, ...)
+	{
+		char stackbuf[JSLOGGER_LINEBUF_SIZE];
+		char *pbuf = stackbuf;
+		size_t headerlen = 0;
+		size_t avail;
+		size_t linelen;
+		int textlen;
 		va_list args;
 
-		time_t rawtime;
-		struct tm timeinfo;
+		if (!isEnabled(logtype))
+			return;
+		if ((m_pParent == NULL) && (m_outtype == TYPE_NULL))
+			return;
 
-		const wchar_t *strlogtype = NULL;
-		const wchar_t *stroutput = NULL;
+		// A child only formats the message; the root logger adds the header.
+		if (m_pParent == NULL)
+			headerlen = _formatHeader(stackbuf, logtype);
+		avail = sizeof(stackbuf) - headerlen - _JSLOGGER_EOL_LEN;
 
-		do {
-			time(&rawtime);
-#if defined(JSCUTILS_OS_WINDOWS)
-			localtime_s(&timeinfo, &rawtime);
-#elif defined(JSCUTILS_OS_LINUX)
-			localtime_r(&rawtime, &timeinfo);
-#endif
-
-			if (m_pParent != NULL)
-			{
-				m_pParent->_child_puts(logtype, m_strPrefixName, text);
-			}
-			else {
-				switch (logtype)
-				{
-				case LOGTYPE_EMERG:
-					strlogtype = L"EMERG";
-					break;
-				case LOGTYPE_ALERT:
-					strlogtype = L"ALERT";
-					break;
-				case LOGTYPE_CRIT:
-					strlogtype = L"CRIT";
-					break;
-				case LOGTYPE_ERR:
-					strlogtype = L"ERR";
-					break;
-				case LOGTYPE_WARNING:
-					strlogtype = L"WARN";
-					break;
-				case LOGTYPE_NOTICE:
-					strlogtype = L"NOTI";
-					break;
-				case LOGTYPE_INFO:
-					strlogtype = L"INFO";
-					break;
-				case LOGTYPE_DEBUG:
-					strlogtype = L"DEBUG";
-					break;
-				default:
-					strlogtype = L"UNDEFINED";
-					break;
-				}
-
-				switch (m_outtype)
-				{
-				case TYPE_STDOUT:
-				case TYPE_STDERR:
-				case TYPE_FILE:
-				case TYPE_CALLBACK:
-#ifndef JSLOGGER_USE_STACK
-					pbuf2 = (char*)malloc(buf1size);
-					if (pbuf2 == NULL)
-						break;
-#endif
-#ifdef JSCUTILS_OS_WINDOWS
-#ifdef _JSCUTILS_MSVC_CRT_SECURE
-					swprintf_s(pbuf2, buf2size, L"[%s] %s %02d %02d:%02d:%02d %d] %s\r\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
-#else
-					swprintf(pbuf2, L"[%s] %s %02d %02d:%02d:%02d %d] %s\r\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
-#endif
-#else
-#ifdef _JSCUTILS_MSVC_CRT_SECURE
-					swprintf_s(pbuf2, buf2size, L"[%s] %s %02d %02d:%02d:%02d %d] %s\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
-#else
-					swprintf(pbuf2, L"[%s] %s %02d %02d:%02d:%02d %d] %s\n", strlogtype, strmonths[timeinfo.tm_mon], timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, timeinfo.tm_year + 1900, text);
-#endif
-#endif
-					stroutput = pbuf2;
-					break;
-				case TYPE_SYSLOG:
-					stroutput = text;
-					break;
-				default:
-					stroutput = NULL;
-					break;
-				}
-
-				if (stroutput == NULL)
-					break;
+		va_start(args, format);
+		textlen = _jslogger_vsnprintf(stackbuf + headerlen, avail, format, args);
+		va_end(args);
+		if (textlen < 0)
+			return;
 
-				lock();
-				switch (m_outtype)
-				{
-				case TYPE_STDOUT:
-				case TYPE_STDERR:
-				case TYPE_FILE:
-					fputws(stroutput, m_fp);
-					fflush(m_fp);
-					break;
-				case TYPE_CALLBACK:
-					m_cbfuncW(m_cbuserptr, stroutput);
-					break;
-				case TYPE_SYSLOG:
-#ifdef HAS_SYSLOG
-					syslog(logtype, "%s", stroutput);
-#endif
-					break;
-				default:
-					break;
-				}
-				unlock();
-			}
-
-		} while (0);
+		if ((size_t)textlen >= avail)
+		{
+			// Rare: the message does not fit into the stack buffer.
+			pbuf = (char*)malloc(headerlen + textlen + _JSLOGGER_EOL_LEN + 1);
+			if (pbuf == NULL)
+				return;
+			memcpy(pbuf, stackbuf, headerlen);
+			va_start(args, format);
+			_jslogger_vsnprintf(pbuf + headerlen, textlen + 1, format, args);
+			va_end(args);
+		}
 
-#ifndef JSLOGGER_USE_STACK
-		if (pbuf2 != NULL)
+		if (m_pParent != NULL)
 		{
-			free(pbuf2);
-			pbuf2 = NULL;
+			m_pParent->_child_puts(logtype, this, pbuf);
+		} else {
+			linelen = headerlen + textlen + _JSLOGGER_EOL_LEN;
+			memcpy(pbuf + headerlen + textlen, _JSLOGGER_EOL, _JSLOGGER_EOL_LEN + 1);
+			_putLine(logtype, pbuf, linelen, pbuf + headerlen, textlen);
 		}
-#endif
+
+		if (pbuf != stackbuf)
+			free(pbuf);
 	}
-#endif
 
-	void Logger::printf(LogType logtype, const char* format, ...)
+#if defined(JSCUTILS_OS_WINDOWS)
+	void Logger::printf(LogType logtype, const wchar_t* format, ...)
 	{
 		long buf1size = 1536;
 #ifdef JSLOGGER_USE_STACK
-		char pbuf1[1536];
+		wchar_t pbuf1[1536];
 #else
-		char *pbuf1 = NULL;
+		wchar_t *pbuf1 = NULL;
 #endif
 
 		va_list args;
 
 		do {
 #ifndef JSLOGGER_USE_STACK
-			pbuf1 = (char*)malloc(buf1size);
+			pbuf1 = (wchar_t*)malloc(buf1size);
 			if (pbuf1 == NULL)
 				break;
 #endif
 
 			va_start(args, format);
 #ifdef _JSCUTILS_MSVC_CRT_SECURE
-			vsprintf_s(pbuf1, buf1size, format, args);
+			vswprintf_s(pbuf1, buf1size, format, args);
 #else
-			vsprintf(pbuf1, format, args);
+			vswprintf(pbuf1, format, args);
 #endif
 			va_end(args);
 
@@ -603,44 +982,706 @@ namespace JsCPPUtils
 		}
 #endif
 	}
+#endif
 
-#if defined(JSCUTILS_OS_WINDOWS)
-	void Logger::printf(LogType logtype, const wchar_t* format, ...)
+	int Logger::startAsync(size_t ringsize, int flushintervalms, AsyncOverflowPolicy policy)
 	{
-		long buf1size = 1536;
-#ifdef JSLOGGER_USE_STACK
-		wchar_t pbuf1[1536];
-#else
-		wchar_t *pbuf1 = NULL;
+		size_t capacity = 4096;
+
+		switch (m_outtype)
+		{
+		case TYPE_STDOUT:
+		case TYPE_STDERR:
+		case TYPE_FILE:
+			break;
+		default:
+			return -EINVAL;
+		}
+		if (m_fp == NULL)
+			return -EINVAL;
+
+		stopAsync();
+
+		while (capacity < ringsize)
+			capacity <<= 1;
+		m_asyncringsize = capacity;
+		m_asyncflushinterval = (flushintervalms > 0) ? flushintervalms : 1;
+		m_asyncpolicy = policy;
+		m_asyncdropped = 0;
+
+#if defined(JSCUTILS_OS_LINUX)
+		{
+			int rc = pthread_key_create(&m_asynckey, _asyncRingDestructor);
+			if (rc != 0)
+				return -rc;
+		}
+		pthread_mutex_init(&m_asyncwakemutex, NULL);
+		pthread_cond_init(&m_asyncwakecond, NULL);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		m_asynctlsidx = ::TlsAlloc();
+		if (m_asynctlsidx == TLS_OUT_OF_INDEXES)
+			return -((int)::GetLastError());
+		m_hasyncwakeevent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (m_hasyncwakeevent == NULL)
+		{
+			int err = (int)::GetLastError();
+			::TlsFree(m_asynctlsidx);
+			m_asynctlsidx = TLS_OUT_OF_INDEXES;
+			return -err;
+		}
 #endif
 
-		va_list args;
+		// Anything written through stdio before this point must not be overtaken by writev.
+		lock();
+		fflush(m_fp);
+		unlock();
+
+		m_asyncthread = new AsyncWriterThread();
+		m_asyncthread->logger = this;
+		m_asyncenabled = 1;
+		m_asyncthread->start(0, NULL, NULL, "LoggerAsync");
+
+		return 1;
+	}
+
+	void Logger::stopAsync()
+	{
+		AsyncRing *ring;
+
+		if (m_asyncthread.getPtr() == NULL)
+			return;
+
+		// New records go the synchronous way; wait for the ones already being pushed.
+		// A full barrier, like the increment in _asyncPush : the inflight load must not pass the store.
+		_JSLOGGER_EXCHANGE_INT(&m_asyncenabled, 0);
+		while (_JSLOGGER_LOAD_INT(&m_asyncinflight) > 0)
+			_JSLOGGER_ASYNC_BACKOFF();
+
+		m_asyncthread->reqStop();
+		_asyncWake();
+		m_asyncthread->join();
+		m_asyncthread = NULL;
+
+		m_asyncringslock.lock();
+		ring = m_asyncrings;
+		m_asyncrings = NULL;
+		m_asyncringslock.unlock();
+		while (ring != NULL)
+		{
+			AsyncRing *next = ring->next;
+			free(ring->buf);
+			delete ring;
+			ring = next;
+		}
+
+#if defined(JSCUTILS_OS_LINUX)
+		pthread_key_delete(m_asynckey);
+		pthread_cond_destroy(&m_asyncwakecond);
+		pthread_mutex_destroy(&m_asyncwakemutex);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		::TlsFree(m_asynctlsidx);
+		m_asynctlsidx = TLS_OUT_OF_INDEXES;
+		::CloseHandle(m_hasyncwakeevent);
+		m_hasyncwakeevent = NULL;
+#endif
+	}
+
+#if defined(JSCUTILS_OS_LINUX)
+	void Logger::forkPrepare()
+	{
+		m_coalescelock.lock();
+		m_asyncringslock.lock();
+		lock();
+		if (m_asyncthread.getPtr() != NULL)
+			pthread_mutex_lock(&m_asyncwakemutex);
+	}
+
+	void Logger::forkParent()
+	{
+		if (m_asyncthread.getPtr() != NULL)
+			pthread_mutex_unlock(&m_asyncwakemutex);
+		unlock();
+		m_asyncringslock.unlock();
+		m_coalescelock.unlock();
+	}
+
+	void Logger::forkChild()
+	{
+		AsyncRing *ring;
+
+		if (m_asyncthread.getPtr() != NULL)
+			pthread_mutex_unlock(&m_asyncwakemutex);
+		unlock();
+		m_asyncringslock.unlock();
+		m_coalescelock.unlock();
+
+		// Their objects are left alone : destroying one would join a thread that does not exist here.
+		if (m_compressthread.getPtr() != NULL)
+		{
+			m_compressthread.detach();
+			m_compressthread = new CompressThread();
+			m_compressthread->start(0, NULL, NULL, "LoggerCompress");
+		}
+		if (m_asyncthread.getPtr() == NULL)
+			return;
+		m_asyncthread.detach();
+		m_asyncthread = NULL;
+		m_asyncenabled = 0;
+		m_asyncinflight = 0;
+
+		// The parent writes these.
+		ring = m_asyncrings;
+		m_asyncrings = NULL;
+		while (ring != NULL)
+		{
+			AsyncRing *next = ring->next;
+			free(ring->buf);
+			delete ring;
+			ring = next;
+		}
+		pthread_key_delete(m_asynckey);
+
+		startAsync(m_asyncringsize, m_asyncflushinterval, m_asyncpolicy);
+	}
+#endif
+
+	void Logger::flush()
+	{
+		_flushRepeats();
+		if (m_asyncthread.getPtr() != NULL)
+			_asyncDrain();
+		if (m_fp != NULL)
+		{
+			lock();
+			fflush(m_fp);
+			unlock();
+		}
+	}
 
+#if defined(JSCUTILS_OS_LINUX)
+	void Logger::_asyncRingDestructor(void *ptr)
+	{
+		// The owning thread is exiting; the writer thread frees the ring once it is drained.
+		__atomic_store_n(&((AsyncRing*)ptr)->closed, 1, __ATOMIC_RELEASE);
+	}
+#endif
+
+	Logger::AsyncRing *Logger::_asyncGetRing(bool bCreate)
+	{
+		AsyncRing *ring;
+#if defined(JSCUTILS_OS_LINUX)
+		ring = (AsyncRing*)pthread_getspecific(m_asynckey);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		ring = (AsyncRing*)::TlsGetValue(m_asynctlsidx);
+#endif
+		if ((ring != NULL) || !bCreate)
+			return ring;
+
+		ring = new AsyncRing();
+		ring->buf = (char*)malloc(m_asyncringsize);
+		if (ring->buf == NULL)
+		{
+			delete ring;
+			return NULL;
+		}
+		ring->mask = m_asyncringsize - 1;
+		ring->head = 0;
+		ring->tail = 0;
+		ring->closed = 0;
+
+#if defined(JSCUTILS_OS_LINUX)
+		pthread_setspecific(m_asynckey, ring);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		::TlsSetValue(m_asynctlsidx, ring);
+#endif
+
+		m_asyncringslock.lock();
+		ring->next = m_asyncrings;
+		m_asyncrings = ring;
+		m_asyncringslock.unlock();
+
+		return ring;
+	}
+
+	bool Logger::_asyncPush(const char *data, size_t len)
+	{
+		bool bQueued = false;
+		AsyncRing *ring;
+		size_t capacity;
+		size_t head;
+		size_t tail;
+		size_t offset;
+		size_t firstlen;
+
+		_JSLOGGER_ATOMIC_INC(&m_asyncinflight);
 		do {
-#ifndef JSLOGGER_USE_STACK
-			pbuf1 = (wchar_t*)malloc(buf1size);
-			if (pbuf1 == NULL)
+			if (!_JSLOGGER_LOAD_INT(&m_asyncenabled))
+				break;
+			capacity = m_asyncringsize;
+			if (len > capacity)
+			{
+				// The caller writes it synchronously : the lines this thread queued before go out first.
+				ring = _asyncGetRing(false);
+				while ((ring != NULL) && (_asyncLoadAcquire(&ring->head) != ring->tail))
+					_asyncDrain();
+				break;
+			}
+			ring = _asyncGetRing();
+			if (ring == NULL)
+				break;
+
+			tail = ring->tail;
+			head = _asyncLoadAcquire(&ring->head);
+			while ((capacity - (tail - head)) < len)
+			{
+				if (m_asyncpolicy == ASYNC_OVERFLOW_DROP)
+				{
+					_JSLOGGER_ATOMIC_INC64(&m_asyncdropped);
+					bQueued = true;
+					break;
+				}
+				_asyncWake();
+				_JSLOGGER_ASYNC_BACKOFF();
+				head = _asyncLoadAcquire(&ring->head);
+			}
+			if (bQueued)
 				break;
+
+			offset = tail & ring->mask;
+			firstlen = capacity - offset;
+			if (firstlen >= len)
+			{
+				memcpy(ring->buf + offset, data, len);
+			} else {
+				memcpy(ring->buf + offset, data, firstlen);
+				memcpy(ring->buf, data + firstlen, len - firstlen);
+			}
+			_asyncStoreRelease(&ring->tail, tail + len);
+			bQueued = true;
+
+			// Wake the writer early when the ring crosses half full.
+			if (((tail - head) <= (capacity / 2)) && ((tail + len - head) > (capacity / 2)))
+				_asyncWake();
+		} while (0);
+		_JSLOGGER_ATOMIC_DEC(&m_asyncinflight);
+
+		return bQueued;
+	}
+
+	void Logger::_asyncWake()
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		pthread_mutex_lock(&m_asyncwakemutex);
+		pthread_cond_signal(&m_asyncwakecond);
+		pthread_mutex_unlock(&m_asyncwakemutex);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		::SetEvent(m_hasyncwakeevent);
 #endif
+	}
 
-			va_start(args, format);
-#ifdef _JSCUTILS_MSVC_CRT_SECURE
-			vswprintf_s(pbuf1, buf1size, format, args);
-#else
-			vswprintf(pbuf1, format, args);
+	void Logger::_asyncWait()
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += m_asyncflushinterval / 1000;
+		ts.tv_nsec += (long)(m_asyncflushinterval % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_mutex_lock(&m_asyncwakemutex);
+		pthread_cond_timedwait(&m_asyncwakecond, &m_asyncwakemutex, &ts);
+		pthread_mutex_unlock(&m_asyncwakemutex);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		::WaitForSingleObject(m_hasyncwakeevent, (DWORD)m_asyncflushinterval);
 #endif
-			va_end(args);
+	}
 
-			this->puts(logtype, pbuf1);
-		} while (0);
+	void Logger::_asyncDrain()
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		struct iovec iov[IOV_MAX];
+		int iovcnt = 0;
+#elif defined(JSCUTILS_OS_WINDOWS)
+		std::string strbatch;
+#endif
+		AsyncRing *ring;
+		AsyncRing **pprev;
+		size_t batchlen = 0;
 
-#ifndef JSLOGGER_USE_STACK
-		if (pbuf1 != NULL)
+		m_asyncringslock.lock();
+
+		for (ring = m_asyncrings; ring != NULL; ring = ring->next)
 		{
-			free(pbuf1);
-			pbuf1 = NULL;
+			size_t head = ring->head;
+			size_t tail = _asyncLoadAcquire(&ring->tail);
+			size_t offset = head & ring->mask;
+			size_t len = tail - head;
+			size_t firstlen = ring->mask + 1 - offset;
+			ring->drainto = head;
+			if (len == 0)
+				continue;
+			if (firstlen > len)
+				firstlen = len;
+#if defined(JSCUTILS_OS_LINUX)
+			// Rings that do not fit into this batch are picked up by the next one.
+			if (iovcnt + 2 > IOV_MAX)
+				continue;
+			iov[iovcnt].iov_base = ring->buf + offset;
+			iov[iovcnt].iov_len = firstlen;
+			iovcnt++;
+			if (len > firstlen)
+			{
+				iov[iovcnt].iov_base = ring->buf;
+				iov[iovcnt].iov_len = len - firstlen;
+				iovcnt++;
+			}
+#elif defined(JSCUTILS_OS_WINDOWS)
+			strbatch.append(ring->buf + offset, firstlen);
+			if (len > firstlen)
+				strbatch.append(ring->buf, len - firstlen);
+#endif
+			ring->drainto = tail;
+			batchlen += len;
+		}
+
+		lock();
+		if (m_outtype == TYPE_FILE)
+		{
+			_checkRotate(batchlen);
+			m_filesize += batchlen;
+		}
+#if defined(JSCUTILS_OS_LINUX)
+		if (m_fp != NULL)
+		{
+			int fd = fileno(m_fp);
+			struct iovec *piov = iov;
+			int remaining = iovcnt;
+			while (remaining > 0)
+			{
+				ssize_t written = ::writev(fd, piov, remaining);
+				if (written < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					m_lasterrno = errno;
+					break;
+				}
+				while ((remaining > 0) && ((size_t)written >= piov->iov_len))
+				{
+					written -= piov->iov_len;
+					piov++;
+					remaining--;
+				}
+				if (remaining > 0)
+				{
+					piov->iov_base = (char*)piov->iov_base + written;
+					piov->iov_len -= written;
+				}
+			}
+		}
+#elif defined(JSCUTILS_OS_WINDOWS)
+		if (!strbatch.empty() && (m_fp != NULL))
+		{
+			fputws(StringEncoding::StringToUnicode(strbatch).c_str(), m_fp);
+			fflush(m_fp);
 		}
 #endif
+		unlock();
+
+		// Hand the written space back to the producers, then free rings whose thread has exited.
+		pprev = &m_asyncrings;
+		while ((ring = *pprev) != NULL)
+		{
+			_asyncStoreRelease(&ring->head, ring->drainto);
+			if (_JSLOGGER_LOAD_INT(&ring->closed) && (_asyncLoadAcquire(&ring->tail) == ring->drainto))
+			{
+				*pprev = ring->next;
+				free(ring->buf);
+				delete ring;
+				continue;
+			}
+			pprev = &ring->next;
+		}
+
+		m_asyncringslock.unlock();
 	}
+
+	static bool _fileExists(const std::string& strPath)
+	{
+		FILE *fp = fopen(strPath.c_str(), "rb");
+		if (fp == NULL)
+			return false;
+		fclose(fp);
+		return true;
+	}
+
+	int Logger::setRotation(int64_t maxbytes, int intervalsec, bool bCompress)
+	{
+		if ((m_outtype != TYPE_FILE) || m_strFilePath.empty())
+			return -EINVAL;
+		lock();
+		m_rotatemaxbytes = maxbytes;
+		m_rotateinterval = intervalsec;
+		m_rotatecompress = bCompress;
+		if (intervalsec > 0)
+			m_nextrotatetime = (time(NULL) / intervalsec + 1) * intervalsec;
+		unlock();
+		if (bCompress && (m_compressthread.getPtr() == NULL))
+		{
+			m_compressthread = new CompressThread();
+			m_compressthread->start(0, NULL, NULL, "LoggerCompress");
+		}
+		return 1;
+	}
+
+	int Logger::rotate()
+	{
+		int retval;
+		if ((m_outtype != TYPE_FILE) || m_strFilePath.empty())
+			return -EINVAL;
+		lock();
+		retval = _rotate();
+		unlock();
+		return retval;
+	}
+
+	/*
+	 * Called with the logger lock held, before nextlen bytes are written.
+	 */
+	void Logger::_checkRotate(size_t nextlen)
+	{
+		if (m_reopenreq)
+		{
+			m_reopenreq = 0;
+			if (m_fp != NULL)
+			{
+				fclose(m_fp);
+				m_fp = NULL;
+			}
+			_openFile();
+		}
+		if ((m_rotatemaxbytes > 0) && (m_filesize > 0) && ((m_filesize + (int64_t)nextlen) > m_rotatemaxbytes))
+		{
+			_rotate();
+		} else if ((m_rotateinterval > 0) && (time(NULL) >= m_nextrotatetime)) {
+			if (m_filesize > 0)
+				_rotate();
+			else
+				m_nextrotatetime = (time(NULL) / m_rotateinterval + 1) * m_rotateinterval;
+		}
+	}
+
+	int Logger::_rotate()
+	{
+		char szStamp[32];
+		char szSuffix[48];
+		std::string strRotated;
+		time_t rawtime = time(NULL);
+		struct tm timeinfo;
+		int retval;
+		int n;
+
+#if defined(JSCUTILS_OS_WINDOWS)
+		localtime_s(&timeinfo, &rawtime);
+#elif defined(JSCUTILS_OS_LINUX)
+		localtime_r(&rawtime, &timeinfo);
+#endif
+		strftime(szStamp, sizeof(szStamp), ".%Y%m%d-%H%M%S", &timeinfo);
+		strRotated = m_strFilePath + szStamp;
+		// More than one rotation in the same second gets a sequence number.
+		for (n = 1; (n < 1000) && (_fileExists(strRotated) || _fileExists(strRotated + ".gz")); n++)
+		{
+			snprintf(szSuffix, sizeof(szSuffix), "%s.%d", szStamp, n);
+			strRotated = m_strFilePath + szSuffix;
+		}
+
+		if (m_fp != NULL)
+		{
+			fclose(m_fp);
+			m_fp = NULL;
+		}
+		retval = (rename(m_strFilePath.c_str(), strRotated.c_str()) == 0) ? 1 : -errno;
+		if (m_rotateinterval > 0)
+			m_nextrotatetime = (rawtime / m_rotateinterval + 1) * m_rotateinterval;
+		if (_openFile() != 1)
+			return -m_lasterrno;
+
+		if ((retval == 1) && m_rotatecompress && (m_compressthread.getPtr() != NULL))
+			m_compressthread->push(strRotated);
+
+		return retval;
+	}
+
+	LogRateLimiter::LogRateLimiter(double ratepersec, int burst)
+	{
+		if (ratepersec <= 0)
+			ratepersec = 1;
+		if (burst < 1)
+			burst = 1;
+		m_interval = (int64_t)(1000000000.0 / ratepersec);
+		if (m_interval < 1)
+			m_interval = 1;
+		m_tolerance = m_interval * burst;
+		m_tat = 0;
+		m_suppressed = 0;
+		m_pending = 0;
+	}
+
+	int64_t LogRateLimiter::now()
+	{
+#if defined(JSCUTILS_OS_WINDOWS)
+		static LARGE_INTEGER freq = { 0 };
+		LARGE_INTEGER counter;
+		if (freq.QuadPart == 0)
+			::QueryPerformanceFrequency(&freq);
+		::QueryPerformanceCounter(&counter);
+		return (int64_t)((double)counter.QuadPart * 1000000000.0 / (double)freq.QuadPart);
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((int64_t)ts.tv_sec) * 1000000000LL + ts.tv_nsec;
 #endif
+	}
+
+	bool LogRateLimiter::allow()
+	{
+		int64_t tnow = now();
+		for (;;)
+		{
+			int64_t tat = m_tat;
+			int64_t newtat = ((tat > tnow) ? tat : tnow) + m_interval;
+			if ((newtat - tnow) > m_tolerance)
+			{
+				_JSLOGGER_ATOMIC_INC64(&m_suppressed);
+				_JSLOGGER_ATOMIC_INC64(&m_pending);
+				return false;
+			}
+#if defined(JSCUTILS_OS_WINDOWS)
+			if (::InterlockedCompareExchange64((volatile LONGLONG*)&m_tat, newtat, tat) == tat)
+				return true;
+#else
+			if (__sync_bool_compare_and_swap(&m_tat, tat, newtat))
+				return true;
+#endif
+		}
+	}
+
+	int64_t LogRateLimiter::takePending()
+	{
+		if (m_pending == 0)
+			return 0;
+#if defined(JSCUTILS_OS_WINDOWS)
+		return ::InterlockedExchange64((volatile LONGLONG*)&m_pending, 0);
+#else
+		return __atomic_exchange_n(&m_pending, 0, __ATOMIC_ACQ_REL);
+#endif
+	}
+
+	int64_t Logger::getSuppressedCount() const
+	{
+		const Logger *plogger = this;
+		while (plogger->m_pParent != NULL)
+			plogger = plogger->m_pParent;
+		return plogger->m_suppressedcount;
+	}
+
+	void Logger::addSuppressed(int64_t count)
+	{
+		Logger *plogger = this;
+		while (plogger->m_pParent != NULL)
+			plogger = plogger->m_pParent;
+#if defined(JSCUTILS_OS_WINDOWS)
+		::InterlockedExchangeAdd64((volatile LONGLONG*)&plogger->m_suppressedcount, count);
+#else
+		__sync_add_and_fetch(&plogger->m_suppressedcount, count);
+#endif
+	}
+
+	void Logger::setCoalesceRepeats(bool bEnable, int intervalsec)
+	{
+		if (!bEnable)
+			_flushRepeats();
+		m_coalescelock.lock();
+		m_coalesceinterval = (intervalsec > 0) ? intervalsec : 30;
+		m_coalesce = bEnable;
+		m_strLastMsg.clear();
+		m_repeatcount = 0;
+		m_coalescelock.unlock();
+	}
+
+	/*
+	 * Returns false when the record repeats the previous one and must not be written.
+	 * Fills pnotice with a "last message repeated" line when one is due.
+	 */
+	bool Logger::_coalesce(LogType logtype, const char *text, size_t textlen, char *pnotice, size_t *pnoticelen, size_t *pnoticehdrlen)
+	{
+		bool bWrite = true;
+		time_t now = time(NULL);
+		int64_t repeats = 0;
+		LogType lastlogtype;
+
+		m_coalescelock.lock();
+		lastlogtype = m_lastlogtype;
+		if ((logtype == m_lastlogtype) && (textlen == m_strLastMsg.length()) && (memcmp(text, m_strLastMsg.data(), textlen) == 0))
+		{
+			m_repeatcount++;
+			bWrite = false;
+			if ((now - m_lastnoticetime) >= m_coalesceinterval)
+			{
+				repeats = m_repeatcount;
+				m_repeatcount = 0;
+				m_lastnoticetime = now;
+			}
+		} else {
+			repeats = m_repeatcount;
+			m_repeatcount = 0;
+			m_strLastMsg.assign(text, textlen);
+			m_lastlogtype = logtype;
+			m_lastnoticetime = now;
+		}
+		m_coalescelock.unlock();
+
+		if (!bWrite)
+			addSuppressed(1);
+
+		*pnoticelen = 0;
+		if (repeats > 0)
+		{
+			size_t hdrlen = _formatHeader(pnotice, lastlogtype);
+			int n = snprintf(pnotice + hdrlen, 128 - hdrlen, "last message repeated %lld times" _JSLOGGER_EOL, (long long)repeats);
+			if ((n > 0) && ((size_t)n < 128 - hdrlen))
+			{
+				*pnoticehdrlen = hdrlen;
+				*pnoticelen = hdrlen + n;
+			}
+		}
+		return bWrite;
+	}
+
+	void Logger::_flushRepeats()
+	{
+		char szNotice[128];
+		size_t hdrlen;
+		int64_t repeats;
+		LogType lastlogtype;
+		int n;
+
+		if (!m_coalesce)
+			return;
+		m_coalescelock.lock();
+		repeats = m_repeatcount;
+		lastlogtype = m_lastlogtype;
+		m_repeatcount = 0;
+		m_coalescelock.unlock();
+		if (repeats <= 0)
+			return;
+
+		hdrlen = _formatHeader(szNotice, lastlogtype);
+		n = snprintf(szNotice + hdrlen, sizeof(szNotice) - hdrlen, "last message repeated %lld times" _JSLOGGER_EOL, (long long)repeats);
+		if ((n > 0) && ((size_t)n < sizeof(szNotice) - hdrlen))
+			_emitLine(lastlogtype, szNotice, hdrlen + n, szNotice + hdrlen, n - _JSLOGGER_EOL_LEN);
+	}
 }
@@ -17,6 +17,7 @@
 
 #include <string>
 #include <stdio.h>
+#include <time.h>
 
 #include "Common.h"
 #include "Lockable.h"
@@ -24,8 +25,112 @@
 
 #define JSLOGGER_USE_STACK
 
+/* Stack buffer for one formatted line; longer lines fall back to the heap. */
+#ifndef JSLOGGER_LINEBUF_SIZE
+#define JSLOGGER_LINEBUF_SIZE 4096
+#endif
+
+/*
+ * Compile-time level threshold (0 = EMERG ... 7 = DEBUG).
+ * JSLOG_xxx calls above it expand to nothing, so their arguments are never evaluated.
+ */
+#ifndef JSLOGGER_COMPILE_LEVEL
+#define JSLOGGER_COMPILE_LEVEL 7
+#endif
+
+#define JSLOGGER_LOG(plogger, logtype, ...) do { \
+		if ((plogger)->isEnabled(logtype)) \
+			(plogger)->printf(logtype, __VA_ARGS__); \
+	} while (0)
+#define _JSLOGGER_NOLOG() do { } while (0)
+
+/*
+ * Per call site token bucket: at most burst lines at once and ratepersec lines per second after that.
+ * The first line let through after a suppressed run reports how many were dropped.
+ */
+#define JSLOG_RATELIMITED(plogger, logtype, ratepersec, burst, ...) do { \
+		if ((plogger)->isEnabled(logtype)) { \
+			static JsCPPUtils::LogRateLimiter _jslog_ratelimiter(ratepersec, burst); \
+			if (_jslog_ratelimiter.allow()) { \
+				int64_t _jslog_suppressed = _jslog_ratelimiter.takePending(); \
+				if (_jslog_suppressed > 0) \
+					(plogger)->printf(logtype, "(%lld similar messages suppressed by rate limit)", (long long)_jslog_suppressed); \
+				(plogger)->printf(logtype, __VA_ARGS__); \
+			} else { \
+				(plogger)->addSuppressed(1); \
+			} \
+		} \
+	} while (0)
+
+#if JSLOGGER_COMPILE_LEVEL >= 0
+#define JSLOG_EMERG(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_EMERG, __VA_ARGS__)
+#else
+#define JSLOG_EMERG(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 1
+#define JSLOG_ALERT(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_ALERT, __VA_ARGS__)
+#else
+#define JSLOG_ALERT(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 2
+#define JSLOG_CRIT(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_CRIT, __VA_ARGS__)
+#else
+#define JSLOG_CRIT(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 3
+#define JSLOG_ERR(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_ERR, __VA_ARGS__)
+#else
+#define JSLOG_ERR(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 4
+#define JSLOG_WARNING(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_WARNING, __VA_ARGS__)
+#else
+#define JSLOG_WARNING(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 5
+#define JSLOG_NOTICE(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_NOTICE, __VA_ARGS__)
+#else
+#define JSLOG_NOTICE(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 6
+#define JSLOG_INFO(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_INFO, __VA_ARGS__)
+#else
+#define JSLOG_INFO(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+#if JSLOGGER_COMPILE_LEVEL >= 7
+#define JSLOG_DEBUG(plogger, ...) JSLOGGER_LOG(plogger, JsCPPUtils::Logger::LOGTYPE_DEBUG, __VA_ARGS__)
+#else
+#define JSLOG_DEBUG(plogger, ...) _JSLOGGER_NOLOG()
+#endif
+
 namespace JsCPPUtils
 {
+	/**
+	 * Lock-free token bucket (GCRA: a single theoretical-arrival-time updated by CAS).
+	 */
+	class LogRateLimiter
+	{
+	private:
+		int64_t m_interval;
+		int64_t m_tolerance;
+		volatile int64_t m_tat;
+		volatile int64_t m_suppressed;
+		volatile int64_t m_pending;
+
+	public:
+		LogRateLimiter(double ratepersec, int burst = 1);
+		bool allow();
+		/**
+		 * Returns the number of records suppressed since the last call and resets it.
+		 */
+		int64_t takePending();
+		int64_t getSuppressed() const {
+			return m_suppressed;
+		}
+		/* monotonic nanoseconds */
+		static int64_t now();
+	};
+
 	class Logger : public Lockable
 	{
 	public:
@@ -49,10 +154,24 @@ namespace JsCPPUtils
 			LOGTYPE_DEBUG = 7
 		};
 
+		/**
+		 * What a caller does when its async ring buffer is full.
+		 * ASYNC_OVERFLOW_BLOCK : wait for the writer thread to drain.
+		 * ASYNC_OVERFLOW_DROP : discard the record and count it (getAsyncDropped).
+		 */
+		enum AsyncOverflowPolicy {
+			ASYNC_OVERFLOW_BLOCK = 0,
+			ASYNC_OVERFLOW_DROP
+		};
+
 		typedef void(*CallbackFuncA_t)(void *userptr, const char *stroutput);
 		typedef void(*CallbackFuncW_t)(void *userptr, const wchar_t *stroutput);
 
 	private:
+		class AsyncWriterThread;
+		struct AsyncRing;
+		class CompressThread;
+
 		Logger *m_pParent;
 		JsCPPUtils::SmartPointer<Logger> m_spParent;
 		std::string m_strPrefixName;
@@ -66,9 +185,68 @@ namespace JsCPPUtils
 
 		int m_lasterrno;
 
+		/* -1 : inherit from the parent (a root logger then logs every level) */
+		volatile int m_minlevel;
+
+		std::string m_strFilePath;
+		int64_t m_filesize;
+		int64_t m_rotatemaxbytes;
+		int m_rotateinterval;
+		time_t m_nextrotatetime;
+		bool m_rotatecompress;
+		volatile int m_reopenreq;
+		JsCPPUtils::SmartPointer<CompressThread> m_compressthread;
+
+		volatile int64_t m_suppressedcount;
+		bool m_coalesce;
+		int m_coalesceinterval;
+		Lockable m_coalescelock;
+		std::string m_strLastMsg;
+		LogType m_lastlogtype;
+		int64_t m_repeatcount;
+		time_t m_lastnoticetime;
+
+		volatile int m_asyncenabled;
+		volatile int m_asyncinflight;
+		size_t m_asyncringsize;
+		int m_asyncflushinterval;
+		AsyncOverflowPolicy m_asyncpolicy;
+		volatile int64_t m_asyncdropped;
+		AsyncRing *m_asyncrings;
+		Lockable m_asyncringslock;
+		JsCPPUtils::SmartPointer<AsyncWriterThread> m_asyncthread;
+#if defined(JSCUTILS_OS_LINUX)
+		pthread_key_t m_asynckey;
+		pthread_mutex_t m_asyncwakemutex;
+		pthread_cond_t m_asyncwakecond;
+		static void _asyncRingDestructor(void *ptr);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		DWORD m_asynctlsidx;
+		HANDLE m_hasyncwakeevent;
+#endif
+
 		void _clearInstance();
 
-		void _child_puts(LogType logtype, const std::string& strPrefixName, const char* szLog);
+		static size_t _formatHeader(char *buf, LogType logtype);
+		void _putLine(LogType logtype, const char *line, size_t linelen, const char *text, size_t textlen);
+		void _emitLine(LogType logtype, const char *line, size_t linelen, const char *text, size_t textlen);
+		bool _coalesce(LogType logtype, const char *text, size_t textlen, char *pnotice, size_t *pnoticelen, size_t *pnoticehdrlen);
+		void _flushRepeats();
+		void _puts(LogType logtype, const char* text, const Logger *pchild = NULL);
+		static size_t _prefixLen(const Logger *pchild);
+		static char *_writePrefix(char *p, const Logger *pchild);
+
+		int _openFile();
+		void _checkRotate(size_t nextlen);
+		int _rotate();
+
+		AsyncRing *_asyncGetRing(bool bCreate = true);
+		bool _asyncPush(const char *data, size_t len);
+		void _asyncDrain();
+		void _asyncWake();
+		void _asyncWait();
+
+		void _child_puts(LogType logtype, const Logger *pchild, const char* szLog);
 		void _child_puts(LogType logtype, const std::string& strPrefixName, const wchar_t* szLog);
 
 	public:
@@ -88,6 +266,27 @@ namespace JsCPPUtils
 		int getErrno() {
 			return m_lasterrno;
 		};
+
+		/**
+		 * Runtime level threshold. Records less severe than level are dropped before any formatting.
+		 * A child logger inherits its parent's threshold until setLevel is called on it,
+		 * and goes back to inheriting after inheritLevel().
+		 */
+		void setLevel(LogType level) {
+			m_minlevel = (int)level;
+		}
+		void inheritLevel() {
+			m_minlevel = -1;
+		}
+		LogType getLevel() const {
+			const Logger *plogger = this;
+			while ((plogger->m_minlevel < 0) && (plogger->m_pParent != NULL))
+				plogger = plogger->m_pParent;
+			return (plogger->m_minlevel < 0) ? LOGTYPE_DEBUG : (LogType)plogger->m_minlevel;
+		}
+		bool isEnabled(LogType logtype) const {
+			return (int)logtype <= (int)getLevel();
+		}
 		void setParent(Logger *pParent);
 		void setParent(const JsCPPUtils::SmartPointer<Logger> &spParent);
 		void printf(LogType logtype, const char* format, ...);
@@ -96,6 +295,74 @@ namespace JsCPPUtils
 		void printf(LogType logtype, const wchar_t* format, ...);
 		void puts(LogType logtype, const wchar_t* text);
 #endif
+
+		/**
+		 * Asynchronous mode (TYPE_STDOUT, TYPE_STDERR, TYPE_FILE only).
+		 * Each logging thread gets its own lock-free ring of ringsize bytes; a background
+		 * writer thread drains all rings every flushintervalms (or sooner when a ring is
+		 * half full) and writes each batch with a single writev.
+		 * Records longer than a ring, and wide-character records, are still written synchronously.
+		 * stopAsync() drains everything that was queued. It must not race with threads that are exiting.
+		 * @return 1 on success, -EINVAL for unsupported output types, other negative errno on failure
+		 */
+		int startAsync(size_t ringsize = 65536, int flushintervalms = 100, AsyncOverflowPolicy policy = ASYNC_OVERFLOW_BLOCK);
+		void stopAsync();
+		bool isAsync() {
+			return m_asyncenabled != 0;
+		}
+		/**
+		 * Write out everything queued so far (async mode) and fflush the output.
+		 */
+		void flush();
+		int64_t getAsyncDropped() {
+			return m_asyncdropped;
+		}
+#if defined(JSCUTILS_OS_LINUX)
+		/**
+		 * Around a fork() of a process that logs from other threads (Daemon::setWorkers() does this) :
+		 * forkPrepare() holds the logger's locks so no other thread is inside, forkParent() and forkChild()
+		 * release them. The writer and compress threads do not come along, so the child starts them again
+		 * with the same settings; records queued before the fork are left to the parent.
+		 */
+		void forkPrepare();
+		void forkParent();
+		void forkChild();
+#endif
+
+		/**
+		 * Built-in rotation (TYPE_FILE opened with a char path only).
+		 * The file is renamed to "<path>.YYYYmmdd-HHMMSS" and reopened when the next line would
+		 * grow it past maxbytes (0 : no size limit) or when a multiple of intervalsec since the
+		 * epoch is crossed (0 : no time limit, 86400 : daily at UTC midnight).
+		 * With bCompress the renamed segment is gzip'ed on a background thread
+		 * (zlib when HAS_ZLIB is defined, otherwise the gzip command on Linux).
+		 * @return 1 on success, -EINVAL if this logger does not write to a file
+		 */
+		int setRotation(int64_t maxbytes, int intervalsec = 0, bool bCompress = false);
+		/**
+		 * Rotate right now.
+		 */
+		int rotate();
+		/**
+		 * Close and reopen the file at the same path before the next write
+		 * (e.g. after logrotate has moved it). Only sets a flag, so it is async-signal-safe;
+		 * Daemon calls it on SIGHUP for its own logger.
+		 */
+		void requestReopen() {
+			m_reopenreq = 1;
+		}
+
+		/**
+		 * Collapse consecutive identical records into one line followed by
+		 * "last message repeated N times", written when a different record arrives,
+		 * on flush()/close(), or every intervalsec while the repetition goes on.
+		 */
+		void setCoalesceRepeats(bool bEnable, int intervalsec = 30);
+		/**
+		 * Records dropped by JSLOG_RATELIMITED or by coalescing, counted on the root logger.
+		 */
+		int64_t getSuppressedCount() const;
+		void addSuppressed(int64_t count);
 	};
 
 }
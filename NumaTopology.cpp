@@ -0,0 +1,293 @@
+/**
+ * @file	NumaTopology.cpp
+ * @class	NumaTopology
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/12
+ * @brief	CPU / NUMA node layout and node-local memory allocation
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "NumaTopology.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define NUMATOPOLOGY_MPOL_BIND 2
+
+namespace JsCPPUtils
+{
+	NumaTopology::NumaTopology()
+	{
+	}
+
+	NumaTopology::~NumaTopology()
+	{
+	}
+
+	int NumaTopology::parseCpuList(const char *szList, std::vector<int>& out)
+	{
+		const char *p = szList;
+		while (*p)
+		{
+			char *pend;
+			long first, last;
+			while ((*p == ',') || (*p == ' ') || (*p == '\n'))
+				p++;
+			if (!*p)
+				break;
+			first = strtol(p, &pend, 10);
+			if (pend == p)
+				return -1;
+			last = first;
+			p = pend;
+			if (*p == '-')
+			{
+				p++;
+				last = strtol(p, &pend, 10);
+				if (pend == p)
+					return -1;
+				p = pend;
+			}
+			for (long i = first; i <= last; i++)
+				out.push_back((int)i);
+		}
+		return (int)out.size();
+	}
+
+#if defined(JSCUTILS_OS_LINUX)
+	static int _readSysFile(const char *szPath, char *buf, size_t bufsize)
+	{
+		FILE *fp = fopen(szPath, "rt");
+		size_t len;
+		if (fp == NULL)
+			return -errno;
+		len = fread(buf, 1, bufsize - 1, fp);
+		buf[len] = 0;
+		fclose(fp);
+		return (int)len;
+	}
+#endif
+
+	int NumaTopology::load()
+	{
+		m_nodecpus.clear();
+		m_cpunode.clear();
+		m_corecpus.clear();
+
+#if defined(JSCUTILS_OS_LINUX)
+		char pathbuf[128];
+		char strbuf[4096];
+		DIR *dir = opendir("/sys/devices/system/node");
+		if (dir != NULL)
+		{
+			struct dirent *ent;
+			while ((ent = readdir(dir)) != NULL)
+			{
+				int node;
+				std::vector<int> cpus;
+				if (sscanf(ent->d_name, "node%d", &node) != 1)
+					continue;
+				snprintf(pathbuf, sizeof(pathbuf), "/sys/devices/system/node/node%d/cpulist", node);
+				if (_readSysFile(pathbuf, strbuf, sizeof(strbuf)) <= 0)
+					continue;
+				if (parseCpuList(strbuf, cpus) <= 0)
+					continue;
+				if ((int)m_nodecpus.size() <= node)
+					m_nodecpus.resize(node + 1);
+				m_nodecpus[node] = cpus;
+			}
+			closedir(dir);
+		}
+		if (m_nodecpus.empty())
+		{
+			long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+			m_nodecpus.resize(1);
+			for (long i = 0; i < ncpus; i++)
+				m_nodecpus[0].push_back((int)i);
+		}
+
+		for (size_t node = 0; node < m_nodecpus.size(); node++)
+		{
+			for (std::vector<int>::const_iterator iter = m_nodecpus[node].begin(); iter != m_nodecpus[node].end(); iter++)
+			{
+				std::vector<int> siblings;
+				if ((int)m_cpunode.size() <= *iter)
+					m_cpunode.resize(*iter + 1, -1);
+				m_cpunode[*iter] = (int)node;
+
+				snprintf(pathbuf, sizeof(pathbuf), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", *iter);
+				if ((_readSysFile(pathbuf, strbuf, sizeof(strbuf)) > 0) && (parseCpuList(strbuf, siblings) > 0))
+				{
+					if (siblings[0] != *iter)
+						continue; // not the first hardware thread of its core
+				}
+				m_corecpus.push_back(*iter);
+			}
+		}
+#elif defined(JSCUTILS_OS_WINDOWS)
+		ULONG highestnode = 0;
+		std::vector<ULONG_PTR> coremasks;
+		DWORD dwLen = 0;
+
+		if (!::GetNumaHighestNodeNumber(&highestnode))
+			highestnode = 0;
+		m_nodecpus.resize(highestnode + 1);
+		for (ULONG node = 0; node <= highestnode; node++)
+		{
+			ULONGLONG mask = 0;
+			if (!::GetNumaNodeProcessorMask((UCHAR)node, &mask))
+				continue;
+			for (int cpu = 0; cpu < 64; cpu++)
+			{
+				if (mask & (((ULONGLONG)1) << cpu))
+				{
+					m_nodecpus[node].push_back(cpu);
+					if ((int)m_cpunode.size() <= cpu)
+						m_cpunode.resize(cpu + 1, -1);
+					m_cpunode[cpu] = (int)node;
+				}
+			}
+		}
+
+		::GetLogicalProcessorInformation(NULL, &dwLen);
+		if (dwLen > 0)
+		{
+			std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(dwLen / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+			if (::GetLogicalProcessorInformation(&infos[0], &dwLen))
+			{
+				for (size_t i = 0; i < dwLen / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); i++)
+				{
+					if (infos[i].Relationship == RelationProcessorCore)
+						coremasks.push_back(infos[i].ProcessorMask);
+				}
+			}
+		}
+		for (size_t node = 0; node < m_nodecpus.size(); node++)
+		{
+			for (std::vector<int>::const_iterator iter = m_nodecpus[node].begin(); iter != m_nodecpus[node].end(); iter++)
+			{
+				bool bFirst = true;
+				for (std::vector<ULONG_PTR>::const_iterator citer = coremasks.begin(); citer != coremasks.end(); citer++)
+				{
+					ULONG_PTR cpubit = ((ULONG_PTR)1) << (*iter);
+					if ((*citer) & cpubit)
+					{
+						bFirst = ((*citer) & (cpubit - 1)) == 0;
+						break;
+					}
+				}
+				if (bFirst)
+					m_corecpus.push_back(*iter);
+			}
+		}
+#endif
+
+		return (int)m_nodecpus.size();
+	}
+
+	int NumaTopology::getNodeCount() const
+	{
+		return (int)m_nodecpus.size();
+	}
+
+	int NumaTopology::getCpuCount() const
+	{
+		int count = 0;
+		for (size_t node = 0; node < m_nodecpus.size(); node++)
+			count += (int)m_nodecpus[node].size();
+		return count;
+	}
+
+	const std::vector<int>& NumaTopology::getNodeCpus(int node) const
+	{
+		static const std::vector<int> emptylist;
+		if ((node < 0) || (node >= (int)m_nodecpus.size()))
+			return emptylist;
+		return m_nodecpus[node];
+	}
+
+	int NumaTopology::getNodeOfCpu(int cpu) const
+	{
+		if ((cpu < 0) || (cpu >= (int)m_cpunode.size()))
+			return -1;
+		return m_cpunode[cpu];
+	}
+
+	void NumaTopology::layoutOnePerCore(std::vector<CpuSlot>& slots, int nodecount) const
+	{
+		slots.clear();
+		for (std::vector<int>::const_iterator iter = m_corecpus.begin(); iter != m_corecpus.end(); iter++)
+		{
+			CpuSlot slot;
+			slot.cpu = *iter;
+			slot.node = getNodeOfCpu(*iter);
+			if ((nodecount > 0) && (slot.node >= nodecount))
+				continue;
+			slots.push_back(slot);
+		}
+	}
+
+	int NumaTopology::placeThreads(const std::vector< JsCPPUtils::SmartPointer<Thread> >& threads) const
+	{
+		std::vector<CpuSlot> slots;
+		int count = 0;
+
+		layoutOnePerCore(slots);
+		if (slots.empty())
+			return 0;
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			const CpuSlot& slot = slots[i % slots.size()];
+			threads[i]->setAffinity(slot.cpu);
+			threads[i]->setNumaNode(slot.node);
+			count++;
+		}
+
+		return count;
+	}
+
+	void *NumaTopology::allocOnNode(size_t size, int node)
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		void *ptr = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+		if ((node >= 0) && (node < 1024))
+		{
+			unsigned long nodemask[1024 / (8 * sizeof(unsigned long))];
+			memset(nodemask, 0, sizeof(nodemask));
+			nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+			// Without NUMA support in the kernel the pages are left to first-touch placement.
+			::syscall(SYS_mbind, ptr, size, NUMATOPOLOGY_MPOL_BIND, nodemask, sizeof(nodemask) * 8, 0);
+		}
+		return ptr;
+#elif defined(JSCUTILS_OS_WINDOWS)
+		if (node < 0)
+			return ::VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		return ::VirtualAllocExNuma(::GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+#endif
+	}
+
+	void NumaTopology::freeOnNode(void *ptr, size_t size)
+	{
+		if (ptr == NULL)
+			return;
+#if defined(JSCUTILS_OS_LINUX)
+		::munmap(ptr, size);
+#elif defined(JSCUTILS_OS_WINDOWS)
+		::VirtualFree(ptr, 0, MEM_RELEASE);
+#endif
+	}
+}
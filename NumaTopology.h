@@ -0,0 +1,79 @@
+/**
+ * @file	NumaTopology.h
+ * @class	NumaTopology
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/12
+ * @brief	CPU / NUMA node layout and node-local memory allocation
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_NUMATOPOLOGY_H__
+#define __JSCPPUTILS_NUMATOPOLOGY_H__
+
+#include "Common.h"
+#include "SmartPointer.h"
+#include "Thread.h"
+
+#include <vector>
+
+namespace JsCPPUtils
+{
+	class NumaTopology
+	{
+	public:
+		struct CpuSlot {
+			int node;
+			int cpu;
+		};
+
+	private:
+		std::vector< std::vector<int> > m_nodecpus;
+		std::vector<int> m_cpunode;
+		std::vector<int> m_corecpus;
+
+		static int parseCpuList(const char *szList, std::vector<int>& out);
+
+	public:
+		NumaTopology();
+		~NumaTopology();
+
+		/**
+		 * Reads the topology of the running system.
+		 * If the system has no NUMA information, all online CPUs are put on node 0.
+		 */
+		int load();
+
+		int getNodeCount() const;
+		int getCpuCount() const;
+		const std::vector<int>& getNodeCpus(int node) const;
+		int getNodeOfCpu(int cpu) const;
+
+		/**
+		 * One slot per physical core (SMT siblings are skipped), grouped node by node.
+		 * @param nodecount	number of nodes to use (<= 0 : all nodes)
+		 */
+		void layoutOnePerCore(std::vector<CpuSlot>& slots, int nodecount = 0) const;
+
+		/**
+		 * Pins each thread to one slot of layoutOnePerCore() and records its node.
+		 * Must be called before the threads are started.
+		 * @return number of threads placed
+		 */
+		int placeThreads(const std::vector< JsCPPUtils::SmartPointer<Thread> >& threads) const;
+
+		/**
+		 * Allocates memory bound to a NUMA node. (node < 0 : no binding)
+		 * Must be released with freeOnNode.
+		 */
+		static void *allocOnNode(size_t size, int node);
+		static void freeOnNode(void *ptr, size_t size);
+	};
+}
+
+#endif /* __JSCPPUTILS_NUMATOPOLOGY_H__ */
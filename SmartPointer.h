@@ -459,10 +459,10 @@ namespace JsCPPUtils
 #if (__cplusplus >= 201103) || (defined(HAS_MOVE_SEMANTICS) && HAS_MOVE_SEMANTICS == 1)
 			explicit SmartPointer(SmartPointer&& _ref)
 			{
-				m_ptr = _ref->m_ptr;
+				m_ptr = _ref.m_ptr;
 				this->ptr = (T*)m_ptr;
 				m_rootManager = _ref.m_rootManager;
-				m_refcounter = _ref.refcounter;
+				m_refcounter = _ref.m_refcounter;
 				_ref.m_ptr = NULL;
 				_ref.m_refcounter = NULL;
 				_ref.m_rootManager = NULL;
@@ -0,0 +1,906 @@
+/**
+ * @file	SocketBenchmark.cpp
+ * @class	SocketBenchmark
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/29
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "SocketBenchmark.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifdef USE_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
+#endif
+
+#define _SOCKETBENCH_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _SOCKETBENCH_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define _SOCKETBENCH_ADD(p, v) __sync_fetch_and_add((p), (v))
+
+namespace JsCPPUtils
+{
+	SocketBenchmark::Connection::Connection(SocketBenchmark *_pbench)
+		: pbench(_pbench)
+		, recvpos(0)
+		, completed(0)
+		, latency_ns_total(0)
+		, latency_ns_max(0)
+		, outstanding(0)
+		, established(0)
+		, closed(0)
+	{
+		memset(header, 0, sizeof(header));
+	}
+
+	int SocketBenchmark::SslServerThread::run(int param_idx, void *param_ptr)
+	{
+		if (fd < 0)
+			pbench->_sslAccept();
+		else
+			pbench->_sslServe(fd);
+		return 0;
+	}
+
+	SocketBenchmark::SocketBenchmark()
+		: m_measurestart(0)
+		, m_measureend(0)
+		, m_stopping(0)
+		, m_pclientengine(NULL)
+		, m_pserverengine(NULL)
+		, m_pserver(NULL)
+		, m_serveraddrlen(0)
+		, m_ppayload(NULL)
+		, m_connected(0)
+		, m_lastconnectns(0)
+		, m_disconnected(0)
+		, m_sinkbytes(0)
+#ifdef USE_OPENSSL
+		, m_psslserverctx(NULL)
+#endif
+		, m_sslfd(-1)
+	{
+		memset(&m_serveraddr, 0, sizeof(m_serveraddr));
+	}
+
+	SocketBenchmark::~SocketBenchmark()
+	{
+	}
+
+	int64_t SocketBenchmark::_nowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	int SocketBenchmark::_histIndex(int64_t ns)
+	{
+		int msb;
+		int shift;
+		int index;
+
+		if (ns < HIST_SUB)
+			return (ns > 0) ? (int)ns : 0;
+		msb = 63 - __builtin_clzll((unsigned long long)ns);
+		shift = msb - HIST_SUB_BITS;
+		index = (shift + 1) * HIST_SUB + (int)((ns >> shift) & (HIST_SUB - 1));
+		return (index < HIST_SIZE) ? index : (HIST_SIZE - 1);
+	}
+
+	int64_t SocketBenchmark::_histValue(int index)
+	{
+		int shift;
+
+		if (index < HIST_SUB)
+			return index;
+		/* the middle of the bucket */
+		shift = index / HIST_SUB - 1;
+		return ((int64_t)(HIST_SUB + index % HIST_SUB) << shift) + (((int64_t)1 << shift) >> 1);
+	}
+
+	bool SocketBenchmark::_measuring(int64_t now)
+	{
+		return (now >= _SOCKETBENCH_LOAD(&m_measurestart)) && (now < _SOCKETBENCH_LOAD(&m_measureend));
+	}
+
+	int SocketBenchmark::run(const Params &params, Result *presult)
+	{
+		int rc;
+
+		m_params = params;
+		if (m_params.connections < 1)
+			m_params.connections = 1;
+		if (m_params.pipeline < 1)
+			m_params.pipeline = 1;
+		if (m_params.messagesize < 1)
+			m_params.messagesize = 1;
+		if ((m_params.mode == MODE_ECHO) && (m_params.messagesize < 8))
+			m_params.messagesize = 8;
+
+		presult->params = m_params;
+		presult->result = 0;
+		presult->connected = 0;
+		presult->connect_total_us = 0;
+		presult->connects_per_sec = 0;
+		presult->connect_avg_us = 0;
+		presult->connect_max_us = 0;
+		presult->messages = 0;
+		presult->bytes = 0;
+		presult->messages_per_sec = 0;
+		presult->mbytes_per_sec = 0;
+		presult->latency_avg_us = -1;
+		presult->latency_p50_us = -1;
+		presult->latency_p90_us = -1;
+		presult->latency_p99_us = -1;
+		presult->latency_p999_us = -1;
+		presult->latency_max_us = -1;
+		presult->disconnects = 0;
+		presult->metrics.reset();
+
+#ifndef USE_OPENSSL
+		if (m_params.ssl)
+		{
+			presult->result = -ENOTSUP;
+			return presult->result;
+		}
+#endif
+
+		m_measurestart = INT64_MAX;
+		m_measureend = INT64_MAX;
+		m_stopping = 0;
+		m_connected = 0;
+		m_lastconnectns = 0;
+		m_disconnected = 0;
+		m_sinkbytes = 0;
+		m_metrics.reset();
+
+		m_ppayload = (char*)malloc(m_params.messagesize);
+		if (m_ppayload == NULL)
+		{
+			presult->result = -ENOMEM;
+			return presult->result;
+		}
+		memset(m_ppayload, 'x', m_params.messagesize);
+
+		m_pclientengine = new JsSocketEngine();
+		m_pserverengine = new JsSocketEngine();
+		rc = m_pclientengine->start(m_params.clientloops, "bench-client", m_params.backend);
+		if (rc == 1)
+			rc = m_pserverengine->start(m_params.serverloops, "bench-server", m_params.backend);
+		if (rc == 1)
+		{
+			/* what the engine actually got (io_uring may have fallen back to epoll) */
+			presult->params.backend = m_pclientengine->getLoop(0)->getBackend();
+			rc = m_params.ssl ? _startSslServer() : _startServer();
+		}
+		if (rc == 1)
+			rc = _connect(presult);
+		if (rc == 1)
+			_drive();
+		_finish(presult);
+		_stopServer();
+
+		m_pclientengine->stop();
+		m_pserverengine->stop();
+		delete m_pclientengine;
+		delete m_pserverengine;
+		m_pclientengine = NULL;
+		m_pserverengine = NULL;
+		free(m_ppayload);
+		m_ppayload = NULL;
+
+		presult->result = (rc == 1) ? 1 : ((rc < 0) ? rc : -EINVAL);
+		return presult->result;
+	}
+
+	int SocketBenchmark::_startServer()
+	{
+		struct sockaddr_in addr;
+		int rc;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		m_pserver = new JsServerSocket(this);
+		m_pserver->setEngine(m_pserverengine);
+		m_pserver->init(65536, NULL, NULL, _serverConnectedProc, _serverRecvProc, NULL);
+		rc = m_pserver->listen((const struct sockaddr*)&addr, sizeof(addr), SOMAXCONN);
+		if (rc != 1)
+			return rc;
+		m_serveraddrlen = sizeof(m_serveraddr);
+		return m_pserver->getLocalAddress((struct sockaddr*)&m_serveraddr, &m_serveraddrlen);
+	}
+
+	void SocketBenchmark::_stopServer()
+	{
+		size_t i;
+
+		if (m_pserver != NULL)
+		{
+			m_pserver->close();
+			delete m_pserver;
+			m_pserver = NULL;
+		}
+
+		if (m_sslfd >= 0)
+		{
+			/* wakes the accept thread */
+			::shutdown(m_sslfd, SHUT_RDWR);
+			if (m_spsslaccept.getPtr() != NULL)
+				m_spsslaccept->join();
+			m_spsslaccept = NULL;
+			for (i = 0; i < m_sslthreads.size(); i++)
+			{
+				::shutdown(m_sslthreads[i]->fd, SHUT_RDWR);
+				m_sslthreads[i]->join();
+				::close(m_sslthreads[i]->fd);
+			}
+			m_sslthreads.clear();
+			::close(m_sslfd);
+			m_sslfd = -1;
+		}
+#ifdef USE_OPENSSL
+		if (m_psslserverctx != NULL)
+		{
+			SSL_CTX_free(m_psslserverctx);
+			m_psslserverctx = NULL;
+		}
+		m_spsslclientctx = NULL;
+#endif
+	}
+
+	int SocketBenchmark::_startSslServer()
+	{
+#ifdef USE_OPENSSL
+		struct sockaddr_in addr;
+		EVP_PKEY_CTX *pkeyctx;
+		EVP_PKEY *pkey = NULL;
+		X509 *pcert;
+		X509_NAME *pname;
+		int ok;
+
+		/* a throwaway P-256 key and self-signed certificate : the clients do not verify it */
+		pkeyctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+		if (pkeyctx == NULL)
+			return -ENOMEM;
+		ok = (EVP_PKEY_keygen_init(pkeyctx) == 1)
+			&& (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pkeyctx, NID_X9_62_prime256v1) == 1)
+			&& (EVP_PKEY_keygen(pkeyctx, &pkey) == 1);
+		EVP_PKEY_CTX_free(pkeyctx);
+		if (!ok)
+			return -EINVAL;
+		pcert = X509_new();
+		X509_set_version(pcert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(pcert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(pcert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(pcert), 86400);
+		X509_set_pubkey(pcert, pkey);
+		pname = X509_get_subject_name(pcert);
+		X509_NAME_add_entry_by_txt(pname, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+		X509_set_issuer_name(pcert, pname);
+		ok = (X509_sign(pcert, pkey, EVP_sha256()) > 0);
+
+		m_psslserverctx = SSL_CTX_new(TLS_server_method());
+		ok = ok && (m_psslserverctx != NULL)
+			&& (SSL_CTX_use_certificate(m_psslserverctx, pcert) == 1)
+			&& (SSL_CTX_use_PrivateKey(m_psslserverctx, pkey) == 1);
+		X509_free(pcert);
+		EVP_PKEY_free(pkey);
+		if (!ok)
+			return -EINVAL;
+
+		if (m_params.sslresume)
+		{
+			m_spsslclientctx = new JsSSLContext();
+			if (m_spsslclientctx->init(TLS_client_method()) != 1)
+				return -EINVAL;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		m_sslfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (m_sslfd < 0)
+			return -errno;
+		if ((::bind(m_sslfd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) || (::listen(m_sslfd, SOMAXCONN) < 0))
+			return -errno;
+		m_serveraddrlen = sizeof(m_serveraddr);
+		if (::getsockname(m_sslfd, (struct sockaddr*)&m_serveraddr, &m_serveraddrlen) < 0)
+			return -errno;
+
+		m_spsslaccept = new SslServerThread();
+		m_spsslaccept->pbench = this;
+		m_spsslaccept->fd = -1;
+		m_spsslaccept->start(0, NULL, NULL, "bench-sslaccept");
+		return 1;
+#else
+		return -ENOTSUP;
+#endif
+	}
+
+	/*
+	 * Accept thread. m_sslthreads is its own until _stopServer() joined it.
+	 */
+	void SocketBenchmark::_sslAccept()
+	{
+		for (;;)
+		{
+			JsCPPUtils::SmartPointer<SslServerThread> spthread;
+			int fd = ::accept4(m_sslfd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0)
+			{
+				if ((errno == EINTR) || (errno == ECONNABORTED))
+					continue;
+				break;
+			}
+			spthread = new SslServerThread();
+			spthread->pbench = this;
+			spthread->fd = fd;
+			m_sslthreads.push_back(spthread);
+			spthread->start(0, NULL, NULL, "bench-ssl");
+		}
+	}
+
+	/*
+	 * Connection thread of the ssl server. fd is closed by _stopServer().
+	 */
+	void SocketBenchmark::_sslServe(int fd)
+	{
+#ifdef USE_OPENSSL
+		sigset_t sigs;
+		SSL *pssl;
+		char buf[65536];
+		int one = 1;
+		int n;
+
+		/* a write to a client that is gone fails with EPIPE instead of killing the process */
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+		if (m_params.nodelay)
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		pssl = SSL_new(m_psslserverctx);
+		if (pssl == NULL)
+			return;
+		SSL_set_fd(pssl, fd);
+		if (SSL_accept(pssl) == 1)
+		{
+			while ((n = SSL_read(pssl, buf, sizeof(buf))) > 0)
+			{
+				if (m_params.mode == MODE_ECHO)
+				{
+					if (SSL_write(pssl, buf, n) != n)
+						break;
+				}else{
+					_serverData(n);
+				}
+			}
+		}
+		SSL_free(pssl);
+#endif
+	}
+
+	void SocketBenchmark::_serverData(int len)
+	{
+		if (_measuring(_nowNs()))
+			_SOCKETBENCH_ADD(&m_sinkbytes, len);
+	}
+
+	int SocketBenchmark::_serverConnectedProc(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx)
+	{
+		SocketBenchmark *pbench = (SocketBenchmark*)pserver->getUserPtr();
+		int one = 1;
+
+		if (pbench->m_params.nodelay)
+			::setsockopt(pclient->getSocket(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		return 1;
+	}
+
+	int SocketBenchmark::_serverRecvProc(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx, int recv_len, char *recv_pbuf)
+	{
+		SocketBenchmark *pbench = (SocketBenchmark*)pserver->getUserPtr();
+
+		if (pbench->m_params.mode == MODE_ECHO)
+			return (pclient->send(recv_pbuf, recv_len) == 1) ? 1 : 0;
+		pbench->_serverData(recv_len);
+		return 1;
+	}
+
+	int SocketBenchmark::_connect(Result *presult)
+	{
+		int64_t start;
+		int64_t deadline;
+		int64_t timings_total = 0;
+		int established = 0;
+		int rc;
+		int i;
+
+		for (i = 0; i < m_params.connections; i++)
+		{
+			Connection *pconn = new Connection(this);
+			m_conns.push_back(pconn);
+			pconn->setEngine(m_pclientengine);
+			if (m_params.metrics)
+				pconn->enableMetrics(&m_metrics, 0);
+			if (m_params.mode == MODE_ECHO)
+			{
+				pconn->hist.resize(HIST_SIZE, 0);
+				pconn->sendbuf.resize(m_params.messagesize, 'x');
+			}
+#ifdef USE_OPENSSL
+			if (m_params.ssl && (m_spsslclientctx.getPtr() != NULL))
+				pconn->setSSLContext(m_spsslclientctx);
+			rc = pconn->init(AF_INET, SOCK_STREAM, 0, m_params.ssl, m_params.ssl ? TLS_client_method() : NULL, 65536, NULL, NULL, _clientConnectedProc, _clientRecvProc, _clientDisconnectedProc);
+#else
+			rc = pconn->init(AF_INET, SOCK_STREAM, 0, false, NULL, 65536, NULL, NULL, _clientConnectedProc, _clientRecvProc, _clientDisconnectedProc);
+#endif
+			if (rc != 1)
+				return (rc < 0) ? rc : -EINVAL;
+		}
+
+		start = _nowNs();
+		for (i = 0; i < m_params.connections; i++)
+			m_conns[i]->beginConnect(NULL, 0, (const struct sockaddr*)&m_serveraddr, m_serveraddrlen, false, 0);
+		deadline = start + (int64_t)m_params.connecttimeoutms * 1000000;
+		while ((_SOCKETBENCH_LOAD(&m_connected) < m_params.connections) && (_nowNs() < deadline))
+			usleep(1000);
+
+		presult->connected = _SOCKETBENCH_LOAD(&m_connected);
+		if (presult->connected == 0)
+			return -ETIMEDOUT;
+		presult->connect_total_us = (_SOCKETBENCH_LOAD(&m_lastconnectns) - start) / 1000;
+		if (presult->connect_total_us > 0)
+			presult->connects_per_sec = (double)presult->connected * 1000000.0 / (double)presult->connect_total_us;
+		for (i = 0; i < m_params.connections; i++)
+		{
+			Connection *pconn = m_conns[i];
+			int64_t total_us;
+			if (!_SOCKETBENCH_LOAD(&pconn->established))
+				continue;
+			total_us = pconn->getConnectTimings().total_us;
+			timings_total += total_us;
+			if (total_us > presult->connect_max_us)
+				presult->connect_max_us = total_us;
+			established++;
+		}
+		if (established > 0)
+			presult->connect_avg_us = timings_total / established;
+		return 1;
+	}
+
+	void SocketBenchmark::_drive()
+	{
+		int64_t now = _nowNs();
+		int64_t end;
+		size_t i;
+		int p;
+
+		_SOCKETBENCH_STORE(&m_measurestart, now + m_params.warmupms * 1000000);
+		end = now + (m_params.warmupms + m_params.durationms) * 1000000;
+		_SOCKETBENCH_STORE(&m_measureend, end);
+
+		if (m_params.mode == MODE_ECHO)
+		{
+			/* the loops keep it going from here : each returning message sends the next */
+			std::vector<char> msg(m_params.messagesize, 'x');
+			for (i = 0; i < m_conns.size(); i++)
+			{
+				if (!_SOCKETBENCH_LOAD(&m_conns[i]->established))
+					continue;
+				for (p = 0; p < m_params.pipeline; p++)
+				{
+					int64_t stamp = _nowNs();
+					memcpy(&msg[0], &stamp, sizeof(stamp));
+					if (m_conns[i]->send(&msg[0], m_params.messagesize) != 1)
+						break;
+				}
+			}
+			while (_nowNs() < end)
+				usleep(10000);
+		}else{
+			/* this thread feeds every connection up to pipeline unfinished sends */
+			while (_nowNs() < end)
+			{
+				bool bSent = false;
+				for (i = 0; i < m_conns.size(); i++)
+				{
+					Connection *pconn = m_conns[i];
+					if (!_SOCKETBENCH_LOAD(&pconn->established) || _SOCKETBENCH_LOAD(&pconn->closed))
+						continue;
+					for (p = 0; (p < m_params.pipeline) && (_SOCKETBENCH_LOAD(&pconn->outstanding) < m_params.pipeline); p++)
+					{
+						_SOCKETBENCH_ADD(&pconn->outstanding, 1);
+						if (pconn->sendOwned(m_ppayload, m_params.messagesize, _clientSentProc, _payloadFreeProc, NULL) != 1)
+						{
+							_SOCKETBENCH_ADD(&pconn->outstanding, -1);
+							break;
+						}
+						bSent = true;
+					}
+				}
+				if (!bSent)
+					sched_yield();
+			}
+		}
+		_SOCKETBENCH_STORE(&m_stopping, 1);
+	}
+
+	void SocketBenchmark::_finish(Result *presult)
+	{
+		std::vector<int64_t> hist;
+		int64_t latency_total = 0;
+		int64_t latency_max = 0;
+		int64_t deadline;
+		size_t i;
+		int h;
+
+		_SOCKETBENCH_STORE(&m_stopping, 1);
+		for (i = 0; i < m_conns.size(); i++)
+			m_conns[i]->beginDisconnect();
+		deadline = _nowNs() + (int64_t)5000 * 1000000;
+		for (i = 0; i < m_conns.size(); i++)
+		{
+			Connection *pconn = m_conns[i];
+			while (_SOCKETBENCH_LOAD(&pconn->established) && !_SOCKETBENCH_LOAD(&pconn->closed) && (_nowNs() < deadline))
+				usleep(1000);
+		}
+
+		if (m_params.mode == MODE_ECHO)
+		{
+			hist.resize(HIST_SIZE, 0);
+			for (i = 0; i < m_conns.size(); i++)
+			{
+				Connection *pconn = m_conns[i];
+				/* still open after the deadline : its loop may be writing these */
+				if (!_SOCKETBENCH_LOAD(&pconn->closed))
+					continue;
+				presult->messages += pconn->completed;
+				latency_total += pconn->latency_ns_total;
+				if (pconn->latency_ns_max > latency_max)
+					latency_max = pconn->latency_ns_max;
+				for (h = 0; h < HIST_SIZE; h++)
+					hist[h] += pconn->hist[h];
+			}
+			presult->bytes = presult->messages * m_params.messagesize;
+			if (presult->messages > 0)
+			{
+				const double ps[4] = { 0.5, 0.9, 0.99, 0.999 };
+				double *pouts[4] = { &presult->latency_p50_us, &presult->latency_p90_us, &presult->latency_p99_us, &presult->latency_p999_us };
+				int64_t seen = 0;
+				int k = 0;
+				for (h = 0; (h < HIST_SIZE) && (k < 4); h++)
+				{
+					seen += hist[h];
+					while ((k < 4) && ((double)seen >= ps[k] * (double)presult->messages))
+					{
+						*pouts[k] = (double)_histValue(h) / 1000.0;
+						k++;
+					}
+				}
+				presult->latency_avg_us = (double)latency_total / (double)presult->messages / 1000.0;
+				presult->latency_max_us = (double)latency_max / 1000.0;
+			}
+		}else{
+			presult->bytes = _SOCKETBENCH_LOAD(&m_sinkbytes);
+			presult->messages = presult->bytes / m_params.messagesize;
+		}
+		if (m_params.durationms > 0)
+		{
+			presult->messages_per_sec = (double)presult->messages * 1000.0 / (double)m_params.durationms;
+			presult->mbytes_per_sec = (double)presult->bytes * 1000.0 / (double)m_params.durationms / 1048576.0;
+		}
+		presult->disconnects = _SOCKETBENCH_LOAD(&m_disconnected);
+		if (m_params.metrics)
+			m_metrics.snapshot(&presult->metrics);
+
+		for (i = 0; i < m_conns.size(); i++)
+			delete m_conns[i];
+		m_conns.clear();
+	}
+
+	/*
+	 * Loop thread of pconn. Reassembles messages to read the send time at their front,
+	 * and sends the next one as each returns.
+	 */
+	void SocketBenchmark::_echoData(Connection *pconn, int len, const char *pbuf)
+	{
+		while (len > 0)
+		{
+			int n;
+			if (pconn->recvpos < 8)
+			{
+				n = 8 - pconn->recvpos;
+				if (n > len)
+					n = len;
+				memcpy(&pconn->header[pconn->recvpos], pbuf, n);
+			}
+			n = m_params.messagesize - pconn->recvpos;
+			if (n > len)
+				n = len;
+			pconn->recvpos += n;
+			pbuf += n;
+			len -= n;
+			if (pconn->recvpos == m_params.messagesize)
+			{
+				int64_t now = _nowNs();
+				int64_t stamp;
+				pconn->recvpos = 0;
+				if (_measuring(now))
+				{
+					int64_t ns;
+					memcpy(&stamp, pconn->header, sizeof(stamp));
+					ns = now - stamp;
+					pconn->completed++;
+					pconn->latency_ns_total += ns;
+					if (ns > pconn->latency_ns_max)
+						pconn->latency_ns_max = ns;
+					pconn->hist[_histIndex(ns)]++;
+				}
+				if (!_SOCKETBENCH_LOAD(&m_stopping))
+				{
+					memcpy(&pconn->sendbuf[0], &now, sizeof(now));
+					pconn->send(&pconn->sendbuf[0], m_params.messagesize);
+				}
+			}
+		}
+	}
+
+	int SocketBenchmark::_clientConnectedProc(JsClientSocket *psockctx, void *pthreaduserctx, JSCUTILS_SOCKET_T clientsock)
+	{
+		Connection *pconn = (Connection*)psockctx;
+		SocketBenchmark *pbench = pconn->pbench;
+		int64_t now = _nowNs();
+		int64_t last;
+		int one = 1;
+
+		if (pbench->m_params.nodelay)
+			::setsockopt(clientsock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		do {
+			last = _SOCKETBENCH_LOAD(&pbench->m_lastconnectns);
+			if (last >= now)
+				break;
+		} while (!__sync_bool_compare_and_swap(&pbench->m_lastconnectns, last, now));
+		_SOCKETBENCH_STORE(&pconn->established, 1);
+		_SOCKETBENCH_ADD(&pbench->m_connected, 1);
+		return 1;
+	}
+
+	int SocketBenchmark::_clientRecvProc(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf)
+	{
+		Connection *pconn = (Connection*)psockctx;
+
+		if (pconn->pbench->m_params.mode == MODE_ECHO)
+			pconn->pbench->_echoData(pconn, recv_len, recv_pbuf);
+		return 1;
+	}
+
+	void SocketBenchmark::_clientDisconnectedProc(JsClientSocket *psockctx, int code)
+	{
+		Connection *pconn = (Connection*)psockctx;
+		SocketBenchmark *pbench = pconn->pbench;
+
+		if (!_SOCKETBENCH_LOAD(&pbench->m_stopping))
+			_SOCKETBENCH_ADD(&pbench->m_disconnected, 1);
+		_SOCKETBENCH_STORE(&pconn->closed, 1);
+	}
+
+	void SocketBenchmark::_clientSentProc(JsClientSocket *psockctx, int code)
+	{
+		Connection *pconn = (Connection*)psockctx;
+		_SOCKETBENCH_ADD(&pconn->outstanding, -1);
+	}
+
+	void SocketBenchmark::_payloadFreeProc(char *pbuf, void *freeparam)
+	{
+		/* m_ppayload is shared by every send and freed by run() */
+	}
+
+	void SocketBenchmark::writeJson(FILE *fp, const Result &result)
+	{
+		const Params &params = result.params;
+
+		fprintf(fp, "{\"mode\":\"%s\",\"connections\":%d,\"messagesize\":%d,\"pipeline\":%d,\"ssl\":%s,\"sslresume\":%s,\"backend\":\"%s\",\"clientloops\":%d,\"serverloops\":%d,\"nodelay\":%s,\"warmupms\":%lld,\"durationms\":%lld",
+			(params.mode == MODE_ECHO) ? "echo" : "sink",
+			params.connections,
+			params.messagesize,
+			params.pipeline,
+			params.ssl ? "true" : "false",
+			params.sslresume ? "true" : "false",
+			(params.backend == JsSocketEngine::BACKEND_IOURING) ? "io_uring" : "epoll",
+			params.clientloops,
+			params.serverloops,
+			params.nodelay ? "true" : "false",
+			(long long)params.warmupms,
+			(long long)params.durationms);
+		fprintf(fp, ",\"result\":%d,\"connected\":%d,\"connect_total_us\":%lld,\"connects_per_sec\":%.1f,\"connect_avg_us\":%lld,\"connect_max_us\":%lld",
+			result.result,
+			result.connected,
+			(long long)result.connect_total_us,
+			result.connects_per_sec,
+			(long long)result.connect_avg_us,
+			(long long)result.connect_max_us);
+		fprintf(fp, ",\"messages\":%lld,\"bytes\":%lld,\"messages_per_sec\":%.1f,\"mbytes_per_sec\":%.3f,\"disconnects\":%d",
+			(long long)result.messages,
+			(long long)result.bytes,
+			result.messages_per_sec,
+			result.mbytes_per_sec,
+			result.disconnects);
+		if (result.latency_avg_us >= 0)
+		{
+			fprintf(fp, ",\"latency_us\":{\"avg\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+				result.latency_avg_us,
+				result.latency_p50_us,
+				result.latency_p90_us,
+				result.latency_p99_us,
+				result.latency_p999_us,
+				result.latency_max_us);
+		}else{
+			fprintf(fp, ",\"latency_us\":null");
+		}
+		if (params.metrics)
+		{
+			SocketMetrics snap;
+			result.metrics.snapshot(&snap);
+			fprintf(fp, ",\"metrics\":{\"bytes_sent\":%lld,\"bytes_received\":%lld,\"sendqueue_depth_max\":%lld,\"sent_avg_us\":%lld,\"sent_max_us\":%lld,\"recvhandler_total_us\":%lld,\"retransmits\":%lld}",
+				(long long)snap.bytes_sent,
+				(long long)snap.bytes_received,
+				(long long)snap.sendqueue_depth_max,
+				(long long)((snap.sent_count > 0) ? (snap.sent_ns_total / snap.sent_count / 1000) : 0),
+				(long long)(snap.sent_ns_max / 1000),
+				(long long)(snap.recvhandler_ns_total / 1000),
+				(long long)snap.retransmits);
+		}
+		fprintf(fp, "}\n");
+		fflush(fp);
+	}
+}
+
+#ifdef JSCPPUTILS_SOCKETBENCHMARK_MAIN
+
+#include <sys/resource.h>
+#include <getopt.h>
+
+static void usage(const char *szProgram)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -m echo|sink     mode (echo)\n"
+		"  -c N[,N...]      connections (64)\n"
+		"  -s N[,N...]      message sizes in bytes (64,1024,16384)\n"
+		"  -p N             messages in flight per connection (1)\n"
+		"  -d MS            measured duration per run (3000)\n"
+		"  -w MS            warmup per run (500)\n"
+		"  -t N             client engine loops (0 : one per CPU)\n"
+		"  -T N             server engine loops (0 : one per CPU)\n"
+		"  -u               io_uring backend\n"
+		"  -S               also run every configuration over TLS\n"
+		"  -r               TLS without session resumption\n"
+		"  -M               collect SocketMetrics\n"
+		"Prints one JSON object per run on stdout.\n",
+		szProgram);
+}
+
+static std::vector<int> parseList(const char *szList)
+{
+	std::vector<int> values;
+	const char *p = szList;
+	while (*p)
+	{
+		char *pend;
+		long v = strtol(p, &pend, 10);
+		if (pend == p)
+			break;
+		values.push_back((int)v);
+		p = (*pend == ',') ? (pend + 1) : pend;
+	}
+	return values;
+}
+
+int main(int argc, char *argv[])
+{
+	JsCPPUtils::SocketBenchmark::Params params;
+	std::vector<int> connections(1, params.connections);
+	std::vector<int> sizes;
+	bool bWithSSL = false;
+	struct rlimit rl;
+	size_t c, s;
+	int ssl;
+	int opt;
+	int failed = 0;
+
+	sizes.push_back(64);
+	sizes.push_back(1024);
+	sizes.push_back(16384);
+
+	while ((opt = getopt(argc, argv, "m:c:s:p:d:w:t:T:uSrMh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			params.mode = (strcmp(optarg, "sink") == 0) ? JsCPPUtils::SocketBenchmark::MODE_SINK : JsCPPUtils::SocketBenchmark::MODE_ECHO;
+			break;
+		case 'c':
+			connections = parseList(optarg);
+			break;
+		case 's':
+			sizes = parseList(optarg);
+			break;
+		case 'p':
+			params.pipeline = atoi(optarg);
+			break;
+		case 'd':
+			params.durationms = atoll(optarg);
+			break;
+		case 'w':
+			params.warmupms = atoll(optarg);
+			break;
+		case 't':
+			params.clientloops = atoi(optarg);
+			break;
+		case 'T':
+			params.serverloops = atoi(optarg);
+			break;
+		case 'u':
+			params.backend = JsCPPUtils::JsSocketEngine::BACKEND_IOURING;
+			break;
+		case 'S':
+			bWithSSL = true;
+			break;
+		case 'r':
+			params.sslresume = false;
+			break;
+		case 'M':
+			params.metrics = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	/* both ends of every connection live in this process */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	for (ssl = 0; ssl <= (bWithSSL ? 1 : 0); ssl++)
+	{
+		for (c = 0; c < connections.size(); c++)
+		{
+			for (s = 0; s < sizes.size(); s++)
+			{
+				JsCPPUtils::SocketBenchmark bench;
+				JsCPPUtils::SocketBenchmark::Result result;
+				params.ssl = (ssl != 0);
+				params.connections = connections[c];
+				params.messagesize = sizes[s];
+				if (bench.run(params, &result) != 1)
+					failed++;
+				JsCPPUtils::SocketBenchmark::writeJson(stdout, result);
+			}
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+#endif /* JSCPPUTILS_SOCKETBENCHMARK_MAIN */
@@ -0,0 +1,246 @@
+/**
+ * @file	SocketBenchmark.h
+ * @class	SocketBenchmark
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/29
+ * @brief	Loopback benchmark of JsClientSocket : connect rate, messages/sec, throughput and latency percentiles
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_SOCKETBENCHMARK_H__
+#define __JSCPPUTILS_SOCKETBENCHMARK_H__
+
+#include "Common.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#elif defined(JSCUTILS_OS_WINDOWS)
+#error "NOT SUPPORTED WINDOWS, yet..."
+#endif
+
+#include <vector>
+
+#include "JsSocketEngine.h"
+#include "JsClientSocket.h"
+#include "JsServerSocket.h"
+#include "SocketMetrics.h"
+#include "Thread.h"
+#include "SmartPointer.h"
+
+namespace JsCPPUtils
+{
+	/**
+	 * Runs a server and many JsClientSocket connections to it on 127.0.0.1, each on its own engine,
+	 * and measures one configuration per run() :
+	 *
+	 *  MODE_ECHO : every connection keeps pipeline messages in flight; the server sends them back and
+	 *              each one that returns is a latency sample (the send time travels in its first 8 bytes).
+	 *  MODE_SINK : the clients send as fast as the sockets take it (pipeline messages queued per
+	 *              connection) and the server only counts; measures throughput.
+	 *
+	 * A plain server is a JsServerSocket. JsServerSocket has no TLS, so with ssl the server is a
+	 * thread per connection doing blocking OpenSSL I/O with a throwaway self-signed certificate;
+	 * its numbers include that server's cost.
+	 *
+	 * Build SocketBenchmark.cpp with JSCPPUTILS_SOCKETBENCHMARK_MAIN defined (and USE_OPENSSL for the
+	 * ssl runs) for a command-line benchmark; it prints one JSON object per run (see writeJson()).
+	 */
+	class SocketBenchmark
+	{
+	public:
+		enum Mode {
+			MODE_ECHO = 0,
+			MODE_SINK = 1
+		};
+
+		struct Params {
+			Mode mode;
+			int connections;
+			/* bytes per message; at least 8 in MODE_ECHO */
+			int messagesize;
+			/* messages in flight per connection */
+			int pipeline;
+			bool ssl;
+			/* ssl : the clients share one JsSSLContext, so most handshakes resume a session */
+			bool sslresume;
+			/* engine loops of each side, <= 0 : one per online CPU */
+			int clientloops;
+			int serverloops;
+			JsSocketEngine::Backend backend;
+			/* not measured, then measured */
+			int64_t warmupms;
+			int64_t durationms;
+			long connecttimeoutms;
+			/* TCP_NODELAY on both ends */
+			bool nodelay;
+			/* enableMetrics() on the clients, into Result::metrics (costs some atomic adds per message) */
+			bool metrics;
+
+			Params()
+				: mode(MODE_ECHO)
+				, connections(64)
+				, messagesize(64)
+				, pipeline(1)
+				, ssl(false)
+				, sslresume(true)
+				, clientloops(0)
+				, serverloops(0)
+				, backend(JsSocketEngine::BACKEND_EPOLL)
+				, warmupms(500)
+				, durationms(3000)
+				, connecttimeoutms(10000)
+				, nodelay(true)
+				, metrics(false)
+			{}
+		};
+
+		struct Result {
+			Params params;
+			/* 1, or negative errno : the run could not be set up (nothing else is valid) */
+			int result;
+			int connected;
+			/* from the first beginConnect() until the last connection was established */
+			int64_t connect_total_us;
+			double connects_per_sec;
+			/* per connection (JsClientSocket::ConnectTimings::total_us) */
+			int64_t connect_avg_us;
+			int64_t connect_max_us;
+
+			/* within durationms : MODE_ECHO counts returned messages, MODE_SINK what the server received */
+			int64_t messages;
+			int64_t bytes;
+			double messages_per_sec;
+			double mbytes_per_sec;
+
+			/* MODE_ECHO only, microseconds (-1 otherwise) */
+			double latency_avg_us;
+			double latency_p50_us;
+			double latency_p90_us;
+			double latency_p99_us;
+			double latency_p999_us;
+			double latency_max_us;
+
+			/* connections lost during the run */
+			int disconnects;
+			/* Params::metrics */
+			SocketMetrics metrics;
+		};
+
+	private:
+		/* log-linear : 32 steps per power of two (about 3% resolution) of nanoseconds */
+		enum {
+			HIST_SUB_BITS = 5,
+			HIST_SUB = 1 << HIST_SUB_BITS,
+			HIST_SIZE = (64 - HIST_SUB_BITS) * HIST_SUB
+		};
+
+		class Connection : public JsClientSocket
+		{
+		public:
+			SocketBenchmark *pbench;
+			/* loop thread only (read by run() once the connection is gone) */
+			int recvpos;
+			char header[8];
+			int64_t completed;
+			int64_t latency_ns_total;
+			int64_t latency_ns_max;
+			std::vector<int64_t> hist;
+			/* MODE_ECHO : the next message, stamped on the loop thread */
+			std::vector<char> sendbuf;
+			/* MODE_SINK : sendOwned() calls whose senthandler has not run yet */
+			volatile int outstanding;
+			volatile int established;
+			volatile int closed;
+
+			Connection(SocketBenchmark *_pbench);
+		};
+
+		class SslServerThread : public Thread
+		{
+		public:
+			SocketBenchmark *pbench;
+			int fd;
+			int run(int param_idx, void *param_ptr) override;
+		};
+
+		Params m_params;
+		/* set by run() : measure between them, stop sending after the end */
+		volatile int64_t m_measurestart;
+		volatile int64_t m_measureend;
+		volatile int m_stopping;
+
+		JsSocketEngine *m_pclientengine;
+		JsSocketEngine *m_pserverengine;
+		JsServerSocket *m_pserver;
+		struct sockaddr_storage m_serveraddr;
+		socklen_t m_serveraddrlen;
+		std::vector<Connection*> m_conns;
+		char *m_ppayload;
+		SocketMetrics m_metrics;
+
+		volatile int m_connected;
+		volatile int64_t m_lastconnectns;
+		volatile int m_disconnected;
+		/* MODE_SINK : bytes the server received while measuring */
+		volatile int64_t m_sinkbytes;
+
+#ifdef USE_OPENSSL
+		/* ssl : listening socket, its accept thread and the connection threads */
+		SSL_CTX *m_psslserverctx;
+		/* shared by the clients, so connects after the first resume */
+		JsCPPUtils::SmartPointer<JsSSLContext> m_spsslclientctx;
+#endif
+		int m_sslfd;
+		JsCPPUtils::SmartPointer<SslServerThread> m_spsslaccept;
+		std::vector< JsCPPUtils::SmartPointer<SslServerThread> > m_sslthreads;
+
+		int _startServer();
+		void _stopServer();
+		int _startSslServer();
+		void _sslAccept();
+		void _sslServe(int fd);
+		int _connect(Result *presult);
+		void _drive();
+		void _finish(Result *presult);
+		void _serverData(int len);
+		void _echoData(Connection *pconn, int len, const char *pbuf);
+		bool _measuring(int64_t now);
+
+		static int _clientConnectedProc(JsClientSocket *psockctx, void *pthreaduserctx, JSCUTILS_SOCKET_T clientsock);
+		static int _clientRecvProc(JsClientSocket *psockctx, void *pthreaduserctx, int recv_len, char *recv_pbuf);
+		static void _clientDisconnectedProc(JsClientSocket *psockctx, int code);
+		static void _clientSentProc(JsClientSocket *psockctx, int code);
+		static void _payloadFreeProc(char *pbuf, void *freeparam);
+		static int _serverConnectedProc(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx);
+		static int _serverRecvProc(JsServerSocket *pserver, JsClientSocket *pclient, void *pthreaduserctx, int recv_len, char *recv_pbuf);
+		static int _histIndex(int64_t ns);
+		static int64_t _histValue(int index);
+		static int64_t _nowNs();
+
+	public:
+		SocketBenchmark();
+		~SocketBenchmark();
+
+		/**
+		 * Blocks for about warmupms + durationms, plus connecting and closing.
+		 * @return presult->result
+		 */
+		int run(const Params &params, Result *presult);
+
+		/**
+		 * One line : a JSON object with the parameters and the results.
+		 */
+		static void writeJson(FILE *fp, const Result &result);
+	};
+
+}
+
+#endif /* __JSCPPUTILS_SOCKETBENCHMARK_H__ */
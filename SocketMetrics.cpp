@@ -0,0 +1,149 @@
+/**
+ * @file	SocketMetrics.cpp
+ * @class	SocketMetrics
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/28
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "SocketMetrics.h"
+#include "Logger.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(JSCUTILS_OS_WINDOWS)
+#define _SOCKETMETRICS_ATOMIC_ADD(p, v) ::InterlockedExchangeAdd64((volatile LONGLONG*)(p), (LONGLONG)(v))
+#define _SOCKETMETRICS_ATOMIC_CAS(p, o, n) (::InterlockedCompareExchange64((volatile LONGLONG*)(p), (LONGLONG)(n), (LONGLONG)(o)) == (LONGLONG)(o))
+#define _SOCKETMETRICS_LOAD(p) ((int64_t)::InterlockedCompareExchange64((volatile LONGLONG*)(p), 0, 0))
+#define _SOCKETMETRICS_STORE(p, v) ::InterlockedExchange64((volatile LONGLONG*)(p), (LONGLONG)(v))
+#elif defined(JSCUTILS_OS_LINUX)
+#define _SOCKETMETRICS_ATOMIC_ADD(p, v) __sync_fetch_and_add((p), (v))
+#define _SOCKETMETRICS_ATOMIC_CAS(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define _SOCKETMETRICS_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define _SOCKETMETRICS_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+/* the struct is nothing but int64_t fields, snapshot() and reset() walk it as an array */
+#define _SOCKETMETRICS_FIELDS (sizeof(SocketMetrics) / sizeof(int64_t))
+
+namespace JsCPPUtils
+{
+	SocketMetrics::SocketMetrics()
+	{
+		reset();
+	}
+
+	void SocketMetrics::add(volatile int64_t *pfield, int64_t value)
+	{
+		_SOCKETMETRICS_ATOMIC_ADD(pfield, value);
+	}
+
+	void SocketMetrics::store(volatile int64_t *pfield, int64_t value)
+	{
+		_SOCKETMETRICS_STORE(pfield, value);
+	}
+
+	int64_t SocketMetrics::load(const volatile int64_t *pfield)
+	{
+		return _SOCKETMETRICS_LOAD(pfield);
+	}
+
+	void SocketMetrics::setMax(volatile int64_t *pfield, int64_t value)
+	{
+		int64_t oldmax;
+		do {
+			oldmax = _SOCKETMETRICS_LOAD(pfield);
+			if (oldmax >= value)
+				break;
+		} while (!_SOCKETMETRICS_ATOMIC_CAS(pfield, oldmax, value));
+	}
+
+	int SocketMetrics::histBucket(int64_t ns)
+	{
+		int64_t us = ns / 1000;
+		int bucket = 0;
+		while ((us > 0) && (bucket < JSCPPUTILS_SOCKETMETRICS_HIST_BUCKETS - 1))
+		{
+			bucket++;
+			us >>= 1;
+		}
+		return bucket;
+	}
+
+	void SocketMetrics::recordSent(int64_t ns)
+	{
+		_SOCKETMETRICS_ATOMIC_ADD(&sent_count, 1);
+		_SOCKETMETRICS_ATOMIC_ADD(&sent_ns_total, ns);
+		_SOCKETMETRICS_ATOMIC_ADD(&sent_hist[histBucket(ns)], 1);
+		setMax(&sent_ns_max, ns);
+	}
+
+	void SocketMetrics::recordRecvHandler(int64_t ns)
+	{
+		_SOCKETMETRICS_ATOMIC_ADD(&recvhandler_ns_total, ns);
+		_SOCKETMETRICS_ATOMIC_ADD(&recvhandler_hist[histBucket(ns)], 1);
+		setMax(&recvhandler_ns_max, ns);
+	}
+
+	void SocketMetrics::snapshot(SocketMetrics *pout) const
+	{
+		const volatile int64_t *psrc = &bytes_sent;
+		volatile int64_t *pdst = &pout->bytes_sent;
+		size_t i;
+		for (i = 0; i < _SOCKETMETRICS_FIELDS; i++)
+			pdst[i] = _SOCKETMETRICS_LOAD(&psrc[i]);
+	}
+
+	void SocketMetrics::reset()
+	{
+		volatile int64_t *pfield = &bytes_sent;
+		size_t i;
+		for (i = 0; i < _SOCKETMETRICS_FIELDS; i++)
+			_SOCKETMETRICS_STORE(&pfield[i], 0);
+	}
+
+	void SocketMetrics::dump(Logger *plogger, const char *szName) const
+	{
+		SocketMetrics snap;
+		char senthist[256];
+		char recvhist[256];
+		int sentlen = 0;
+		int recvlen = 0;
+		int b;
+
+		if (plogger == NULL)
+			return;
+
+		snapshot(&snap);
+		for (b = 0; b < JSCPPUTILS_SOCKETMETRICS_HIST_BUCKETS; b++)
+		{
+			sentlen += snprintf(&senthist[sentlen], sizeof(senthist) - sentlen, "%s%lld", b ? "," : "", (long long)snap.sent_hist[b]);
+			recvlen += snprintf(&recvhist[recvlen], sizeof(recvhist) - recvlen, "%s%lld", b ? "," : "", (long long)snap.recvhandler_hist[b]);
+		}
+		plogger->printf(Logger::LOGTYPE_INFO, "socket[%s] sent=%lldB/%lld recv=%lldB/%lld queue=%lld(max %lld) sent_latency avg=%lldus max=%lldus hist=[%s] recvhandler total=%lldus max=%lldus hist=[%s] connects=%lld failures=%lld reconnects=%lld disconnects=%lld rtt=%lldus rttvar=%lldus rtt_avg=%lldus retrans=%lld",
+			(szName != NULL) ? szName : "",
+			(long long)snap.bytes_sent,
+			(long long)snap.messages_sent,
+			(long long)snap.bytes_received,
+			(long long)snap.messages_received,
+			(long long)snap.sendqueue_depth,
+			(long long)snap.sendqueue_depth_max,
+			(long long)((snap.sent_count > 0) ? (snap.sent_ns_total / snap.sent_count / 1000) : 0),
+			(long long)(snap.sent_ns_max / 1000),
+			senthist,
+			(long long)(snap.recvhandler_ns_total / 1000),
+			(long long)(snap.recvhandler_ns_max / 1000),
+			recvhist,
+			(long long)snap.connects,
+			(long long)snap.connect_failures,
+			(long long)snap.reconnects,
+			(long long)snap.disconnects,
+			(long long)snap.rtt_us,
+			(long long)snap.rttvar_us,
+			(long long)((snap.rtt_samples > 0) ? (snap.rtt_us_total / snap.rtt_samples) : 0),
+			(long long)snap.retransmits);
+	}
+}
@@ -0,0 +1,96 @@
+/**
+ * @file	SocketMetrics.h
+ * @class	SocketMetrics
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/category/JsCPPUtils )
+ * @date	2019/03/28
+ * @brief	I/O counters of a JsClientSocket (or of many, in aggregate), readable without locks
+ * @copyright Copyright (C) 2019 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the MIT license.  See the LICENSE file for details.
+ */
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif
+
+#ifndef __JSCPPUTILS_SOCKETMETRICS_H__
+#define __JSCPPUTILS_SOCKETMETRICS_H__
+
+#include "Common.h"
+
+#include <stdint.h>
+
+#define JSCPPUTILS_SOCKETMETRICS_HIST_BUCKETS 16
+
+namespace JsCPPUtils
+{
+	class Logger;
+
+	/**
+	 * Updated with atomic adds by the socket's loop and by the threads calling send(); any thread
+	 * may take a snapshot() or load() single fields. Fields are read one by one, so a snapshot
+	 * taken while traffic flows is not a single point in time (e.g. bytes_sent may already count
+	 * a send that messages_sent does not yet).
+	 *
+	 * Histograms : bucket 0 : < 1us, bucket i : [2^(i-1), 2^i) us, last bucket : everything longer.
+	 */
+	struct SocketMetrics
+	{
+		volatile int64_t bytes_sent;
+		volatile int64_t bytes_received;
+		/* send() / sendOwned() calls accepted */
+		volatile int64_t messages_sent;
+		/* receive handler calls */
+		volatile int64_t messages_received;
+
+		/* buffers queued and not yet handed to the senthandler (a gauge; summed over an aggregate's sockets) */
+		volatile int64_t sendqueue_depth;
+		volatile int64_t sendqueue_depth_max;
+
+		/* send() until its senthandler (or until written, without one) */
+		volatile int64_t sent_count;
+		volatile int64_t sent_ns_total;
+		volatile int64_t sent_ns_max;
+		volatile int64_t sent_hist[JSCPPUTILS_SOCKETMETRICS_HIST_BUCKETS];
+
+		/* time spent in the receive handler, per call */
+		volatile int64_t recvhandler_ns_total;
+		volatile int64_t recvhandler_ns_max;
+		volatile int64_t recvhandler_hist[JSCPPUTILS_SOCKETMETRICS_HIST_BUCKETS];
+
+		volatile int64_t connects;
+		volatile int64_t connect_failures;
+		/* connects started by auto reconnect */
+		volatile int64_t reconnects;
+		/* established connections that closed */
+		volatile int64_t disconnects;
+
+		/* TCP_INFO : the latest sample (of any socket, in an aggregate), and the sum of all samples for an average */
+		volatile int64_t rtt_us;
+		volatile int64_t rttvar_us;
+		volatile int64_t rtt_us_total;
+		volatile int64_t rtt_samples;
+		/* segments retransmitted (tcpi_total_retrans), summed */
+		volatile int64_t retransmits;
+
+		SocketMetrics();
+
+		void add(volatile int64_t *pfield, int64_t value);
+		void store(volatile int64_t *pfield, int64_t value);
+		void setMax(volatile int64_t *pfield, int64_t value);
+		void recordSent(int64_t ns);
+		void recordRecvHandler(int64_t ns);
+
+		void snapshot(SocketMetrics *pout) const;
+		void reset();
+		/**
+		 * One line on plogger, prefixed with szName.
+		 */
+		void dump(Logger *plogger, const char *szName) const;
+
+		static int64_t load(const volatile int64_t *pfield);
+		static int histBucket(int64_t ns);
+	};
+}
+
+#endif /* __JSCPPUTILS_SOCKETMETRICS_H__ */
@@ -11,7 +11,12 @@
 
 #include <errno.h>
 
-#include "thread.h"
+#include "Thread.h"
+
+#if defined(JSCUTILS_OS_LINUX)
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 namespace JsCPPUtils
 {
@@ -23,6 +28,11 @@ namespace JsCPPUtils
 		m_hThread = INVALID_HANDLE_VALUE;;
 #endif
 		m_retval = 0;
+		m_stacksize = 0;
+		m_bsetsched = false;
+		m_schedpolicy = 0;
+		m_schedpriority = 0;
+		m_numanode = -1;
 	}
 	
 	Thread::~Thread()
@@ -32,9 +42,7 @@ namespace JsCPPUtils
 			reqStop();
 			join();
 		}
-#if defined(JSCUTILS_OS_LINUX)
-		::pthread_mutex_destroy(&m_run_mutex);
-#elif defined(JSCUTILS_OS_WINDOWS)
+#if defined(JSCUTILS_OS_WINDOWS)
 		if (m_hThread && (m_hThread != INVALID_HANDLE_VALUE))
 		{
 			::CloseHandle(m_hThread);
@@ -50,10 +58,10 @@ namespace JsCPPUtils
 		int retval;
 		spThread.attach((JsCPPUtils::SmartPointer<Thread>*)param);
 
-		retval = spThread->run(spThread->m_index, spThread->m_param);
+		spThread->m_retval = retval = spThread->run(spThread->m_index, spThread->m_param);
 		spThread->m_runningstatus.set(0);
 
-		return (DWORD)retval;
+		return (void*)(intptr_t)retval;
 	}
 #elif defined(JSCUTILS_OS_WINDOWS)
 	DWORD WINAPI Thread::threadProcV2(LPVOID param)
@@ -112,19 +120,108 @@ namespace JsCPPUtils
 		return 1;
 	}
 #elif defined(JSCUTILS_OS_LINUX)
-	int JsThread::ThreadContext::join(int nTimeout)
+	int Thread::join(int nTimeout)
 	{
 		void *pthret = NULL;
+		int64_t st;
+
+		if (m_pthread == 0)
+			return 0;
+
+		if (nTimeout < 0)
+		{
+			pthread_join(m_pthread, &pthret);
+			m_pthread = 0;
+			return 1;
+		}
+
+		st = JsCPPUtils::Common::getTickCount();
+		while (m_runningstatus.get() > 0)
+		{
+			if ((JsCPPUtils::Common::getTickCount() - st) >= nTimeout)
+				return 0;
+			::usleep(10000);
+		}
 		pthread_join(m_pthread, &pthret);
+		m_pthread = 0;
 		return 1;
 	}
 #endif
 
+	void Thread::setStackSize(size_t stacksize)
+	{
+		m_stacksize = stacksize;
+	}
+
+	void Thread::setSchedPolicy(int policy, int priority)
+	{
+		m_bsetsched = true;
+		m_schedpolicy = policy;
+		m_schedpriority = priority;
+	}
+
+	int Thread::setAffinity(int cpu)
+	{
+		std::vector<int> cpus;
+		cpus.push_back(cpu);
+		return setAffinity(cpus);
+	}
+
+	int Thread::setAffinity(const std::vector<int>& cpus)
+	{
+		m_cpus = cpus;
+		if (m_runningstatus.get() > 0)
+			return _applyAffinity();
+		return 1;
+	}
+
+	const std::vector<int>& Thread::getAffinity()
+	{
+		return m_cpus;
+	}
+
+	void Thread::setNumaNode(int node)
+	{
+		m_numanode = node;
+	}
+
+	int Thread::getNumaNode()
+	{
+		return m_numanode;
+	}
+
+	int Thread::_applyAffinity()
+	{
+#if defined(JSCUTILS_OS_LINUX)
+		cpu_set_t cpuset;
+		int nrst;
+		CPU_ZERO(&cpuset);
+		for (std::vector<int>::const_iterator iter = m_cpus.begin(); iter != m_cpus.end(); iter++)
+		{
+			if ((*iter >= 0) && (*iter < CPU_SETSIZE))
+				CPU_SET(*iter, &cpuset);
+		}
+		nrst = pthread_setaffinity_np(m_pthread, sizeof(cpuset), &cpuset);
+		if (nrst != 0)
+			return -nrst;
+		return 1;
+#elif defined(JSCUTILS_OS_WINDOWS)
+		DWORD_PTR dwMask = 0;
+		for (std::vector<int>::const_iterator iter = m_cpus.begin(); iter != m_cpus.end(); iter++)
+		{
+			if ((*iter >= 0) && (*iter < (int)(sizeof(DWORD_PTR) * 8)))
+				dwMask |= ((DWORD_PTR)1) << (*iter);
+		}
+		if (::SetThreadAffinityMask(m_hThread, dwMask) == 0)
+			return -((int)::GetLastError());
+		return 1;
+#endif
+	}
+
 	int Thread::start(int param_idx, void *param_ptr, JSTHREAD_THREADID_TYPE *pThreadId, const char *szThreadName)
 	{
 		int retval = 0;
 		int nrst;
-		int step = 0;
 
 		if (!JsCPPUtils::SmartPointer<Thread>::checkManaged(this))
 		{
@@ -137,42 +234,95 @@ namespace JsCPPUtils
 		m_index = param_idx;
 		m_param = param_ptr;
 		
+#if defined(JSCUTILS_OS_LINUX)
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+#endif
+
 		do
 		{
 #if defined(JSCUTILS_OS_LINUX)
+			if (m_stacksize > 0)
+			{
+				nrst = pthread_attr_setstacksize(&attr, m_stacksize);
+				if (nrst != 0)
+				{
+					retval = -nrst;
+					break;
+				}
+			}
+			if (m_bsetsched)
+			{
+				struct sched_param schparam;
+				memset(&schparam, 0, sizeof(schparam));
+				schparam.sched_priority = m_schedpriority;
+				pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+				nrst = pthread_attr_setschedpolicy(&attr, m_schedpolicy);
+				if (nrst == 0)
+					nrst = pthread_attr_setschedparam(&attr, &schparam);
+				if (nrst != 0)
+				{
+					retval = -nrst;
+					break;
+				}
+			}
+			if (!m_cpus.empty())
+			{
+				// Pinned before the thread runs, so its first-touch allocations land on the right node.
+				cpu_set_t cpuset;
+				CPU_ZERO(&cpuset);
+				for (std::vector<int>::const_iterator iter = m_cpus.begin(); iter != m_cpus.end(); iter++)
+				{
+					if ((*iter >= 0) && (*iter < CPU_SETSIZE))
+						CPU_SET(*iter, &cpuset);
+				}
+				nrst = pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+				if (nrst != 0)
+				{
+					retval = -nrst;
+					break;
+				}
+			}
+
 			m_runningstatus = 1;
 
-			step = 2;
-			nrst = pthread_create(&m_pthread, NULL, threadProcV2, spThread.detach());
+			nrst = pthread_create(&m_pthread, &attr, threadProcV2, spThread.detach());
 			if (nrst != 0)
 			{
+				m_runningstatus = 0;
 				retval = -nrst;
 				break;
 			}
-			pThreadCtx->m_tid = m_pthread;
+			m_tid = m_pthread;
 
 			if (szThreadName != NULL)
 			{
 				pthread_setname_np(m_pthread, szThreadName);
 			}
 
-			step = 3;
 #elif defined(JSCUTILS_OS_WINDOWS)
-			step = 1;
 			m_runningstatus = 1;
-			m_hThread = ::CreateThread(NULL, 0, threadProcV2, spThread.detach(), 0, &m_tid);
+			m_hThread = ::CreateThread(NULL, m_stacksize, threadProcV2, spThread.detach(), CREATE_SUSPENDED, &m_tid);
 			if (m_hThread == INVALID_HANDLE_VALUE)
 			{
 				nrst = GetLastError();
 				retval = -nrst;
 				break;
 			}
-			step = 2;
+			if (m_bsetsched)
+				::SetThreadPriority(m_hThread, m_schedpriority);
+			if (!m_cpus.empty())
+				_applyAffinity();
+			::ResumeThread(m_hThread);
 #endif
 
 			retval = 1;
 		} while (0);
 
+#if defined(JSCUTILS_OS_LINUX)
+		pthread_attr_destroy(&attr);
+#endif
+
 		if (retval <= 0)
 		{
 #if defined(JSCUTILS_OS_WINDOWS)
@@ -33,6 +33,8 @@
 #include "SmartPointer.h"
 #include "AtomicNum.h"
 
+#include <vector>
+
 namespace JsCPPUtils
 {
 	class Thread : public SmartPointerRefCounter
@@ -60,6 +62,15 @@ namespace JsCPPUtils
 
 		int m_retval;
 
+		size_t m_stacksize;
+		bool m_bsetsched;
+		int m_schedpolicy;
+		int m_schedpriority;
+		std::vector<int> m_cpus;
+		int m_numanode;
+
+		int _applyAffinity();
+
 		/*
 		 * 0 : Stopped
 		 * 1 : Running
@@ -78,6 +89,26 @@ namespace JsCPPUtils
 		virtual ~Thread();
 
 		int start(int param_idx = 0, void *param_ptr = NULL, JSTHREAD_THREADID_TYPE *pThreadId = NULL, const char *szThreadName = NULL);
+
+		/**
+		 * Placement options. setStackSize/setSchedPolicy must be called before start().
+		 * setAffinity may be called at any time and is applied immediately to a running thread.
+		 */
+		void setStackSize(size_t stacksize);
+		/**
+		 * Linux : policy is SCHED_OTHER, SCHED_FIFO, SCHED_RR... and priority is sched_priority.
+		 * Windows : policy is ignored and priority is passed to SetThreadPriority.
+		 */
+		void setSchedPolicy(int policy, int priority);
+		int setAffinity(int cpu);
+		int setAffinity(const std::vector<int>& cpus);
+		const std::vector<int>& getAffinity();
+		/**
+		 * NUMA node this thread is placed on (-1 : unknown). Set by NumaTopology::placeThreads.
+		 */
+		void setNumaNode(int node);
+		int getNumaNode();
+
 		int reqStop();
 		int isRunning();
 		RunningStatus getRunningStatus();
@@ -12,11 +12,27 @@
 #include "Timer.h"
 #include "TimerTask.h"
 
+#if defined(JSCUTILS_OS_LINUX)
+#include <unistd.h>
+#endif
+
+#if defined(JSCUTILS_OS_WINDOWS)
+#define _TIMER_LOAD(p) ((int64_t)::InterlockedCompareExchange64((volatile LONGLONG*)(p), 0, 0))
+#define _TIMER_STORE(p, v) ::InterlockedExchange64((volatile LONGLONG*)(p), (LONGLONG)(v))
+#elif defined(JSCUTILS_OS_LINUX)
+#define _TIMER_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define _TIMER_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
 namespace JsCPPUtils {
 
 	Timer::Timer()
 	{
 		m_minDelayTime = 100;
+		m_laglast = 0;
+		m_lagmax = 0;
+		m_lagtotal = 0;
+		m_lagcount = 0;
 		m_thread = new WorkerThread();
 		m_thread->timer = this;
 		m_thread->start();
@@ -92,6 +108,18 @@ namespace JsCPPUtils {
 		return m_minDelayTime;
 	}
 
+	void Timer::getLag(int64_t *plast, int64_t *pmax, int64_t *ptotal, int64_t *pcount)
+	{
+		if (plast)
+			*plast = _TIMER_LOAD(&m_laglast);
+		if (pmax)
+			*pmax = _TIMER_LOAD(&m_lagmax);
+		if (ptotal)
+			*ptotal = _TIMER_LOAD(&m_lagtotal);
+		if (pcount)
+			*pcount = _TIMER_LOAD(&m_lagcount);
+	}
+
 	int Timer::WorkerThread::run(int param_idx, void *param_ptr)
 	{
 		while (Thread::isRun())
@@ -116,6 +144,12 @@ namespace JsCPPUtils {
 						int64_t exectime = (iter->lastexecutedtick + iter->period);
 						if (exectime <= curtime)
 						{
+							int64_t lag = curtime - exectime;
+							_TIMER_STORE(&timer->m_laglast, lag);
+							if (lag > timer->m_lagmax)
+								_TIMER_STORE(&timer->m_lagmax, lag);
+							_TIMER_STORE(&timer->m_lagtotal, timer->m_lagtotal + lag);
+							_TIMER_STORE(&timer->m_lagcount, timer->m_lagcount + 1);
 							if (iter->schType == SCHTYPE_FIXEDRATE)
 								iter->lastexecutedtick = curtime;
 							iter->task->execute(iter->task.getPtr(), curtime);
@@ -128,7 +162,11 @@ namespace JsCPPUtils {
 			}
 
 			delayTime = timer->m_minDelayTime;
-			Sleep(delayTime);
+#if defined(JSCUTILS_OS_WINDOWS)
+			::Sleep(delayTime);
+#else
+			::usleep(delayTime * 1000);
+#endif
 		}
 		return 0;
 	}
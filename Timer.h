@@ -45,6 +45,12 @@ namespace JsCPPUtils {
 		Lockable m_timerTaskQueueLock;
 		int m_minDelayTime;
 
+		/* how late periodic runs started (ms); written by the worker thread only */
+		volatile int64_t m_laglast;
+		volatile int64_t m_lagmax;
+		volatile int64_t m_lagtotal;
+		volatile int64_t m_lagcount;
+
 		JsCPPUtils::SmartPointer<WorkerThread> m_thread;
 
 	public:
@@ -60,14 +66,20 @@ namespace JsCPPUtils {
 		void setMinDelayTime(int minDelayTime);
 		int getMinDelayTime();
 
+		/**
+		 * How late periodic tasks started, in milliseconds : the last run, the worst one, and sum / count
+		 * for an average. Includes the minDelayTime polling granularity. Any thread, without the queue lock.
+		 */
+		void getLag(int64_t *plast, int64_t *pmax, int64_t *ptotal, int64_t *pcount);
+
 		virtual bool preCheckSchedule() { return true; }
 
-	private:
-		class WorkerThread : public Thread
-		{
-		public:
-			Timer *timer;
-			int run(int param_idx, void *param_ptr) override;
+	private:
+		class WorkerThread : public Thread
+		{
+		public:
+			Timer *timer;
+			int run(int param_idx, void *param_ptr) override;
 		};
 	};
 